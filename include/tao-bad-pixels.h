@@ -0,0 +1,485 @@
+// tao-bad-pixels.h -
+//
+// Masking and interpolation of bad pixels in TAO library.
+//
+//-----------------------------------------------------------------------------
+//
+// This file if part of TAO real-time software licensed under the MIT license
+// (https://git-cral.univ-lyon1.fr/tao/tao-rt).
+//
+// Copyright (C) 2022, Éric Thiébaut.
+
+#ifndef TAO_BAD_PIXELS_H_
+#define TAO_BAD_PIXELS_H_ 1
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <tao-basics.h>
+#include <tao-camera-servers.h>
+#include <tao-cameras-private.h>
+#include <tao-config.h>
+#include <tao-encodings.h>
+#include <tao-errors.h>
+#include <tao-processor-chains.h>
+#include <tao-shared-arrays.h>
+#include <tao-utils.h>
+
+TAO_BEGIN_DECLS
+
+/**
+ * @defgroup BadPixels  Bad pixels
+ *
+ * @ingroup Cameras
+ *
+ * @brief Masking and interpolation of bad pixels during pre-processing.
+ *
+ * @{
+ *
+ * The map of the defective (dead, hot, etc.) pixels of a camera is stored in
+ * a shared array of `uint8_t` values of the same size as the images, a
+ * nonzero value indicating a bad pixel.  This shared array complements the
+ * 4 shared arrays storing the pre-processing coefficients `a`, `b`, `q`, and
+ * `r`, its shared memory identifier is published in the configuration
+ * parameter `<owner>-bad-pixels`.  To change the map, a client locks the
+ * shared array for writing, writes the new map, increments its serial number
+ * and unlocks it.  The server checks the serial number for each frame and
+ * copies the new map when it can lock the shared array for reading without
+ * blocking (see tao_bad_pixels_refresh()).
+ *
+ * With full pre-processing, the weights of bad pixels are set to zero so that
+ * they have no effect on the measurements.  Optionally, the value of each bad
+ * pixel is also replaced by the mean of its valid neighbours (among the 8
+ * nearest ones) for consumers ignoring the weights.
+ *
+ * The functions `tao_pixels_preprocess_full_masked_*` fuse this into the
+ * pre-processing: the weights are masked in the same vectorized loop as the
+ * affine correction and the bad pixels of a row are interpolated as soon as
+ * the next row has been pre-processed, while the rows are still in the
+ * cache.  The camera servers use them for raw images with 8, 16, or 32 bits
+ * per pixel unless there are other pixel processors than the processing
+ * kernel beneath the one masking bad pixels (e.g., when pre-processing is
+ * split across helper threads, see @ref ParallelPreprocessing); otherwise,
+ * the pixels listed as bad are fixed after pre-processing, which only costs
+ * a pass over the list of bad pixels.
+ *
+ * This header defines static functions, it must be included by a single
+ * compilation unit.
+ */
+
+/**
+ * Map of bad pixels.
+ */
+typedef struct tao_bad_pixels {
+    long                  width;///< Image width.
+    long                 height;///< Image height.
+    long                   nbad;///< Number of bad pixels.
+    long*                  list;///< Sorted indices of bad pixels (one
+                                ///  entry per pixel is allocated).
+    uint8_t*                map;///< Private copy of the map.
+    bool            interpolate;///< Interpolate bad pixels?
+    tao_shared_array*    shared;///< Map in shared memory.
+    tao_serial           serial;///< Serial number of copied map.
+} tao_bad_pixels;
+
+/**
+ * Destroy a map of bad pixels.
+ *
+ * @param bp      Map of bad pixels (can be `NULL`).
+ */
+static inline void tao_bad_pixels_destroy(
+    tao_bad_pixels* bp)
+{
+    if (bp != NULL) {
+        if (bp->shared != NULL) {
+            tao_shared_array_detach(bp->shared);
+        }
+        tao_free(bp->list);
+        tao_free(bp->map);
+        tao_free(bp);
+    }
+}
+
+/**
+ * Create a map of bad pixels.
+ *
+ * This function creates the shared array storing the map of bad pixels and
+ * publishes its shared memory identifier.  Initially, there are no bad
+ * pixels.
+ *
+ * @param owner        The name of the camera server.
+ *
+ * @param width        Image width.
+ *
+ * @param height       Image height.
+ *
+ * @param interpolate  Whether to replace bad pixels by the mean of their
+ *                     valid neighbours.
+ *
+ * @param flags        Permissions granted to the group and to the others
+ *                     for the shared array.
+ *
+ * @return The address of a new map of bad pixels; `NULL` in case of failure.
+ */
+static inline tao_bad_pixels* tao_bad_pixels_create(
+    const char* owner,
+    long        width,
+    long        height,
+    bool        interpolate,
+    unsigned    flags)
+{
+    if (owner == NULL || owner[0] == '\0' ||
+        strlen(owner) >= TAO_OWNER_SIZE) {
+        tao_store_error(__func__, TAO_BAD_NAME);
+        return NULL;
+    }
+    if (width < 1 || height < 1) {
+        tao_store_error(__func__, TAO_BAD_SIZE);
+        return NULL;
+    }
+    tao_bad_pixels* bp = (tao_bad_pixels*)tao_calloc(
+        1, sizeof(tao_bad_pixels));
+    if (bp == NULL) {
+        return NULL;
+    }
+    bp->width = width;
+    bp->height = height;
+    bp->interpolate = interpolate;
+    bp->map = (uint8_t*)tao_calloc(width*height, sizeof(uint8_t));
+    if (bp->map == NULL) {
+        goto error;
+    }
+    bp->list = (long*)tao_malloc(width*height*sizeof(long));
+    if (bp->list == NULL) {
+        goto error;
+    }
+    bp->shared = tao_shared_array_create_2d(TAO_UINT8, width, height, flags);
+    if (bp->shared == NULL) {
+        goto error;
+    }
+    memset(tao_shared_array_get_data(bp->shared), 0, width*height);
+    bp->serial = tao_shared_array_get_serial(bp->shared);
+    char name[TAO_OWNER_SIZE + 16];
+    sprintf(name, "%s-bad-pixels", owner);
+    if (tao_config_write_long(
+            name, tao_shared_array_get_shmid(bp->shared)) != TAO_OK) {
+        goto error;
+    }
+    return bp;
+
+error:
+    tao_bad_pixels_destroy(bp);
+    return NULL;
+}
+
+/**
+ * Copy the map of bad pixels if it has changed.
+ *
+ * This function never blocks: if the shared array storing the map is locked
+ * for writing by a client, nothing is done and the map will be copied by a
+ * subsequent call.
+ *
+ * @param bp      Map of bad pixels.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure.
+ */
+static inline tao_status tao_bad_pixels_refresh(
+    tao_bad_pixels* bp)
+{
+    if (tao_shared_array_get_serial(bp->shared) == bp->serial) {
+        return TAO_OK;
+    }
+    tao_status status = tao_shared_array_try_rdlock(bp->shared);
+    if (status != TAO_OK) {
+        return status == TAO_TIMEOUT ? TAO_OK : TAO_ERROR;
+    }
+    // The map, the list, and the serial number are updated together and
+    // without any allocation, so they always agree.
+    long npixels = bp->width*bp->height;
+    const uint8_t* src = (const uint8_t*)tao_shared_array_get_data(
+        bp->shared);
+    long nbad = 0;
+    for (long i = 0; i < npixels; ++i) {
+        bp->map[i] = (src[i] != 0);
+        if (bp->map[i] != 0) {
+            bp->list[nbad++] = i;
+        }
+    }
+    bp->nbad = nbad;
+    bp->serial = tao_shared_array_get_serial(bp->shared);
+    return tao_shared_array_unlock(bp->shared);
+}
+
+#ifndef TAO_DOXYGEN_
+// Replace the `i`-th pixel by the mean of its valid neighbours.  All rows
+// around the pixel must have been pre-processed.
+#define _TAO_BP_PATCH(O, T)                                             \
+    static TAO_ALWAYS_INLINE void _tao_bad_pixels_patch_##O(            \
+        T*             restrict dat,                                    \
+        const uint8_t* restrict bad,                                    \
+        long                    width,                                  \
+        long                    height,                                 \
+        long                    i)                                      \
+    {                                                                   \
+        long x = i % width, y = i / width;                              \
+        long x0 = TAO_MAX(x - 1, 0), x1 = TAO_MIN(x + 1, width - 1);    \
+        long y0 = TAO_MAX(y - 1, 0), y1 = TAO_MIN(y + 1, height - 1);   \
+        T sum = 0;                                                      \
+        long n = 0;                                                     \
+        for (long yy = y0; yy <= y1; ++yy) {                            \
+            for (long xx = x0; xx <= x1; ++xx) {                        \
+                long j = xx + yy*width;                                 \
+                if (bad[j] == 0) {                                      \
+                    sum += dat[j];                                      \
+                    ++n;                                                \
+                }                                                       \
+            }                                                           \
+        }                                                               \
+        dat[i] = (n > 0 ? sum/n : 0);                                   \
+    }                                                                   \
+                                                                        \
+    static inline void _tao_bad_pixels_fix_##O(                         \
+        const tao_bad_pixels*   bp,                                     \
+        T*             restrict dat,                                    \
+        T*             restrict wgt)                                    \
+    {                                                                   \
+        for (long k = 0; k < bp->nbad; ++k) {                           \
+            wgt[bp->list[k]] = 0;                                       \
+        }                                                               \
+        if (bp->interpolate) {                                          \
+            for (long k = 0; k < bp->nbad; ++k) {                       \
+                _tao_bad_pixels_patch_##O(dat, bp->map, bp->width,      \
+                                          bp->height, bp->list[k]);     \
+            }                                                           \
+        }                                                               \
+    }
+
+_TAO_BP_PATCH(flt, float)
+_TAO_BP_PATCH(dbl, double)
+
+#define _TAO_BP_FULL(S, P, O, T)                                        \
+    static inline TAO_SIMD_CLONES void                                  \
+    tao_pixels_preprocess_full_masked_##S##_to_##O(                     \
+        T*              restrict dat,                                   \
+        T*              restrict wgt,                                   \
+        long                     width,                                 \
+        long                     height,                                \
+        const T*        restrict a,                                     \
+        const T*        restrict b,                                     \
+        const T*        restrict q,                                     \
+        const T*        restrict r,                                     \
+        const P*        restrict raw,                                   \
+        long                     stride,                                \
+        const tao_bad_pixels*    bp)                                    \
+    {                                                                   \
+        const uint8_t* bad = bp->map;                                   \
+        const long* list = bp->list;                                    \
+        long nbad = bp->interpolate ? bp->nbad : 0, k = 0;              \
+        for (long y = 0; y < height; ++y) {                             \
+            const P* src = (const P*)((const uint8_t*)raw + y*stride);  \
+            long off = y*width;                                         \
+            for (long x = 0; x < width; ++x) {                          \
+                long i = off + x;                                       \
+                T val = ((T)src[x] - b[i])*a[i];                        \
+                T w = q[i]/((val > 0 ? val : 0) + r[i]);                \
+                dat[i] = val;                                           \
+                wgt[i] = (bad[i] != 0 ? 0 : w);                         \
+            }                                                           \
+            for (; k < nbad && list[k] < off; ++k) {                    \
+                _tao_bad_pixels_patch_##O(dat, bad, width, height,      \
+                                          list[k]);                     \
+            }                                                           \
+        }                                                               \
+        for (; k < nbad; ++k) {                                         \
+            _tao_bad_pixels_patch_##O(dat, bad, width, height, list[k]); \
+        }                                                               \
+    }
+
+_TAO_BP_FULL(u8,  uint8_t,  flt, float)
+_TAO_BP_FULL(u8,  uint8_t,  dbl, double)
+_TAO_BP_FULL(u16, uint16_t, flt, float)
+_TAO_BP_FULL(u16, uint16_t, dbl, double)
+_TAO_BP_FULL(u32, uint32_t, flt, float)
+_TAO_BP_FULL(u32, uint32_t, dbl, double)
+
+#undef _TAO_BP_FULL
+#undef _TAO_BP_PATCH
+#endif // TAO_DOXYGEN_
+
+#ifdef TAO_DOXYGEN_
+/**
+ * @brief Apply affine correction to raw pixels and compute weights with
+ * masking of bad pixels.
+ *
+ * This function behaves as tao_pixels_preprocess_full_u8_to_flt() except
+ * that the weights of bad pixels are set to zero and, if requested by the
+ * map of bad pixels, their values are replaced by the mean of their valid
+ * neighbours.  There are similar functions for 16-bit and 32-bit raw pixels
+ * and for double precision output (suffixes `u16_to_flt`, `u32_to_flt`,
+ * `u8_to_dbl`, `u16_to_dbl`, and `u32_to_dbl`).
+ *
+ * @param dat     Output array of pre-processed pixels.
+ * @param wgt     Output array of weights.
+ * @param width   Number of pixels per line of the image.
+ * @param height  Number of lines of pixels in the image.
+ * @param a       Pixelwise linear correction.
+ * @param b       Pixelwise bias correction
+ * @param q       Pixelwise numerator value in the weight expression.
+ * @param r       Pixelwise denominator offset in the weight expression.
+ * @param raw     Input buffer of raw pixels.
+ * @param stride  Number of bytes between successive lines in input image
+ *                buffer @a raw.
+ * @param bp      Map of bad pixels of the same size as the image.
+ */
+extern void tao_pixels_preprocess_full_masked_u8_to_flt(
+    float*          restrict dat,
+    float*          restrict wgt,
+    long                     width,
+    long                     height,
+    const float*    restrict a,
+    const float*    restrict b,
+    const float*    restrict q,
+    const float*    restrict r,
+    const uint8_t*  restrict raw,
+    long                     stride,
+    const tao_bad_pixels*    bp);
+#endif // TAO_DOXYGEN_
+
+#ifndef TAO_DOXYGEN_
+// Map of bad pixels and pixel processor used by the camera server, and
+// whether the latter is the processing kernel which can be fused with the
+// masking of bad pixels.
+static tao_bad_pixels*       _tao_bad_pixels_instance = NULL;
+static tao_pixels_processor* _tao_bad_pixels_processor = NULL;
+static bool                  _tao_bad_pixels_fusable = false;
+
+#define _TAO_BP_CALL(S, P, O, T)                                        \
+    tao_pixels_preprocess_full_masked_##S##_to_##O(                     \
+        (T*)ctx->dat, (T*)ctx->wgt, ctx->width, ctx->height,            \
+        (const T*)ctx->preproc[0], (const T*)ctx->preproc[1],           \
+        (const T*)ctx->preproc[2], (const T*)ctx->preproc[3],           \
+        (const P*)ctx->raw, ctx->stride, bp)
+
+static void _tao_bad_pixels_masking_processor(
+    const tao_pixels_processor_context* ctx)
+{
+    tao_bad_pixels* bp = _tao_bad_pixels_instance;
+    if (tao_bad_pixels_refresh(bp) != TAO_OK) {
+        tao_report_error();
+    }
+    if (ctx->preprocessing != TAO_PREPROCESSING_FULL ||
+        ctx->width != bp->width || ctx->height != bp->height) {
+        _tao_bad_pixels_processor(ctx);
+        return;
+    }
+    tao_encoding enc = ctx->bufferencoding;
+    unsigned pkt = TAO_ENCODING_BITS_PER_PACKET(enc);
+    bool fused = (_tao_bad_pixels_fusable &&
+                  TAO_ENCODING_COLORANT(enc) == TAO_COLORANT_MONO &&
+                  (pkt == 8 || pkt == 16 || pkt == 32));
+    if (ctx->eltype == TAO_FLOAT) {
+        if (fused && pkt == 8) {
+            _TAO_BP_CALL(u8, uint8_t, flt, float);
+        } else if (fused && pkt == 16) {
+            _TAO_BP_CALL(u16, uint16_t, flt, float);
+        } else if (fused && pkt == 32) {
+            _TAO_BP_CALL(u32, uint32_t, flt, float);
+        } else {
+            _tao_bad_pixels_processor(ctx);
+            _tao_bad_pixels_fix_flt(bp, ctx->dat, ctx->wgt);
+        }
+    } else if (ctx->eltype == TAO_DOUBLE) {
+        if (fused && pkt == 8) {
+            _TAO_BP_CALL(u8, uint8_t, dbl, double);
+        } else if (fused && pkt == 16) {
+            _TAO_BP_CALL(u16, uint16_t, dbl, double);
+        } else if (fused && pkt == 32) {
+            _TAO_BP_CALL(u32, uint32_t, dbl, double);
+        } else {
+            _tao_bad_pixels_processor(ctx);
+            _tao_bad_pixels_fix_dbl(bp, ctx->dat, ctx->wgt);
+        }
+    } else {
+        _tao_bad_pixels_processor(ctx);
+    }
+}
+
+#undef _TAO_BP_CALL
+
+static tao_status _tao_bad_pixels_stage(
+    tao_camera_server* srv)
+{
+    _tao_bad_pixels_fusable = true;
+    for (long k = 0; k < _tao_processor_chain.nstages; ++k) {
+        tao_processor_rank rank = _tao_processor_chain.stages[k].rank;
+        if (rank > TAO_PROCESSOR_RANK_KERNEL &&
+            rank < TAO_PROCESSOR_RANK_MASK) {
+            _tao_bad_pixels_fusable = false;
+        }
+    }
+    _tao_bad_pixels_processor = srv->proc.processor;
+    srv->proc.processor = _tao_bad_pixels_masking_processor;
+    return TAO_OK;
+}
+#endif // TAO_DOXYGEN_
+
+/**
+ * Attach a map of bad pixels to a camera server.
+ *
+ * This function adds a stage of rank @ref TAO_PROCESSOR_RANK_MASK to the
+ * chain of pixel processors of the camera server (see @ref ProcessorChains).
+ * The pixel processor of this stage refreshes the map of bad pixels and
+ * masks the bad pixels for each image.  Being of lower rank than the
+ * calibration, it uses the coefficients of the active calibration set.  It
+ * is installed again whenever the library resets the pixel processor of the
+ * server, e.g. after the camera has been configured.  There is a single
+ * attached map of bad pixels per process.  The camera must not be acquiring.
+ *
+ * @param srv     Camera server.
+ *
+ * @param bp      Map of bad pixels, `NULL` to detach the map of bad pixels.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure.
+ */
+static inline tao_status tao_camera_server_attach_bad_pixels(
+    tao_camera_server* srv,
+    tao_bad_pixels*    bp)
+{
+    if (bp == NULL) {
+        if (tao_camera_server_remove_processor_stage(
+                srv, _tao_bad_pixels_stage) != TAO_OK) {
+            return TAO_ERROR;
+        }
+        _tao_bad_pixels_instance = NULL;
+        return TAO_OK;
+    }
+    // The map shall not be changed while the worker may be using it.
+    tao_camera* cam = srv->device;
+    if (tao_camera_lock(cam) != TAO_OK) {
+        return TAO_ERROR;
+    }
+    tao_status status = TAO_OK;
+    if (cam->runlevel == 2) {
+        tao_store_error(__func__, TAO_ACQUISITION_RUNNING);
+        status = TAO_ERROR;
+    } else {
+        _tao_bad_pixels_instance = bp;
+    }
+    if (tao_camera_unlock(cam) != TAO_OK) {
+        status = TAO_ERROR;
+    }
+    if (status != TAO_OK) {
+        return TAO_ERROR;
+    }
+    return tao_camera_server_add_processor_stage(
+        srv, _tao_bad_pixels_stage, TAO_PROCESSOR_RANK_MASK, false);
+}
+
+/**
+ * @}
+ */
+
+TAO_END_DECLS
+
+#endif // TAO_BAD_PIXELS_H_
@@ -106,6 +106,39 @@ typedef int64_t tao_serial;
 #  define TAO_NORETURN // nothing
 #endif
 
+/**
+ * @def TAO_SIMD_CLONES
+ *
+ * Mark a function to be compiled for several instruction sets (AVX-512, AVX2,
+ * and the baseline of the target) with the best version selected at run-time
+ * according to the capabilities of the processor.  This is only effective for
+ * x86-64 ELF targets with GCC 6 or Clang 14 and newer and unless macro
+ * `TAO_NO_SIMD_CLONES` is defined.  Functions marked by this macro are not
+ * inlined, the intended usage is to mark a function with loops over many
+ * pixels that call kernels marked by @ref TAO_ALWAYS_INLINE.
+ */
+#if !defined(TAO_NO_SIMD_CLONES) && defined(__x86_64__) && defined(__ELF__) && \
+    ((defined(__clang__) && (__clang_major__ >= 14)) || \
+     (!defined(__clang__) && defined(__GNUC__) && (__GNUC__ >= 6)))
+#  define TAO_SIMD_CLONES \
+    __attribute__((target_clones("avx512f","avx2","default")))
+#else
+#  define TAO_SIMD_CLONES // nothing
+#endif
+
+/**
+ * @def TAO_ALWAYS_INLINE
+ *
+ * Mark a function to be always inlined.  This is needed for kernels called by
+ * functions marked by @ref TAO_SIMD_CLONES so that they are compiled for the
+ * instruction set of each clone.
+ */
+#if (defined(__GNUC__) && (__GNUC__ > 2)) || defined(__clang__)
+#  define TAO_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#  define TAO_ALWAYS_INLINE inline
+#endif
+
 /**
  * @}
  */
@@ -0,0 +1,573 @@
+// tao-calibrations.h -
+//
+// Double-buffered pre-processing calibration in TAO library.
+//
+//-----------------------------------------------------------------------------
+//
+// This file if part of TAO real-time software licensed under the MIT license
+// (https://git-cral.univ-lyon1.fr/tao/tao-rt).
+//
+// Copyright (C) 2022, Éric Thiébaut.
+
+#ifndef TAO_CALIBRATIONS_H_
+#define TAO_CALIBRATIONS_H_ 1
+
+#include <stdio.h>
+#include <string.h>
+
+#include <tao-basics.h>
+#include <tao-camera-servers.h>
+#include <tao-cameras-private.h>
+#include <tao-config.h>
+#include <tao-errors.h>
+#include <tao-macros.h>
+#include <tao-processor-chains.h>
+#include <tao-shared-arrays.h>
+#include <tao-utils.h>
+
+TAO_BEGIN_DECLS
+
+/**
+ * @defgroup Calibrations  Double-buffered calibration
+ *
+ * @ingroup Cameras
+ *
+ * @brief Hot-swappable pre-processing calibration of camera servers.
+ *
+ * @{
+ *
+ * The pre-processing coefficients `a`, `b`, `q`, and `r` of a camera server
+ * (see @ref tao_pixels_processor_context) are stored in two calibration sets.
+ * Each set is a 3-dimensional shared array of size `width×height×4` whose
+ * planes are the 4 coefficients and whose serial number is the generation of
+ * the set.  The shared memory identifiers of the sets are published in the
+ * configuration parameters `<owner>-calibration-0` and
+ * `<owner>-calibration-1`.
+ *
+ * The worker of the camera server keeps a read lock on the active set, the one
+ * with the highest generation it has seen, and calls
+ * tao_calibration_refresh() at every frame boundary.  If the other set has a
+ * higher generation, the worker locks it for reading (without blocking),
+ * releases the previously active set, and uses the new coefficients for the
+ * next frame.
+ *
+ * A client, e.g. to upload a new dark or flat, calls
+ * tao_calibration_upload() which locks the shadow set for writing (it cannot
+ * be the active set since the worker holds a read lock on it), copies the new
+ * coefficients, and gives it a generation higher than the active set.  No
+ * lock is held by the worker while the client copies the coefficients, so
+ * acquisition is never stalled.
+ *
+ * Typical usage in a camera server, once the camera is configured:
+ *
+ * ~~~~~{.c}
+ * tao_calibration* cal = tao_calibration_create(
+ *     owner, srv->proc.width, srv->proc.height, srv->proc.eltype,
+ *     srv->proc.preproc, flags);
+ * tao_camera_server_attach_calibration(srv, cal);
+ * ~~~~~
+ *
+ * This header defines static functions, it must be included by a single
+ * compilation unit.
+ */
+
+/**
+ * Double-buffered calibration of a camera server.
+ */
+typedef struct tao_calibration {
+    tao_shared_array* sets[2];///< Calibration sets.
+    int                active;///< Index of active set, -1 if none.
+    tao_serial         serial;///< Generation of active set.
+    long              npixels;///< Number of pixels per plane.
+    size_t             elsize;///< Size of coefficients.
+} tao_calibration;
+
+#ifndef TAO_DOXYGEN_
+// Copy coefficients into calibration set `k` locked for writing by the
+// caller and give it a new generation.  Missing coefficients are copied from
+// the other set.
+static inline tao_status _tao_calibration_write(
+    tao_shared_array* sets[2],
+    int               k,
+    const void*       coefs[4],
+    double            secs)
+{
+    long npixels = tao_shared_array_get_dim(sets[k], 1)*
+        tao_shared_array_get_dim(sets[k], 2);
+    size_t size = npixels*tao_size_of_eltype(
+        tao_shared_array_get_eltype(sets[k]));
+    char* dst = (char*)tao_shared_array_get_data(sets[k]);
+    tao_serial mine = tao_shared_array_get_serial(sets[k]);
+    tao_serial other = tao_shared_array_get_serial(sets[1-k]);
+    bool incomplete = false;
+    for (int p = 0; p < 4; ++p) {
+        if (coefs[p] != NULL) {
+            memcpy(dst + p*size, coefs[p], size);
+        } else {
+            incomplete = true;
+        }
+    }
+    if (incomplete && mine < other) {
+        tao_status status = tao_shared_array_timed_rdlock(sets[1-k], secs);
+        if (status != TAO_OK) {
+            return status;
+        }
+        const char* src = (const char*)tao_shared_array_get_data(sets[1-k]);
+        for (int p = 0; p < 4; ++p) {
+            if (coefs[p] == NULL) {
+                memcpy(dst + p*size, src + p*size, size);
+            }
+        }
+        if (tao_shared_array_unlock(sets[1-k]) != TAO_OK) {
+            return TAO_ERROR;
+        }
+    }
+    tao_shared_array_set_serial(sets[k], TAO_MAX(mine, other) + 1);
+    return TAO_OK;
+}
+
+// Lock the shadow calibration set for writing, write the coefficients, and
+// unlock it.  The shadow set is the oldest one unless it is still in use by
+// the worker which has not yet switched to the most recent one, in which case
+// the most recent one is overwritten.
+static inline tao_status _tao_calibration_store(
+    tao_shared_array* sets[2],
+    const void*       coefs[4],
+    double            secs)
+{
+    int k = (tao_shared_array_get_serial(sets[0]) <
+             tao_shared_array_get_serial(sets[1])) ? 0 : 1;
+    tao_status status = tao_shared_array_try_wrlock(sets[k]);
+    if (status == TAO_TIMEOUT) {
+        status = tao_shared_array_try_wrlock(sets[1-k]);
+        if (status == TAO_OK) {
+            k = 1 - k;
+        } else if (status == TAO_TIMEOUT) {
+            status = tao_shared_array_timed_wrlock(sets[k], secs);
+        }
+    }
+    if (status != TAO_OK) {
+        return status;
+    }
+    status = _tao_calibration_write(sets, k, coefs, secs);
+    if (tao_shared_array_unlock(sets[k]) != TAO_OK) {
+        status = TAO_ERROR;
+    }
+    return status;
+}
+#endif // TAO_DOXYGEN_
+
+/**
+ * Destroy a double-buffered calibration.
+ *
+ * This function shall not be called while the worker of the camera server
+ * is processing images.
+ *
+ * @param cal     Calibration (can be `NULL`).
+ */
+static inline void tao_calibration_destroy(
+    tao_calibration* cal)
+{
+    if (cal != NULL) {
+        if (cal->active >= 0) {
+            tao_shared_array_unlock(cal->sets[cal->active]);
+        }
+        for (int k = 0; k < 2; ++k) {
+            if (cal->sets[k] != NULL) {
+                tao_shared_array_detach(cal->sets[k]);
+            }
+        }
+        tao_free(cal);
+    }
+}
+
+/**
+ * Create a double-buffered calibration.
+ *
+ * This function creates the two calibration sets of a camera server and
+ * publishes their shared memory identifiers.
+ *
+ * @param owner   The name of the camera server.
+ *
+ * @param width   Image width.
+ *
+ * @param height  Image height.
+ *
+ * @param eltype  Type of the coefficients, @ref TAO_FLOAT or @ref
+ *                TAO_DOUBLE.
+ *
+ * @param coefs   Initial coefficients `a`, `b`, `q`, and `r`, any of which
+ *                may be `NULL` to assume `a = q = r = 1` and `b = 0`.
+ *
+ * @param flags   Permissions granted to the group and to the others for the
+ *                shared arrays.
+ *
+ * @return The address of a new calibration; `NULL` in case of failure.
+ */
+static inline tao_calibration* tao_calibration_create(
+    const char*  owner,
+    long         width,
+    long         height,
+    tao_eltype   eltype,
+    const void*  coefs[4],
+    unsigned     flags)
+{
+    if (owner == NULL || owner[0] == '\0' ||
+        strlen(owner) >= TAO_OWNER_SIZE) {
+        tao_store_error(__func__, TAO_BAD_NAME);
+        return NULL;
+    }
+    if (width < 1 || height < 1) {
+        tao_store_error(__func__, TAO_BAD_SIZE);
+        return NULL;
+    }
+    if (eltype != TAO_FLOAT && eltype != TAO_DOUBLE) {
+        tao_store_error(__func__, TAO_BAD_TYPE);
+        return NULL;
+    }
+    tao_calibration* cal = (tao_calibration*)tao_calloc(
+        1, sizeof(tao_calibration));
+    if (cal == NULL) {
+        return NULL;
+    }
+    cal->active = -1;
+    cal->npixels = width*height;
+    cal->elsize = tao_size_of_eltype(eltype);
+    for (int k = 0; k < 2; ++k) {
+        cal->sets[k] = tao_shared_array_create_3d(
+            eltype, width, height, 4, flags);
+        if (cal->sets[k] == NULL) {
+            goto error;
+        }
+        void* data = tao_shared_array_get_data(cal->sets[k]);
+        for (int p = 0; p < 4; ++p) {
+            if (coefs != NULL && coefs[p] != NULL) {
+                memcpy((char*)data + p*cal->npixels*cal->elsize, coefs[p],
+                       cal->npixels*cal->elsize);
+            } else {
+                double val = (p == 1 ? 0.0 : 1.0);
+                for (long i = 0; i < cal->npixels; ++i) {
+                    if (eltype == TAO_FLOAT) {
+                        ((float*)data)[p*cal->npixels + i] = val;
+                    } else {
+                        ((double*)data)[p*cal->npixels + i] = val;
+                    }
+                }
+            }
+        }
+        tao_shared_array_set_serial(cal->sets[k], k == 0 ? 1 : 0);
+        char name[TAO_OWNER_SIZE + 16];
+        sprintf(name, "%s-calibration-%d", owner, k);
+        if (tao_config_write_long(
+                name, tao_shared_array_get_shmid(cal->sets[k])) != TAO_OK) {
+            goto error;
+        }
+    }
+    return cal;
+
+error:
+    tao_calibration_destroy(cal);
+    return NULL;
+}
+
+/**
+ * Switch to the most recent calibration set.
+ *
+ * This function shall be called by the worker of the camera server at every
+ * frame boundary.  It never blocks except the very first time when it waits
+ * for the most recent set to be readable.
+ *
+ * @param cal     Calibration.
+ *
+ * @param coefs   Array of 4 pointers to store the addresses of the
+ *                coefficients `a`, `b`, `q`, and `r` of the active set.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure.
+ */
+static inline tao_status tao_calibration_refresh(
+    tao_calibration* cal,
+    const void*      coefs[4])
+{
+    int k = cal->active;
+    if (k < 0) {
+        k = (tao_shared_array_get_serial(cal->sets[0]) >=
+             tao_shared_array_get_serial(cal->sets[1])) ? 0 : 1;
+        if (tao_shared_array_rdlock(cal->sets[k]) != TAO_OK) {
+            return TAO_ERROR;
+        }
+        cal->active = k;
+        cal->serial = tao_shared_array_get_serial(cal->sets[k]);
+    } else if (tao_shared_array_get_serial(cal->sets[1-k]) > cal->serial) {
+        tao_status status = tao_shared_array_try_rdlock(cal->sets[1-k]);
+        if (status == TAO_ERROR) {
+            return TAO_ERROR;
+        }
+        if (status == TAO_OK) {
+            if (tao_shared_array_unlock(cal->sets[k]) != TAO_OK) {
+                tao_shared_array_unlock(cal->sets[1-k]);
+                cal->active = -1;
+                return TAO_ERROR;
+            }
+            k = 1 - k;
+            cal->active = k;
+            cal->serial = tao_shared_array_get_serial(cal->sets[k]);
+        }
+    }
+    const char* data = (const char*)tao_shared_array_get_data(cal->sets[k]);
+    for (int p = 0; p < 4; ++p) {
+        coefs[p] = data + p*cal->npixels*cal->elsize;
+    }
+    return TAO_OK;
+}
+
+/**
+ * Lock the most recent calibration set for another thread than the worker.
+ *
+ * This function is for threads of the camera server which pre-process images
+ * on behalf of the worker (e.g., the processing threads of a camera pipeline,
+ * see @ref CameraPipelines).  It never blocks: the most recent set is locked
+ * for reading if possible, the other one otherwise.  The locked set must be
+ * released by tao_calibration_release().  Since the worker only switches to
+ * the most recent set at frame boundaries, the caller must check that the
+ * coefficients it used are those of the worker for the same frame.
+ *
+ * @param cal     Calibration.
+ *
+ * @param coefs   Array of 4 pointers to store the addresses of the
+ *                coefficients `a`, `b`, `q`, and `r` of the locked set.
+ *
+ * @return The index of the locked set; -1 if no set could be locked without
+ *         blocking or in case of failure.
+ */
+static inline int tao_calibration_acquire(
+    tao_calibration* cal,
+    const void*      coefs[4])
+{
+    int k = (tao_shared_array_get_serial(cal->sets[0]) >=
+             tao_shared_array_get_serial(cal->sets[1])) ? 0 : 1;
+    tao_status status = tao_shared_array_try_rdlock(cal->sets[k]);
+    if (status == TAO_TIMEOUT) {
+        k = 1 - k;
+        status = tao_shared_array_try_rdlock(cal->sets[k]);
+    }
+    if (status != TAO_OK) {
+        return -1;
+    }
+    const char* data = (const char*)tao_shared_array_get_data(cal->sets[k]);
+    for (int p = 0; p < 4; ++p) {
+        coefs[p] = data + p*cal->npixels*cal->elsize;
+    }
+    return k;
+}
+
+/**
+ * Release a calibration set locked by tao_calibration_acquire().
+ *
+ * @param cal     Calibration.
+ *
+ * @param k       Index of the locked set.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure.
+ */
+static inline tao_status tao_calibration_release(
+    tao_calibration* cal,
+    int              k)
+{
+    return tao_shared_array_unlock(cal->sets[k]);
+}
+
+/**
+ * Publish new calibration coefficients from the camera server.
+ *
+ * This function is like tao_calibration_upload() but for the camera server
+ * owning the calibration.  It shall not be called by the worker of the
+ * camera server.
+ *
+ * @param cal     Calibration.
+ *
+ * @param coefs   New coefficients `a`, `b`, `q`, and `r`, any of which may
+ *                be `NULL` to keep the current values.
+ *
+ * @param secs    Maximum time to wait for the shadow set (in seconds).
+ *
+ * @return @ref TAO_OK on success; @ref TAO_TIMEOUT if the shadow set could
+ *         not be locked in time; @ref TAO_ERROR in case of failure.
+ */
+static inline tao_status tao_calibration_publish(
+    tao_calibration* cal,
+    const void*      coefs[4],
+    double           secs)
+{
+    return _tao_calibration_store(cal->sets, coefs, secs);
+}
+
+/**
+ * Upload new calibration coefficients to a camera server.
+ *
+ * This function attaches the calibration sets of a camera server, writes
+ * the coefficients in the shadow set, and makes it the most recent one.  The
+ * worker of the server switches to the new coefficients at the next frame
+ * boundary.
+ *
+ * @param owner   The name of the camera server.
+ *
+ * @param eltype  Type of the coefficients, must be the same as the
+ *                pre-processed images of the server.
+ *
+ * @param width   Image width, must be the same as the server's.
+ *
+ * @param height  Image height, must be the same as the server's.
+ *
+ * @param coefs   New coefficients `a`, `b`, `q`, and `r` (each of
+ *                `width*height` values), any of which may be `NULL` to
+ *                keep the current values.
+ *
+ * @param secs    Maximum time to wait for the shadow set (in seconds).
+ *
+ * @return @ref TAO_OK on success; @ref TAO_TIMEOUT if the shadow set could
+ *         not be locked in time; @ref TAO_ERROR in case of failure.
+ */
+static inline tao_status tao_calibration_upload(
+    const char*  owner,
+    tao_eltype   eltype,
+    long         width,
+    long         height,
+    const void*  coefs[4],
+    double       secs)
+{
+    if (owner == NULL || owner[0] == '\0' ||
+        strlen(owner) >= TAO_OWNER_SIZE) {
+        tao_store_error(__func__, TAO_BAD_NAME);
+        return TAO_ERROR;
+    }
+    tao_shared_array* sets[2] = {NULL, NULL};
+    tao_status status = TAO_ERROR;
+    for (int k = 0; k < 2; ++k) {
+        char name[TAO_OWNER_SIZE + 16];
+        sprintf(name, "%s-calibration-%d", owner, k);
+        tao_shmid shmid = tao_config_read_shmid(name);
+        if (shmid == TAO_BAD_SHMID) {
+            tao_store_error(__func__, TAO_NOT_FOUND);
+            goto done;
+        }
+        sets[k] = tao_shared_array_attach(shmid);
+        if (sets[k] == NULL) {
+            goto done;
+        }
+        if (tao_shared_array_get_eltype(sets[k]) != eltype) {
+            tao_store_error(__func__, TAO_BAD_TYPE);
+            goto done;
+        }
+        if (tao_shared_array_get_ndims(sets[k]) != 3 ||
+            tao_shared_array_get_dim(sets[k], 1) != width ||
+            tao_shared_array_get_dim(sets[k], 2) != height ||
+            tao_shared_array_get_dim(sets[k], 3) != 4) {
+            tao_store_error(__func__, TAO_BAD_SIZE);
+            goto done;
+        }
+    }
+    status = _tao_calibration_store(sets, coefs, secs);
+
+done:
+    for (int k = 0; k < 2; ++k) {
+        if (sets[k] != NULL && tao_shared_array_detach(sets[k]) != TAO_OK) {
+            status = TAO_ERROR;
+        }
+    }
+    return status;
+}
+
+#ifndef TAO_DOXYGEN_
+// Calibration and pixel processor used by the camera server.
+static tao_calibration*      _tao_calibration_instance = NULL;
+static tao_pixels_processor* _tao_calibration_processor = NULL;
+
+static void _tao_calibration_calibrated_processor(
+    const tao_pixels_processor_context* ctx)
+{
+    tao_pixels_processor_context tmp = *ctx;
+    if (tao_calibration_refresh(_tao_calibration_instance,
+                                tmp.preproc) != TAO_OK) {
+        tao_report_error();
+    }
+    _tao_calibration_processor(&tmp);
+}
+
+static tao_status _tao_calibration_stage(
+    tao_camera_server* srv)
+{
+    tao_pixels_processor_context* ctx = &srv->proc;
+    tao_calibration* cal = _tao_calibration_instance;
+    if (cal->npixels != ctx->width*ctx->height ||
+        cal->elsize != tao_size_of_eltype(ctx->eltype)) {
+        tao_store_error(__func__, TAO_BAD_SIZE);
+        return TAO_ERROR;
+    }
+    _tao_calibration_processor = ctx->processor;
+    ctx->processor = _tao_calibration_calibrated_processor;
+    return TAO_OK;
+}
+#endif // TAO_DOXYGEN_
+
+/**
+ * Attach a double-buffered calibration to a camera server.
+ *
+ * This function adds a stage of rank @ref TAO_PROCESSOR_RANK_CALIBRATION to
+ * the chain of pixel processors of the camera server (see @ref
+ * ProcessorChains).  The pixel processor of this stage calls
+ * tao_calibration_refresh() before processing each image with the
+ * coefficients of the active calibration set.  It is installed again
+ * whenever the library resets the pixel processor of the server, e.g. after
+ * the camera has been configured, unless the size and type of the
+ * calibration no longer match the processed images in which case an error is
+ * reported by the worker and the images are not calibrated.  There is a
+ * single attached calibration per process.  The camera must not be
+ * acquiring.
+ *
+ * @param srv     Camera server.
+ *
+ * @param cal     Calibration, `NULL` to detach the calibration.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure.
+ */
+static inline tao_status tao_camera_server_attach_calibration(
+    tao_camera_server* srv,
+    tao_calibration*   cal)
+{
+    if (cal == NULL) {
+        if (tao_camera_server_remove_processor_stage(
+                srv, _tao_calibration_stage) != TAO_OK) {
+            return TAO_ERROR;
+        }
+        _tao_calibration_instance = NULL;
+        return TAO_OK;
+    }
+    // The calibration shall not be changed while the worker may be using it.
+    tao_camera* cam = srv->device;
+    if (tao_camera_lock(cam) != TAO_OK) {
+        return TAO_ERROR;
+    }
+    tao_status status = TAO_OK;
+    if (cam->runlevel == 2) {
+        tao_store_error(__func__, TAO_ACQUISITION_RUNNING);
+        status = TAO_ERROR;
+    } else {
+        _tao_calibration_instance = cal;
+    }
+    if (tao_camera_unlock(cam) != TAO_OK) {
+        status = TAO_ERROR;
+    }
+    if (status != TAO_OK) {
+        return TAO_ERROR;
+    }
+    return tao_camera_server_add_processor_stage(
+        srv, _tao_calibration_stage, TAO_PROCESSOR_RANK_CALIBRATION, false);
+}
+
+/**
+ * @}
+ */
+
+TAO_END_DECLS
+
+#endif // TAO_CALIBRATIONS_H_
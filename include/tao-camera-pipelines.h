@@ -0,0 +1,892 @@
+// tao-camera-pipelines.h -
+//
+// Pipelined acquisition and processing of images by camera servers in TAO
+// library.
+//
+//-----------------------------------------------------------------------------
+//
+// This file if part of TAO real-time software licensed under the MIT license
+// (https://git-cral.univ-lyon1.fr/tao/tao-rt).
+//
+// Copyright (C) 2022, Éric Thiébaut.
+
+#ifndef TAO_CAMERA_PIPELINES_H_
+#define TAO_CAMERA_PIPELINES_H_ 1
+
+#include <stdatomic.h>
+#include <string.h>
+
+#include <tao-basics.h>
+#include <tao-calibrations.h>
+#include <tao-camera-servers.h>
+#include <tao-cameras-private.h>
+#include <tao-errors.h>
+#include <tao-processor-chains.h>
+#include <tao-threads.h>
+#include <tao-utils.h>
+
+TAO_BEGIN_DECLS
+
+/**
+ * @defgroup CameraPipelines  Camera pipelines
+ *
+ * @ingroup Cameras
+ *
+ * @brief Pipelined acquisition, processing and publication of images.
+ *
+ * @{
+ *
+ * The worker of a camera server waits for an acquisition buffer, processes
+ * it and publishes the resulting image, one frame after the other, so the
+ * frame rate is limited by the sum of the times spent in these stages.  A
+ * camera pipeline splits this work in stages run by different threads:
+ *
+ * 1. An acquisition thread calls the `wait_buffer` method of the camera
+ *    driver and copies each frame in a free slot of the pipeline.
+ *
+ * 2. A number of processing threads pre-process the frames stored in the
+ *    slots, several frames being processed at the same time.
+ *
+ * 3. The worker of the camera server gets the processed frames in the order
+ *    of acquisition, copies them into the output images and publishes them.
+ *
+ * The slots are passed between the stages by bounded lock-free queues.  The
+ * number of slots bounds the number of frames in the pipeline: when no slot
+ * is free, the acquisition thread drops the new frame and increments the
+ * number of overruns of the camera.  When the server asks to drop pending
+ * buffers (member `drop` of @ref tao_camera_server), the worker skips the
+ * processed frames which are not the newest ones (`drop = 1`) or which have
+ * been acquired before it asked for a frame (`drop > 1`), and increments
+ * the number of dropped frames of the camera.
+ *
+ * The counters of the camera are only updated with the camera locked: the
+ * acquisition thread calls the `wait_buffer` method of the camera driver
+ * with the camera locked, as the worker of the server does without a
+ * pipeline, and the worker of the server unlocks the camera while waiting
+ * for processed frames.  The driver must therefore unlock the camera while
+ * waiting for a frame (e.g., with tao_camera_abstimed_wait()), or the worker
+ * of the server would be held off.
+ *
+ * The pipeline is attached to a camera server by
+ * tao_camera_server_attach_pipeline() which replaces the `start`, `stop` and
+ * `wait_buffer` methods of the camera device and adds a stage of rank @ref
+ * TAO_PROCESSOR_RANK_PIPELINE to the chain of pixel processors of the server
+ * (see @ref ProcessorChains).  The processing threads call the pixel
+ * processors of the stages of lower rank (e.g., tuned or parallel
+ * pre-processing), one at a time if any of them is not reentrant.  The pixel
+ * processors of the stages of higher rank are called by the worker of the
+ * server.  The settings of the pixel processing context of the server are
+ * sampled when acquisition is started, after the chain has been applied: if
+ * they do not match those of a frame at the time of its publication, the
+ * frame is processed again by the worker of the server.  If a calibration is
+ * attached to the server (see @ref Calibrations), the processing threads
+ * use the coefficients of its most recent set (see tao_calibration_acquire())
+ * and a frame is only processed again by the worker if it has not yet
+ * switched to the same set, e.g. for the frames in the pipeline when new
+ * coefficients are uploaded.  A pipeline cannot be used with zero-copy
+ * publication (see @ref ZeroCopy).
+ *
+ * This header defines static functions, it must be included by a single
+ * compilation unit.
+ */
+
+/**
+ * @def TAO_CAMERA_PIPELINE_MAX_THREADS
+ *
+ * Maximum number of processing threads of a camera pipeline.
+ */
+#define TAO_CAMERA_PIPELINE_MAX_THREADS 64
+
+/**
+ * @def TAO_CAMERA_PIPELINE_POLL
+ *
+ * Maximum number of seconds the acquisition thread of a camera pipeline
+ * waits for a frame before checking whether it must quit.
+ */
+#define TAO_CAMERA_PIPELINE_POLL 0.1
+
+/**
+ * Bounded lock-free queue of indices.
+ *
+ * This is a multi-producer multi-consumer queue of fixed capacity (a power
+ * of 2) where each cell has a sequence number telling whether it can be
+ * written or read for a given position.
+ */
+typedef struct tao_index_queue {
+    long                 mask;///< Capacity minus one.
+    tao_atomic long      head;///< Position of next index to pop.
+    tao_atomic long      tail;///< Position of next index to push.
+    struct {
+        tao_atomic long   seq;///< Sequence number of cell.
+        long              val;///< Index stored in cell.
+    }                cells[1];///< Cells of the queue.  Must be last.
+} tao_index_queue;
+
+/**
+ * Create a bounded lock-free queue of indices.
+ *
+ * @param len     Minimal capacity of the queue.
+ *
+ * @return The address of a new empty queue; `NULL` in case of failure.
+ */
+static inline tao_index_queue* tao_index_queue_create(
+    long len)
+{
+    if (len < 1) {
+        tao_store_error(__func__, TAO_BAD_SIZE);
+        return NULL;
+    }
+    long cap = 1;
+    while (cap < len) {
+        cap *= 2;
+    }
+    tao_index_queue* q = (tao_index_queue*)tao_calloc(
+        1, sizeof(tao_index_queue) + (cap - 1)*sizeof(q->cells[0]));
+    if (q == NULL) {
+        return NULL;
+    }
+    q->mask = cap - 1;
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    for (long i = 0; i < cap; ++i) {
+        atomic_init(&q->cells[i].seq, i);
+    }
+    return q;
+}
+
+/**
+ * Destroy a bounded lock-free queue of indices.
+ *
+ * @param q       Queue to destroy (can be `NULL`).
+ */
+static inline void tao_index_queue_destroy(
+    tao_index_queue* q)
+{
+    if (q != NULL) {
+        tao_free(q);
+    }
+}
+
+/**
+ * Push an index into a bounded lock-free queue.
+ *
+ * @param q       Queue.
+ *
+ * @param val     Index to push.
+ *
+ * @return Whether the index has been pushed, false if the queue is full.
+ */
+static inline bool tao_index_queue_push(
+    tao_index_queue* q,
+    long             val)
+{
+    long pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    while (true) {
+        long seq = atomic_load_explicit(&q->cells[pos & q->mask].seq,
+                                        memory_order_acquire);
+        long dif = seq - pos;
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(
+                    &q->tail, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (dif < 0) {
+            return false;
+        } else {
+            pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+        }
+    }
+    q->cells[pos & q->mask].val = val;
+    atomic_store_explicit(&q->cells[pos & q->mask].seq, pos + 1,
+                          memory_order_release);
+    return true;
+}
+
+/**
+ * Pop an index from a bounded lock-free queue.
+ *
+ * @param q       Queue.
+ *
+ * @param val     Address to store the popped index.
+ *
+ * @return Whether an index has been popped, false if the queue is empty.
+ */
+static inline bool tao_index_queue_pop(
+    tao_index_queue* q,
+    long*            val)
+{
+    long pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    while (true) {
+        long seq = atomic_load_explicit(&q->cells[pos & q->mask].seq,
+                                        memory_order_acquire);
+        long dif = seq - (pos + 1);
+        if (dif == 0) {
+            if (atomic_compare_exchange_weak_explicit(
+                    &q->head, &pos, pos + 1,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (dif < 0) {
+            return false;
+        } else {
+            pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+        }
+    }
+    *val = q->cells[pos & q->mask].val;
+    atomic_store_explicit(&q->cells[pos & q->mask].seq, pos + q->mask + 1,
+                          memory_order_release);
+    return true;
+}
+
+/**
+ * Peek the next index of a bounded lock-free queue.
+ *
+ * This function shall only be used if there is a single consumer, the
+ * caller.
+ *
+ * @param q       Queue.
+ *
+ * @param val     Address to store the next index.
+ *
+ * @return Whether the queue is not empty.
+ */
+static inline bool tao_index_queue_peek(
+    tao_index_queue* q,
+    long*            val)
+{
+    long pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    long seq = atomic_load_explicit(&q->cells[pos & q->mask].seq,
+                                    memory_order_acquire);
+    if (seq != pos + 1) {
+        return false;
+    }
+    *val = q->cells[pos & q->mask].val;
+    return true;
+}
+
+/**
+ * Slot of a camera pipeline.
+ */
+typedef struct tao_camera_pipeline_slot {
+    tao_acquisition_buffer buf;///< Acquired frame, with `buf.data = raw`.
+    void*                  raw;///< Copy of the acquisition buffer.
+    size_t             rawsize;///< Number of bytes allocated for `raw`.
+    void*                  dat;///< Pre-processed pixels.
+    void*                  wgt;///< Weights of pre-processed pixels.
+    const void*     preproc[4];///< Pre-processing parameters used for
+                               ///  `dat` and `wgt`.
+    tao_serial             seq;///< Rank of the frame in order of
+                               ///  acquisition.
+    bool             processed;///< Whether `dat` and `wgt` are valid.
+    tao_atomic bool       done;///< Whether processing is over.
+} tao_camera_pipeline_slot;
+
+/**
+ * Camera pipeline.
+ */
+typedef struct tao_camera_pipeline {
+    tao_mutex                 mutex;///< Lock to notify the stages.
+    tao_cond                   cond;///< Condition to notify the stages.
+    tao_mutex            serializer;///< Lock to call the pixel processor
+                                    ///  one thread at a time.
+    bool                  serialize;///< Whether to call the pixel
+                                    ///  processor one thread at a time.
+    long                     nslots;///< Number of slots.
+    long                   nthreads;///< Number of processing threads.
+    long                   nrunning;///< Number of running threads.
+    tao_thread             acquirer;///< Acquisition thread.
+    tao_thread workers[TAO_CAMERA_PIPELINE_MAX_THREADS];///< Processing
+                                    ///  threads.
+    tao_atomic bool            quit;///< Threads must quit.
+    tao_atomic bool          failed;///< Acquisition failed.
+    tao_atomic tao_serial  acquired;///< Number of frames stored in slots.
+    tao_camera_server*          srv;///< Attached camera server.
+    tao_camera*              device;///< Camera device of the server.
+    const tao_camera_ops*    driver;///< Methods of the camera driver.
+    tao_camera_ops              ops;///< Methods of the pipelined camera.
+    tao_pixels_processor_context proc;///< Processing context sampled when
+                                    ///  acquisition is started.
+    tao_calibration*            cal;///< Calibration of the server, `NULL`
+                                    ///  if none.
+    size_t                  datsize;///< Bytes allocated for `dat` and `wgt`
+                                    ///  in each slot.
+    long                    current;///< Slot being published, -1 if none.
+    tao_index_queue*          avail;///< Queue of free slots.
+    tao_index_queue*           todo;///< Queue of slots to process.
+    tao_index_queue*          order;///< Queue of slots in order of
+                                    ///  acquisition.
+    tao_camera_pipeline_slot* slots;///< Slots of the pipeline.
+} tao_camera_pipeline;
+
+/**
+ * Destroy a camera pipeline.
+ *
+ * The pipeline must have been detached from the camera server.
+ *
+ * @param pipe    Camera pipeline to destroy (can be `NULL`).
+ */
+static inline void tao_camera_pipeline_destroy(
+    tao_camera_pipeline* pipe)
+{
+    if (pipe != NULL) {
+        if (pipe->slots != NULL) {
+            for (long i = 0; i < pipe->nslots; ++i) {
+                tao_free(pipe->slots[i].raw);
+                tao_free(pipe->slots[i].dat);
+                tao_free(pipe->slots[i].wgt);
+            }
+            tao_free(pipe->slots);
+        }
+        tao_index_queue_destroy(pipe->avail);
+        tao_index_queue_destroy(pipe->todo);
+        tao_index_queue_destroy(pipe->order);
+        tao_condition_destroy(&pipe->cond);
+        tao_mutex_destroy(&pipe->mutex, false);
+        tao_mutex_destroy(&pipe->serializer, false);
+        tao_free(pipe);
+    }
+}
+
+/**
+ * Create a camera pipeline.
+ *
+ * @param nslots    Number of slots, that is the maximum number of frames
+ *                  being processed or waiting for publication.  Must be at
+ *                  least 2.
+ *
+ * @param nthreads  Number of processing threads, at most @ref
+ *                  TAO_CAMERA_PIPELINE_MAX_THREADS.
+ *
+ * @return The address of a new camera pipeline; `NULL` in case of failure.
+ */
+static inline tao_camera_pipeline* tao_camera_pipeline_create(
+    long nslots,
+    long nthreads)
+{
+    if (nslots < 2) {
+        tao_store_error(__func__, TAO_BAD_BUFFERS);
+        return NULL;
+    }
+    if (nthreads < 1 || nthreads > TAO_CAMERA_PIPELINE_MAX_THREADS) {
+        tao_store_error(__func__, TAO_BAD_NUMBER);
+        return NULL;
+    }
+    tao_camera_pipeline* pipe = (tao_camera_pipeline*)tao_calloc(
+        1, sizeof(tao_camera_pipeline));
+    if (pipe == NULL) {
+        return NULL;
+    }
+    if (tao_mutex_initialize(&pipe->mutex, TAO_PROCESS_PRIVATE) != TAO_OK) {
+        tao_free(pipe);
+        return NULL;
+    }
+    if (tao_condition_initialize(&pipe->cond, TAO_PROCESS_PRIVATE) != TAO_OK) {
+        tao_mutex_destroy(&pipe->mutex, false);
+        tao_free(pipe);
+        return NULL;
+    }
+    if (tao_mutex_initialize(&pipe->serializer,
+                             TAO_PROCESS_PRIVATE) != TAO_OK) {
+        tao_condition_destroy(&pipe->cond);
+        tao_mutex_destroy(&pipe->mutex, false);
+        tao_free(pipe);
+        return NULL;
+    }
+    pipe->nslots = nslots;
+    pipe->nthreads = nthreads;
+    pipe->current = -1;
+    atomic_init(&pipe->quit, false);
+    atomic_init(&pipe->failed, false);
+    atomic_init(&pipe->acquired, 0);
+    pipe->slots = (tao_camera_pipeline_slot*)tao_calloc(
+        nslots, sizeof(tao_camera_pipeline_slot));
+    pipe->avail = tao_index_queue_create(nslots);
+    pipe->todo = tao_index_queue_create(nslots);
+    pipe->order = tao_index_queue_create(nslots);
+    if (pipe->slots == NULL || pipe->avail == NULL ||
+        pipe->todo == NULL || pipe->order == NULL) {
+        tao_camera_pipeline_destroy(pipe);
+        return NULL;
+    }
+    for (long i = 0; i < nslots; ++i) {
+        atomic_init(&pipe->slots[i].done, false);
+    }
+    return pipe;
+}
+
+#ifndef TAO_DOXYGEN_
+// Camera pipeline and pixel processor used by the camera server.
+static tao_camera_pipeline*  _tao_camera_pipeline_instance = NULL;
+static tao_pixels_processor* _tao_camera_pipeline_processor = NULL;
+
+// Wake up the threads waiting on the pipeline.
+static inline void _tao_camera_pipeline_notify(
+    tao_camera_pipeline* pipe)
+{
+    tao_mutex_lock(&pipe->mutex);
+    tao_condition_broadcast(&pipe->cond);
+    tao_mutex_unlock(&pipe->mutex);
+}
+
+// Check whether the settings of a pixel processing context match those of
+// the pipeline and the pre-processing parameters used for a slot.
+static inline bool _tao_camera_pipeline_same_settings(
+    const tao_pixels_processor_context* a,
+    const tao_pixels_processor_context* b,
+    const tao_camera_pipeline_slot*     slot)
+{
+    return (a->preprocessing == b->preprocessing &&
+            a->bufferencoding == b->bufferencoding &&
+            a->eltype == b->eltype && a->width == b->width &&
+            a->height == b->height && a->preproc[0] == slot->preproc[0] &&
+            a->preproc[1] == slot->preproc[1] &&
+            a->preproc[2] == slot->preproc[2] &&
+            a->preproc[3] == slot->preproc[3]);
+}
+
+// Acquisition stage: copy frames in free slots.
+static void* _tao_camera_pipeline_acquirer(
+    void* arg)
+{
+    tao_camera_pipeline* pipe = (tao_camera_pipeline*)arg;
+    tao_camera* cam = pipe->device;
+    while (!atomic_load(&pipe->quit)) {
+        // The driver updates the counters of the camera, it is called with
+        // the camera locked.  The acquired frame remains valid until the
+        // next call.
+        tao_acquisition_buffer buf;
+        memset(&buf, 0, sizeof(buf));
+        long idx = -1;
+        if (tao_camera_lock(cam) != TAO_OK) {
+            goto failure;
+        }
+        tao_status status = pipe->driver->wait_buffer(
+            cam, &buf, TAO_CAMERA_PIPELINE_POLL, 0);
+        if (status == TAO_OK && !tao_index_queue_pop(pipe->avail, &idx)) {
+            ++cam->config.overruns;
+        }
+        if (tao_camera_unlock(cam) != TAO_OK) {
+            goto failure;
+        }
+        if (status == TAO_TIMEOUT || (status == TAO_OK && idx < 0)) {
+            continue;
+        }
+        if (status != TAO_OK) {
+            goto failure;
+        }
+        tao_camera_pipeline_slot* slot = &pipe->slots[idx];
+        if (slot->rawsize < buf.size) {
+            tao_free(slot->raw);
+            slot->rawsize = 0;
+            slot->raw = tao_malloc(buf.size);
+            if (slot->raw == NULL) {
+                goto failure;
+            }
+            slot->rawsize = buf.size;
+        }
+        memcpy(slot->raw, buf.data, buf.size);
+        slot->buf = buf;
+        slot->buf.data = slot->raw;
+        slot->seq = atomic_fetch_add(&pipe->acquired, 1) + 1;
+        atomic_store(&slot->done, false);
+        tao_index_queue_push(pipe->order, idx);
+        tao_index_queue_push(pipe->todo, idx);
+        _tao_camera_pipeline_notify(pipe);
+    }
+    return NULL;
+
+failure:
+    tao_report_error();
+    atomic_store(&pipe->failed, true);
+    _tao_camera_pipeline_notify(pipe);
+    return NULL;
+}
+
+// Processing stage: pre-process frames in their slots.
+static void* _tao_camera_pipeline_worker(
+    void* arg)
+{
+    tao_camera_pipeline* pipe = (tao_camera_pipeline*)arg;
+    while (true) {
+        long idx;
+        if (!tao_index_queue_pop(pipe->todo, &idx)) {
+            bool quit;
+            tao_mutex_lock(&pipe->mutex);
+            while (!(quit = atomic_load(&pipe->quit)) &&
+                   !tao_index_queue_pop(pipe->todo, &idx)) {
+                tao_condition_wait(&pipe->cond, &pipe->mutex);
+            }
+            tao_mutex_unlock(&pipe->mutex);
+            if (quit) {
+                break;
+            }
+        }
+        tao_camera_pipeline_slot* slot = &pipe->slots[idx];
+        tao_pixels_processor_context ctx = pipe->proc;
+        slot->processed = (slot->buf.width == ctx.width &&
+                           slot->buf.height == ctx.height &&
+                           slot->buf.encoding == ctx.bufferencoding &&
+                           slot->buf.stride >= ctx.stride_min &&
+                           slot->dat != NULL && slot->wgt != NULL);
+        // With a calibration, the coefficients of its most recent set are
+        // used.  The frame is left to the worker if no set can be locked.
+        int set = -1;
+        if (slot->processed && pipe->cal != NULL) {
+            set = tao_calibration_acquire(pipe->cal, ctx.preproc);
+            if (set < 0) {
+                slot->processed = false;
+                if (tao_any_errors(NULL)) {
+                    tao_report_error();
+                }
+            }
+        }
+        if (slot->processed) {
+            ctx.raw = (const char*)slot->raw + slot->buf.offset;
+            ctx.stride = slot->buf.stride;
+            ctx.dat = slot->dat;
+            ctx.wgt = slot->wgt;
+            if (pipe->serialize) {
+                tao_mutex_lock(&pipe->serializer);
+                ctx.processor(&ctx);
+                tao_mutex_unlock(&pipe->serializer);
+            } else {
+                ctx.processor(&ctx);
+            }
+            for (int j = 0; j < 4; ++j) {
+                slot->preproc[j] = ctx.preproc[j];
+            }
+        }
+        if (set >= 0 && tao_calibration_release(pipe->cal, set) != TAO_OK) {
+            tao_report_error();
+        }
+        atomic_store(&slot->done, true);
+        _tao_camera_pipeline_notify(pipe);
+    }
+    return NULL;
+}
+
+// Stop and join all threads of the pipeline.  The caller owns the lock on
+// the camera, it is released meanwhile since the acquisition thread may be
+// waiting for it.
+static inline void _tao_camera_pipeline_stop_threads(
+    tao_camera_pipeline* pipe)
+{
+    atomic_store(&pipe->quit, true);
+    _tao_camera_pipeline_notify(pipe);
+    if (pipe->nrunning > 0) {
+        tao_camera_unlock(pipe->device);
+        tao_thread_join(pipe->acquirer, NULL);
+        for (long k = 1; k < pipe->nrunning; ++k) {
+            tao_thread_join(pipe->workers[k-1], NULL);
+        }
+        tao_camera_lock(pipe->device);
+        pipe->nrunning = 0;
+    }
+}
+
+// Reset the queues so that all slots are free.
+static inline void _tao_camera_pipeline_reset(
+    tao_camera_pipeline* pipe)
+{
+    long idx;
+    while (tao_index_queue_pop(pipe->todo, &idx)) {
+    }
+    while (tao_index_queue_pop(pipe->order, &idx)) {
+    }
+    while (tao_index_queue_pop(pipe->avail, &idx)) {
+    }
+    for (long i = 0; i < pipe->nslots; ++i) {
+        atomic_store(&pipe->slots[i].done, false);
+        tao_index_queue_push(pipe->avail, i);
+    }
+    pipe->current = -1;
+    atomic_store(&pipe->acquired, 0);
+    atomic_store(&pipe->quit, false);
+    atomic_store(&pipe->failed, false);
+}
+
+// Method to start acquisition by a pipelined camera.
+static tao_status _tao_camera_pipeline_start(
+    tao_camera* cam)
+{
+    // The chain of pixel processors has been applied, the pixel processor
+    // beneath the pipeline is thus known.
+    tao_camera_pipeline* pipe = _tao_camera_pipeline_instance;
+    pipe->proc = pipe->srv->proc;
+    pipe->proc.processor = _tao_camera_pipeline_processor;
+    tao_calibration* cal = _tao_calibration_instance;
+    pipe->cal = (cal != NULL &&
+                 tao_processor_chain_has_stage(_tao_calibration_stage) &&
+                 cal->npixels == pipe->proc.width*pipe->proc.height &&
+                 cal->elsize == tao_size_of_eltype(pipe->proc.eltype) ?
+                 cal : NULL);
+    size_t size = pipe->proc.width*pipe->proc.height*
+        tao_size_of_eltype(pipe->proc.eltype);
+    if (size > pipe->datsize) {
+        for (long i = 0; i < pipe->nslots; ++i) {
+            tao_camera_pipeline_slot* slot = &pipe->slots[i];
+            tao_free(slot->dat);
+            tao_free(slot->wgt);
+            slot->dat = tao_malloc(size);
+            slot->wgt = tao_malloc(size);
+        }
+        pipe->datsize = size;
+    }
+    _tao_camera_pipeline_reset(pipe);
+    if (pipe->driver->start(cam) != TAO_OK) {
+        return TAO_ERROR;
+    }
+    if (tao_thread_create(&pipe->acquirer, NULL,
+                          _tao_camera_pipeline_acquirer, pipe) != TAO_OK) {
+        goto error;
+    }
+    pipe->nrunning = 1;
+    for (long k = 0; k < pipe->nthreads; ++k) {
+        if (tao_thread_create(&pipe->workers[k], NULL,
+                              _tao_camera_pipeline_worker, pipe) != TAO_OK) {
+            goto error;
+        }
+        pipe->nrunning = k + 2;
+    }
+    return TAO_OK;
+
+error:
+    _tao_camera_pipeline_stop_threads(pipe);
+    pipe->driver->stop(cam);
+    return TAO_ERROR;
+}
+
+// Method to stop acquisition by a pipelined camera.
+static tao_status _tao_camera_pipeline_stop(
+    tao_camera* cam)
+{
+    tao_camera_pipeline* pipe = _tao_camera_pipeline_instance;
+    _tao_camera_pipeline_stop_threads(pipe);
+    return pipe->driver->stop(cam);
+}
+
+// Check whether the next slot in order of acquisition has been processed.
+static inline bool _tao_camera_pipeline_ready(
+    tao_camera_pipeline* pipe,
+    long*                idx)
+{
+    return (tao_index_queue_peek(pipe->order, idx) &&
+            atomic_load(&pipe->slots[*idx].done));
+}
+
+// Wait until the next slot in order of acquisition has been processed.  The
+// caller owns the lock on the camera, it is released while waiting so that
+// the acquisition thread can call the driver.
+static inline tao_status _tao_camera_pipeline_wait_ready(
+    tao_camera_pipeline* pipe,
+    tao_camera*          cam,
+    long*                idx,
+    tao_timeout          timeout,
+    const tao_time*      lim)
+{
+    if (_tao_camera_pipeline_ready(pipe, idx)) {
+        return TAO_OK;
+    }
+    if (tao_camera_unlock(cam) != TAO_OK) {
+        return TAO_ERROR;
+    }
+    tao_status status = TAO_OK;
+    tao_mutex_lock(&pipe->mutex);
+    while (status == TAO_OK && !_tao_camera_pipeline_ready(pipe, idx)) {
+        if (atomic_load(&pipe->failed)) {
+            status = TAO_ERROR;
+        } else if (timeout == TAO_TIMEOUT_NEVER) {
+            status = tao_condition_wait(&pipe->cond, &pipe->mutex);
+        } else if (timeout == TAO_TIMEOUT_FUTURE) {
+            status = tao_condition_abstimed_wait(
+                &pipe->cond, &pipe->mutex, lim);
+        } else {
+            status = TAO_TIMEOUT;
+        }
+    }
+    tao_mutex_unlock(&pipe->mutex);
+    if (tao_camera_lock(cam) != TAO_OK) {
+        return TAO_ERROR;
+    }
+    if (status == TAO_ERROR && atomic_load(&pipe->failed)) {
+        tao_store_error(__func__, TAO_NOT_ACQUIRING);
+    }
+    return status;
+}
+
+// Method to wait for the next frame of a pipelined camera.
+static tao_status _tao_camera_pipeline_wait_buffer(
+    tao_camera*             cam,
+    tao_acquisition_buffer* buf,
+    double                  secs,
+    int                     drop)
+{
+    tao_camera_pipeline* pipe = _tao_camera_pipeline_instance;
+    if (pipe->current >= 0) {
+        tao_index_queue_push(pipe->avail, pipe->current);
+        pipe->current = -1;
+    }
+    tao_time lim;
+    tao_timeout timeout = tao_get_absolute_timeout(&lim, secs);
+    if (timeout == TAO_TIMEOUT_ERROR) {
+        return TAO_ERROR;
+    }
+    // Frames acquired before this call are dropped if `drop > 1`.
+    tao_serial fresh = atomic_load(&pipe->acquired);
+    long idx;
+    while (true) {
+        tao_status status = _tao_camera_pipeline_wait_ready(
+            pipe, cam, &idx, timeout, &lim);
+        if (status != TAO_OK) {
+            return status;
+        }
+        tao_index_queue_pop(pipe->order, &idx);
+        if (drop <= 1 || pipe->slots[idx].seq > fresh) {
+            break;
+        }
+        tao_index_queue_push(pipe->avail, idx);
+        ++cam->config.droppedframes;
+    }
+    if (drop > 0) {
+        long next;
+        while (_tao_camera_pipeline_ready(pipe, &next)) {
+            tao_index_queue_pop(pipe->order, &next);
+            tao_index_queue_push(pipe->avail, idx);
+            ++cam->config.droppedframes;
+            idx = next;
+        }
+    }
+    pipe->current = idx;
+    *buf = pipe->slots[idx].buf;
+    return TAO_OK;
+}
+
+// Publication stage: copy the pre-processed pixels in the output image.
+static void _tao_camera_pipeline_publishing_processor(
+    const tao_pixels_processor_context* ctx)
+{
+    tao_camera_pipeline* pipe = _tao_camera_pipeline_instance;
+    if (pipe != NULL && pipe->current >= 0) {
+        const tao_camera_pipeline_slot* slot = &pipe->slots[pipe->current];
+        if (slot->processed &&
+            ctx->raw == (const char*)slot->raw + slot->buf.offset &&
+            _tao_camera_pipeline_same_settings(ctx, &pipe->proc, slot)) {
+            size_t size = ctx->width*ctx->height*
+                tao_size_of_eltype(ctx->eltype);
+            memcpy(ctx->dat, slot->dat, size);
+            if (ctx->preprocessing == TAO_PREPROCESSING_FULL) {
+                memcpy(ctx->wgt, slot->wgt, size);
+            }
+            return;
+        }
+    }
+    _tao_camera_pipeline_processor(ctx);
+}
+
+static tao_status _tao_camera_pipeline_stage(
+    tao_camera_server* srv)
+{
+    tao_camera_pipeline* pipe = _tao_camera_pipeline_instance;
+    _tao_camera_pipeline_processor = srv->proc.processor;
+    pipe->serialize = !tao_processor_chain_is_reentrant(
+        TAO_PROCESSOR_RANK_PIPELINE);
+    srv->proc.processor = _tao_camera_pipeline_publishing_processor;
+    return TAO_OK;
+}
+#endif // TAO_DOXYGEN_
+
+/**
+ * Attach a camera pipeline to a camera server.
+ *
+ * This function replaces the `start`, `stop` and `wait_buffer` methods of
+ * the camera device of the server by those of the pipeline and adds a stage
+ * of rank @ref TAO_PROCESSOR_RANK_PIPELINE to the chain of pixel processors
+ * of the server (see @ref ProcessorChains) whose pixel processor copies the
+ * frames pre-processed by the pipeline.  The stage is installed again
+ * whenever the library resets the pixel processor of the server, e.g. after
+ * the camera has been configured.  There is a single attached camera
+ * pipeline per process.  The camera must not be acquiring.
+ *
+ * @param srv     Camera server.
+ *
+ * @param pipe    Camera pipeline, `NULL` to detach the pipeline and restore
+ *                the previous methods of the camera.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure.
+ */
+static inline tao_status tao_camera_server_attach_pipeline(
+    tao_camera_server*   srv,
+    tao_camera_pipeline* pipe)
+{
+    tao_camera* cam = srv->device;
+    if (pipe == NULL) {
+        if (tao_camera_server_remove_processor_stage(
+                srv, _tao_camera_pipeline_stage) != TAO_OK) {
+            return TAO_ERROR;
+        }
+    }
+    // The pipeline shall not be changed while the worker may be using it.
+    if (tao_camera_lock(cam) != TAO_OK) {
+        return TAO_ERROR;
+    }
+    tao_status status = TAO_OK;
+    if (cam->runlevel == 2) {
+        tao_store_error(__func__, TAO_ACQUISITION_RUNNING);
+        status = TAO_ERROR;
+    } else {
+        tao_camera_pipeline* prev = _tao_camera_pipeline_instance;
+        if (prev != NULL &&
+            tao_camera_server_get_camera_ops(srv) == &prev->ops) {
+            tao_camera_server_set_camera_ops(srv, prev->driver);
+        }
+        _tao_camera_pipeline_instance = pipe;
+    }
+    if (tao_camera_unlock(cam) != TAO_OK) {
+        status = TAO_ERROR;
+    }
+    if (status != TAO_OK || pipe == NULL) {
+        return status;
+    }
+    // The stage is added before replacing the methods of the camera, so
+    // that the pipeline is never started without its stage in the chain.
+    if (tao_camera_server_add_processor_stage(
+            srv, _tao_camera_pipeline_stage, TAO_PROCESSOR_RANK_PIPELINE,
+            false) != TAO_OK) {
+        return TAO_ERROR;
+    }
+    if (tao_camera_lock(cam) != TAO_OK) {
+        return TAO_ERROR;
+    }
+    if (cam->runlevel == 2) {
+        tao_store_error(__func__, TAO_ACQUISITION_RUNNING);
+        status = TAO_ERROR;
+    } else {
+        pipe->srv = srv;
+        pipe->device = cam;
+        pipe->driver = tao_camera_server_get_camera_ops(srv);
+        pipe->ops = *pipe->driver;
+        pipe->ops.start = _tao_camera_pipeline_start;
+        pipe->ops.stop = _tao_camera_pipeline_stop;
+        pipe->ops.wait_buffer = _tao_camera_pipeline_wait_buffer;
+        tao_camera_server_set_camera_ops(srv, &pipe->ops);
+    }
+    if (tao_camera_unlock(cam) != TAO_OK) {
+        status = TAO_ERROR;
+    }
+    if (status != TAO_OK) {
+        return TAO_ERROR;
+    }
+    tao_inform(srv->logfile, TAO_MESG_INFO,
+               "Pipelined processing with %ld slots and %ld threads\n",
+               pipe->nslots, pipe->nthreads);
+    return TAO_OK;
+}
+
+/**
+ * @}
+ */
+
+TAO_END_DECLS
+
+#endif // TAO_CAMERA_PIPELINES_H_
@@ -0,0 +1,616 @@
+// tao-dark-estimators.h -
+//
+// Online estimation of the dark/background in TAO library.
+//
+//-----------------------------------------------------------------------------
+//
+// This file if part of TAO real-time software licensed under the MIT license
+// (https://git-cral.univ-lyon1.fr/tao/tao-rt).
+//
+// Copyright (C) 2022, Éric Thiébaut.
+
+#ifndef TAO_DARK_ESTIMATORS_H_
+#define TAO_DARK_ESTIMATORS_H_ 1
+
+#include <stdatomic.h>
+#include <string.h>
+
+#include <tao-basics.h>
+#include <tao-calibrations.h>
+#include <tao-camera-servers.h>
+#include <tao-cameras-private.h>
+#include <tao-encodings.h>
+#include <tao-errors.h>
+#include <tao-packed-pixels.h>
+#include <tao-pixels.h>
+#include <tao-processor-chains.h>
+#include <tao-shackhartmann.h>
+#include <tao-threads.h>
+#include <tao-utils.h>
+
+TAO_BEGIN_DECLS
+
+/**
+ * @defgroup DarkEstimators  Online dark estimation
+ *
+ * @ingroup Cameras
+ *
+ * @brief Running estimation of the dark/background of a camera server.
+ *
+ * @{
+ *
+ * A dark estimator keeps an exponentially weighted moving average of the
+ * mean and of the variance of the raw value of every pixel:
+ *
+ *     mean ← mean + λ*(raw - mean)
+ *     var  ← (1 - λ)*(var + λ*(raw - mean)²)
+ *
+ * where `λ ∈ (0,1]` is the weight of the new sample and `(raw - mean)` is
+ * computed with the mean before the update.  All pixels are updated by
+ * frames flagged as dark (see tao_dark_estimator_set_dark(), e.g. when the
+ * shutter is closed), only the background pixels (see
+ * tao_dark_estimator_set_background(), e.g. outside the sub-image boxes) are
+ * updated by other frames.
+ *
+ * The estimator periodically publishes the bias `b = mean` and the offset
+ * `r = q*a²*var` of the weights (so that `q/r` is the precision of a
+ * pre-processed dark pixel) through a double-buffered calibration (see @ref
+ * tao_calibration), the coefficients `a` and `q` being those of the
+ * calibration when the estimator was created.
+ *
+ * All the work is done by a background thread: the worker of the camera
+ * server only copies the raw bytes of the frames it posts to the estimator
+ * and never waits, a frame is not posted if the background thread is busy or
+ * if it is not dark and there are no background pixels.  The raw pixels are
+ * converted by the background thread.  Raw images with 8, 16 or 32 bits per
+ * pixel (possibly padded, e.g. 12 bits per pixel in 16-bit words) and packed
+ * 10, 12 or 14 bits per pixel are supported.
+ *
+ * Typical usage in a camera server, once the calibration has been created:
+ *
+ * ~~~~~{.c}
+ * tao_dark_estimator* est = tao_dark_estimator_create(cal, 0.01, 100);
+ * tao_dark_estimator_set_background(est, subs, nsubs);
+ * tao_dark_estimator_start(est);
+ * tao_camera_server_attach_dark_estimator(srv, est);
+ * ~~~~~
+ *
+ * This header defines static functions, it must be included by a single
+ * compilation unit.
+ */
+
+/**
+ * Online dark/background estimator.
+ */
+typedef struct tao_dark_estimator {
+    long                  width;///< Image width.
+    long                 height;///< Image height.
+    long                 period;///< Number of updates between publications.
+    long               nupdates;///< Number of updates.
+    tao_calibration*        cal;///< Calibration to publish to.
+    tao_eltype           eltype;///< Type of calibration coefficients.
+    tao_atomic double    lambda;///< Weight of new samples.
+    tao_atomic bool        dark;///< Next posted frames are dark.
+    uint8_t*               mask;///< Background pixels (owned by updater).
+    long            nbackground;///< Number of background pixels.
+    double*                mean;///< Mean of raw pixels (owned by updater).
+    double*                 var;///< Variance of raw pixels (idem).
+    double*                gain;///< `q*a²` (owned by updater).
+    void*                  bias;///< Published `b` (owned by updater).
+    void*                offset;///< Published `r` (owned by updater).
+    float*               pixels;///< Converted raw pixels (owned by updater).
+    uint8_t*             posted;///< Raw bytes of posted frame.
+    uint8_t*               work;///< Raw bytes of frame being processed.
+    long              maxstride;///< Maximum number of bytes per raw line.
+    long          posted_stride;///< Bytes per line of posted frame.
+    long            work_stride;///< Bytes per line of frame being processed.
+    tao_encoding posted_encoding;///< Encoding of posted frame.
+    tao_encoding   work_encoding;///< Encoding of frame being processed.
+    bool            posted_dark;///< Posted frame is dark.
+    bool              work_dark;///< Frame being processed is dark.
+    tao_mutex             mutex;///< Lock for posted frames.
+    tao_cond               cond;///< Condition to notify posted frames.
+    tao_thread           thread;///< Background updater thread.
+    bool                running;///< Background thread is running.
+    bool                   quit;///< Background thread must quit.
+    bool                pending;///< A frame has been posted.
+    void*                  base;///< Base address of allocated memory.
+} tao_dark_estimator;
+
+#ifndef TAO_DOXYGEN_
+// Yield the number of bytes per line of raw pixels with a given encoding,
+// 0 if the encoding is not supported.
+static inline long _tao_dark_estimator_line_size(
+    tao_encoding enc,
+    long         width)
+{
+    unsigned pix = TAO_ENCODING_BITS_PER_PIXEL(enc);
+    unsigned pkt = TAO_ENCODING_BITS_PER_PACKET(enc);
+    bool mono = (TAO_ENCODING_COLORANT(enc) == TAO_COLORANT_MONO);
+    if (mono && pix >= 1 && pix <= pkt &&
+        (pkt == 8 || pkt == 16 || pkt == 32) &&
+        TAO_ENCODING_FLAGS(enc) == TAO_ENCODING_FLAGS_MSB_PAD) {
+        // One pixel per packet, possibly with zero padded upper bits.
+        return width*(pkt/8);
+    }
+    if (enc == TAO_ENCODING_ANDOR_MONO12PACKED ||
+        enc == TAO_ENCODING_GENICAM_MONO10P ||
+        enc == TAO_ENCODING_GENICAM_MONO14P) {
+        long npix = pkt/pix; // number of pixels per packet
+        return ((width + npix - 1)/npix)*(pkt/8);
+    }
+    return 0;
+}
+
+// Convert the raw pixels of the frame being processed.
+static inline bool _tao_dark_estimator_convert(
+    tao_dark_estimator* est)
+{
+    tao_encoding enc = est->work_encoding;
+    float* dst = est->pixels;
+    const uint8_t* raw = est->work;
+    long w = est->width, h = est->height, s = est->work_stride;
+    unsigned pkt = TAO_ENCODING_BITS_PER_PACKET(enc);
+    bool mono = (TAO_ENCODING_COLORANT(enc) == TAO_COLORANT_MONO);
+    if (mono && pkt == 8) {
+        tao_pixels_convert_u8_to_flt(dst, w, h, raw, s);
+    } else if (mono && pkt == 16) {
+        tao_pixels_convert_u16_to_flt(dst, w, h, (const uint16_t*)raw, s);
+    } else if (mono && pkt == 32) {
+        tao_pixels_convert_u32_to_flt(dst, w, h, (const uint32_t*)raw, s);
+    } else if (enc == TAO_ENCODING_ANDOR_MONO12PACKED) {
+        tao_pixels_convert_p12_to_flt(dst, w, h, raw, s);
+    } else if (enc == TAO_ENCODING_GENICAM_MONO10P) {
+        tao_pixels_convert_p10_to_flt(dst, w, h, raw, s);
+    } else if (enc == TAO_ENCODING_GENICAM_MONO14P) {
+        tao_pixels_convert_p14_to_flt(dst, w, h, raw, s);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Update the estimates with the frame being processed and publish them if
+// it is time to.
+static inline void _tao_dark_estimator_update(
+    tao_dark_estimator* est,
+    double              lambda)
+{
+    if (!_tao_dark_estimator_convert(est)) {
+        return;
+    }
+    long npixels = est->width*est->height;
+    const float* raw = est->pixels;
+    if (est->work_dark) {
+        for (long i = 0; i < npixels; ++i) {
+            double d = raw[i] - est->mean[i];
+            est->mean[i] += lambda*d;
+            est->var[i] = (1 - lambda)*(est->var[i] + lambda*d*d);
+        }
+    } else {
+        for (long i = 0; i < npixels; ++i) {
+            if (est->mask[i] != 0) {
+                double d = raw[i] - est->mean[i];
+                est->mean[i] += lambda*d;
+                est->var[i] = (1 - lambda)*(est->var[i] + lambda*d*d);
+            }
+        }
+    }
+    if (++est->nupdates % est->period != 0) {
+        return;
+    }
+    for (long i = 0; i < npixels; ++i) {
+        if (est->eltype == TAO_FLOAT) {
+            ((float*)est->bias)[i] = est->mean[i];
+            ((float*)est->offset)[i] = est->gain[i]*est->var[i];
+        } else {
+            ((double*)est->bias)[i] = est->mean[i];
+            ((double*)est->offset)[i] = est->gain[i]*est->var[i];
+        }
+    }
+    const void* coefs[4] = {NULL, est->bias, NULL, est->offset};
+    if (tao_calibration_publish(est->cal, coefs, 1.0) == TAO_ERROR) {
+        tao_report_error();
+    }
+}
+
+// Function run by the background thread.
+static inline void* _tao_dark_estimator_updater(
+    void* arg)
+{
+    tao_dark_estimator* est = (tao_dark_estimator*)arg;
+    while (true) {
+        tao_mutex_lock(&est->mutex);
+        while (!est->pending && !est->quit) {
+            tao_condition_wait(&est->cond, &est->mutex);
+        }
+        if (est->quit) {
+            tao_mutex_unlock(&est->mutex);
+            break;
+        }
+        uint8_t* buf = est->posted;
+        est->posted = est->work;
+        est->work = buf;
+        est->work_stride = est->posted_stride;
+        est->work_encoding = est->posted_encoding;
+        est->work_dark = est->posted_dark;
+        est->pending = false;
+        tao_mutex_unlock(&est->mutex);
+        _tao_dark_estimator_update(est, atomic_load(&est->lambda));
+    }
+    return NULL;
+}
+#endif // TAO_DOXYGEN_
+
+/**
+ * Destroy a dark estimator.
+ *
+ * The background thread, if any, is stopped and joined.
+ *
+ * @param est     Dark estimator (can be `NULL`).
+ */
+static inline void tao_dark_estimator_destroy(
+    tao_dark_estimator* est)
+{
+    if (est != NULL) {
+        if (est->running) {
+            tao_mutex_lock(&est->mutex);
+            est->quit = true;
+            tao_condition_signal(&est->cond);
+            tao_mutex_unlock(&est->mutex);
+            tao_thread_join(est->thread, NULL);
+        }
+        tao_condition_destroy(&est->cond);
+        tao_mutex_destroy(&est->mutex, false);
+        tao_free(est->base);
+        tao_free(est);
+    }
+}
+
+/**
+ * Create a dark estimator.
+ *
+ * The estimates are initialized from the coefficients `a`, `b`, `q`, and `r`
+ * of the most recent set of the calibration.  Initially, no pixels belong to
+ * the background.
+ *
+ * @param cal     Calibration to publish the estimates to.
+ *
+ * @param lambda  Weight of new samples in the range `(0,1]`.
+ *
+ * @param period  Number of updates between publications.
+ *
+ * @return The address of a new dark estimator; `NULL` in case of failure.
+ */
+static inline tao_dark_estimator* tao_dark_estimator_create(
+    tao_calibration* cal,
+    double           lambda,
+    long             period)
+{
+    if (!(lambda > 0 && lambda <= 1)) {
+        tao_store_error(__func__, TAO_BAD_FORGETTING_FACTOR);
+        return NULL;
+    }
+    if (period < 1) {
+        tao_store_error(__func__, TAO_BAD_NUMBER);
+        return NULL;
+    }
+    tao_dark_estimator* est = (tao_dark_estimator*)tao_calloc(
+        1, sizeof(tao_dark_estimator));
+    if (est == NULL) {
+        return NULL;
+    }
+    int k = (tao_shared_array_get_serial(cal->sets[0]) >=
+             tao_shared_array_get_serial(cal->sets[1])) ? 0 : 1;
+    tao_shared_array* set = cal->sets[k];
+    long npixels = cal->npixels;
+    est->width = tao_shared_array_get_dim(set, 1);
+    est->height = tao_shared_array_get_dim(set, 2);
+    est->period = period;
+    est->cal = cal;
+    est->eltype = tao_shared_array_get_eltype(set);
+    atomic_init(&est->lambda, lambda);
+    atomic_init(&est->dark, false);
+    // Packets of supported encodings have at most 8 bytes and 32 bits per
+    // pixel.
+    est->maxstride = TAO_ROUND_UP(4*est->width + 8, TAO_ALIGNMENT);
+    long rawsize = est->maxstride*est->height;
+    est->base = tao_calloc(1, TAO_ALIGNMENT - 1 + 2*rawsize + npixels*(
+                               3*sizeof(double) + 2*cal->elsize +
+                               sizeof(float) + 1));
+    if (est->base == NULL) {
+        tao_free(est);
+        return NULL;
+    }
+    char* ptr = (char*)TAO_ROUND_UP((uintptr_t)est->base, TAO_ALIGNMENT);
+    est->mean = (double*)ptr;
+    ptr += npixels*sizeof(double);
+    est->var = (double*)ptr;
+    ptr += npixels*sizeof(double);
+    est->gain = (double*)ptr;
+    ptr += npixels*sizeof(double);
+    est->bias = ptr;
+    ptr += npixels*cal->elsize;
+    est->offset = ptr;
+    ptr += npixels*cal->elsize;
+    est->pixels = (float*)ptr;
+    ptr += npixels*sizeof(float);
+    est->posted = (uint8_t*)ptr;
+    ptr += rawsize;
+    est->work = (uint8_t*)ptr;
+    ptr += rawsize;
+    est->mask = (uint8_t*)ptr;
+    if (tao_mutex_initialize(&est->mutex, TAO_PROCESS_PRIVATE) != TAO_OK) {
+        tao_free(est->base);
+        tao_free(est);
+        return NULL;
+    }
+    if (tao_condition_initialize(&est->cond, TAO_PROCESS_PRIVATE) != TAO_OK) {
+        tao_mutex_destroy(&est->mutex, false);
+        tao_free(est->base);
+        tao_free(est);
+        return NULL;
+    }
+    if (tao_shared_array_timed_rdlock(set, 1.0) != TAO_OK) {
+        tao_dark_estimator_destroy(est);
+        return NULL;
+    }
+    const void* data = tao_shared_array_get_data(set);
+    for (long i = 0; i < npixels; ++i) {
+        double a, b, q, r;
+        if (est->eltype == TAO_FLOAT) {
+            const float* c = (const float*)data;
+            a = c[i];
+            b = c[i + npixels];
+            q = c[i + 2*npixels];
+            r = c[i + 3*npixels];
+        } else {
+            const double* c = (const double*)data;
+            a = c[i];
+            b = c[i + npixels];
+            q = c[i + 2*npixels];
+            r = c[i + 3*npixels];
+        }
+        est->gain[i] = q*a*a;
+        est->mean[i] = b;
+        est->var[i] = (est->gain[i] > 0 ? r/est->gain[i] : 0);
+    }
+    if (tao_shared_array_unlock(set) != TAO_OK) {
+        tao_dark_estimator_destroy(est);
+        return NULL;
+    }
+    return est;
+}
+
+/**
+ * Set the background pixels of a dark estimator.
+ *
+ * The background pixels are updated by all frames, not only by dark frames.
+ * This function sets all the pixels outside the bounding boxes of the
+ * sub-images as background pixels.  It shall not be called once the
+ * background thread has been started.
+ *
+ * @param est     Dark estimator.
+ *
+ * @param subs    Sub-image definitions, can be `NULL` if @a nsubs is `0`.
+ *
+ * @param nsubs   Number of sub-images, `-1` to have no background pixels.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure.
+ */
+static inline tao_status tao_dark_estimator_set_background(
+    tao_dark_estimator* est,
+    const tao_subimage* subs,
+    long                nsubs)
+{
+    if (est->running) {
+        tao_store_error(__func__, TAO_ALREADY_IN_USE);
+        return TAO_ERROR;
+    }
+    for (long i = 0; i < nsubs; ++i) {
+        const tao_bounding_box* box = &subs[i].box;
+        if (box->xmin < 0 || box->xmax < box->xmin ||
+            box->xmax >= est->width || box->ymin < 0 ||
+            box->ymax < box->ymin || box->ymax >= est->height) {
+            tao_store_error(__func__, TAO_BAD_BOUNDING_BOX);
+            return TAO_ERROR;
+        }
+    }
+    long npixels = est->width*est->height;
+    memset(est->mask, (nsubs < 0 ? 0 : 1), npixels);
+    for (long i = 0; i < nsubs; ++i) {
+        const tao_bounding_box* box = &subs[i].box;
+        for (long y = box->ymin; y <= box->ymax; ++y) {
+            memset(est->mask + y*est->width + box->xmin, 0,
+                   box->xmax - box->xmin + 1);
+        }
+    }
+    est->nbackground = 0;
+    for (long i = 0; i < npixels; ++i) {
+        est->nbackground += est->mask[i];
+    }
+    return TAO_OK;
+}
+
+/**
+ * Start the background thread of a dark estimator.
+ *
+ * @param est     Dark estimator.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure.
+ */
+static inline tao_status tao_dark_estimator_start(
+    tao_dark_estimator* est)
+{
+    if (est->running) {
+        return TAO_OK;
+    }
+    est->quit = false;
+    est->pending = false;
+    if (tao_thread_create(&est->thread, NULL,
+                          _tao_dark_estimator_updater, est) != TAO_OK) {
+        return TAO_ERROR;
+    }
+    est->running = true;
+    return TAO_OK;
+}
+
+/**
+ * Tune the weight of new samples of a dark estimator.
+ *
+ * This function can be called at any time, it never blocks.
+ *
+ * @param est     Dark estimator.
+ *
+ * @param lambda  Weight of new samples in the range `(0,1]`.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure.
+ */
+static inline tao_status tao_dark_estimator_tune(
+    tao_dark_estimator* est,
+    double              lambda)
+{
+    if (!(lambda > 0 && lambda <= 1)) {
+        tao_store_error(__func__, TAO_BAD_FORGETTING_FACTOR);
+        return TAO_ERROR;
+    }
+    atomic_store(&est->lambda, lambda);
+    return TAO_OK;
+}
+
+/**
+ * Flag the next frames posted to a dark estimator as dark frames or not.
+ *
+ * This function can be called at any time (e.g. when the shutter is closed
+ * or opened, or according to the mark of the frames), it never blocks.
+ *
+ * @param est     Dark estimator.
+ *
+ * @param dark    Whether the next frames are dark.
+ */
+static inline void tao_dark_estimator_set_dark(
+    tao_dark_estimator* est,
+    bool                dark)
+{
+    atomic_store(&est->dark, dark);
+}
+
+/**
+ * Post a raw frame to a dark estimator.
+ *
+ * This function is intended to be called by the worker of the camera server
+ * for each frame.  It never blocks: the frame is not posted if the background
+ * thread is busy.  Frames which are not dark are not posted (nor copied) if
+ * there are no background pixels, since they would not change the estimates.
+ * Only the raw bytes of the frame are copied, they are converted by the
+ * background thread.
+ *
+ * @param est     Dark estimator.
+ *
+ * @param ctx     Pixel processing context with the raw pixels of the frame.
+ */
+static inline void tao_dark_estimator_post(
+    tao_dark_estimator*                 est,
+    const tao_pixels_processor_context* ctx)
+{
+    bool dark = atomic_load(&est->dark);
+    if ((!dark && est->nbackground == 0) ||
+        ctx->width != est->width || ctx->height != est->height ||
+        tao_mutex_try_lock(&est->mutex) != TAO_OK) {
+        return;
+    }
+    long len = _tao_dark_estimator_line_size(ctx->bufferencoding, ctx->width);
+    if (!est->pending && len > 0 && len <= ctx->stride) {
+        const uint8_t* src = (const uint8_t*)ctx->raw;
+        uint8_t* dst = est->posted;
+        for (long y = 0; y < ctx->height; ++y) {
+            memcpy(dst + y*len, src + y*ctx->stride, len);
+        }
+        est->posted_stride = len;
+        est->posted_encoding = ctx->bufferencoding;
+        est->posted_dark = dark;
+        est->pending = true;
+        tao_condition_signal(&est->cond);
+    }
+    tao_mutex_unlock(&est->mutex);
+}
+
+#ifndef TAO_DOXYGEN_
+// Dark estimator and pixel processor used by the camera server.
+static tao_dark_estimator*   _tao_dark_estimator_instance = NULL;
+static tao_pixels_processor* _tao_dark_estimator_processor = NULL;
+
+static void _tao_dark_estimator_posting_processor(
+    const tao_pixels_processor_context* ctx)
+{
+    _tao_dark_estimator_processor(ctx);
+    tao_dark_estimator_post(_tao_dark_estimator_instance, ctx);
+}
+
+static tao_status _tao_dark_estimator_stage(
+    tao_camera_server* srv)
+{
+    _tao_dark_estimator_processor = srv->proc.processor;
+    srv->proc.processor = _tao_dark_estimator_posting_processor;
+    return TAO_OK;
+}
+#endif // TAO_DOXYGEN_
+
+/**
+ * Attach a dark estimator to a camera server.
+ *
+ * This function adds a stage of rank @ref TAO_PROCESSOR_RANK_OUTPUT to the
+ * chain of pixel processors of the camera server (see @ref ProcessorChains).
+ * The pixel processor of this stage posts each raw frame to the dark
+ * estimator after having processed it.  It is installed again whenever the
+ * library resets the pixel processor of the server, e.g. after the camera
+ * has been configured.  There is a single attached dark estimator per
+ * process.  The camera must not be acquiring.
+ *
+ * @param srv     Camera server.
+ *
+ * @param est     Dark estimator, `NULL` to detach the dark estimator.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure.
+ */
+static inline tao_status tao_camera_server_attach_dark_estimator(
+    tao_camera_server*  srv,
+    tao_dark_estimator* est)
+{
+    if (est == NULL) {
+        if (tao_camera_server_remove_processor_stage(
+                srv, _tao_dark_estimator_stage) != TAO_OK) {
+            return TAO_ERROR;
+        }
+        _tao_dark_estimator_instance = NULL;
+        return TAO_OK;
+    }
+    // The estimator shall not be changed while the worker may be using it.
+    tao_camera* cam = srv->device;
+    if (tao_camera_lock(cam) != TAO_OK) {
+        return TAO_ERROR;
+    }
+    tao_status status = TAO_OK;
+    if (cam->runlevel == 2) {
+        tao_store_error(__func__, TAO_ACQUISITION_RUNNING);
+        status = TAO_ERROR;
+    } else {
+        _tao_dark_estimator_instance = est;
+    }
+    if (tao_camera_unlock(cam) != TAO_OK) {
+        status = TAO_ERROR;
+    }
+    if (status != TAO_OK) {
+        return TAO_ERROR;
+    }
+    return tao_camera_server_add_processor_stage(
+        srv, _tao_dark_estimator_stage, TAO_PROCESSOR_RANK_OUTPUT, true);
+}
+
+/**
+ * @}
+ */
+
+TAO_END_DECLS
+
+#endif // TAO_DARK_ESTIMATORS_H_
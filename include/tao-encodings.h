@@ -471,6 +471,29 @@ typedef uint32_t tao_encoding;
 #define TAO_ENCODING_ANDOR_MONO22PACKEDPARALLEL \
     TAO_ENCODING_4_(TAO_COLORANT_MONO, 22, 88, TAO_ENCODING_FLAGS_PARALLEL)
 
+/**
+ * @def TAO_ENCODING_GENICAM_MONO10P
+ *
+ * @brief GenICam Mono10p encoding.
+ *
+ * GenICam Mono10p encoding is monochrome with 10 bits per pixel, stored by
+ * packing 4 adjacent pixels into 5 bytes.  Bits are packed in little-endian
+ * order: the least significant bits of a pixel are stored in the first byte
+ * (at the least significant bits not used by the previous pixel).
+ */
+#define TAO_ENCODING_GENICAM_MONO10P TAO_ENCODING_MONO_PKT(10, 40)
+
+/**
+ * @def TAO_ENCODING_GENICAM_MONO14P
+ *
+ * @brief GenICam Mono14p encoding.
+ *
+ * GenICam Mono14p encoding is monochrome with 14 bits per pixel, stored by
+ * packing 4 adjacent pixels into 7 bytes.  Bits are packed in the same order
+ * as for @ref TAO_ENCODING_GENICAM_MONO10P.
+ */
+#define TAO_ENCODING_GENICAM_MONO14P TAO_ENCODING_MONO_PKT(14, 56)
+
 /**
  * Get pixel encoding matching given element type.
  *
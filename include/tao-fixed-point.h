@@ -0,0 +1,403 @@
+// tao-fixed-point.h -
+//
+// Fixed-point integer pre-processing of pixels in TAO library.
+//
+//-----------------------------------------------------------------------------
+//
+// This file if part of TAO real-time software licensed under the MIT license
+// (https://git-cral.univ-lyon1.fr/tao/tao-rt).
+//
+// Copyright (C) 2022, Éric Thiébaut.
+
+#ifndef TAO_FIXED_POINT_H_
+#define TAO_FIXED_POINT_H_ 1
+
+#include <math.h>
+#include <stdint.h>
+
+#include <tao-basics.h>
+#include <tao-errors.h>
+#include <tao-macros.h>
+#include <tao-utils.h>
+
+TAO_BEGIN_DECLS
+
+/**
+ * @defgroup FixedPoint  Fixed-point pixels
+ *
+ * @ingroup Cameras
+ *
+ * @brief Pre-processing of 8-bit and 16-bit raw pixels with integer
+ * arithmetic.
+ *
+ * @{
+ *
+ * For 8-bit and 16-bit raw pixels, the affine correction `(raw - b)*a` can be
+ * applied with 32-bit integer arithmetic and the result stored as 16-bit or
+ * 32-bit signed integers.  This avoids the conversion of the raw pixels to
+ * floating-point and, with 16-bit output, doubles the number of pixels
+ * processed per instruction by integer-friendly consumers (e.g., the center
+ * of gravity in small windows).
+ *
+ * The gain `a` of each pixel is stored as a 16-bit signed integer `A` in
+ * Q-format with `g` fractional bits (i.e., `A ≈ a*2^g`) and the bias is
+ * folded into a 32-bit offset `C ≈ b*a*2^g` so that the pre-processed value
+ * is computed as:
+ *
+ *     dat = (raw*A - C) >> shift
+ *
+ * with `shift = g - frac` and `frac` the number of fractional bits of the
+ * result (the rounding is included in `C`).  Thus `dat ≈ (raw - b)*a*2^frac`.
+ * The number `g` is chosen as large as possible for the largest gain to be
+ * exactly represented.  The gains and biases must be nonnegative so that
+ * there are no integer overflows.
+ *
+ * With full pre-processing, the weights are taken from a small lookup table
+ * indexed by the pre-processed value.  Since the weights `q/(dat + r)` vary
+ * the most for small values, the bins are log-spaced: with `u = max(dat,0)
+ * >> lutshift`, the 16 first bins are for `u = 0, ..., 15` and the others
+ * split each octave `[2^e, 2^(e+1))` in 16 bins (this is the exponent and
+ * the 4 most significant bits of the mantissa of `u` converted to `float`).
+ * The relative width of a bin is thus at most 1/16 and, for most settings,
+ * `lutshift = 0` and dark pixels have exact weights.  The table is computed
+ * for the scalar coefficients `q` and `r` of the weights (typically their
+ * median values) at the center of the values in each bin and stored as
+ * 16-bit integers with `wfrac` fractional bits.
+ *
+ * The functions in this header follow the conventions of the functions in
+ * @ref tao-pixels.h.  They are compiled for several instruction sets with the
+ * best one selected at run-time (see @ref TAO_SIMD_CLONES).
+ *
+ * These functions are only provided by the library for consumers owning their
+ * buffers of integer pixels.  They are not installed in the chain of pixel
+ * processors of camera servers (see @ref ProcessorChains) because the
+ * pre-processed images of camera servers have floating-point pixels.
+ *
+ * This header defines static functions, it must be included by a single
+ * compilation unit.
+ */
+
+/**
+ * @def TAO_FIXED_POINT_LUT_SIZE
+ *
+ * Number of entries in the lookup table of the weights for fixed-point
+ * pre-processing.
+ */
+#define TAO_FIXED_POINT_LUT_SIZE 256
+
+#ifndef TAO_DOXYGEN_
+// Number of linear bins (also the number of bins per octave) and number of
+// octaves of the lookup table of weights.  The (shifted) values above
+// `_TAO_FP_LUT_RANGE` all fall in the last bin.
+#define _TAO_FP_LUT_LINEAR  16
+#define _TAO_FP_LUT_OCTAVES \
+    ((TAO_FIXED_POINT_LUT_SIZE - _TAO_FP_LUT_LINEAR)/_TAO_FP_LUT_LINEAR)
+#define _TAO_FP_LUT_RANGE   (_TAO_FP_LUT_LINEAR << _TAO_FP_LUT_OCTAVES)
+
+// Index of the bin of the lookup table for pre-processed value `v`.  For `u
+// >= 16`, the biased exponent `E` and the 4 most significant bits `m` of the
+// mantissa of `(float)u` yield `k = (E - 127 - 3)*16 + m`.
+static inline int32_t _tao_fixed_point_lut_index(
+    int32_t v,
+    int     lutshift)
+{
+    int32_t u = (v > 0 ? v >> lutshift : 0);
+    union { float f; uint32_t i; } x = { .f = (float)u };
+    int32_t k = (u < _TAO_FP_LUT_LINEAR ? u :
+                 (int32_t)(x.i >> 19) - (127 + 3)*_TAO_FP_LUT_LINEAR);
+    return (k < TAO_FIXED_POINT_LUT_SIZE - 1 ? k :
+            TAO_FIXED_POINT_LUT_SIZE - 1);
+}
+#endif // TAO_DOXYGEN_
+
+/**
+ * Coefficients for fixed-point pre-processing.
+ */
+typedef struct tao_fixed_point_coefs {
+    long                          npixels;///< Number of pixels.
+    int16_t*                            a;///< Gains in Q-format.
+    int32_t*                            c;///< Offsets in Q-format.
+    int                             shift;///< Right shift of products.
+    int                              frac;///< Fractional bits of values.
+    int                             wfrac;///< Fractional bits of weights.
+    int                          lutshift;///< Right shift of LUT index.
+    int32_t lut[TAO_FIXED_POINT_LUT_SIZE];///< Lookup table of weights.
+} tao_fixed_point_coefs;
+
+/**
+ * Destroy coefficients for fixed-point pre-processing.
+ *
+ * @param fp      Coefficients (can be `NULL`).
+ */
+static inline void tao_fixed_point_coefs_destroy(
+    tao_fixed_point_coefs* fp)
+{
+    if (fp != NULL) {
+        tao_free(fp->a);
+        tao_free(fp->c);
+        tao_free(fp);
+    }
+}
+
+/**
+ * Compute coefficients for fixed-point pre-processing.
+ *
+ * @param npixels  Number of pixels.
+ *
+ * @param a        Pixelwise gains (nonnegative).
+ *
+ * @param b        Pixelwise biases (nonnegative).
+ *
+ * @param q        Numerator of the weights.
+ *
+ * @param r        Denominator offset of the weights.
+ *
+ * @param rawbits  Number of significant bits of the raw pixels (at most 16).
+ *
+ * @param frac     Number of fractional bits of the pre-processed values.
+ *
+ * @param wfrac    Number of fractional bits of the weights.
+ *
+ * @return The address of new coefficients; `NULL` in case of failure.  The
+ *         error code is @ref TAO_OUT_OF_RANGE if the coefficients cannot be
+ *         represented without overflows.
+ */
+static inline tao_fixed_point_coefs* tao_fixed_point_coefs_create(
+    long         npixels,
+    const float* a,
+    const float* b,
+    double       q,
+    double       r,
+    int          rawbits,
+    int          frac,
+    int          wfrac)
+{
+    if (npixels < 1) {
+        tao_store_error(__func__, TAO_BAD_SIZE);
+        return NULL;
+    }
+    if (rawbits < 1 || rawbits > 16 || frac < 0 || frac > 15 ||
+        wfrac < 0 || wfrac > 15 || !(q >= 0) || !(r > 0)) {
+        tao_store_error(__func__, TAO_BAD_ARGUMENT);
+        return NULL;
+    }
+    double amax = 0;
+    for (long i = 0; i < npixels; ++i) {
+        if (!(a[i] >= 0) || !(b[i] >= 0)) {
+            tao_store_error(__func__, TAO_OUT_OF_RANGE);
+            return NULL;
+        }
+        amax = TAO_MAX(amax, (double)a[i]);
+    }
+    // Largest number of fractional bits for the gains such that the
+    // largest gain fits in 15 bits and the rounding term cannot overflow.
+    int g = frac + 16;
+    while (g > 0 && amax*ldexp(1.0, g) > 32767.0) {
+        --g;
+    }
+    if (g < frac) {
+        tao_store_error(__func__, TAO_OUT_OF_RANGE);
+        return NULL;
+    }
+    tao_fixed_point_coefs* fp = (tao_fixed_point_coefs*)tao_calloc(
+        1, sizeof(tao_fixed_point_coefs));
+    if (fp == NULL) {
+        return NULL;
+    }
+    fp->npixels = npixels;
+    fp->shift = g - frac;
+    fp->frac = frac;
+    fp->wfrac = wfrac;
+    fp->a = (int16_t*)tao_malloc(npixels*sizeof(int16_t));
+    fp->c = (int32_t*)tao_malloc(npixels*sizeof(int32_t));
+    if (fp->a == NULL || fp->c == NULL) {
+        tao_fixed_point_coefs_destroy(fp);
+        return NULL;
+    }
+    double rnd = (fp->shift > 0 ? ldexp(1.0, fp->shift - 1) : 0.0);
+    double scl = ldexp(1.0, g);
+    long rawmax = (1L << rawbits) - 1;
+    long vmax = 0;
+    for (long i = 0; i < npixels; ++i) {
+        double c = round((double)b[i]*(double)a[i]*scl) - rnd;
+        if (c > 2147483647.0) {
+            tao_store_error(__func__, TAO_OUT_OF_RANGE);
+            tao_fixed_point_coefs_destroy(fp);
+            return NULL;
+        }
+        fp->a[i] = (int16_t)lround(a[i]*scl);
+        fp->c[i] = (int32_t)c;
+        vmax = TAO_MAX(vmax, (rawmax*fp->a[i] - fp->c[i]) >> fp->shift);
+    }
+    fp->lutshift = 0;
+    while ((vmax >> fp->lutshift) >= _TAO_FP_LUT_RANGE) {
+        ++fp->lutshift;
+    }
+    // Bin `j` has the values `v` such that `lo <= (v >> lutshift) < hi`, the
+    // weight is computed at the center of these values.
+    for (int j = 0; j < TAO_FIXED_POINT_LUT_SIZE; ++j) {
+        long lo, hi;
+        if (j < _TAO_FP_LUT_LINEAR) {
+            lo = j;
+            hi = j + 1;
+        } else {
+            int e = (j - _TAO_FP_LUT_LINEAR)/_TAO_FP_LUT_LINEAR;
+            int m = (j - _TAO_FP_LUT_LINEAR)%_TAO_FP_LUT_LINEAR;
+            lo = (long)(_TAO_FP_LUT_LINEAR + m) << e;
+            hi = (long)(_TAO_FP_LUT_LINEAR + m + 1) << e;
+        }
+        double v = ldexp(0.5*(double)((lo << fp->lutshift) +
+                                      (hi << fp->lutshift) - 1), -frac);
+        double w = ldexp(q/(v + r), wfrac);
+        fp->lut[j] = (int32_t)TAO_MIN(lround(w), 32767L);
+    }
+    return fp;
+}
+
+#ifndef TAO_DOXYGEN_
+#define _TAO_FP_ROW(raw, y, stride, T) \
+    ((const T*)((const uint8_t*)(raw) + (y)*(stride)))
+
+// Saturating conversions of 32-bit values.
+#define _TAO_FP_STORE_i16(v)                                 \
+    ((int16_t)((v) < INT16_MIN ? INT16_MIN :                 \
+               (v) > INT16_MAX ? INT16_MAX : (v)))
+#define _TAO_FP_STORE_i32(v) (v)
+
+#define _TAO_FP_ENCODE(S, T, O, U)                                      \
+    static inline TAO_SIMD_CLONES void                                  \
+    tao_pixels_preprocess_affine_##S##_to_##O(                          \
+        U*              restrict dat,                                   \
+        long                     width,                                 \
+        long                     height,                                \
+        const int16_t*  restrict a,                                     \
+        const int32_t*  restrict c,                                     \
+        int                      shift,                                 \
+        const T*        restrict raw,                                   \
+        long                     stride)                                \
+    {                                                                   \
+        for (long y = 0; y < height; ++y) {                             \
+            const T* src = _TAO_FP_ROW(raw, y, stride, T);              \
+            long off = y*width;                                         \
+            for (long x = 0; x < width; ++x) {                          \
+                long i = off + x;                                       \
+                int32_t v = ((int32_t)src[x]*a[i] - c[i]) >> shift;     \
+                dat[i] = _TAO_FP_STORE_##O(v);                          \
+            }                                                           \
+        }                                                               \
+    }                                                                   \
+                                                                        \
+    static inline TAO_SIMD_CLONES void                                  \
+    tao_pixels_preprocess_full_##S##_to_##O(                            \
+        U*              restrict dat,                                   \
+        U*              restrict wgt,                                   \
+        long                     width,                                 \
+        long                     height,                                \
+        const int16_t*  restrict a,                                     \
+        const int32_t*  restrict c,                                     \
+        int                      shift,                                 \
+        const int32_t*  restrict lut,                                   \
+        int                      lutshift,                              \
+        const T*        restrict raw,                                   \
+        long                     stride)                                \
+    {                                                                   \
+        for (long y = 0; y < height; ++y) {                             \
+            const T* src = _TAO_FP_ROW(raw, y, stride, T);              \
+            long off = y*width;                                         \
+            for (long x = 0; x < width; ++x) {                          \
+                long i = off + x;                                       \
+                int32_t v = ((int32_t)src[x]*a[i] - c[i]) >> shift;     \
+                int32_t k = _tao_fixed_point_lut_index(v, lutshift);    \
+                dat[i] = _TAO_FP_STORE_##O(v);                          \
+                wgt[i] = (U)lut[k];                                     \
+            }                                                           \
+        }                                                               \
+    }
+
+_TAO_FP_ENCODE(u8,  uint8_t,  i16, int16_t)
+_TAO_FP_ENCODE(u8,  uint8_t,  i32, int32_t)
+_TAO_FP_ENCODE(u16, uint16_t, i16, int16_t)
+_TAO_FP_ENCODE(u16, uint16_t, i32, int32_t)
+
+#undef _TAO_FP_ENCODE
+#undef _TAO_FP_STORE_i16
+#undef _TAO_FP_STORE_i32
+#undef _TAO_FP_ROW
+#endif // TAO_DOXYGEN_
+
+#ifdef TAO_DOXYGEN_
+/**
+ * @brief Apply affine correction to raw pixels with fixed-point arithmetic.
+ *
+ * This function behaves as tao_pixels_preprocess_affine_u8_to_flt() except
+ * that the correction is computed with 32-bit integer arithmetic and that
+ * the output image has 16-bit signed integer pixels (saturated) with
+ * `frac` fractional bits.  The functions
+ * tao_pixels_preprocess_affine_u8_to_i32(),
+ * tao_pixels_preprocess_affine_u16_to_i16(), and
+ * tao_pixels_preprocess_affine_u16_to_i32() are similar for other raw and
+ * output pixel types.
+ *
+ * @param dat     Output array of pixels.
+ * @param width   Number of pixels per line of the image.
+ * @param height  Number of lines of pixels in the image.
+ * @param a       Pixelwise gains in Q-format (member `a` of @ref
+ *                tao_fixed_point_coefs).
+ * @param c       Pixelwise offsets in Q-format (member `c` of @ref
+ *                tao_fixed_point_coefs).
+ * @param shift   Right shift of the products (member `shift` of @ref
+ *                tao_fixed_point_coefs).
+ * @param raw     Input buffer of raw pixels.
+ * @param stride  Number of bytes between successive lines in input image
+ *                buffer @a raw.
+ */
+extern void tao_pixels_preprocess_affine_u8_to_i16(
+    int16_t*        restrict dat,
+    long                     width,
+    long                     height,
+    const int16_t*  restrict a,
+    const int32_t*  restrict c,
+    int                      shift,
+    const uint8_t*  restrict raw,
+    long                     stride);
+
+/**
+ * @brief Apply affine correction and compute weights with fixed-point
+ * arithmetic.
+ *
+ * This function behaves as tao_pixels_preprocess_affine_u8_to_i16() and, in
+ * addition, stores in @a wgt the weights taken from a lookup table of @ref
+ * TAO_FIXED_POINT_LUT_SIZE log-spaced entries indexed by the pre-processed
+ * values.  The
+ * functions tao_pixels_preprocess_full_u8_to_i32(),
+ * tao_pixels_preprocess_full_u16_to_i16(), and
+ * tao_pixels_preprocess_full_u16_to_i32() are similar for other raw and
+ * output pixel types.
+ *
+ * @param lut       Lookup table of weights (member `lut` of @ref
+ *                  tao_fixed_point_coefs).
+ * @param lutshift  Right shift of the pre-processed values to index the
+ *                  lookup table (member `lutshift` of @ref
+ *                  tao_fixed_point_coefs).
+ */
+extern void tao_pixels_preprocess_full_u8_to_i16(
+    int16_t*        restrict dat,
+    int16_t*        restrict wgt,
+    long                     width,
+    long                     height,
+    const int16_t*  restrict a,
+    const int32_t*  restrict c,
+    int                      shift,
+    const int32_t*  restrict lut,
+    int                      lutshift,
+    const uint8_t*  restrict raw,
+    long                     stride);
+#endif // TAO_DOXYGEN_
+
+/**
+ * @}
+ */
+
+TAO_END_DECLS
+
+#endif // TAO_FIXED_POINT_H_
@@ -0,0 +1,681 @@
+// tao-float16.h -
+//
+// Half-precision floating-point pixels in TAO library.
+//
+//-----------------------------------------------------------------------------
+//
+// This file if part of TAO real-time software licensed under the MIT license
+// (https://git-cral.univ-lyon1.fr/tao/tao-rt).
+//
+// Copyright (C) 2022, Éric Thiébaut.
+
+#ifndef TAO_FLOAT16_H_
+#define TAO_FLOAT16_H_ 1
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <tao-basics.h>
+#include <tao-camera-servers.h>
+#include <tao-cameras-private.h>
+#include <tao-config.h>
+#include <tao-errors.h>
+#include <tao-processor-chains.h>
+#include <tao-shared-arrays.h>
+#include <tao-utils.h>
+
+TAO_BEGIN_DECLS
+
+/**
+ * @defgroup Float16  Half-precision pixels
+ *
+ * @ingroup Cameras
+ *
+ * @brief Conversion and pre-processing of pixels to half-precision.
+ *
+ * @{
+ *
+ * Storing pre-processed images and weights as IEEE 754 half-precision
+ * (binary16) floating-point values halves their size compared to single
+ * precision and makes them no larger than the raw 16-bit images.  The
+ * relative precision of normalized half-precision values is about 5e-4, the
+ * smallest normalized value is about 6.1e-5 and the largest finite value is
+ * 65504.  Smaller values are subnormal, their absolute precision is about
+ * 6e-8 so their relative precision degrades as they get smaller.  This is
+ * sufficient for pixel values expressed in photo-electrons, but not for
+ * their weights (the inverse of their variances) which are about 1e-5 for
+ * bright pixels.  Weights are therefore multiplied by a power of 2 before
+ * being converted (see @ref TAO_FLOAT16_WEIGHT_SCALE), which is exact.
+ *
+ * Half-precision values are stored as `uint16_t` bit patterns (type @ref
+ * tao_float16), so pre-processed images in half-precision are stored in
+ * shared arrays of element type @ref TAO_UINT16.  As nothing in a shared
+ * array tells that its elements are half-precision values, such arrays are
+ * published under configuration parameters with a `-float16` suffix, which
+ * clients shall check (see tao_float16_publisher_attach()).  All arithmetic
+ * is done in single precision, the results are rounded to the nearest
+ * half-precision value when stored.
+ *
+ * The images pre-processed by a camera server are published in
+ * half-precision by a @ref tao_float16_publisher attached to the server.
+ * The kernels converting raw pixels directly to half-precision are provided
+ * for camera drivers or clients, camera servers do not call them since they
+ * must store their output images in single or double precision.
+ *
+ * The functions in this header follow the conventions of the functions in
+ * @ref tao-pixels.h.  They are compiled for several instruction sets with the
+ * best one selected at run-time (see @ref TAO_F16C_CLONES) so that the
+ * conversions to and from half-precision are done by the F16C instructions
+ * when available.
+ */
+
+/**
+ * Half-precision floating-point value stored as a bit pattern.
+ */
+typedef uint16_t tao_float16;
+
+/**
+ * @def TAO_F16C_CLONES
+ *
+ * Mark a function to be compiled for AVX-512 and AVX2 capable processors
+ * (both with F16C instructions) and the baseline of the target with the best
+ * version selected at run-time.  This is like @ref TAO_SIMD_CLONES except
+ * that the clones are specified by processor architectures because GCC does
+ * not accept F16C as a target attribute.
+ */
+#if !defined(TAO_NO_SIMD_CLONES) && defined(__x86_64__) && defined(__ELF__) && \
+    !defined(__clang__) && defined(__GNUC__) && (__GNUC__ >= 12)
+#  define TAO_F16C_CLONES \
+    __attribute__((target_clones("arch=skylake-avx512","arch=haswell",\
+                                 "default")))
+#else
+#  define TAO_F16C_CLONES // nothing
+#endif
+
+/**
+ * Convert a single precision value to half-precision.
+ *
+ * The value is rounded to the nearest half-precision value (ties to even),
+ * values too large are converted to infinities.
+ *
+ * @param x   Single precision value.
+ *
+ * @return The half-precision value.
+ */
+static TAO_ALWAYS_INLINE tao_float16 tao_float_to_float16(
+    float x)
+{
+#ifdef __FLT16_MAX__
+    _Float16 h = (_Float16)x;
+    tao_float16 r;
+    memcpy(&r, &h, sizeof(r));
+    return r;
+#else
+    uint32_t u;
+    memcpy(&u, &x, sizeof(u));
+    uint32_t sign = (u >> 16) & 0x8000;
+    uint32_t absu = u & 0x7fffffff;
+    if (absu >= 0x7f800000) {
+        // Infinity or NaN (keep NaN quiet).
+        return sign | 0x7c00 | (absu > 0x7f800000 ? 0x0200 : 0);
+    }
+    if (absu >= 0x477ff000) {
+        // Overflow after rounding.
+        return sign | 0x7c00;
+    }
+    if (absu < 0x38800000) {
+        // Subnormal or zero result.
+        if (absu < 0x33000000) {
+            return sign;
+        }
+        uint32_t e = absu >> 23;
+        uint32_t m = (absu & 0x007fffff) | 0x00800000;
+        uint32_t shift = 126 - e;
+        uint32_t r = m >> shift;
+        uint32_t rem = m & ((1u << shift) - 1);
+        uint32_t half = 1u << (shift - 1);
+        if (rem > half || (rem == half && (r & 1) != 0)) {
+            ++r;
+        }
+        return sign | r;
+    }
+    // Normal result, rounding to nearest even.
+    uint32_t r = absu - 0x38000000;
+    r += 0x0fff + ((r >> 13) & 1);
+    return sign | (r >> 13);
+#endif
+}
+
+/**
+ * Convert a half-precision value to single precision.
+ *
+ * The conversion is exact.
+ *
+ * @param h   Half-precision value.
+ *
+ * @return The single precision value.
+ */
+static TAO_ALWAYS_INLINE float tao_float16_to_float(
+    tao_float16 h)
+{
+#ifdef __FLT16_MAX__
+    _Float16 x;
+    memcpy(&x, &h, sizeof(x));
+    return (float)x;
+#else
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t e = (h >> 10) & 0x1f;
+    uint32_t m = h & 0x03ff;
+    uint32_t u;
+    if (e == 0x1f) {
+        u = sign | 0x7f800000 | (m << 13);
+    } else if (e != 0) {
+        u = sign | ((e + 112) << 23) | (m << 13);
+    } else if (m != 0) {
+        // Subnormal value, normalize it.
+        e = 113;
+        while ((m & 0x0400) == 0) {
+            m <<= 1;
+            --e;
+        }
+        u = sign | (e << 23) | ((m & 0x03ff) << 13);
+    } else {
+        u = sign;
+    }
+    float x;
+    memcpy(&x, &u, sizeof(x));
+    return x;
+#endif
+}
+
+#ifndef TAO_DOXYGEN_
+#define _TAO_F16_ROW(raw, y, stride, T) \
+    ((const T*)((const uint8_t*)(raw) + (y)*(stride)))
+
+#define _TAO_F16_ENCODE(S, T)                                           \
+    static inline TAO_F16C_CLONES void tao_pixels_convert_##S##_to_f16( \
+        tao_float16*    restrict dat,                                   \
+        long                     width,                                 \
+        long                     height,                                \
+        const T*        restrict raw,                                   \
+        long                     stride)                                \
+    {                                                                   \
+        for (long y = 0; y < height; ++y) {                             \
+            const T* src = _TAO_F16_ROW(raw, y, stride, T);             \
+            tao_float16* dst = dat + y*width;                           \
+            for (long x = 0; x < width; ++x) {                          \
+                dst[x] = tao_float_to_float16((float)src[x]);           \
+            }                                                           \
+        }                                                               \
+    }                                                                   \
+                                                                        \
+    static inline TAO_F16C_CLONES void                                  \
+    tao_pixels_preprocess_affine_##S##_to_f16(                          \
+        tao_float16*    restrict dat,                                   \
+        long                     width,                                 \
+        long                     height,                                \
+        const float*    restrict a,                                     \
+        const float*    restrict b,                                     \
+        const T*        restrict raw,                                   \
+        long                     stride)                                \
+    {                                                                   \
+        for (long y = 0; y < height; ++y) {                             \
+            const T* src = _TAO_F16_ROW(raw, y, stride, T);             \
+            long off = y*width;                                         \
+            for (long x = 0; x < width; ++x) {                          \
+                long i = off + x;                                       \
+                dat[i] = tao_float_to_float16(                          \
+                    ((float)src[x] - b[i])*a[i]);                       \
+            }                                                           \
+        }                                                               \
+    }                                                                   \
+                                                                        \
+    static inline TAO_F16C_CLONES void                                  \
+    tao_pixels_preprocess_full_##S##_to_f16(                            \
+        tao_float16*    restrict dat,                                   \
+        tao_float16*    restrict wgt,                                   \
+        long                     width,                                 \
+        long                     height,                                \
+        const float*    restrict a,                                     \
+        const float*    restrict b,                                     \
+        const float*    restrict q,                                     \
+        const float*    restrict r,                                     \
+        const T*        restrict raw,                                   \
+        long                     stride)                                \
+    {                                                                   \
+        for (long y = 0; y < height; ++y) {                             \
+            const T* src = _TAO_F16_ROW(raw, y, stride, T);             \
+            long off = y*width;                                         \
+            for (long x = 0; x < width; ++x) {                          \
+                long i = off + x;                                       \
+                float val = ((float)src[x] - b[i])*a[i];                \
+                dat[i] = tao_float_to_float16(val);                     \
+                wgt[i] = tao_float_to_float16(                          \
+                    q[i]/((val > 0 ? val : 0) + r[i]));                 \
+            }                                                           \
+        }                                                               \
+    }
+
+_TAO_F16_ENCODE(u8,  uint8_t)
+_TAO_F16_ENCODE(u16, uint16_t)
+
+#define _TAO_F16_SCALE(S, T)                                            \
+    static inline TAO_F16C_CLONES void tao_pixels_convert_##S##_to_f16( \
+        tao_float16*    restrict dst,                                   \
+        const T*        restrict src,                                   \
+        long                     n,                                     \
+        float                    scale)                                 \
+    {                                                                   \
+        for (long i = 0; i < n; ++i) {                                  \
+            dst[i] = tao_float_to_float16((float)src[i]*scale);         \
+        }                                                               \
+    }
+
+_TAO_F16_SCALE(flt, float)
+_TAO_F16_SCALE(dbl, double)
+
+#undef _TAO_F16_ENCODE
+#undef _TAO_F16_SCALE
+#undef _TAO_F16_ROW
+#endif // TAO_DOXYGEN_
+
+#ifdef TAO_DOXYGEN_
+/**
+ * @brief Convert raw pixels to half-precision.
+ *
+ * This function behaves as tao_pixels_convert_u8_to_flt() except that the
+ * output image has half-precision floating-point pixels.  The function
+ * tao_pixels_convert_u16_to_f16() is similar for 16-bit raw pixels.
+ *
+ * @param dat     Output array of pixels.
+ * @param width   Number of pixels per line of the image.
+ * @param height  Number of lines of pixels in the image.
+ * @param raw     Input buffer of raw pixels.
+ * @param stride  Number of bytes between successive lines in input image
+ *                buffer @a raw.
+ */
+extern void tao_pixels_convert_u8_to_f16(
+    tao_float16*    restrict dat,
+    long                     width,
+    long                     height,
+    const uint8_t*  restrict raw,
+    long                     stride);
+
+/**
+ * @brief Apply affine correction to raw pixels with half-precision output.
+ *
+ * This function behaves as tao_pixels_preprocess_affine_u8_to_flt() except
+ * that the output image has half-precision floating-point pixels (the
+ * correction is computed in single precision).  The function
+ * tao_pixels_preprocess_affine_u16_to_f16() is similar for 16-bit raw
+ * pixels.
+ */
+extern void tao_pixels_preprocess_affine_u8_to_f16(
+    tao_float16*    restrict dat,
+    long                     width,
+    long                     height,
+    const float*    restrict a,
+    const float*    restrict b,
+    const uint8_t*  restrict raw,
+    long                     stride);
+
+/**
+ * @brief Apply affine correction and compute weights with half-precision
+ * output.
+ *
+ * This function behaves as tao_pixels_preprocess_full_u8_to_flt() except
+ * that the output images have half-precision floating-point pixels (the
+ * correction and the weights are computed in single precision).  The
+ * function tao_pixels_preprocess_full_u16_to_f16() is similar for 16-bit raw
+ * pixels.
+ */
+extern void tao_pixels_preprocess_full_u8_to_f16(
+    tao_float16*    restrict dat,
+    tao_float16*    restrict wgt,
+    long                     width,
+    long                     height,
+    const float*    restrict a,
+    const float*    restrict b,
+    const float*    restrict q,
+    const float*    restrict r,
+    const uint8_t*  restrict raw,
+    long                     stride);
+
+/**
+ * @brief Convert pre-processed values to half-precision.
+ *
+ * This function stores `src[i]*scale` rounded to half-precision in `dst[i]`
+ * for `i` in `0:n-1`.  The function tao_pixels_convert_dbl_to_f16() is
+ * similar for double precision values.
+ *
+ * @param dst     Output array of half-precision values.
+ * @param src     Input array of values.
+ * @param n       Number of values.
+ * @param scale   Multiplier applied before conversion.
+ */
+extern void tao_pixels_convert_flt_to_f16(
+    tao_float16*    restrict dst,
+    const float*    restrict src,
+    long                     n,
+    float                    scale);
+#endif // TAO_DOXYGEN_
+
+/**
+ * @def TAO_FLOAT16_WEIGHT_SCALE
+ *
+ * Default factor applied to the weights published in half-precision.  With
+ * this value, weights from about 6e-8 (variance of 1.6e7) to 64 (variance of
+ * 0.016) are normalized half-precision values.
+ */
+#define TAO_FLOAT16_WEIGHT_SCALE 1024.0
+
+/**
+ * Publisher of pre-processed images in half-precision.
+ *
+ * A publisher converts each image pre-processed by a camera server into
+ * half-precision and publishes it in a shared array of element type @ref
+ * TAO_UINT16 and dimensions `(width,height,2)`.  The first plane stores the
+ * pixel values, the second plane stores the weights multiplied by
+ * `wgtscale`, or zeros if the images have no weights.  The shared memory
+ * identifier of the shared array is written in the configuration parameter
+ * `<owner>-float16` and the factor of the weights in the configuration
+ * parameter `<owner>-float16-weight-scale`.  The serial number of the shared
+ * array is the number of published images and its first time-stamp is the
+ * time of publication.
+ *
+ * The conversion is performed by the worker of the camera server once the
+ * image has been pre-processed.  The publisher never blocks: if the shared
+ * array is locked by a client, the image is not published and the counter
+ * of skipped images is incremented.
+ */
+typedef struct tao_float16_publisher {
+    long                  width;///< Width of images.
+    long                 height;///< Height of images.
+    float              wgtscale;///< Factor of the published weights.
+    long                skipped;///< Number of skipped images.
+    tao_serial           serial;///< Number of published images.
+    tao_shared_array*    shared;///< Half-precision images in shared memory.
+} tao_float16_publisher;
+
+/**
+ * Destroy a publisher of images in half-precision.
+ *
+ * The publisher must have been detached from the camera server.
+ *
+ * @param pub     Publisher (can be `NULL`).
+ */
+static inline void tao_float16_publisher_destroy(
+    tao_float16_publisher* pub)
+{
+    if (pub != NULL) {
+        if (pub->shared != NULL) {
+            tao_shared_array_detach(pub->shared);
+        }
+        tao_free(pub);
+    }
+}
+
+/**
+ * Create a publisher of images in half-precision.
+ *
+ * This function creates the shared array storing the images in
+ * half-precision and publishes its shared memory identifier and the factor of
+ * the weights.
+ *
+ * @param owner     The name of the camera server.
+ *
+ * @param width     Width of the pre-processed images.
+ *
+ * @param height    Height of the pre-processed images.
+ *
+ * @param wgtscale  Factor of the published weights, a power of 2 for the
+ *                  scaling to be exact (e.g. @ref TAO_FLOAT16_WEIGHT_SCALE).
+ *
+ * @param flags     Permissions granted to the group and to the others for
+ *                  the shared array.
+ *
+ * @return The address of a new publisher; `NULL` in case of failure.
+ */
+static inline tao_float16_publisher* tao_float16_publisher_create(
+    const char* owner,
+    long        width,
+    long        height,
+    double      wgtscale,
+    unsigned    flags)
+{
+    if (owner == NULL || owner[0] == '\0' ||
+        strlen(owner) >= TAO_OWNER_SIZE) {
+        tao_store_error(__func__, TAO_BAD_NAME);
+        return NULL;
+    }
+    if (width < 1 || height < 1) {
+        tao_store_error(__func__, TAO_BAD_SIZE);
+        return NULL;
+    }
+    if (!(wgtscale > 0 && wgtscale < 65504)) {
+        tao_store_error(__func__, TAO_OUT_OF_RANGE);
+        return NULL;
+    }
+    tao_float16_publisher* pub = (tao_float16_publisher*)tao_calloc(
+        1, sizeof(tao_float16_publisher));
+    if (pub == NULL) {
+        return NULL;
+    }
+    pub->width = width;
+    pub->height = height;
+    pub->wgtscale = (float)wgtscale;
+    pub->shared = tao_shared_array_create_3d(
+        TAO_UINT16, width, height, 2, flags);
+    if (pub->shared == NULL) {
+        goto error;
+    }
+    memset(tao_shared_array_get_data(pub->shared), 0,
+           2*width*height*sizeof(tao_float16));
+    char name[TAO_OWNER_SIZE + 32];
+    sprintf(name, "%s-float16-weight-scale", owner);
+    if (tao_config_write(name, "%.17g", (double)pub->wgtscale) != TAO_OK) {
+        goto error;
+    }
+    sprintf(name, "%s-float16", owner);
+    if (tao_config_write_long(
+            name, tao_shared_array_get_shmid(pub->shared)) != TAO_OK) {
+        goto error;
+    }
+    return pub;
+
+error:
+    tao_float16_publisher_destroy(pub);
+    return NULL;
+}
+
+/**
+ * Attach the shared array of images in half-precision of a camera server.
+ *
+ * This function is intended for the clients of a camera server with a
+ * publisher of images in half-precision.
+ *
+ * @param owner     Name of the camera server.
+ *
+ * @param arr       Address to store the shared array.
+ *
+ * @param wgtscale  Address to store the factor of the published weights.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure.  The
+ *         shared array shall be detached by the caller with
+ *         tao_shared_array_detach().
+ */
+static inline tao_status tao_float16_publisher_attach(
+    const char*        owner,
+    tao_shared_array** arr,
+    double*            wgtscale)
+{
+    char name[TAO_OWNER_SIZE + 32];
+    long shmid;
+    *arr = NULL;
+    if (owner == NULL || owner[0] == '\0' ||
+        strlen(owner) >= TAO_OWNER_SIZE) {
+        tao_store_error(__func__, TAO_BAD_NAME);
+        return TAO_ERROR;
+    }
+    sprintf(name, "%s-float16-weight-scale", owner);
+    if (tao_config_read(name, "%lf", wgtscale) != 1) {
+        tao_store_error(__func__, TAO_BAD_VALUE);
+        return TAO_ERROR;
+    }
+    sprintf(name, "%s-float16", owner);
+    if (tao_config_read_long(name, &shmid) != TAO_OK ||
+        (*arr = tao_shared_array_attach(shmid)) == NULL) {
+        return TAO_ERROR;
+    }
+    if (tao_shared_array_get_eltype(*arr) != TAO_UINT16 ||
+        tao_shared_array_get_ndims(*arr) != 3 ||
+        tao_shared_array_get_dim(*arr, 3) != 2) {
+        tao_shared_array_detach(*arr);
+        *arr = NULL;
+        tao_store_error(__func__, TAO_BAD_TYPE);
+        return TAO_ERROR;
+    }
+    return TAO_OK;
+}
+
+/**
+ * Publish a pre-processed image in half-precision.
+ *
+ * This function is intended to be called by the worker of the camera server
+ * for each image, after pre-processing.  It never blocks.  Images whose size
+ * or pixel type do not match those of the publisher are ignored.
+ *
+ * @param pub     Publisher.
+ *
+ * @param ctx     Pixel processing context with the pre-processed image.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure.
+ */
+static inline tao_status tao_float16_publisher_process(
+    tao_float16_publisher*              pub,
+    const tao_pixels_processor_context* ctx)
+{
+    if (ctx->width != pub->width || ctx->height != pub->height ||
+        (ctx->eltype != TAO_FLOAT && ctx->eltype != TAO_DOUBLE) ||
+        ctx->dat == NULL) {
+        return TAO_OK;
+    }
+    tao_status status = tao_shared_array_try_wrlock(pub->shared);
+    if (status != TAO_OK) {
+        if (status != TAO_TIMEOUT) {
+            return TAO_ERROR;
+        }
+        ++pub->skipped;
+        return TAO_OK;
+    }
+    long n = pub->width*pub->height;
+    tao_float16* dst = (tao_float16*)tao_shared_array_get_data(pub->shared);
+    bool weighted = (ctx->preprocessing == TAO_PREPROCESSING_FULL &&
+                     ctx->wgt != NULL);
+    if (ctx->eltype == TAO_FLOAT) {
+        tao_pixels_convert_flt_to_f16(dst, ctx->dat, n, 1);
+        if (weighted) {
+            tao_pixels_convert_flt_to_f16(dst + n, ctx->wgt, n,
+                                          pub->wgtscale);
+        }
+    } else {
+        tao_pixels_convert_dbl_to_f16(dst, ctx->dat, n, 1);
+        if (weighted) {
+            tao_pixels_convert_dbl_to_f16(dst + n, ctx->wgt, n,
+                                          pub->wgtscale);
+        }
+    }
+    if (!weighted) {
+        memset(dst + n, 0, n*sizeof(tao_float16));
+    }
+    tao_time now;
+    if (tao_get_monotonic_time(&now) == TAO_OK) {
+        tao_shared_array_set_timestamp(pub->shared, 0, &now);
+    }
+    tao_shared_array_set_serial(pub->shared, ++pub->serial);
+    return tao_shared_array_unlock(pub->shared);
+}
+
+#ifndef TAO_DOXYGEN_
+// Publisher and pixel processor used by the camera server.
+static tao_float16_publisher* _tao_float16_publisher_instance = NULL;
+static tao_pixels_processor*  _tao_float16_publisher_processor = NULL;
+
+static void _tao_float16_publisher_publishing_processor(
+    const tao_pixels_processor_context* ctx)
+{
+    _tao_float16_publisher_processor(ctx);
+    if (tao_float16_publisher_process(_tao_float16_publisher_instance,
+                                      ctx) != TAO_OK) {
+        tao_report_error();
+    }
+}
+
+static tao_status _tao_float16_publisher_stage(
+    tao_camera_server* srv)
+{
+    _tao_float16_publisher_processor = srv->proc.processor;
+    srv->proc.processor = _tao_float16_publisher_publishing_processor;
+    return TAO_OK;
+}
+#endif // TAO_DOXYGEN_
+
+/**
+ * Attach a publisher of images in half-precision to a camera server.
+ *
+ * This function adds a stage of rank @ref TAO_PROCESSOR_RANK_OUTPUT to the
+ * chain of pixel processors of the camera server (see @ref ProcessorChains).
+ * The pixel processor of this stage publishes each image in half-precision
+ * after having processed it.  The stage is installed again whenever the
+ * library resets the pixel processor of the server, e.g. after the camera
+ * has been configured.  There is a single attached publisher of images in
+ * half-precision per process.  The camera must not be acquiring.
+ *
+ * @param srv     Camera server.
+ *
+ * @param pub     Publisher, `NULL` to detach the publisher.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure.
+ */
+static inline tao_status tao_camera_server_attach_float16_publisher(
+    tao_camera_server*     srv,
+    tao_float16_publisher* pub)
+{
+    if (pub == NULL) {
+        if (tao_camera_server_remove_processor_stage(
+                srv, _tao_float16_publisher_stage) != TAO_OK) {
+            return TAO_ERROR;
+        }
+        _tao_float16_publisher_instance = NULL;
+        return TAO_OK;
+    }
+    // The publisher shall not be changed while the worker may be using it.
+    tao_camera* cam = srv->device;
+    if (tao_camera_lock(cam) != TAO_OK) {
+        return TAO_ERROR;
+    }
+    tao_status status = TAO_OK;
+    if (cam->runlevel == 2) {
+        tao_store_error(__func__, TAO_ACQUISITION_RUNNING);
+        status = TAO_ERROR;
+    } else {
+        _tao_float16_publisher_instance = pub;
+    }
+    if (tao_camera_unlock(cam) != TAO_OK) {
+        status = TAO_ERROR;
+    }
+    if (status != TAO_OK) {
+        return TAO_ERROR;
+    }
+    return tao_camera_server_add_processor_stage(
+        srv, _tao_float16_publisher_stage, TAO_PROCESSOR_RANK_OUTPUT, false);
+}
+
+/**
+ * @}
+ */
+
+TAO_END_DECLS
+
+#endif // TAO_FLOAT16_H_
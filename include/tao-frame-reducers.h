@@ -0,0 +1,454 @@
+// tao-frame-reducers.h -
+//
+// Co-adding and software binning of images in TAO library.
+//
+//-----------------------------------------------------------------------------
+//
+// This file if part of TAO real-time software licensed under the MIT license
+// (https://git-cral.univ-lyon1.fr/tao/tao-rt).
+//
+// Copyright (C) 2022, Éric Thiébaut.
+
+#ifndef TAO_FRAME_REDUCERS_H_
+#define TAO_FRAME_REDUCERS_H_ 1
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <tao-basics.h>
+#include <tao-camera-servers.h>
+#include <tao-cameras-private.h>
+#include <tao-config.h>
+#include <tao-errors.h>
+#include <tao-processor-chains.h>
+#include <tao-shared-arrays.h>
+#include <tao-utils.h>
+
+TAO_BEGIN_DECLS
+
+/**
+ * @defgroup FrameReducers  Frame reducers
+ *
+ * @ingroup Cameras
+ *
+ * @brief Co-adding and software binning of pre-processed images.
+ *
+ * @{
+ *
+ * A frame reducer sums `nframes` consecutive pre-processed images and bins
+ * their pixels by macro-pixels of `xbin` by `ybin` pixels (in addition to
+ * the hardware binning of the camera, if any).  Each reduced image is
+ * published in a shared array whose shared memory identifier is written in
+ * the configuration parameter `<owner>-reduced`.  Slow clients (monitoring,
+ * visualization, etc.) can then read a reduced-rate and reduced-size stream
+ * instead of copying and summing all the images published by the server.
+ *
+ * The shared array is a `W×H×2` array with `W = width/xbin` and
+ * `H = height/ybin` (the remaining rows and columns of pixels are ignored),
+ * and the same element type as the pre-processed images.  The first plane
+ * stores the sums of the pre-processed values, the second plane stores the
+ * corresponding weights computed as the inverse of the sums of the variances
+ * (the inverses of the weights of the summed pixels).  Hence a macro-pixel
+ * has a zero weight if any of its pixels has a zero weight (e.g. a bad
+ * pixel).  If the images have no weights, the weights of the reduced images
+ * are all set to one.  The serial number of the shared array is the number
+ * of reduced images published so far and its first time-stamp is the time of
+ * publication.
+ *
+ * The reduction is performed by the worker thread of the camera server as
+ * soon as an image has been pre-processed: a single pass over the output
+ * image and weights accumulates the co-added and binned values while they
+ * are still in the cache.  The worker never waits for the clients: when a
+ * reduced image is complete and the shared array is locked by a client, it
+ * is kept aside and published by the first subsequent call that can lock the
+ * shared array without blocking; if a newer reduced image is completed
+ * before, the older one is dropped.
+ *
+ * This header defines static functions, it must be included by a single
+ * compilation unit.
+ */
+
+/**
+ * Co-adder and software binner of images.
+ */
+typedef struct tao_frame_reducer {
+    long                  width;///< Width of input images.
+    long                 height;///< Height of input images.
+    long                   xbin;///< Horizontal binning factor.
+    long                   ybin;///< Vertical binning factor.
+    long                nframes;///< Number of images to co-add.
+    long                  count;///< Number of images currently summed.
+    long                dropped;///< Number of dropped reduced images.
+    tao_eltype           eltype;///< Type of pixels.
+    bool                pending;///< A reduced image awaits publication.
+    bool               weighted;///< Current sums have weights.
+    bool           rdy_weighted;///< Pending sums have weights.
+    void*                   acc;///< Sums of values being accumulated.
+    void*                   var;///< Sums of variances being accumulated.
+    void*               rdy_acc;///< Sums of values awaiting publication.
+    void*               rdy_var;///< Sums of variances awaiting publication.
+    tao_serial           serial;///< Number of published reduced images.
+    tao_shared_array*    shared;///< Reduced images in shared memory.
+} tao_frame_reducer;
+
+/**
+ * Destroy a frame reducer.
+ *
+ * @param red     Frame reducer (can be `NULL`).
+ */
+static inline void tao_frame_reducer_destroy(
+    tao_frame_reducer* red)
+{
+    if (red != NULL) {
+        if (red->shared != NULL) {
+            tao_shared_array_detach(red->shared);
+        }
+        tao_free(red->acc);
+        tao_free(red->var);
+        tao_free(red->rdy_acc);
+        tao_free(red->rdy_var);
+        tao_free(red);
+    }
+}
+
+/**
+ * Create a frame reducer.
+ *
+ * This function creates the shared array storing the reduced images and
+ * publishes its shared memory identifier.
+ *
+ * @param owner    The name of the camera server.
+ *
+ * @param width    Width of the pre-processed images.
+ *
+ * @param height   Height of the pre-processed images.
+ *
+ * @param eltype   Type of the pre-processed pixels, @ref TAO_FLOAT or @ref
+ *                 TAO_DOUBLE.
+ *
+ * @param nframes  Number of consecutive images to co-add.
+ *
+ * @param xbin     Horizontal size of macro-pixels.
+ *
+ * @param ybin     Vertical size of macro-pixels.
+ *
+ * @param flags    Permissions granted to the group and to the others for
+ *                 the shared array.
+ *
+ * @return The address of a new frame reducer; `NULL` in case of failure.
+ */
+static inline tao_frame_reducer* tao_frame_reducer_create(
+    const char* owner,
+    long        width,
+    long        height,
+    tao_eltype  eltype,
+    long        nframes,
+    long        xbin,
+    long        ybin,
+    unsigned    flags)
+{
+    if (owner == NULL || owner[0] == '\0' ||
+        strlen(owner) >= TAO_OWNER_SIZE) {
+        tao_store_error(__func__, TAO_BAD_NAME);
+        return NULL;
+    }
+    if (eltype != TAO_FLOAT && eltype != TAO_DOUBLE) {
+        tao_store_error(__func__, TAO_BAD_TYPE);
+        return NULL;
+    }
+    if (nframes < 1) {
+        tao_store_error(__func__, TAO_BAD_NUMBER);
+        return NULL;
+    }
+    if (xbin < 1 || ybin < 1 || width < xbin || height < ybin) {
+        tao_store_error(__func__, TAO_BAD_SIZE);
+        return NULL;
+    }
+    tao_frame_reducer* red = (tao_frame_reducer*)tao_calloc(
+        1, sizeof(tao_frame_reducer));
+    if (red == NULL) {
+        return NULL;
+    }
+    red->width = width;
+    red->height = height;
+    red->xbin = xbin;
+    red->ybin = ybin;
+    red->nframes = nframes;
+    red->eltype = eltype;
+    long w = width/xbin, h = height/ybin;
+    size_t size = w*h*tao_size_of_eltype(eltype);
+    red->acc = tao_malloc(size);
+    red->var = tao_malloc(size);
+    red->rdy_acc = tao_malloc(size);
+    red->rdy_var = tao_malloc(size);
+    if (red->acc == NULL || red->var == NULL ||
+        red->rdy_acc == NULL || red->rdy_var == NULL) {
+        goto error;
+    }
+    red->shared = tao_shared_array_create_3d(eltype, w, h, 2, flags);
+    if (red->shared == NULL) {
+        goto error;
+    }
+    memset(tao_shared_array_get_data(red->shared), 0, 2*size);
+    char name[TAO_OWNER_SIZE + 16];
+    sprintf(name, "%s-reduced", owner);
+    if (tao_config_write_long(
+            name, tao_shared_array_get_shmid(red->shared)) != TAO_OK) {
+        goto error;
+    }
+    return red;
+
+error:
+    tao_frame_reducer_destroy(red);
+    return NULL;
+}
+
+#ifndef TAO_DOXYGEN_
+// Accumulate the co-added and binned values and variances of an image.  If
+// `first` is true, the sums are initialized.  If `wgt` is `NULL`, the
+// variances are not computed.
+#define _TAO_FR_ACCUMULATE(O, T)                                        \
+    static inline TAO_SIMD_CLONES void _tao_frame_reducer_accumulate_##O( \
+        T*       restrict acc,                                          \
+        T*       restrict var,                                          \
+        long              width,                                        \
+        long              xbin,                                         \
+        long              ybin,                                         \
+        long              w,                                            \
+        long              h,                                            \
+        const T* restrict dat,                                          \
+        const T* restrict wgt,                                          \
+        bool              first)                                        \
+    {                                                                   \
+        for (long y = 0; y < h; ++y) {                                  \
+            T* restrict a = acc + y*w;                                  \
+            T* restrict v = var + y*w;                                  \
+            for (long yy = 0; yy < ybin; ++yy) {                        \
+                long off = (y*ybin + yy)*width;                         \
+                const T* restrict d = dat + off;                        \
+                bool init = (first && yy == 0);                         \
+                for (long x = 0; x < w; ++x) {                          \
+                    T s = 0;                                            \
+                    for (long xx = 0; xx < xbin; ++xx) {                \
+                        s += d[x*xbin + xx];                            \
+                    }                                                   \
+                    a[x] = (init ? s : a[x] + s);                       \
+                }                                                       \
+                if (wgt != NULL) {                                      \
+                    const T* restrict g = wgt + off;                    \
+                    for (long x = 0; x < w; ++x) {                      \
+                        T s = 0;                                        \
+                        for (long xx = 0; xx < xbin; ++xx) {            \
+                            T gi = g[x*xbin + xx];                      \
+                            s += (gi > 0 ? 1/gi : (T)INFINITY);         \
+                        }                                               \
+                        v[x] = (init ? s : v[x] + s);                   \
+                    }                                                   \
+                }                                                       \
+            }                                                           \
+        }                                                               \
+    }                                                                   \
+                                                                        \
+    /* Store reduced values and weights in a shared array. */           \
+    static inline void _tao_frame_reducer_store_##O(                    \
+        T*       restrict dst,                                          \
+        const T* restrict acc,                                          \
+        const T* restrict var,                                          \
+        long              n,                                            \
+        bool              weighted)                                     \
+    {                                                                   \
+        memcpy(dst, acc, n*sizeof(T));                                  \
+        T* restrict wgt = dst + n;                                      \
+        if (weighted) {                                                 \
+            for (long i = 0; i < n; ++i) {                              \
+                wgt[i] = 1/var[i];                                      \
+            }                                                           \
+        } else {                                                        \
+            for (long i = 0; i < n; ++i) {                              \
+                wgt[i] = 1;                                             \
+            }                                                           \
+        }                                                               \
+    }
+
+_TAO_FR_ACCUMULATE(flt, float)
+_TAO_FR_ACCUMULATE(dbl, double)
+
+#undef _TAO_FR_ACCUMULATE
+
+// Publish pending reduced image if the shared array can be locked without
+// blocking.
+static inline tao_status _tao_frame_reducer_publish(
+    tao_frame_reducer* red)
+{
+    tao_status status = tao_shared_array_try_wrlock(red->shared);
+    if (status != TAO_OK) {
+        return status == TAO_TIMEOUT ? TAO_OK : TAO_ERROR;
+    }
+    long n = (red->width/red->xbin)*(red->height/red->ybin);
+    void* dst = tao_shared_array_get_data(red->shared);
+    if (red->eltype == TAO_FLOAT) {
+        _tao_frame_reducer_store_flt(dst, red->rdy_acc, red->rdy_var, n,
+                                     red->rdy_weighted);
+    } else {
+        _tao_frame_reducer_store_dbl(dst, red->rdy_acc, red->rdy_var, n,
+                                     red->rdy_weighted);
+    }
+    tao_time now;
+    if (tao_get_monotonic_time(&now) == TAO_OK) {
+        tao_shared_array_set_timestamp(red->shared, 0, &now);
+    }
+    tao_shared_array_set_serial(red->shared, ++red->serial);
+    red->pending = false;
+    return tao_shared_array_unlock(red->shared);
+}
+#endif // TAO_DOXYGEN_
+
+/**
+ * Accumulate a pre-processed image in a frame reducer.
+ *
+ * This function is intended to be called by the worker of the camera server
+ * for each image, after pre-processing.  It never blocks.  Images whose size
+ * or pixel type do not match those of the frame reducer are ignored.
+ *
+ * @param red     Frame reducer.
+ *
+ * @param ctx     Pixel processing context with the pre-processed image.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure.
+ */
+static inline tao_status tao_frame_reducer_process(
+    tao_frame_reducer*                  red,
+    const tao_pixels_processor_context* ctx)
+{
+    tao_status status = TAO_OK;
+    if (red->pending) {
+        status = _tao_frame_reducer_publish(red);
+    }
+    if (ctx->width != red->width || ctx->height != red->height ||
+        ctx->eltype != red->eltype || ctx->dat == NULL) {
+        return status;
+    }
+    bool first = (red->count == 0);
+    bool weighted = (ctx->preprocessing == TAO_PREPROCESSING_FULL &&
+                     ctx->wgt != NULL);
+    red->weighted = (first ? weighted : red->weighted && weighted);
+    const void* wgt = (red->weighted ? ctx->wgt : NULL);
+    long w = red->width/red->xbin, h = red->height/red->ybin;
+    if (red->eltype == TAO_FLOAT) {
+        _tao_frame_reducer_accumulate_flt(
+            red->acc, red->var, red->width, red->xbin, red->ybin, w, h,
+            ctx->dat, wgt, first);
+    } else {
+        _tao_frame_reducer_accumulate_dbl(
+            red->acc, red->var, red->width, red->xbin, red->ybin, w, h,
+            ctx->dat, wgt, first);
+    }
+    if (++red->count >= red->nframes) {
+        void* tmp;
+        tmp = red->rdy_acc; red->rdy_acc = red->acc; red->acc = tmp;
+        tmp = red->rdy_var; red->rdy_var = red->var; red->var = tmp;
+        red->rdy_weighted = red->weighted;
+        red->count = 0;
+        if (red->pending) {
+            ++red->dropped;
+        }
+        red->pending = true;
+        if (_tao_frame_reducer_publish(red) != TAO_OK) {
+            status = TAO_ERROR;
+        }
+    }
+    return status;
+}
+
+#ifndef TAO_DOXYGEN_
+// Frame reducer and pixel processor used by the camera server.
+static tao_frame_reducer*    _tao_frame_reducer_instance = NULL;
+static tao_pixels_processor* _tao_frame_reducer_processor = NULL;
+
+static void _tao_frame_reducer_reducing_processor(
+    const tao_pixels_processor_context* ctx)
+{
+    _tao_frame_reducer_processor(ctx);
+    if (tao_frame_reducer_process(_tao_frame_reducer_instance,
+                                  ctx) != TAO_OK) {
+        tao_report_error();
+    }
+}
+
+static tao_status _tao_frame_reducer_stage(
+    tao_camera_server* srv)
+{
+    _tao_frame_reducer_processor = srv->proc.processor;
+    srv->proc.processor = _tao_frame_reducer_reducing_processor;
+    return TAO_OK;
+}
+#endif // TAO_DOXYGEN_
+
+/**
+ * Attach a frame reducer to a camera server.
+ *
+ * This function adds a stage of rank @ref TAO_PROCESSOR_RANK_OUTPUT to the
+ * chain of pixel processors of the camera server (see @ref ProcessorChains).
+ * The pixel processor of this stage accumulates each image in the frame
+ * reducer after having processed it.  Being of higher rank than the stages
+ * changing the processed images, the reduced images are those published by
+ * the server.  The stage is installed again whenever the library resets the
+ * pixel processor of the server, e.g. after the camera has been configured.
+ * There is a single attached frame reducer per process.  The camera must not
+ * be acquiring.
+ *
+ * @param srv     Camera server.
+ *
+ * @param red     Frame reducer, `NULL` to detach the frame reducer.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure.
+ */
+static inline tao_status tao_camera_server_attach_frame_reducer(
+    tao_camera_server* srv,
+    tao_frame_reducer* red)
+{
+    if (red == NULL) {
+        if (tao_camera_server_remove_processor_stage(
+                srv, _tao_frame_reducer_stage) != TAO_OK) {
+            return TAO_ERROR;
+        }
+        _tao_frame_reducer_instance = NULL;
+        return TAO_OK;
+    }
+    // The reducer shall not be changed while the worker may be using it.
+    tao_camera* cam = srv->device;
+    if (tao_camera_lock(cam) != TAO_OK) {
+        return TAO_ERROR;
+    }
+    tao_status status = TAO_OK;
+    if (cam->runlevel == 2) {
+        tao_store_error(__func__, TAO_ACQUISITION_RUNNING);
+        status = TAO_ERROR;
+    } else {
+        _tao_frame_reducer_instance = red;
+    }
+    if (tao_camera_unlock(cam) != TAO_OK) {
+        status = TAO_ERROR;
+    }
+    if (status != TAO_OK) {
+        return TAO_ERROR;
+    }
+    if (tao_camera_server_add_processor_stage(
+            srv, _tao_frame_reducer_stage, TAO_PROCESSOR_RANK_OUTPUT,
+            false) != TAO_OK) {
+        return TAO_ERROR;
+    }
+    tao_inform(srv->logfile, TAO_MESG_INFO,
+               "Publishing sums of %ld images binned %ld×%ld\n",
+               red->nframes, red->xbin, red->ybin);
+    return TAO_OK;
+}
+
+/**
+ * @}
+ */
+
+TAO_END_DECLS
+
+#endif // TAO_FRAME_REDUCERS_H_
@@ -0,0 +1,478 @@
+// tao-image-generations.h -
+//
+// Lock-free reading of the images published by camera servers in TAO
+// library.
+//
+//-----------------------------------------------------------------------------
+//
+// This file if part of TAO real-time software licensed under the MIT license
+// (https://git-cral.univ-lyon1.fr/tao/tao-rt).
+//
+// Copyright (C) 2022, Éric Thiébaut.
+
+#ifndef TAO_IMAGE_GENERATIONS_H_
+#define TAO_IMAGE_GENERATIONS_H_ 1
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <tao-basics.h>
+#include <tao-camera-servers.h>
+#include <tao-cameras-private.h>
+#include <tao-config.h>
+#include <tao-encodings.h>
+#include <tao-errors.h>
+#include <tao-macros.h>
+#include <tao-processor-chains.h>
+#include <tao-shared-arrays.h>
+
+TAO_BEGIN_DECLS
+
+/**
+ * @defgroup ImageGenerations  Lock-free image reading
+ *
+ * @ingroup Cameras
+ *
+ * @brief Reading of the output images of camera servers without locks.
+ *
+ * @{
+ *
+ * Clients normally read an output image of a camera server while owning a
+ * read lock on the shared array storing the image.  A client which is slow to
+ * release this lock holds off the server when the image is to be overwritten
+ * and may cause overruns.  The generation counters in this header implement
+ * an optional lock-free protocol (a so-called *sequence lock*) where readers
+ * never lock the images, so they cannot block the worker of the server:
+ *
+ * - The server (see tao_camera_server_attach_image_generations()) has a
+ *   generation counter for each output image stored in a shared array of
+ *   generations.  The counter is incremented to an odd value before an image
+ *   is overwritten and to an even value after the new image has been
+ *   written.  The serial number of the image is also set to 0 while it is
+ *   being overwritten.
+ *
+ * - A reader calls tao_shared_image_peek() to check that the image has the
+ *   expected serial number and is not being overwritten, then copies or
+ *   processes the pixels, and finally calls tao_shared_image_validate() to
+ *   check that the generation of the image has not changed.  If the
+ *   validation fails, the image has been overwritten and whatever has been
+ *   obtained from the pixels must be discarded.  Function
+ *   tao_shared_image_fetch() implements this for copying an image.
+ *
+ * Typical usage:
+ *
+ * ~~~~~{.c}
+ * tao_shared_array* gens = tao_image_generations_attach(camera_name);
+ * tao_serial serial = tao_remote_camera_wait_output(cam, 0, maxsecs);
+ * if (serial > 0) {
+ *     tao_shmid shmid = tao_remote_camera_get_image_shmid(cam, serial);
+ *     tao_shared_array* img = tao_shared_array_attach(shmid);
+ *     if (img != NULL) {
+ *         tao_image_generation gen;
+ *         const void* pixels = tao_shared_image_peek(gens, img, serial, &gen);
+ *         if (pixels != NULL) {
+ *             // Process the pixels.
+ *             ...;
+ *             if (tao_shared_image_validate(gens, &gen)) {
+ *                 // Results are valid.
+ *                 ...;
+ *             }
+ *         }
+ *         tao_shared_array_detach(img);
+ *     }
+ * }
+ * ~~~~~
+ *
+ * The worker of the server still locks the images for writing, clients
+ * using read locks remain supported but may still hold off the server.  The
+ * protocol cannot be used with zero-copy publication (see @ref ZeroCopy)
+ * where the pixels are written before the generation is incremented.
+ *
+ * The protocol fails safe: whenever the server may write the output images
+ * without updating their generations (the generations are detached, or
+ * zero-copy publication is enabled), the generations of all the images are
+ * left odd so that readers never accept an image until it has been written
+ * again with its generation updated.
+ *
+ * This header defines static functions, it must be included by a single
+ * compilation unit.
+ */
+
+/**
+ * Generation of an output image read by a client.
+ */
+typedef struct tao_image_generation {
+    long   index;///< Index of the image in the shared array of generations.
+    int64_t value;///< Generation of the image when it was peeked.
+} tao_image_generation;
+
+#ifndef TAO_DOXYGEN_
+// Get the address of the shared memory identifier and of the generation of
+// the k-th output image.
+static inline int64_t* _tao_image_generations_entry(
+    const tao_shared_array* gens,
+    long                    k)
+{
+    return (int64_t*)tao_shared_array_get_data(gens) + 2*k;
+}
+
+// Find the index of an output image in a shared array of generations, -1 if
+// not found.
+static inline long _tao_image_generations_find(
+    const tao_shared_array* gens,
+    const tao_shared_array* img)
+{
+    int64_t shmid = tao_shared_array_get_shmid(img);
+    long nbufs = tao_shared_array_get_dim(gens, 2);
+    for (long k = 0; k < nbufs; ++k) {
+        int64_t* entry = _tao_image_generations_entry(gens, k);
+        if (__atomic_load_n(&entry[0], __ATOMIC_ACQUIRE) == shmid) {
+            return k;
+        }
+    }
+    return -1;
+}
+#endif // TAO_DOXYGEN_
+
+/**
+ * Create the shared array of generations for the output images of a camera
+ * server.
+ *
+ * The shared array has 2 rows (the shared memory identifier of an output
+ * image and its generation) and `nbufs` columns.  Its shared memory
+ * identifier is written in the configuration of the server with suffix
+ * `-generations`.
+ *
+ * @param owner   Name of the camera server.
+ *
+ * @param nbufs   Number of output images of the server.
+ *
+ * @param flags   Permissions granted to the group and to the others.
+ *
+ * @return The address of a new shared array; `NULL` in case of failure.
+ */
+static inline tao_shared_array* tao_image_generations_create(
+    const char* owner,
+    long        nbufs,
+    unsigned    flags)
+{
+    if (owner == NULL || owner[0] == '\0' ||
+        strlen(owner) >= TAO_OWNER_SIZE) {
+        tao_store_error(__func__, TAO_BAD_NAME);
+        return NULL;
+    }
+    if (nbufs < 1) {
+        tao_store_error(__func__, TAO_BAD_BUFFERS);
+        return NULL;
+    }
+    tao_shared_array* gens = tao_shared_array_create_2d(
+        TAO_INT64, 2, nbufs, flags);
+    if (gens == NULL) {
+        return NULL;
+    }
+    for (long k = 0; k < nbufs; ++k) {
+        int64_t* entry = _tao_image_generations_entry(gens, k);
+        entry[0] = TAO_BAD_SHMID;
+        entry[1] = 0;
+    }
+    char name[TAO_OWNER_SIZE + 16];
+    sprintf(name, "%s-generations", owner);
+    if (tao_config_write_long(
+            name, tao_shared_array_get_shmid(gens)) != TAO_OK) {
+        tao_shared_array_detach(gens);
+        return NULL;
+    }
+    return gens;
+}
+
+/**
+ * Attach the shared array of generations of a camera server.
+ *
+ * @param owner   Name of the camera server.
+ *
+ * @return The address of the shared array of generations in the caller's
+ *         address space, to be detached by tao_shared_array_detach(); `NULL`
+ *         in case of failure.
+ */
+static inline tao_shared_array* tao_image_generations_attach(
+    const char* owner)
+{
+    if (owner == NULL || owner[0] == '\0' ||
+        strlen(owner) >= TAO_OWNER_SIZE) {
+        tao_store_error(__func__, TAO_BAD_NAME);
+        return NULL;
+    }
+    char name[TAO_OWNER_SIZE + 16];
+    sprintf(name, "%s-generations", owner);
+    long shmid;
+    if (tao_config_read_long(name, &shmid) != TAO_OK) {
+        return NULL;
+    }
+    tao_shared_array* gens = tao_shared_array_attach(shmid);
+    if (gens != NULL && (tao_shared_array_get_eltype(gens) != TAO_INT64 ||
+                         tao_shared_array_get_ndims(gens) != 2 ||
+                         tao_shared_array_get_dim(gens, 1) != 2)) {
+        tao_shared_array_detach(gens);
+        tao_store_error(__func__, TAO_BAD_TYPE);
+        return NULL;
+    }
+    return gens;
+}
+
+/**
+ * Get a lock-free access to the pixels of an output image.
+ *
+ * This function yields the address of the pixels of an output image if it
+ * has the expected serial number and is not being overwritten.  The pixels
+ * may be overwritten by the server at any time, so, after having used them,
+ * the caller must call tao_shared_image_validate() to check that they have
+ * not been overwritten in the mean time.  The caller shall not lock the
+ * image.
+ *
+ * @param gens    Shared array of generations of the camera server.
+ *
+ * @param img     Output image of the camera server.
+ *
+ * @param serial  Expected serial number of the image, typically obtained by
+ *                calling tao_remote_camera_wait_output().
+ *
+ * @param gen     Address to store the generation of the image.  If the image
+ *                is not available, `gen->value` is set to 0 if the image is
+ *                too new or is being overwritten and to -1 if it has been
+ *                overwritten.
+ *
+ * @return The address of the pixels; `NULL` if the image is not available.
+ */
+static inline const void* tao_shared_image_peek(
+    const tao_shared_array* gens,
+    const tao_shared_array* img,
+    tao_serial              serial,
+    tao_image_generation*   gen)
+{
+    gen->index = _tao_image_generations_find(gens, img);
+    gen->value = 0;
+    if (gen->index < 0) {
+        return NULL;
+    }
+    int64_t* entry = _tao_image_generations_entry(gens, gen->index);
+    int64_t value = __atomic_load_n(&entry[1], __ATOMIC_ACQUIRE);
+    if ((value & 1) != 0) {
+        return NULL;
+    }
+    tao_serial actual = tao_shared_array_get_serial(img);
+    if (actual != serial) {
+        gen->value = (actual > serial ? -1 : 0);
+        return NULL;
+    }
+    gen->value = value;
+    return tao_shared_array_get_data(img);
+}
+
+/**
+ * Check whether an output image read without locks is still valid.
+ *
+ * This function checks that an output image accessed by
+ * tao_shared_image_peek() has not been overwritten by the server.  It must
+ * be called after all reads of the image.
+ *
+ * @param gens    Shared array of generations of the camera server.
+ *
+ * @param gen     Generation of the image set by tao_shared_image_peek().
+ *
+ * @return Whether the image has not been overwritten.
+ */
+static inline bool tao_shared_image_validate(
+    const tao_shared_array*     gens,
+    const tao_image_generation* gen)
+{
+    if (gen->index < 0 || gen->value <= 0) {
+        return false;
+    }
+    int64_t* entry = _tao_image_generations_entry(gens, gen->index);
+    atomic_thread_fence(memory_order_acquire);
+    return __atomic_load_n(&entry[1], __ATOMIC_RELAXED) == gen->value;
+}
+
+/**
+ * Copy an output image without locks.
+ *
+ * @param gens    Shared array of generations of the camera server.
+ *
+ * @param img     Output image of the camera server.
+ *
+ * @param serial  Expected serial number of the image.
+ *
+ * @param dst     Destination with room for all the pixels of the image.
+ *
+ * @return The serial number of the image on success, `0` if the image is too
+ *         new or is being overwritten, `-1` if it has been overwritten.
+ */
+static inline tao_serial tao_shared_image_fetch(
+    const tao_shared_array* gens,
+    const tao_shared_array* img,
+    tao_serial              serial,
+    void*                   dst)
+{
+    tao_image_generation gen;
+    const void* src = tao_shared_image_peek(gens, img, serial, &gen);
+    if (src == NULL) {
+        return gen.value;
+    }
+    memcpy(dst, src, tao_shared_array_get_length(img)*
+           tao_size_of_eltype(tao_shared_array_get_eltype(img)));
+    return tao_shared_image_validate(gens, &gen) ? serial : -1;
+}
+
+#ifndef TAO_DOXYGEN_
+// Shared array of generations, camera server and pixel processor used by the
+// camera server.
+static tao_shared_array*     _tao_image_generations_instance = NULL;
+static tao_camera_server*    _tao_image_generations_server = NULL;
+static tao_pixels_processor* _tao_image_generations_processor = NULL;
+
+static void _tao_image_generations_writing_processor(
+    const tao_pixels_processor_context* ctx)
+{
+    tao_shared_array* gens = _tao_image_generations_instance;
+    tao_camera_server* srv = _tao_image_generations_server;
+    tao_shared_array* img = srv->locked;
+    long k = -1;
+    if (img != NULL) {
+        long nbufs = TAO_MIN(srv->nbufs, tao_shared_array_get_dim(gens, 2));
+        for (long i = 0; i < nbufs; ++i) {
+            if (srv->images[i] == img) {
+                k = i;
+                break;
+            }
+        }
+    }
+    if (k < 0) {
+        _tao_image_generations_processor(ctx);
+        return;
+    }
+    // The generation may already be odd if it has been invalidated.
+    int64_t* entry = _tao_image_generations_entry(gens, k);
+    int64_t value = __atomic_load_n(&entry[1], __ATOMIC_RELAXED) | 1;
+    __atomic_store_n(&entry[1], value, __ATOMIC_RELAXED);
+    atomic_thread_fence(memory_order_release);
+    __atomic_store_n(&entry[0], (int64_t)tao_shared_array_get_shmid(img),
+                     __ATOMIC_RELAXED);
+    tao_shared_array_set_serial(img, 0);
+    _tao_image_generations_processor(ctx);
+    __atomic_store_n(&entry[1], value + 1, __ATOMIC_RELEASE);
+}
+
+// Make the generations of all images odd, so that readers do not accept any
+// image until it has been written again by the processor above.
+static inline void _tao_image_generations_invalidate(
+    tao_shared_array* gens)
+{
+    long nbufs = tao_shared_array_get_dim(gens, 2);
+    for (long k = 0; k < nbufs; ++k) {
+        int64_t* entry = _tao_image_generations_entry(gens, k);
+        int64_t value = __atomic_load_n(&entry[1], __ATOMIC_RELAXED);
+        __atomic_store_n(&entry[1], value | 1, __ATOMIC_RELEASE);
+    }
+}
+
+static tao_status _tao_image_generations_stage(
+    tao_camera_server* srv)
+{
+    for (long k = 0; k < _tao_processor_chain.nstages; ++k) {
+        if (_tao_processor_chain.stages[k].rank == TAO_PROCESSOR_RANK_COPY) {
+            // Images may be written before their generation is updated.
+            _tao_image_generations_invalidate(
+                _tao_image_generations_instance);
+            tao_store_error(__func__, TAO_UNSUPPORTED);
+            return TAO_ERROR;
+        }
+    }
+    _tao_image_generations_processor = srv->proc.processor;
+    srv->proc.processor = _tao_image_generations_writing_processor;
+    return TAO_OK;
+}
+#endif // TAO_DOXYGEN_
+
+/**
+ * Attach a shared array of generations to a camera server.
+ *
+ * This function adds a stage of rank @ref TAO_PROCESSOR_RANK_PUBLICATION to
+ * the chain of pixel processors of the camera server (see @ref
+ * ProcessorChains).  The pixel processor of this stage updates the
+ * generation of the output image around the call to the pixel processor
+ * beneath it, so that clients can read the output images without locks.
+ * Being of higher rank than the stages changing the output images, the
+ * generation is incremented before any change of the output image.  The
+ * stage is installed again whenever the library resets the pixel processor
+ * of the server, e.g. after the camera has been configured, unless
+ * zero-copy publication is enabled in which case an error is reported by the
+ * worker and the generations are invalidated.  When the generations are
+ * detached, they are invalidated too.  There is a single attached shared
+ * array of generations per process.  The camera must not be acquiring.
+ *
+ * @param srv     Camera server.
+ *
+ * @param gens    Shared array of generations created by
+ *                tao_image_generations_create(), `NULL` to detach the
+ *                shared array of generations.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure.
+ */
+static inline tao_status tao_camera_server_attach_image_generations(
+    tao_camera_server* srv,
+    tao_shared_array*  gens)
+{
+    if (gens == NULL) {
+        if (tao_camera_server_remove_processor_stage(
+                srv, _tao_image_generations_stage) != TAO_OK) {
+            return TAO_ERROR;
+        }
+        if (_tao_image_generations_instance != NULL) {
+            _tao_image_generations_invalidate(
+                _tao_image_generations_instance);
+        }
+        _tao_image_generations_instance = NULL;
+        _tao_image_generations_server = NULL;
+        return TAO_OK;
+    }
+    if (tao_shared_array_get_dim(gens, 2) < srv->nbufs) {
+        tao_store_error(__func__, TAO_BAD_BUFFERS);
+        return TAO_ERROR;
+    }
+    // The generations shall not be changed while the worker may be using
+    // them.
+    tao_camera* cam = srv->device;
+    if (tao_camera_lock(cam) != TAO_OK) {
+        return TAO_ERROR;
+    }
+    tao_status status = TAO_OK;
+    if (cam->runlevel == 2) {
+        tao_store_error(__func__, TAO_ACQUISITION_RUNNING);
+        status = TAO_ERROR;
+    } else {
+        tao_shared_array* prev = _tao_image_generations_instance;
+        if (prev != NULL && prev != gens) {
+            _tao_image_generations_invalidate(prev);
+        }
+        _tao_image_generations_instance = gens;
+        _tao_image_generations_server = srv;
+    }
+    if (tao_camera_unlock(cam) != TAO_OK) {
+        status = TAO_ERROR;
+    }
+    if (status != TAO_OK) {
+        return TAO_ERROR;
+    }
+    return tao_camera_server_add_processor_stage(
+        srv, _tao_image_generations_stage, TAO_PROCESSOR_RANK_PUBLICATION,
+        false);
+}
+
+/**
+ * @}
+ */
+
+TAO_END_DECLS
+
+#endif // TAO_IMAGE_GENERATIONS_H_
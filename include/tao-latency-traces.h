@@ -0,0 +1,732 @@
+// tao-latency-traces.h -
+//
+// Tracing of the latency of the stages of camera servers in TAO library.
+//
+//-----------------------------------------------------------------------------
+//
+// This file if part of TAO real-time software licensed under the MIT license
+// (https://git-cral.univ-lyon1.fr/tao/tao-rt).
+//
+// Copyright (C) 2022, Éric Thiébaut.
+
+#ifndef TAO_LATENCY_TRACES_H_
+#define TAO_LATENCY_TRACES_H_ 1
+
+#include <math.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <tao-basics.h>
+#include <tao-camera-servers.h>
+#include <tao-cameras-private.h>
+#include <tao-config.h>
+#include <tao-encodings.h>
+#include <tao-errors.h>
+#include <tao-options.h>
+#include <tao-processor-chains.h>
+#include <tao-shared-arrays.h>
+#include <tao-utils.h>
+
+TAO_BEGIN_DECLS
+
+/**
+ * @defgroup LatencyTraces  Latency traces
+ *
+ * @ingroup Cameras
+ *
+ * @brief Per-frame times of the stages of camera servers in shared memory.
+ *
+ * @{
+ *
+ * The time-stamps of an output image (see @ref TAO_SHARED_ARRAY_TIMESTAMPS)
+ * only tell about the last image stored in a given shared array.  A latency
+ * trace collects, for each frame processed by a camera server, the times of
+ * the following events (all given by tao_get_monotonic_time()):
+ *
+ * | Field | Event                                                    |
+ * |:-----:|:---------------------------------------------------------|
+ * | 0     | Serial number of the image.                              |
+ * | 1     | Frame start (first time-stamp of the image).             |
+ * | 2     | Frame end (second time-stamp of the image).              |
+ * | 3     | Buffer ready (third time-stamp of the image).            |
+ * | 4     | Start of the processing of the image by the server.      |
+ * | 5     | End of the processing of the image by the server.        |
+ * | 6     | Image sent (fourth time-stamp of the image).             |
+ *
+ * The records are stored, with times in nanoseconds, in a cyclic list in
+ * shared memory (a shared array of @ref TAO_LATENCY_TRACE_FIELDS ×
+ * `capacity` 64-bit integers whose shared memory identifier is written in the
+ * configuration of the server with suffix `-latency`).  Unknown times are
+ * set to 0.  In addition, the durations of the stages listed in @ref
+ * tao_latency_stage are accumulated in histograms (a shared array of @ref
+ * TAO_LATENCY_TRACE_BINS × @ref TAO_LATENCY_TRACE_STAGES 64-bit integers whose
+ * shared memory identifier is written with suffix `-latency-histograms`).
+ * The bins are logarithmically spaced, with @ref
+ * TAO_LATENCY_TRACE_BINS_PER_DECADE bins per decade from @ref
+ * TAO_LATENCY_TRACE_MIN_SECONDS, the first and last bins collecting
+ * durations out of range.
+ *
+ * Since the server sets the time-stamps of an image after having processed
+ * it, the record of an image is written when the next image is processed.
+ * Records are identified by the serial number of the published image, not by
+ * the output image, so that a frame is recorded even though the worker
+ * processes the next frame into the same output image, and never twice.
+ * Records and histograms are written without locks and never block the
+ * worker of the server: a record is invalidated (its serial number is set to
+ * 0) before being written and readers shall check that its serial number has
+ * not changed after having copied it, as done by tao_latency_trace_collect().
+ *
+ * The function tao_latency_trace_main() implements the `tao_latency_trace`
+ * program which prints percentiles of the durations of the stages every
+ * given number of seconds.
+ *
+ * This header defines static functions, it must be included by a single
+ * compilation unit.
+ */
+
+/**
+ * Number of fields of a record of a latency trace.
+ */
+#define TAO_LATENCY_TRACE_FIELDS 7
+
+/**
+ * Number of stages of a latency trace.
+ */
+#define TAO_LATENCY_TRACE_STAGES 6
+
+/**
+ * Number of bins per decade of the histograms of a latency trace.
+ */
+#define TAO_LATENCY_TRACE_BINS_PER_DECADE 10
+
+/**
+ * Lower bound of the durations (in seconds) in the histograms of a latency
+ * trace.
+ */
+#define TAO_LATENCY_TRACE_MIN_SECONDS 1e-7
+
+/**
+ * Number of bins of the histograms of a latency trace, covering 8 decades
+ * plus the bins for the durations out of range.
+ */
+#define TAO_LATENCY_TRACE_BINS (8*TAO_LATENCY_TRACE_BINS_PER_DECADE + 2)
+
+/**
+ * Stages of a latency trace.
+ */
+typedef enum tao_latency_stage {
+    TAO_LATENCY_EXPOSURE    = 0,///< From frame start to frame end.
+    TAO_LATENCY_READOUT     = 1,///< From frame end to buffer ready.
+    TAO_LATENCY_DISPATCH    = 2,///< From buffer ready to processing start.
+    TAO_LATENCY_PROCESSING  = 3,///< From processing start to processing end.
+    TAO_LATENCY_PUBLICATION = 4,///< From processing end to image sent.
+    TAO_LATENCY_TOTAL       = 5,///< From frame end to image sent.
+} tao_latency_stage;
+
+/**
+ * Names of the stages of a latency trace.
+ */
+static const char* const tao_latency_stage_names[
+    TAO_LATENCY_TRACE_STAGES] = {
+    "exposure", "readout", "dispatch", "processing", "publication", "total"
+};
+
+/**
+ * Latency trace of a camera server.
+ */
+typedef struct tao_latency_trace {
+    tao_shared_array*  ring;///< Cyclic list of records.
+    tao_shared_array* hists;///< Histograms of the durations of the stages.
+    long           capacity;///< Number of records in the cyclic list.
+    long               next;///< Index of next record.
+    tao_shared_array*  prev;///< Output image of previous frame, `NULL` if
+                            ///  none.
+    tao_serial         last;///< Serial number of last record.
+    int64_t      proc_start;///< Processing start of previous frame (in ns).
+    int64_t        proc_end;///< Processing end of previous frame (in ns).
+} tao_latency_trace;
+
+#ifndef TAO_DOXYGEN_
+// Fields of records at the start and at the end of the stages.
+static const int _tao_latency_stage_fields[TAO_LATENCY_TRACE_STAGES][2] = {
+    {1, 2}, {2, 3}, {3, 4}, {4, 5}, {5, 6}, {2, 6}
+};
+
+// Convert a time into nanoseconds, 0 if unknown.
+static inline int64_t _tao_latency_trace_nanoseconds(
+    const tao_time* t)
+{
+    return (int64_t)t->sec*1000000000 + (int64_t)t->nsec;
+}
+
+// Get the current monotonic time in nanoseconds.
+static inline int64_t _tao_latency_trace_now(
+    void)
+{
+    tao_time t;
+    if (tao_get_monotonic_time(&t) != TAO_OK) {
+        return 0;
+    }
+    return _tao_latency_trace_nanoseconds(&t);
+}
+
+// Get the index of the histogram bin of a duration in nanoseconds.
+static inline long _tao_latency_trace_bin(
+    int64_t ns)
+{
+    double r = 1e-9*ns/TAO_LATENCY_TRACE_MIN_SECONDS;
+    if (!(r >= 1)) {
+        return 0;
+    }
+    double b = 1 + floor(TAO_LATENCY_TRACE_BINS_PER_DECADE*log10(r));
+    return (b < TAO_LATENCY_TRACE_BINS - 1 ? (long)b :
+            TAO_LATENCY_TRACE_BINS - 1);
+}
+
+// Write the record of the previous frame and update the histograms.
+static void _tao_latency_trace_record(
+    tao_latency_trace* trace)
+{
+    int64_t rec[TAO_LATENCY_TRACE_FIELDS];
+    tao_time ts;
+    rec[0] = tao_shared_array_get_serial(trace->prev);
+    for (int i = 0; i < 3; ++i) {
+        tao_shared_array_get_timestamp(trace->prev, i, &ts);
+        rec[i+1] = _tao_latency_trace_nanoseconds(&ts);
+    }
+    rec[4] = trace->proc_start;
+    rec[5] = trace->proc_end;
+    tao_shared_array_get_timestamp(trace->prev, 3, &ts);
+    rec[6] = _tao_latency_trace_nanoseconds(&ts);
+    if (rec[0] <= 0 || rec[0] == trace->last) {
+        // Image not published or already recorded.
+        return;
+    }
+    trace->last = rec[0];
+    int64_t* dst = (int64_t*)tao_shared_array_get_data(trace->ring) +
+        trace->next*TAO_LATENCY_TRACE_FIELDS;
+    __atomic_store_n(&dst[0], 0, __ATOMIC_RELAXED);
+    atomic_thread_fence(memory_order_release);
+    for (int i = 1; i < TAO_LATENCY_TRACE_FIELDS; ++i) {
+        __atomic_store_n(&dst[i], rec[i], __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&dst[0], rec[0], __ATOMIC_RELEASE);
+    trace->next = (trace->next + 1)%trace->capacity;
+    int64_t* hist = (int64_t*)tao_shared_array_get_data(trace->hists);
+    for (int s = 0; s < TAO_LATENCY_TRACE_STAGES; ++s) {
+        int64_t t0 = rec[_tao_latency_stage_fields[s][0]];
+        int64_t t1 = rec[_tao_latency_stage_fields[s][1]];
+        if (t0 > 0 && t1 >= t0) {
+            __atomic_fetch_add(&hist[s*TAO_LATENCY_TRACE_BINS +
+                                     _tao_latency_trace_bin(t1 - t0)],
+                               1, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// Build the name of a shared array of a latency trace in the configuration.
+static inline tao_status _tao_latency_trace_name(
+    char*       name,
+    const char* owner,
+    const char* suffix)
+{
+    if (owner == NULL || owner[0] == '\0' ||
+        strlen(owner) >= TAO_OWNER_SIZE) {
+        tao_store_error(__func__, TAO_BAD_NAME);
+        return TAO_ERROR;
+    }
+    sprintf(name, "%s%s", owner, suffix);
+    return TAO_OK;
+}
+#endif // TAO_DOXYGEN_
+
+/**
+ * Destroy a latency trace.
+ *
+ * The latency trace must have been detached from the camera server.
+ *
+ * @param trace   Latency trace to destroy (can be `NULL`).
+ */
+static inline void tao_latency_trace_destroy(
+    tao_latency_trace* trace)
+{
+    if (trace != NULL) {
+        if (trace->ring != NULL) {
+            tao_shared_array_detach(trace->ring);
+        }
+        if (trace->hists != NULL) {
+            tao_shared_array_detach(trace->hists);
+        }
+        tao_free(trace);
+    }
+}
+
+/**
+ * Create a latency trace.
+ *
+ * @param owner     Name of the camera server.
+ *
+ * @param capacity  Number of records in the cyclic list.
+ *
+ * @param flags     Permissions granted to the group and to the others.
+ *
+ * @return The address of a new latency trace; `NULL` in case of failure.
+ */
+static inline tao_latency_trace* tao_latency_trace_create(
+    const char* owner,
+    long        capacity,
+    unsigned    flags)
+{
+    char name[TAO_OWNER_SIZE + 32];
+    if (_tao_latency_trace_name(name, owner, "-latency") != TAO_OK) {
+        return NULL;
+    }
+    if (capacity < 1) {
+        tao_store_error(__func__, TAO_BAD_SIZE);
+        return NULL;
+    }
+    tao_latency_trace* trace = (tao_latency_trace*)tao_calloc(
+        1, sizeof(tao_latency_trace));
+    if (trace == NULL) {
+        return NULL;
+    }
+    trace->capacity = capacity;
+    trace->ring = tao_shared_array_create_2d(
+        TAO_INT64, TAO_LATENCY_TRACE_FIELDS, capacity, flags);
+    trace->hists = tao_shared_array_create_2d(
+        TAO_INT64, TAO_LATENCY_TRACE_BINS, TAO_LATENCY_TRACE_STAGES, flags);
+    if (trace->ring == NULL || trace->hists == NULL) {
+        goto error;
+    }
+    memset(tao_shared_array_get_data(trace->ring), 0,
+           TAO_LATENCY_TRACE_FIELDS*capacity*sizeof(int64_t));
+    memset(tao_shared_array_get_data(trace->hists), 0,
+           TAO_LATENCY_TRACE_BINS*TAO_LATENCY_TRACE_STAGES*sizeof(int64_t));
+    if (tao_config_write_long(
+            name, tao_shared_array_get_shmid(trace->ring)) != TAO_OK) {
+        goto error;
+    }
+    _tao_latency_trace_name(name, owner, "-latency-histograms");
+    if (tao_config_write_long(
+            name, tao_shared_array_get_shmid(trace->hists)) != TAO_OK) {
+        goto error;
+    }
+    return trace;
+
+error:
+    tao_latency_trace_destroy(trace);
+    return NULL;
+}
+
+/**
+ * Attach the shared arrays of the latency trace of a camera server.
+ *
+ * @param owner   Name of the camera server.
+ *
+ * @param ring    Address to store the cyclic list of records.
+ *
+ * @param hists   Address to store the histograms.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure.  The
+ *         shared arrays shall be detached by the caller with
+ *         tao_shared_array_detach().
+ */
+static inline tao_status tao_latency_trace_attach(
+    const char*        owner,
+    tao_shared_array** ring,
+    tao_shared_array** hists)
+{
+    char name[TAO_OWNER_SIZE + 32];
+    long shmid;
+    *ring = NULL;
+    *hists = NULL;
+    if (_tao_latency_trace_name(name, owner, "-latency") != TAO_OK ||
+        tao_config_read_long(name, &shmid) != TAO_OK ||
+        (*ring = tao_shared_array_attach(shmid)) == NULL) {
+        return TAO_ERROR;
+    }
+    _tao_latency_trace_name(name, owner, "-latency-histograms");
+    if (tao_config_read_long(name, &shmid) != TAO_OK ||
+        (*hists = tao_shared_array_attach(shmid)) == NULL) {
+        goto error;
+    }
+    if (tao_shared_array_get_eltype(*ring) != TAO_INT64 ||
+        tao_shared_array_get_dim(*ring, 1) != TAO_LATENCY_TRACE_FIELDS ||
+        tao_shared_array_get_eltype(*hists) != TAO_INT64 ||
+        tao_shared_array_get_dim(*hists, 1) != TAO_LATENCY_TRACE_BINS ||
+        tao_shared_array_get_dim(*hists, 2) != TAO_LATENCY_TRACE_STAGES) {
+        tao_store_error(__func__, TAO_BAD_TYPE);
+        goto error;
+    }
+    return TAO_OK;
+
+error:
+    if (*ring != NULL) {
+        tao_shared_array_detach(*ring);
+        *ring = NULL;
+    }
+    if (*hists != NULL) {
+        tao_shared_array_detach(*hists);
+        *hists = NULL;
+    }
+    return TAO_ERROR;
+}
+
+/**
+ * Collect the valid records of a latency trace.
+ *
+ * Records being written by the server are skipped.
+ *
+ * @param ring    Cyclic list of records.
+ *
+ * @param dst     Destination with room for all the records of the list, that
+ *                is @ref TAO_LATENCY_TRACE_FIELDS times the capacity of the
+ *                list.
+ *
+ * @param since   Only records with a serial number greater than this are
+ *                collected.
+ *
+ * @return The number of collected records.
+ */
+static inline long tao_latency_trace_collect(
+    const tao_shared_array* ring,
+    int64_t*                dst,
+    tao_serial              since)
+{
+    long capacity = tao_shared_array_get_dim(ring, 2);
+    int64_t* src = (int64_t*)tao_shared_array_get_data(ring);
+    long n = 0;
+    for (long k = 0; k < capacity; ++k) {
+        int64_t* rec = src + k*TAO_LATENCY_TRACE_FIELDS;
+        int64_t* out = dst + n*TAO_LATENCY_TRACE_FIELDS;
+        int64_t serial = __atomic_load_n(&rec[0], __ATOMIC_ACQUIRE);
+        if (serial <= since) {
+            continue;
+        }
+        out[0] = serial;
+        for (int i = 1; i < TAO_LATENCY_TRACE_FIELDS; ++i) {
+            out[i] = __atomic_load_n(&rec[i], __ATOMIC_RELAXED);
+        }
+        atomic_thread_fence(memory_order_acquire);
+        if (__atomic_load_n(&rec[0], __ATOMIC_RELAXED) == serial) {
+            ++n;
+        }
+    }
+    return n;
+}
+
+#ifndef TAO_DOXYGEN_
+static int _tao_latency_trace_compare(
+    const void* a,
+    const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x < y ? -1 : (x > y ? 1 : 0));
+}
+#endif // TAO_DOXYGEN_
+
+/**
+ * Compute percentiles of the duration of a stage from records.
+ *
+ * @param rec     Records collected by tao_latency_trace_collect().
+ *
+ * @param n       Number of records.
+ *
+ * @param stage   Stage.
+ *
+ * @param probs   Probabilities of the percentiles (in the range `[0,1]`).
+ *
+ * @param np      Number of percentiles.
+ *
+ * @param res     Destination for the percentiles (in seconds), set to NaN
+ *                if the duration of the stage is unknown for all records.
+ *
+ * @param work    Workspace of `n` values.
+ *
+ * @return The number of records where the duration of the stage is known.
+ */
+static inline long tao_latency_trace_percentiles(
+    const int64_t*    rec,
+    long              n,
+    tao_latency_stage stage,
+    const double*     probs,
+    long              np,
+    double*           res,
+    double*           work)
+{
+    int f0 = _tao_latency_stage_fields[stage][0];
+    int f1 = _tao_latency_stage_fields[stage][1];
+    long m = 0;
+    for (long k = 0; k < n; ++k) {
+        int64_t t0 = rec[k*TAO_LATENCY_TRACE_FIELDS + f0];
+        int64_t t1 = rec[k*TAO_LATENCY_TRACE_FIELDS + f1];
+        if (t0 > 0 && t1 >= t0) {
+            work[m++] = 1e-9*(t1 - t0);
+        }
+    }
+    qsort(work, m, sizeof(double), _tao_latency_trace_compare);
+    for (long j = 0; j < np; ++j) {
+        res[j] = (m > 0 ? work[lround(probs[j]*(m - 1))] : NAN);
+    }
+    return m;
+}
+
+/**
+ * Compute a percentile of the duration of a stage from the histograms.
+ *
+ * @param hists   Histograms of the latency trace.
+ *
+ * @param stage   Stage.
+ *
+ * @param prob    Probability of the percentile (in the range `[0,1]`).
+ *
+ * @param count   Address to store the number of accumulated durations, not
+ *                used if `NULL`.
+ *
+ * @return The upper bound of the bin of the percentile (in seconds),
+ *         infinite if in the last bin, NaN if no durations have been
+ *         accumulated.
+ */
+static inline double tao_latency_trace_histogram_percentile(
+    const tao_shared_array* hists,
+    tao_latency_stage       stage,
+    double                  prob,
+    int64_t*                count)
+{
+    const int64_t* hist = (const int64_t*)tao_shared_array_get_data(hists) +
+        stage*TAO_LATENCY_TRACE_BINS;
+    int64_t cnt[TAO_LATENCY_TRACE_BINS], total = 0;
+    for (long b = 0; b < TAO_LATENCY_TRACE_BINS; ++b) {
+        cnt[b] = __atomic_load_n(&hist[b], __ATOMIC_RELAXED);
+        total += cnt[b];
+    }
+    if (count != NULL) {
+        *count = total;
+    }
+    if (total <= 0) {
+        return NAN;
+    }
+    int64_t rank = (int64_t)ceil(prob*total), sum = 0;
+    long b = 0;
+    while (b < TAO_LATENCY_TRACE_BINS - 1 && (sum += cnt[b]) < rank) {
+        ++b;
+    }
+    if (b == TAO_LATENCY_TRACE_BINS - 1) {
+        return INFINITY;
+    }
+    return TAO_LATENCY_TRACE_MIN_SECONDS*pow(
+        10.0, (double)b/TAO_LATENCY_TRACE_BINS_PER_DECADE);
+}
+
+#ifndef TAO_DOXYGEN_
+// Latency trace, camera server and pixel processor used by the camera
+// server.
+static tao_latency_trace*    _tao_latency_trace_instance = NULL;
+static tao_camera_server*    _tao_latency_trace_server = NULL;
+static tao_pixels_processor* _tao_latency_trace_processor = NULL;
+
+static void _tao_latency_trace_timing_processor(
+    const tao_pixels_processor_context* ctx)
+{
+    tao_latency_trace* trace = _tao_latency_trace_instance;
+    tao_shared_array* img = _tao_latency_trace_server->locked;
+    int64_t start = _tao_latency_trace_now();
+    if (trace->prev != NULL) {
+        _tao_latency_trace_record(trace);
+    }
+    _tao_latency_trace_processor(ctx);
+    trace->prev = img;
+    trace->proc_start = start;
+    trace->proc_end = _tao_latency_trace_now();
+}
+
+static tao_status _tao_latency_trace_stage(
+    tao_camera_server* srv)
+{
+    _tao_latency_trace_processor = srv->proc.processor;
+    srv->proc.processor = _tao_latency_trace_timing_processor;
+    return TAO_OK;
+}
+#endif // TAO_DOXYGEN_
+
+/**
+ * Attach a latency trace to a camera server.
+ *
+ * This function adds a stage of rank @ref TAO_PROCESSOR_RANK_TIMING to the
+ * chain of pixel processors of the camera server (see @ref ProcessorChains).
+ * The pixel processor of this stage measures the processing time of each
+ * image and records the times of the previous image.  Being of highest rank,
+ * the processing time includes all the other stages whatever the order in
+ * which they have been attached, and images published without copy are
+ * recorded as well.  The stage is installed again whenever the library
+ * resets the pixel processor of the server, e.g. after the camera has been
+ * configured.  There is a single attached latency trace per process.  The
+ * camera must not be acquiring.
+ *
+ * @param srv     Camera server.
+ *
+ * @param trace   Latency trace, `NULL` to detach the latency trace.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure.
+ */
+static inline tao_status tao_camera_server_attach_latency_trace(
+    tao_camera_server* srv,
+    tao_latency_trace* trace)
+{
+    if (trace == NULL) {
+        if (tao_camera_server_remove_processor_stage(
+                srv, _tao_latency_trace_stage) != TAO_OK) {
+            return TAO_ERROR;
+        }
+        _tao_latency_trace_instance = NULL;
+        _tao_latency_trace_server = NULL;
+        return TAO_OK;
+    }
+    // The trace shall not be changed while the worker may be using it.
+    tao_camera* cam = srv->device;
+    if (tao_camera_lock(cam) != TAO_OK) {
+        return TAO_ERROR;
+    }
+    tao_status status = TAO_OK;
+    if (cam->runlevel == 2) {
+        tao_store_error(__func__, TAO_ACQUISITION_RUNNING);
+        status = TAO_ERROR;
+    } else {
+        trace->prev = NULL;
+        trace->last = 0;
+        _tao_latency_trace_instance = trace;
+        _tao_latency_trace_server = srv;
+    }
+    if (tao_camera_unlock(cam) != TAO_OK) {
+        status = TAO_ERROR;
+    }
+    if (status != TAO_OK) {
+        return TAO_ERROR;
+    }
+    return tao_camera_server_add_processor_stage(
+        srv, _tao_latency_trace_stage, TAO_PROCESSOR_RANK_TIMING, false);
+}
+
+/**
+ * Main function of the `tao_latency_trace` program.
+ *
+ * The program attaches the latency trace of the camera server named after
+ * its single argument and prints, every `-interval` seconds, the number of
+ * samples and the 50th, 90th, 99th and 99.9th percentiles and the maximum of
+ * the duration of each stage for the records collected since the previous
+ * report.  With option `-histograms`, the percentiles are computed from the
+ * histograms accumulated since the server was started.  Option `-count`
+ * specifies the number of reports (0 for no limit).
+ *
+ * @param argc    Number of arguments.
+ *
+ * @param argv    List of arguments.
+ *
+ * @return The exit status of the program.
+ */
+static inline int tao_latency_trace_main(
+    int   argc,
+    char* argv[])
+{
+    double interval = 1.0;
+    long count = 0;
+    bool histograms = false;
+    tao_help_info info = {
+        .program = argv[0],
+        .args = "NAME",
+        .purpose = "Print percentiles of the latency of a camera server.",
+        .output = stdout,
+    };
+    tao_option options[] = {
+        TAO_OPTION_POSITIVE_DOUBLE(0, "interval", "SECONDS",
+                                   "Time between reports", &interval),
+        TAO_OPTION_NONNEGATIVE_LONG(0, "count", "NUMBER",
+                                    "Number of reports (0 for no limit)",
+                                    &count),
+        TAO_OPTION_SWITCH(0, "histograms",
+                          "Use histograms since start of server",
+                          &histograms),
+        TAO_OPTION_HELP_AND_EXIT(0, 0),
+        TAO_OPTION_LAST_ENTRY,
+    };
+    info.options = options;
+    options[3].ptr = &info;
+    argc = tao_parse_options(NULL, argc, argv, 0, options);
+    if (argc != 2) {
+        if (argc >= 0) {
+            fprintf(stderr, "%s: %s server name\n", argv[0],
+                    (argc < 2 ? "missing" : "too many arguments after"));
+        }
+        return EXIT_FAILURE;
+    }
+    tao_shared_array* ring = NULL;
+    tao_shared_array* hists = NULL;
+    if (tao_latency_trace_attach(argv[1], &ring, &hists) != TAO_OK) {
+        tao_report_error();
+        return EXIT_FAILURE;
+    }
+    long capacity = tao_shared_array_get_dim(ring, 2);
+    int64_t* rec = (int64_t*)tao_malloc(
+        capacity*TAO_LATENCY_TRACE_FIELDS*sizeof(int64_t));
+    double* work = (double*)tao_malloc(capacity*sizeof(double));
+    int code = EXIT_SUCCESS;
+    if (rec == NULL || work == NULL) {
+        tao_report_error();
+        code = EXIT_FAILURE;
+        goto done;
+    }
+    const double probs[] = {0.5, 0.9, 0.99, 0.999, 1.0};
+    const long np = sizeof(probs)/sizeof(probs[0]);
+    tao_serial since = 0;
+    for (long r = 0; count == 0 || r < count; ++r) {
+        tao_sleep(interval);
+        long n = 0;
+        if (!histograms) {
+            n = tao_latency_trace_collect(ring, rec, since);
+            for (long k = 0; k < n; ++k) {
+                since = TAO_MAX(since, rec[k*TAO_LATENCY_TRACE_FIELDS]);
+            }
+        }
+        fprintf(stdout, "%-12s %10s %10s %10s %10s %10s %10s\n",
+                "stage (µs)", "samples", "p50", "p90", "p99", "p99.9",
+                (histograms ? "p100" : "max"));
+        for (int s = 0; s < TAO_LATENCY_TRACE_STAGES; ++s) {
+            double res[5];
+            int64_t m;
+            if (histograms) {
+                for (long j = 0; j < np; ++j) {
+                    res[j] = tao_latency_trace_histogram_percentile(
+                        hists, s, probs[j], &m);
+                }
+            } else {
+                m = tao_latency_trace_percentiles(
+                    rec, n, s, probs, np, res, work);
+            }
+            fprintf(stdout, "%-12s %10ld", tao_latency_stage_names[s],
+                    (long)m);
+            for (long j = 0; j < np; ++j) {
+                fprintf(stdout, " %10.1f", 1e6*res[j]);
+            }
+            fputc('\n', stdout);
+        }
+        fputc('\n', stdout);
+        fflush(stdout);
+    }
+
+done:
+    tao_free(rec);
+    tao_free(work);
+    tao_shared_array_detach(ring);
+    tao_shared_array_detach(hists);
+    return code;
+}
+
+/**
+ * @}
+ */
+
+TAO_END_DECLS
+
+#endif // TAO_LATENCY_TRACES_H_
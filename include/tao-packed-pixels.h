@@ -0,0 +1,456 @@
+// tao-packed-pixels.h -
+//
+// Conversion and pre-processing of packed 10-bit and 14-bit pixels in TAO
+// library.
+//
+//-----------------------------------------------------------------------------
+//
+// This file if part of TAO real-time software licensed under the MIT license
+// (https://git-cral.univ-lyon1.fr/tao/tao-rt).
+//
+// Copyright (C) 2022, Éric Thiébaut.
+
+#ifndef TAO_PACKED_PIXELS_H_
+#define TAO_PACKED_PIXELS_H_ 1
+
+#include <stdint.h>
+#include <string.h>
+
+#include <tao-basics.h>
+#include <tao-camera-servers.h>
+#include <tao-cameras-private.h>
+#include <tao-encodings.h>
+#include <tao-macros.h>
+#include <tao-processor-chains.h>
+
+TAO_BEGIN_DECLS
+
+/**
+ * @defgroup PackedPixels  Packed 10-bit and 14-bit pixels
+ *
+ * @ingroup Cameras
+ *
+ * @brief Conversion and pre-processing of packed 10-bit and 14-bit pixels.
+ *
+ * @{
+ *
+ * Cameras streaming raw images with encodings @ref
+ * TAO_ENCODING_GENICAM_MONO10P (`p10`) or @ref TAO_ENCODING_GENICAM_MONO14P
+ * (`p14`) pack 4 pixels into 5 or 7 bytes to save bandwidth on the link.  The
+ * functions in this header follow the conventions of the `p12` functions in
+ * @ref tao-pixels.h: they unpack, convert, and optionally pre-process the raw
+ * pixels for all output types.
+ *
+ * Each row of raw pixels is processed by chunks of @ref TAO_PACKED_CHUNK
+ * pixels which are first unpacked into a small buffer and then converted or
+ * pre-processed by vectorized loops.  Unpacking is done by shuffling the
+ * bytes of 32-byte vectors so that each pixel lands in its own 16-bit (`p10`)
+ * or 32-bit (`p14`) lane, then shifting each lane by a constant and masking.
+ * All functions are compiled for several instruction sets with the best one
+ * selected at run-time (see @ref TAO_SIMD_CLONES).
+ *
+ * Function tao_pixels_packed_processor() is a pixel processor for camera
+ * servers whose acquisition buffers have one of these encodings, it is
+ * installed by tao_camera_server_enable_packed_pixels().
+ */
+
+/**
+ * @def TAO_PACKED_CHUNK
+ *
+ * Number of pixels unpacked at a time, must be a multiple of 16.
+ */
+#ifndef TAO_PACKED_CHUNK
+#  define TAO_PACKED_CHUNK 256
+#endif
+
+#ifndef TAO_DOXYGEN_
+
+#if (defined(__clang__) || (defined(__GNUC__) && (__GNUC__ >= 12))) && \
+    defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#  define _TAO_PACKED_SHUFFLE 1
+typedef uint8_t  _tao_packed_u8x32  __attribute__((vector_size(32)));
+typedef uint16_t _tao_packed_u16x16 __attribute__((vector_size(32)));
+typedef uint16_t _tao_packed_u16x8  __attribute__((vector_size(16)));
+typedef uint32_t _tao_packed_u32x8  __attribute__((vector_size(32)));
+#endif
+
+// Extract the i-th pixel of `bits` bits from a packed buffer of `nbytes`
+// bytes.
+static TAO_ALWAYS_INLINE uint16_t _tao_packed_get(
+    const uint8_t* restrict src,
+    long                    i,
+    int                     bits,
+    long                    nbytes)
+{
+    long p = i*bits;
+    long k = p >> 3;
+    uint32_t w = src[k];
+    if (k + 1 < nbytes) {
+        w |= (uint32_t)src[k+1] << 8;
+    }
+    if (k + 2 < nbytes) {
+        w |= (uint32_t)src[k+2] << 16;
+    }
+    return (w >> (p & 7)) & ((1u << bits) - 1u);
+}
+
+// Unpack `n` 10-bit pixels, `src` has at least `avail` readable bytes.
+static TAO_ALWAYS_INLINE void _tao_unpack_p10(
+    uint16_t*      restrict dst,
+    const uint8_t* restrict src,
+    long                    n,
+    long                    avail)
+{
+    long i = 0;
+#ifdef _TAO_PACKED_SHUFFLE
+    const _tao_packed_u16x16 shift = {0,2,4,6, 0,2,4,6, 0,2,4,6, 0,2,4,6};
+    for (; i + 16 <= n && (i/4)*5 + 32 <= avail; i += 16) {
+        _tao_packed_u8x32 v;
+        memcpy(&v, src + (i/4)*5, sizeof(v));
+        _tao_packed_u8x32 s = __builtin_shufflevector(
+            v, v,
+             0,  1,  1,  2,  2,  3,  3,  4,  5,  6,  6,  7,  7,  8,  8,  9,
+            10, 11, 11, 12, 12, 13, 13, 14, 15, 16, 16, 17, 17, 18, 18, 19);
+        _tao_packed_u16x16 w = ((_tao_packed_u16x16)s >> shift) & 0x3ff;
+        memcpy(dst + i, &w, sizeof(w));
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i] = _tao_packed_get(src, i, 10, avail);
+    }
+}
+
+// Unpack `n` 14-bit pixels, `src` has at least `avail` readable bytes.
+static TAO_ALWAYS_INLINE void _tao_unpack_p14(
+    uint16_t*      restrict dst,
+    const uint8_t* restrict src,
+    long                    n,
+    long                    avail)
+{
+    long i = 0;
+#ifdef _TAO_PACKED_SHUFFLE
+    const _tao_packed_u32x8 shift = {0,6,4,2, 0,6,4,2};
+    for (; i + 8 <= n && (i/4)*7 + 32 <= avail; i += 8) {
+        _tao_packed_u8x32 v;
+        memcpy(&v, src + (i/4)*7, sizeof(v));
+        _tao_packed_u8x32 s = __builtin_shufflevector(
+            v, v,
+             0,  1,  2,  3,  1,  2,  3,  4,  3,  4,  5,  6,  5,  6,  7,  8,
+             7,  8,  9, 10,  8,  9, 10, 11, 10, 11, 12, 13, 12, 13, 14, 15);
+        _tao_packed_u32x8 w = ((_tao_packed_u32x8)s >> shift) & 0x3fff;
+        _tao_packed_u16x8 h = __builtin_convertvector(w, _tao_packed_u16x8);
+        memcpy(dst + i, &h, sizeof(h));
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i] = _tao_packed_get(src, i, 14, avail);
+    }
+}
+
+// Loop over the chunks of unpacked pixels of the image.  In BODY, `buf` is
+// the unpacked chunk, `n` its length, and `i0` the index of its first pixel
+// in the output image.
+#define _TAO_PACKED_LOOP(S, BITS, BODY)                                 \
+    do {                                                                \
+        long rowbytes = (width*BITS + 7)/8;                             \
+        uint16_t buf[TAO_PACKED_CHUNK];                                 \
+        for (long y = 0; y < height; ++y) {                             \
+            const uint8_t* row = raw + y*stride;                        \
+            for (long x0 = 0; x0 < width; x0 += TAO_PACKED_CHUNK) {     \
+                long n = TAO_MIN(width - x0, TAO_PACKED_CHUNK);         \
+                long off = (x0*BITS)/8;                                 \
+                long i0 = y*width + x0;                                 \
+                _tao_unpack_##S(buf, row + off, n, rowbytes - off);     \
+                BODY;                                                   \
+            }                                                           \
+        }                                                               \
+    } while (false)
+
+#define _TAO_PACKED_CONVERT(S, BITS, O, T)                              \
+    static inline TAO_SIMD_CLONES void tao_pixels_convert_##S##_to_##O( \
+        T*              restrict dat,                                   \
+        long                     width,                                 \
+        long                     height,                                \
+        const uint8_t*  restrict raw,                                   \
+        long                     stride)                                \
+    {                                                                   \
+        _TAO_PACKED_LOOP(S, BITS,                                       \
+            for (long x = 0; x < n; ++x) {                              \
+                dat[i0 + x] = (T)buf[x];                                \
+            });                                                         \
+    }
+
+#define _TAO_PACKED_PREPROCESS(S, BITS, O, T)                           \
+    static inline TAO_SIMD_CLONES void                                  \
+    tao_pixels_preprocess_affine_##S##_to_##O(                          \
+        T*              restrict dat,                                   \
+        long                     width,                                 \
+        long                     height,                                \
+        const T*        restrict a,                                     \
+        const T*        restrict b,                                     \
+        const uint8_t*  restrict raw,                                   \
+        long                     stride)                                \
+    {                                                                   \
+        _TAO_PACKED_LOOP(S, BITS,                                       \
+            for (long x = 0; x < n; ++x) {                              \
+                long i = i0 + x;                                        \
+                dat[i] = ((T)buf[x] - b[i])*a[i];                       \
+            });                                                         \
+    }                                                                   \
+                                                                        \
+    static inline TAO_SIMD_CLONES void                                  \
+    tao_pixels_preprocess_full_##S##_to_##O(                            \
+        T*              restrict dat,                                   \
+        T*              restrict wgt,                                   \
+        long                     width,                                 \
+        long                     height,                                \
+        const T*        restrict a,                                     \
+        const T*        restrict b,                                     \
+        const T*        restrict q,                                     \
+        const T*        restrict r,                                     \
+        const uint8_t*  restrict raw,                                   \
+        long                     stride)                                \
+    {                                                                   \
+        _TAO_PACKED_LOOP(S, BITS,                                       \
+            for (long x = 0; x < n; ++x) {                              \
+                long i = i0 + x;                                        \
+                T val = ((T)buf[x] - b[i])*a[i];                        \
+                dat[i] = val;                                           \
+                wgt[i] = q[i]/((val > 0 ? val : 0) + r[i]);             \
+            });                                                         \
+    }
+
+#define _TAO_PACKED_ENCODE(S, BITS)                                     \
+    static inline TAO_SIMD_CLONES void tao_pixels_convert_##S##_to_u16( \
+        uint16_t*       restrict dat,                                   \
+        long                     width,                                 \
+        long                     height,                                \
+        const uint8_t*  restrict raw,                                   \
+        long                     stride)                                \
+    {                                                                   \
+        long rowbytes = (width*BITS + 7)/8;                             \
+        for (long y = 0; y < height; ++y) {                             \
+            _tao_unpack_##S(dat + y*width, raw + y*stride,              \
+                            width, rowbytes);                           \
+        }                                                               \
+    }                                                                   \
+    _TAO_PACKED_CONVERT(S, BITS, u32, uint32_t)                         \
+    _TAO_PACKED_CONVERT(S, BITS, flt, float)                            \
+    _TAO_PACKED_CONVERT(S, BITS, dbl, double)                           \
+    _TAO_PACKED_PREPROCESS(S, BITS, flt, float)                         \
+    _TAO_PACKED_PREPROCESS(S, BITS, dbl, double)
+
+_TAO_PACKED_ENCODE(p10, 10)
+_TAO_PACKED_ENCODE(p14, 14)
+
+#undef _TAO_PACKED_ENCODE
+#undef _TAO_PACKED_PREPROCESS
+#undef _TAO_PACKED_CONVERT
+#undef _TAO_PACKED_LOOP
+#endif // TAO_DOXYGEN_
+
+#ifdef TAO_DOXYGEN_
+/**
+ * @brief Convert raw pixels.
+ *
+ * This function behaves as tao_pixels_convert_p12_to_u16() except that the
+ * input image has packed 10-bit unsigned integer pixels (see @ref
+ * TAO_ENCODING_GENICAM_MONO10P).  Functions tao_pixels_convert_p10_to_u32(),
+ * tao_pixels_convert_p10_to_flt(), and tao_pixels_convert_p10_to_dbl() are
+ * similar for other output types.  Functions `tao_pixels_convert_p14_to_*`
+ * are similar for packed 14-bit pixels (see @ref
+ * TAO_ENCODING_GENICAM_MONO14P).
+ *
+ * @param dat     Output array of pixels.
+ * @param width   Number of pixels per line of the image.
+ * @param height  Number of lines of pixels in the image.
+ * @param raw     Input buffer of raw pixels.
+ * @param stride  Number of bytes between successive lines in input image
+ *                buffer @a raw.
+ */
+extern void tao_pixels_convert_p10_to_u16(
+    uint16_t*       restrict dat,
+    long                     width,
+    long                     height,
+    const uint8_t*  restrict raw,
+    long                     stride);
+
+/**
+ * @brief Apply affine correction to raw pixels.
+ *
+ * This function behaves as tao_pixels_preprocess_affine_p12_to_flt() except
+ * that the input image has packed 10-bit unsigned integer pixels.  Functions
+ * tao_pixels_preprocess_affine_p10_to_dbl(),
+ * tao_pixels_preprocess_affine_p14_to_flt(), and
+ * tao_pixels_preprocess_affine_p14_to_dbl() are similar.
+ */
+extern void tao_pixels_preprocess_affine_p10_to_flt(
+    float*          restrict dat,
+    long                     width,
+    long                     height,
+    const float*    restrict a,
+    const float*    restrict b,
+    const uint8_t*  restrict raw,
+    long                     stride);
+
+/**
+ * @brief Apply affine correction to raw pixels and compute weights.
+ *
+ * This function behaves as tao_pixels_preprocess_full_p12_to_flt() except
+ * that the input image has packed 10-bit unsigned integer pixels.  Functions
+ * tao_pixels_preprocess_full_p10_to_dbl(),
+ * tao_pixels_preprocess_full_p14_to_flt(), and
+ * tao_pixels_preprocess_full_p14_to_dbl() are similar.
+ */
+extern void tao_pixels_preprocess_full_p10_to_flt(
+    float*          restrict dat,
+    float*          restrict wgt,
+    long                     width,
+    long                     height,
+    const float*    restrict a,
+    const float*    restrict b,
+    const float*    restrict q,
+    const float*    restrict r,
+    const uint8_t*  restrict raw,
+    long                     stride);
+#endif // TAO_DOXYGEN_
+
+#ifndef TAO_DOXYGEN_
+#define _TAO_PACKED_DISPATCH(S)                                         \
+    switch (ctx->preprocessing) {                                       \
+    case TAO_PREPROCESSING_NONE:                                        \
+        switch (ctx->eltype) {                                          \
+        case TAO_UINT16:                                                \
+            tao_pixels_convert_##S##_to_u16(                            \
+                ctx->dat, ctx->width, ctx->height, raw, ctx->stride);   \
+            return;                                                     \
+        case TAO_UINT32:                                                \
+            tao_pixels_convert_##S##_to_u32(                            \
+                ctx->dat, ctx->width, ctx->height, raw, ctx->stride);   \
+            return;                                                     \
+        case TAO_FLOAT:                                                 \
+            tao_pixels_convert_##S##_to_flt(                            \
+                ctx->dat, ctx->width, ctx->height, raw, ctx->stride);   \
+            return;                                                     \
+        case TAO_DOUBLE:                                                \
+            tao_pixels_convert_##S##_to_dbl(                            \
+                ctx->dat, ctx->width, ctx->height, raw, ctx->stride);   \
+            return;                                                     \
+        default:                                                        \
+            return;                                                     \
+        }                                                               \
+    case TAO_PREPROCESSING_AFFINE:                                      \
+        if (ctx->eltype == TAO_FLOAT) {                                 \
+            tao_pixels_preprocess_affine_##S##_to_flt(                  \
+                ctx->dat, ctx->width, ctx->height,                      \
+                ctx->preproc[0], ctx->preproc[1], raw, ctx->stride);    \
+        } else if (ctx->eltype == TAO_DOUBLE) {                         \
+            tao_pixels_preprocess_affine_##S##_to_dbl(                  \
+                ctx->dat, ctx->width, ctx->height,                      \
+                ctx->preproc[0], ctx->preproc[1], raw, ctx->stride);    \
+        }                                                               \
+        return;                                                         \
+    case TAO_PREPROCESSING_FULL:                                        \
+        if (ctx->eltype == TAO_FLOAT) {                                 \
+            tao_pixels_preprocess_full_##S##_to_flt(                    \
+                ctx->dat, ctx->wgt, ctx->width, ctx->height,            \
+                ctx->preproc[0], ctx->preproc[1],                       \
+                ctx->preproc[2], ctx->preproc[3], raw, ctx->stride);    \
+        } else if (ctx->eltype == TAO_DOUBLE) {                         \
+            tao_pixels_preprocess_full_##S##_to_dbl(                    \
+                ctx->dat, ctx->wgt, ctx->width, ctx->height,            \
+                ctx->preproc[0], ctx->preproc[1],                       \
+                ctx->preproc[2], ctx->preproc[3], raw, ctx->stride);    \
+        }                                                               \
+        return;                                                         \
+    }
+#endif // TAO_DOXYGEN_
+
+/**
+ * Pixel processor for packed 10-bit and 14-bit raw images.
+ *
+ * This pixel processor applies the pre-processing specified in the context
+ * to raw images encoded as @ref TAO_ENCODING_GENICAM_MONO10P or @ref
+ * TAO_ENCODING_GENICAM_MONO14P.  Nothing is done for other encodings or
+ * unsupported output pixel types.  The library resets the pixel processor
+ * of camera servers when the worker starts and whenever the camera is
+ * configured, so camera servers shall not install this function themselves
+ * but call tao_camera_server_enable_packed_pixels().
+ *
+ * @param ctx     Pixel processing context.
+ */
+static inline void tao_pixels_packed_processor(
+    const tao_pixels_processor_context* ctx)
+{
+    const uint8_t* raw = (const uint8_t*)ctx->raw;
+    if (ctx->bufferencoding == TAO_ENCODING_GENICAM_MONO10P) {
+        _TAO_PACKED_DISPATCH(p10);
+    } else if (ctx->bufferencoding == TAO_ENCODING_GENICAM_MONO14P) {
+        _TAO_PACKED_DISPATCH(p14);
+    }
+}
+
+#ifndef TAO_DOXYGEN_
+#undef _TAO_PACKED_DISPATCH
+
+// Pixel processor replaced by the one for packed pixels.
+static tao_pixels_processor* _tao_packed_pixels_fallback = NULL;
+
+static void _tao_packed_pixels_processor(
+    const tao_pixels_processor_context* ctx)
+{
+    if (ctx->bufferencoding == TAO_ENCODING_GENICAM_MONO10P ||
+        ctx->bufferencoding == TAO_ENCODING_GENICAM_MONO14P) {
+        tao_pixels_packed_processor(ctx);
+    } else {
+        _tao_packed_pixels_fallback(ctx);
+    }
+}
+
+static tao_status _tao_packed_pixels_stage(
+    tao_camera_server* srv)
+{
+    _tao_packed_pixels_fallback = srv->proc.processor;
+    srv->proc.processor = _tao_packed_pixels_processor;
+    return TAO_OK;
+}
+#endif // TAO_DOXYGEN_
+
+/**
+ * Process packed 10-bit and 14-bit raw images in a camera server.
+ *
+ * This function adds (or removes) a stage of rank @ref
+ * TAO_PROCESSOR_RANK_KERNEL to the chain of pixel processors of the camera
+ * server (see @ref ProcessorChains).  The pixel processor of this stage calls
+ * tao_pixels_packed_processor() for raw images encoded as @ref
+ * TAO_ENCODING_GENICAM_MONO10P or @ref TAO_ENCODING_GENICAM_MONO14P and the
+ * pixel processor chosen by the library for other encodings.  The stage is
+ * installed again whenever the library resets the pixel processor of the
+ * server, e.g. after the camera has been configured.  The camera must not be
+ * acquiring.
+ *
+ * @param srv     Camera server.
+ *
+ * @param enable  Whether to process packed raw images.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure.
+ */
+static inline tao_status tao_camera_server_enable_packed_pixels(
+    tao_camera_server* srv,
+    bool               enable)
+{
+    if (!enable) {
+        return tao_camera_server_remove_processor_stage(
+            srv, _tao_packed_pixels_stage);
+    }
+    return tao_camera_server_add_processor_stage(
+        srv, _tao_packed_pixels_stage, TAO_PROCESSOR_RANK_KERNEL, true);
+}
+
+/**
+ * @}
+ */
+
+TAO_END_DECLS
+
+#endif // TAO_PACKED_PIXELS_H_
@@ -0,0 +1,305 @@
+// tao-parallel-preprocessing.h -
+//
+// Multi-threaded pre-processing of images in TAO library.
+//
+//-----------------------------------------------------------------------------
+//
+// This file if part of TAO real-time software licensed under the MIT license
+// (https://git-cral.univ-lyon1.fr/tao/tao-rt).
+//
+// Copyright (C) 2022, Éric Thiébaut.
+
+#ifndef TAO_PARALLEL_PREPROCESSING_H_
+#define TAO_PARALLEL_PREPROCESSING_H_ 1
+
+#include <tao-basics.h>
+#include <tao-camera-servers.h>
+#include <tao-cameras-private.h>
+#include <tao-errors.h>
+#include <tao-processor-chains.h>
+#include <tao-utils.h>
+#include <tao-worker-teams.h>
+
+TAO_BEGIN_DECLS
+
+/**
+ * @defgroup ParallelPreprocessing Parallel pre-processing
+ *
+ * @ingroup Cameras
+ *
+ * @brief Pre-processing of images by several threads.
+ *
+ * @{
+ *
+ * A pixels team splits the processing of an image described by a @ref
+ * tao_pixels_processor_context into bands of consecutive rows which are
+ * processed by the calling thread and by the persistent workers of a @ref
+ * tao_worker_team.  Each band is processed by the same pixel processor as
+ * the whole image with a copy of the context whose pointers (`raw`, `dat`,
+ * `wgt`, and `preproc`) and height are those of the band, the stride is left
+ * unchanged.  This does not change the result because pixels are processed
+ * independently.
+ *
+ * Camera servers call tao_camera_server_set_preprocessing_threads() to add
+ * a stage of rank @ref TAO_PROCESSOR_RANK_SPLIT to the chain of pixel
+ * processors of the server (see @ref ProcessorChains).  This stage splits
+ * the work of the pixel processor beneath it (e.g., the one selected by
+ * tao_camera_server_tune_preprocessing()) between the worker thread of the
+ * server and helper threads.  Being part of the chain, it is installed again
+ * whenever the library resets the pixel processor of the server, e.g. after
+ * the camera has been configured.  There is a single such team per process.
+ *
+ * This header defines static functions, it must be included by a single
+ * compilation unit.
+ */
+
+/**
+ * @def TAO_PIXELS_BAND_MIN_ROWS
+ *
+ * Minimum number of rows of the bands of an image processed by a pixels
+ * team.  Small images are processed by less threads to avoid that the
+ * synchronization costs more than the work.
+ */
+#ifndef TAO_PIXELS_BAND_MIN_ROWS
+#  define TAO_PIXELS_BAND_MIN_ROWS 16
+#endif
+
+/**
+ * Team of threads to process pixels.
+ */
+typedef struct tao_pixels_team {
+    tao_worker_team*                  workers;///< Team of worker threads.
+    tao_pixels_processor*           processor;///< Processor of the bands.
+    const tao_pixels_processor_context*   ctx;///< Context of current image.
+    long                                 rows;///< Number of rows per band.
+} tao_pixels_team;
+
+/**
+ * Create a team of threads to process pixels.
+ *
+ * The team has initially no workers, so all bands are processed by the
+ * calling thread of tao_pixels_team_process() until
+ * tao_pixels_team_set_workers() is called.
+ *
+ * @return The address of a new team; `NULL` in case of failure.
+ */
+static inline tao_pixels_team* tao_pixels_team_create(
+    void)
+{
+    tao_pixels_team* team = (tao_pixels_team*)tao_calloc(
+        1, sizeof(tao_pixels_team));
+    if (team == NULL) {
+        return NULL;
+    }
+    team->workers = tao_worker_team_create();
+    if (team->workers == NULL) {
+        tao_free(team);
+        return NULL;
+    }
+    return team;
+}
+
+/**
+ * Destroy a team of threads to process pixels.
+ *
+ * @param team    Team to destroy (can be `NULL`).
+ */
+static inline void tao_pixels_team_destroy(
+    tao_pixels_team* team)
+{
+    if (team != NULL) {
+        tao_worker_team_destroy(team->workers);
+        tao_free(team);
+    }
+}
+
+/**
+ * Set the workers of a team of threads to process pixels.
+ *
+ * @param team      Team.
+ *
+ * @param nworkers  Number of worker threads in addition to the calling
+ *                  thread of tao_pixels_team_process().
+ *
+ * @param cpus      If not `NULL`, an array of `nworkers` indices of the cores
+ *                  to pin the workers to.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure.
+ *
+ * @see tao_worker_team_set_workers().
+ */
+static inline tao_status tao_pixels_team_set_workers(
+    tao_pixels_team* team,
+    long             nworkers,
+    const int*       cpus)
+{
+    return tao_worker_team_set_workers(team->workers, nworkers, cpus);
+}
+
+/**
+ * Get the number of workers of a team of threads to process pixels.
+ *
+ * @param team    Team.
+ *
+ * @return The number of worker threads.
+ */
+static inline long tao_pixels_team_get_workers(
+    const tao_pixels_team* team)
+{
+    return tao_worker_team_get_workers(team->workers);
+}
+
+// Process a band of rows of the current image.
+static inline void _tao_pixels_team_job(
+    void* arg,
+    long  b)
+{
+    tao_pixels_team* team = (tao_pixels_team*)arg;
+    const tao_pixels_processor_context* ctx = team->ctx;
+    long y0 = b*team->rows;
+    long y1 = TAO_MIN(y0 + team->rows, ctx->height);
+    size_t offset = y0*ctx->width*tao_size_of_eltype(ctx->eltype);
+    tao_pixels_processor_context band = *ctx;
+    band.height = y1 - y0;
+    band.raw = (const char*)ctx->raw + y0*ctx->stride;
+    band.dat = (char*)ctx->dat + offset;
+    if (ctx->wgt != NULL) {
+        band.wgt = (char*)ctx->wgt + offset;
+    }
+    for (int j = 0; j < 4; ++j) {
+        if (ctx->preproc[j] != NULL) {
+            band.preproc[j] = (const char*)ctx->preproc[j] + offset;
+        }
+    }
+    team->processor(&band);
+}
+
+/**
+ * Process an image with a team of threads.
+ *
+ * This function splits the image into at most as many bands of at least
+ * @ref TAO_PIXELS_BAND_MIN_ROWS rows as there are threads in the team
+ * (including the caller) and processes the bands with a given pixel
+ * processor.  It returns when the whole image has been processed.
+ *
+ * @param team       Team.
+ *
+ * @param ctx        Context describing the whole image.
+ *
+ * @param processor  Pixel processor to apply to each band.
+ */
+static inline void tao_pixels_team_process(
+    tao_pixels_team*                    team,
+    const tao_pixels_processor_context* ctx,
+    tao_pixels_processor*               processor)
+{
+    long nthreads = tao_pixels_team_get_workers(team) + 1;
+    long nbands = TAO_MIN(nthreads, ctx->height/TAO_PIXELS_BAND_MIN_ROWS);
+    if (nbands <= 1) {
+        processor(ctx);
+        return;
+    }
+    team->processor = processor;
+    team->ctx = ctx;
+    team->rows = (ctx->height + nbands - 1)/nbands;
+    nbands = (ctx->height + team->rows - 1)/team->rows;
+    tao_worker_team_run(team->workers, _tao_pixels_team_job, team, nbands);
+}
+
+#ifndef TAO_DOXYGEN_
+// Team and serial pixel processor used by the camera server.
+static tao_pixels_team*      _tao_pixels_team_instance = NULL;
+static tao_pixels_processor* _tao_pixels_team_processor = NULL;
+
+static void _tao_pixels_team_parallel_processor(
+    const tao_pixels_processor_context* ctx)
+{
+    tao_pixels_team_process(_tao_pixels_team_instance, ctx,
+                            _tao_pixels_team_processor);
+}
+
+static tao_status _tao_pixels_team_stage(
+    tao_camera_server* srv)
+{
+    _tao_pixels_team_processor = srv->proc.processor;
+    srv->proc.processor = _tao_pixels_team_parallel_processor;
+    return TAO_OK;
+}
+#endif // TAO_DOXYGEN_
+
+/**
+ * Set the number of threads pre-processing images in a camera server.
+ *
+ * Unless @a nthreads is less than 2, this function sets the number of helper
+ * threads of the team of the camera server to `nthreads - 1` and adds the
+ * stage splitting each image in bands processed in parallel by the worker of
+ * the server and the helper threads to the chain of pixel processors of the
+ * server.  Otherwise, the stage is removed and the helper threads are
+ * stopped.  The camera must not be acquiring.
+ *
+ * @param srv       Camera server.
+ *
+ * @param nthreads  Total number of threads processing an image, including
+ *                  the worker thread of the server.
+ *
+ * @param cpus      If not `NULL`, an array of `nthreads - 1` indices of the
+ *                  cores to pin the helper threads to.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure.
+ */
+static inline tao_status tao_camera_server_set_preprocessing_threads(
+    tao_camera_server* srv,
+    long               nthreads,
+    const int*         cpus)
+{
+    if (nthreads < 2) {
+        if (tao_camera_server_remove_processor_stage(
+                srv, _tao_pixels_team_stage) != TAO_OK) {
+            return TAO_ERROR;
+        }
+        tao_pixels_team_destroy(_tao_pixels_team_instance);
+        _tao_pixels_team_instance = NULL;
+        return TAO_OK;
+    }
+    // The team shall not be changed while the worker may be using it.
+    tao_camera* cam = srv->device;
+    if (tao_camera_lock(cam) != TAO_OK) {
+        return TAO_ERROR;
+    }
+    tao_status status = TAO_OK;
+    if (cam->runlevel == 2) {
+        tao_store_error(__func__, TAO_ACQUISITION_RUNNING);
+        status = TAO_ERROR;
+    } else {
+        if (_tao_pixels_team_instance == NULL) {
+            _tao_pixels_team_instance = tao_pixels_team_create();
+        }
+        if (_tao_pixels_team_instance == NULL ||
+            tao_pixels_team_set_workers(
+                _tao_pixels_team_instance, nthreads - 1, cpus) != TAO_OK) {
+            status = TAO_ERROR;
+        }
+    }
+    if (tao_camera_unlock(cam) != TAO_OK) {
+        status = TAO_ERROR;
+    }
+    if (status != TAO_OK) {
+        return TAO_ERROR;
+    }
+    if (tao_camera_server_add_processor_stage(
+            srv, _tao_pixels_team_stage, TAO_PROCESSOR_RANK_SPLIT,
+            false) != TAO_OK) {
+        return TAO_ERROR;
+    }
+    tao_inform(srv->logfile, TAO_MESG_INFO,
+               "Pre-processing of images by %ld threads\n", nthreads);
+    return TAO_OK;
+}
+
+/**
+ * @}
+ */
+
+TAO_END_DECLS
+
+#endif // TAO_PARALLEL_PREPROCESSING_H_
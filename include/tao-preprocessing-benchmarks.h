@@ -0,0 +1,712 @@
+// tao-preprocessing-benchmarks.h -
+//
+// Benchmarks of the pre-processing methods.
+//
+//-----------------------------------------------------------------------------
+//
+// This file if part of TAO real-time software licensed under the MIT license
+// (https://git-cral.univ-lyon1.fr/tao/tao-rt).
+//
+// Copyright (C) 2022, Éric Thiébaut.
+
+#ifndef TAO_PREPROCESSING_BENCHMARKS_H_
+#define TAO_PREPROCESSING_BENCHMARKS_H_ 1
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <tao-basics.h>
+#include <tao-errors.h>
+#include <tao-options.h>
+#include <tao-pixels.h>
+#include <tao-preprocessing-tuning.h>
+#include <tao-utils.h>
+
+TAO_BEGIN_DECLS
+
+/**
+ * @defgroup PreprocessingBenchmarks Pre-processing benchmarks
+ *
+ * @ingroup Cameras
+ *
+ * @brief Timing of all the pre-processing methods on synthetic images.
+ *
+ * @{
+ *
+ * This header encodes all the variants of the full pre-processing (see @ref
+ * PreprocessingTests), that is `i + 10*j` with `i = 1, ..., 4` and `j = 1,
+ * ..., 7`, for raw pixels of type `uint8_t`, `uint16_t`, or `uint32_t` and
+ * for `float` or `double` results.  Function
+ * tao_preprocessing_benchmark_run() times each of these variants and the
+ * corresponding function of the library (variant 0) on synthetic images of
+ * a given size.  Since `tao-test-preprocessing.h` does not encode variants
+ * for packed pixels, only the library functions are timed for packed 12-bit
+ * raw pixels.
+ *
+ * The pre-processed pixels and weights computed by each variant are compared
+ * with those computed by the library function (with offsets `-a*b` for the
+ * variants computing `dat = raw*a + b`).  The maximum absolute difference is
+ * reported and variants whose differences exceed the rounding errors are
+ * flagged as disagreeing with the library (such variants are never selected
+ * by tao_preprocessing_tune()).
+ *
+ * For each method, the first call is not timed (to warm-up the caches) and
+ * the following calls are timed individually.  The minimum, maximum, mean
+ * and standard deviation of the times are computed by
+ * tao_compute_time_statistics(), the median and the 99th percentile are
+ * computed from the sorted times, and the rate is the number of bytes read
+ * and written by a call (raw image, 4 arrays of pre-processing coefficients,
+ * data and weights) divided by the median time.
+ *
+ * The function tao_preprocessing_benchmark_main() implements the
+ * `tao-bench-preproc` program which prints the results as text or as JSON
+ * (for regression checks on acquisition nodes) and exits with a failure
+ * status if any variant disagrees with the library:
+ *
+ * ~~~~~{.c}
+ * #include <tao-preprocessing-benchmarks.h>
+ *
+ * int main(int argc, char* argv[])
+ * {
+ *     return tao_preprocessing_benchmark_main(argc, argv);
+ * }
+ * ~~~~~
+ *
+ * This header defines static functions, it must be included by a single
+ * compilation unit.
+ */
+
+/**
+ * Number of pre-processing variants that are benchmarked for each
+ * combination of unpacked raw pixel type and output type.
+ */
+#define TAO_PREPROCESSING_BENCHMARK_VARIANTS 28
+
+/**
+ * Identifiers of the benchmarked pre-processing variants.
+ */
+static const int tao_preprocessing_benchmark_variants[
+    TAO_PREPROCESSING_BENCHMARK_VARIANTS] = {
+    11, 12, 13, 14, 21, 22, 23, 24, 31, 32, 33, 34, 41, 42,
+    43, 44, 51, 52, 53, 54, 61, 62, 63, 64, 71, 72, 73, 74
+};
+
+/**
+ * Maximum number of results of tao_preprocessing_benchmark_run().
+ */
+#define TAO_PREPROCESSING_BENCHMARK_RESULTS \
+    (6*(TAO_PREPROCESSING_BENCHMARK_VARIANTS + 1) + 2)
+
+/**
+ * Result of the benchmark of a pre-processing method.
+ */
+typedef struct tao_preprocessing_benchmark {
+    const char*  pixel;///< Raw pixel type (`"u8"`, `"u16"`, `"u32"`, or
+                       ///  `"p12"`).
+    const char* eltype;///< Output type (`"float"` or `"double"`).
+    int        variant;///< Variant, 0 for the library function.
+    long         width;///< Image width.
+    long        height;///< Image height.
+    tao_time_stat stat;///< Time statistics (in seconds).
+    double      median;///< Median time (in seconds).
+    double         p99;///< 99th percentile of time (in seconds).
+    double        rate;///< Throughput at median time (in GB/s).
+    double        diff;///< Maximum absolute difference with the library
+                       ///  function (0 for variant 0).
+    bool         agree;///< Whether the result agrees with the library
+                       ///  function.
+} tao_preprocessing_benchmark;
+
+#ifndef TAO_DOXYGEN_
+static int _tao_preprocessing_benchmark_compare(
+    const void* a,
+    const void* b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x < y ? -1 : (x > y ? 1 : 0));
+}
+
+// Summarize the times of a benchmark.
+static void _tao_preprocessing_benchmark_summarize(
+    tao_preprocessing_benchmark* res,
+    double*                      times,
+    long                         repeats,
+    double                       bytes)
+{
+    tao_time_stat_data tsd;
+    tao_initialize_time_statistics(&tsd);
+    for (long k = 0; k < repeats; ++k) {
+        tao_update_time_statistics(&tsd, times[k]);
+    }
+    tao_compute_time_statistics(&res->stat, &tsd);
+    qsort(times, repeats, sizeof(double),
+          _tao_preprocessing_benchmark_compare);
+    res->median = times[(repeats - 1)/2];
+    res->p99 = times[TAO_MAX((long)ceil(0.99*repeats) - 1, 0)];
+    res->rate = (res->median > 0 ? 1e-9*bytes/res->median : 0);
+}
+
+#define _TAO_PB_JOIN2_(a, b) a##_##b
+#define _TAO_PB_JOIN2(a, b) _TAO_PB_JOIN2_(a, b)
+#define _TAO_PB_JOIN3_(a, b, c) a##_##b##_##c
+#define _TAO_PB_JOIN3(a, b, c) _TAO_PB_JOIN3_(a, b, c)
+#define _TAO_PB_NAME(name) _TAO_PB_JOIN2(name, _TAO_PB_SUFFIX)
+#define _TAO_PB_KERNEL(v) _TAO_PB_JOIN3(_tao_bench_preproc, _TAO_PB_SUFFIX, v)
+#define _TAO_PB_LIBRARY(sfx) _TAO_PB_JOIN2(tao_pixels_preprocess_full, sfx)
+
+#define _TAO_PB_PIXEL    uint8_t
+#define _TAO_PB_FLOAT    float
+#define _TAO_PB_SUFFIX   u8_to_flt
+#define _TAO_PB_NICK     "u8"
+#define _TAO_PB_VARIANTS 1
+#include <tao-preprocessing-benchmarks.h>
+#undef _TAO_PB_PIXEL
+#undef _TAO_PB_FLOAT
+#undef _TAO_PB_SUFFIX
+#undef _TAO_PB_NICK
+#undef _TAO_PB_VARIANTS
+
+#define _TAO_PB_PIXEL    uint16_t
+#define _TAO_PB_FLOAT    float
+#define _TAO_PB_SUFFIX   u16_to_flt
+#define _TAO_PB_NICK     "u16"
+#define _TAO_PB_VARIANTS 1
+#include <tao-preprocessing-benchmarks.h>
+#undef _TAO_PB_PIXEL
+#undef _TAO_PB_FLOAT
+#undef _TAO_PB_SUFFIX
+#undef _TAO_PB_NICK
+#undef _TAO_PB_VARIANTS
+
+#define _TAO_PB_PIXEL    uint32_t
+#define _TAO_PB_FLOAT    float
+#define _TAO_PB_SUFFIX   u32_to_flt
+#define _TAO_PB_NICK     "u32"
+#define _TAO_PB_VARIANTS 1
+#include <tao-preprocessing-benchmarks.h>
+#undef _TAO_PB_PIXEL
+#undef _TAO_PB_FLOAT
+#undef _TAO_PB_SUFFIX
+#undef _TAO_PB_NICK
+#undef _TAO_PB_VARIANTS
+
+#define _TAO_PB_PIXEL    uint8_t
+#define _TAO_PB_FLOAT    float
+#define _TAO_PB_SUFFIX   p12_to_flt
+#define _TAO_PB_NICK     "p12"
+#define _TAO_PB_VARIANTS 0
+#include <tao-preprocessing-benchmarks.h>
+#undef _TAO_PB_PIXEL
+#undef _TAO_PB_FLOAT
+#undef _TAO_PB_SUFFIX
+#undef _TAO_PB_NICK
+#undef _TAO_PB_VARIANTS
+
+#define _TAO_PB_PIXEL    uint8_t
+#define _TAO_PB_FLOAT    double
+#define _TAO_PB_SUFFIX   u8_to_dbl
+#define _TAO_PB_NICK     "u8"
+#define _TAO_PB_VARIANTS 1
+#include <tao-preprocessing-benchmarks.h>
+#undef _TAO_PB_PIXEL
+#undef _TAO_PB_FLOAT
+#undef _TAO_PB_SUFFIX
+#undef _TAO_PB_NICK
+#undef _TAO_PB_VARIANTS
+
+#define _TAO_PB_PIXEL    uint16_t
+#define _TAO_PB_FLOAT    double
+#define _TAO_PB_SUFFIX   u16_to_dbl
+#define _TAO_PB_NICK     "u16"
+#define _TAO_PB_VARIANTS 1
+#include <tao-preprocessing-benchmarks.h>
+#undef _TAO_PB_PIXEL
+#undef _TAO_PB_FLOAT
+#undef _TAO_PB_SUFFIX
+#undef _TAO_PB_NICK
+#undef _TAO_PB_VARIANTS
+
+#define _TAO_PB_PIXEL    uint32_t
+#define _TAO_PB_FLOAT    double
+#define _TAO_PB_SUFFIX   u32_to_dbl
+#define _TAO_PB_NICK     "u32"
+#define _TAO_PB_VARIANTS 1
+#include <tao-preprocessing-benchmarks.h>
+#undef _TAO_PB_PIXEL
+#undef _TAO_PB_FLOAT
+#undef _TAO_PB_SUFFIX
+#undef _TAO_PB_NICK
+#undef _TAO_PB_VARIANTS
+
+#define _TAO_PB_PIXEL    uint8_t
+#define _TAO_PB_FLOAT    double
+#define _TAO_PB_SUFFIX   p12_to_dbl
+#define _TAO_PB_NICK     "p12"
+#define _TAO_PB_VARIANTS 0
+#include <tao-preprocessing-benchmarks.h>
+#undef _TAO_PB_PIXEL
+#undef _TAO_PB_FLOAT
+#undef _TAO_PB_SUFFIX
+#undef _TAO_PB_NICK
+#undef _TAO_PB_VARIANTS
+
+// Benchmarks for all combinations of pixel types.
+static long (*const _tao_preprocessing_benchmarks[8])(
+    tao_preprocessing_benchmark*, long, long, long,
+    const uint8_t*, double*, double*) = {
+    _tao_preprocessing_benchmark_u8_to_flt,
+    _tao_preprocessing_benchmark_u16_to_flt,
+    _tao_preprocessing_benchmark_u32_to_flt,
+    _tao_preprocessing_benchmark_p12_to_flt,
+    _tao_preprocessing_benchmark_u8_to_dbl,
+    _tao_preprocessing_benchmark_u16_to_dbl,
+    _tao_preprocessing_benchmark_u32_to_dbl,
+    _tao_preprocessing_benchmark_p12_to_dbl
+};
+#endif // TAO_DOXYGEN_
+
+/**
+ * Benchmark all the pre-processing methods.
+ *
+ * @param res      Array of at least @ref TAO_PREPROCESSING_BENCHMARK_RESULTS
+ *                 entries to store the results.
+ *
+ * @param width    Image width (must be even for packed 12-bit pixels).
+ *
+ * @param height   Image height.
+ *
+ * @param repeats  Number of timed calls of each method.
+ *
+ * @return The number of results stored in @a res; -1 in case of failure.
+ */
+static inline long tao_preprocessing_benchmark_run(
+    tao_preprocessing_benchmark* res,
+    long                         width,
+    long                         height,
+    long                         repeats)
+{
+    if (width < 2 || (width & 1) != 0 || height < 1) {
+        tao_store_error(__func__, TAO_BAD_SIZE);
+        return -1;
+    }
+    if (repeats < 1) {
+        tao_store_error(__func__, TAO_BAD_NUMBER);
+        return -1;
+    }
+    long n = width*height;
+    size_t rawsize = n*sizeof(uint32_t);
+    uint8_t* raw = (uint8_t*)tao_malloc(rawsize);
+    double* buf = (double*)tao_malloc(9*n*sizeof(double));
+    double* times = (double*)tao_malloc(repeats*sizeof(double));
+    long nres = -1;
+    if (raw != NULL && buf != NULL && times != NULL) {
+        _tao_preprocessing_fill(raw, rawsize);
+        nres = 0;
+        for (int k = 0; k < 8; ++k) {
+            long m = _tao_preprocessing_benchmarks[k](
+                res + nres, width, height, repeats, raw, buf, times);
+            if (m < 0) {
+                nres = -1;
+                break;
+            }
+            nres += m;
+        }
+    }
+    tao_free(raw);
+    tao_free(buf);
+    tao_free(times);
+    return nres;
+}
+
+/**
+ * Print the results of pre-processing benchmarks as text.
+ *
+ * @param out     Output file stream.
+ *
+ * @param res     Array of results.
+ *
+ * @param nres    Number of results.
+ */
+static inline void tao_preprocessing_benchmark_print_text(
+    FILE*                              out,
+    const tao_preprocessing_benchmark* res,
+    long                               nres)
+{
+    fprintf(out, "# Pre-processing of %ld×%ld images (%s instructions)\n",
+            (nres > 0 ? res[0].width : 0), (nres > 0 ? res[0].height : 0),
+            tao_preprocessing_target());
+    fprintf(out, "# %-5s %-6s %7s %10s %10s %10s %10s %10s %8s %9s\n",
+            "pixel", "output", "variant", "min (µs)", "median", "p99",
+            "mean", "std", "GB/s", "max diff");
+    for (long k = 0; k < nres; ++k) {
+        const tao_preprocessing_benchmark* r = &res[k];
+        fprintf(out, "  %-5s %-6s %7d %10.2f %10.2f %10.2f %10.2f %10.2f "
+                "%8.2f %9.2e%s\n", r->pixel, r->eltype, r->variant,
+                1e6*r->stat.min, 1e6*r->median, 1e6*r->p99,
+                1e6*r->stat.avg, 1e6*r->stat.std, r->rate, r->diff,
+                (r->agree ? "" : " (disagrees with library)"));
+    }
+}
+
+/**
+ * Print the results of pre-processing benchmarks as JSON.
+ *
+ * The output is an object with the instruction set used by the SIMD clones
+ * (`target`) and the list of results (`results`), times are in seconds and
+ * rates in GB/s.  The maximum absolute difference with the library function
+ * (`diff`) is `null` if it is not a number.
+ *
+ * @param out     Output file stream.
+ *
+ * @param res     Array of results.
+ *
+ * @param nres    Number of results.
+ */
+static inline void tao_preprocessing_benchmark_print_json(
+    FILE*                              out,
+    const tao_preprocessing_benchmark* res,
+    long                               nres)
+{
+    fprintf(out, "{\n  \"target\": \"%s\",\n  \"results\": [",
+            tao_preprocessing_target());
+    for (long k = 0; k < nres; ++k) {
+        const tao_preprocessing_benchmark* r = &res[k];
+        fprintf(out, "%s\n    {\"pixel\": \"%s\", \"eltype\": \"%s\", "
+                "\"variant\": %d, \"width\": %ld, \"height\": %ld, "
+                "\"repeats\": %zu, \"min\": %.9g, \"median\": %.9g, "
+                "\"p99\": %.9g, \"max\": %.9g, \"mean\": %.9g, "
+                "\"std\": %.9g, \"rate\": %.6g, \"diff\": ",
+                (k > 0 ? "," : ""), r->pixel, r->eltype, r->variant,
+                r->width, r->height, r->stat.numb, r->stat.min, r->median,
+                r->p99, r->stat.max, r->stat.avg, r->stat.std, r->rate);
+        if (isnan(r->diff)) {
+            fputs("null", out);
+        } else {
+            fprintf(out, "%.3g", r->diff);
+        }
+        fprintf(out, ", \"agree\": %s}", (r->agree ? "true" : "false"));
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
+
+/**
+ * Main function of the `tao-bench-preproc` program.
+ *
+ * The program accepts options `-width`, `-height` and `-repeat` to specify
+ * the size of the synthetic images and the number of timed calls, and
+ * option `-json` to print the results as JSON instead of text.  The exit
+ * status is a failure if any variant disagrees with the library.
+ *
+ * @param argc    Number of arguments.
+ *
+ * @param argv    List of arguments.
+ *
+ * @return The exit status of the program.
+ */
+static inline int tao_preprocessing_benchmark_main(
+    int   argc,
+    char* argv[])
+{
+    long width = 512, height = 512, repeats = 100;
+    bool json = false;
+    tao_help_info info = {
+        .program = argv[0],
+        .args = NULL,
+        .purpose = "Benchmark the pre-processing methods.",
+        .output = stdout,
+    };
+    tao_option options[] = {
+        TAO_OPTION_POSITIVE_LONG(0, "width", "NUMBER",
+                                 "Width of images", &width),
+        TAO_OPTION_POSITIVE_LONG(0, "height", "NUMBER",
+                                 "Height of images", &height),
+        TAO_OPTION_POSITIVE_LONG(0, "repeat", "NUMBER",
+                                 "Number of timed calls", &repeats),
+        TAO_OPTION_SWITCH(0, "json", "Print results as JSON", &json),
+        TAO_OPTION_HELP_AND_EXIT(0, 0),
+        TAO_OPTION_LAST_ENTRY,
+    };
+    info.options = options;
+    options[4].ptr = &info;
+    argc = tao_parse_options(NULL, argc, argv, 0, options);
+    if (argc != 1) {
+        if (argc > 1) {
+            fprintf(stderr, "%s: too many arguments\n", argv[0]);
+        }
+        return EXIT_FAILURE;
+    }
+    tao_preprocessing_benchmark* res = (tao_preprocessing_benchmark*)
+        tao_malloc(TAO_PREPROCESSING_BENCHMARK_RESULTS*
+                   sizeof(tao_preprocessing_benchmark));
+    long nres = (res == NULL ? -1 :
+                 tao_preprocessing_benchmark_run(res, width, height,
+                                                 repeats));
+    if (nres < 0) {
+        tao_report_error();
+        tao_free(res);
+        return EXIT_FAILURE;
+    }
+    if (json) {
+        tao_preprocessing_benchmark_print_json(stdout, res, nres);
+    } else {
+        tao_preprocessing_benchmark_print_text(stdout, res, nres);
+    }
+    bool agree = true;
+    for (long k = 0; k < nres; ++k) {
+        agree = agree && res[k].agree;
+    }
+    tao_free(res);
+    return (agree ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+/**
+ * @}
+ */
+
+TAO_END_DECLS
+
+#endif // TAO_PREPROCESSING_BENCHMARKS_H_
+
+//-----------------------------------------------------------------------------
+// Code encoded for each combination of pixel types and for each variant.
+
+#if defined(_TAO_PB_PIXEL) && defined(_TAO_PB_VARIANT)
+
+#define PREPROC_SCOPE      static
+#define PREPROC_ATTRIBUTES TAO_SIMD_CLONES
+#define PREPROC_PIXEL      _TAO_PB_PIXEL
+#define PREPROC_FLOAT      _TAO_PB_FLOAT
+#define PREPROC_FUNC       _TAO_PB_KERNEL(_TAO_PB_VARIANT)
+#define PREPROC_VARIANT    _TAO_PB_VARIANT
+#include <tao-test-preprocessing.h>
+#undef PREPROC_SCOPE
+#undef PREPROC_ATTRIBUTES
+
+#elif defined(_TAO_PB_PIXEL)
+
+typedef void _TAO_PB_NAME(_tao_bench_preproc_kernel)(
+    long width,
+    long height,
+    long stride,
+    _TAO_PB_FLOAT*       restrict wgt,
+    _TAO_PB_FLOAT*       restrict dat,
+    _TAO_PB_PIXEL const* restrict img,
+    _TAO_PB_FLOAT const* restrict a,
+    _TAO_PB_FLOAT const* restrict b,
+    _TAO_PB_FLOAT const* restrict q,
+    _TAO_PB_FLOAT const* restrict r);
+
+// Call the library function with the arguments of the encoded variants.
+static void _TAO_PB_KERNEL(0)(
+    long width,
+    long height,
+    long stride,
+    _TAO_PB_FLOAT*       restrict wgt,
+    _TAO_PB_FLOAT*       restrict dat,
+    _TAO_PB_PIXEL const* restrict img,
+    _TAO_PB_FLOAT const* restrict a,
+    _TAO_PB_FLOAT const* restrict b,
+    _TAO_PB_FLOAT const* restrict q,
+    _TAO_PB_FLOAT const* restrict r)
+{
+    _TAO_PB_LIBRARY(_TAO_PB_SUFFIX)(
+        dat, wgt, width, height, a, b, q, r, img,
+        stride*sizeof(_TAO_PB_PIXEL));
+}
+
+#if _TAO_PB_VARIANTS
+#define _TAO_PB_VARIANT 11
+#include <tao-preprocessing-benchmarks.h>
+#undef _TAO_PB_VARIANT
+#define _TAO_PB_VARIANT 12
+#include <tao-preprocessing-benchmarks.h>
+#undef _TAO_PB_VARIANT
+#define _TAO_PB_VARIANT 13
+#include <tao-preprocessing-benchmarks.h>
+#undef _TAO_PB_VARIANT
+#define _TAO_PB_VARIANT 14
+#include <tao-preprocessing-benchmarks.h>
+#undef _TAO_PB_VARIANT
+#define _TAO_PB_VARIANT 21
+#include <tao-preprocessing-benchmarks.h>
+#undef _TAO_PB_VARIANT
+#define _TAO_PB_VARIANT 22
+#include <tao-preprocessing-benchmarks.h>
+#undef _TAO_PB_VARIANT
+#define _TAO_PB_VARIANT 23
+#include <tao-preprocessing-benchmarks.h>
+#undef _TAO_PB_VARIANT
+#define _TAO_PB_VARIANT 24
+#include <tao-preprocessing-benchmarks.h>
+#undef _TAO_PB_VARIANT
+#define _TAO_PB_VARIANT 31
+#include <tao-preprocessing-benchmarks.h>
+#undef _TAO_PB_VARIANT
+#define _TAO_PB_VARIANT 32
+#include <tao-preprocessing-benchmarks.h>
+#undef _TAO_PB_VARIANT
+#define _TAO_PB_VARIANT 33
+#include <tao-preprocessing-benchmarks.h>
+#undef _TAO_PB_VARIANT
+#define _TAO_PB_VARIANT 34
+#include <tao-preprocessing-benchmarks.h>
+#undef _TAO_PB_VARIANT
+#define _TAO_PB_VARIANT 41
+#include <tao-preprocessing-benchmarks.h>
+#undef _TAO_PB_VARIANT
+#define _TAO_PB_VARIANT 42
+#include <tao-preprocessing-benchmarks.h>
+#undef _TAO_PB_VARIANT
+#define _TAO_PB_VARIANT 43
+#include <tao-preprocessing-benchmarks.h>
+#undef _TAO_PB_VARIANT
+#define _TAO_PB_VARIANT 44
+#include <tao-preprocessing-benchmarks.h>
+#undef _TAO_PB_VARIANT
+#define _TAO_PB_VARIANT 51
+#include <tao-preprocessing-benchmarks.h>
+#undef _TAO_PB_VARIANT
+#define _TAO_PB_VARIANT 52
+#include <tao-preprocessing-benchmarks.h>
+#undef _TAO_PB_VARIANT
+#define _TAO_PB_VARIANT 53
+#include <tao-preprocessing-benchmarks.h>
+#undef _TAO_PB_VARIANT
+#define _TAO_PB_VARIANT 54
+#include <tao-preprocessing-benchmarks.h>
+#undef _TAO_PB_VARIANT
+#define _TAO_PB_VARIANT 61
+#include <tao-preprocessing-benchmarks.h>
+#undef _TAO_PB_VARIANT
+#define _TAO_PB_VARIANT 62
+#include <tao-preprocessing-benchmarks.h>
+#undef _TAO_PB_VARIANT
+#define _TAO_PB_VARIANT 63
+#include <tao-preprocessing-benchmarks.h>
+#undef _TAO_PB_VARIANT
+#define _TAO_PB_VARIANT 64
+#include <tao-preprocessing-benchmarks.h>
+#undef _TAO_PB_VARIANT
+#define _TAO_PB_VARIANT 71
+#include <tao-preprocessing-benchmarks.h>
+#undef _TAO_PB_VARIANT
+#define _TAO_PB_VARIANT 72
+#include <tao-preprocessing-benchmarks.h>
+#undef _TAO_PB_VARIANT
+#define _TAO_PB_VARIANT 73
+#include <tao-preprocessing-benchmarks.h>
+#undef _TAO_PB_VARIANT
+#define _TAO_PB_VARIANT 74
+#include <tao-preprocessing-benchmarks.h>
+#undef _TAO_PB_VARIANT
+
+static _TAO_PB_NAME(_tao_bench_preproc_kernel)* const
+_TAO_PB_NAME(_tao_bench_preproc_kernels)[
+    TAO_PREPROCESSING_BENCHMARK_VARIANTS + 1] = {
+    _TAO_PB_KERNEL(0),
+    _TAO_PB_KERNEL(11), _TAO_PB_KERNEL(12),
+    _TAO_PB_KERNEL(13), _TAO_PB_KERNEL(14),
+    _TAO_PB_KERNEL(21), _TAO_PB_KERNEL(22),
+    _TAO_PB_KERNEL(23), _TAO_PB_KERNEL(24),
+    _TAO_PB_KERNEL(31), _TAO_PB_KERNEL(32),
+    _TAO_PB_KERNEL(33), _TAO_PB_KERNEL(34),
+    _TAO_PB_KERNEL(41), _TAO_PB_KERNEL(42),
+    _TAO_PB_KERNEL(43), _TAO_PB_KERNEL(44),
+    _TAO_PB_KERNEL(51), _TAO_PB_KERNEL(52),
+    _TAO_PB_KERNEL(53), _TAO_PB_KERNEL(54),
+    _TAO_PB_KERNEL(61), _TAO_PB_KERNEL(62),
+    _TAO_PB_KERNEL(63), _TAO_PB_KERNEL(64),
+    _TAO_PB_KERNEL(71), _TAO_PB_KERNEL(72),
+    _TAO_PB_KERNEL(73), _TAO_PB_KERNEL(74)
+};
+#define _TAO_PB_NKERNELS (TAO_PREPROCESSING_BENCHMARK_VARIANTS + 1)
+#else
+static _TAO_PB_NAME(_tao_bench_preproc_kernel)* const
+_TAO_PB_NAME(_tao_bench_preproc_kernels)[1] = {
+    _TAO_PB_KERNEL(0)
+};
+#define _TAO_PB_NKERNELS 1
+#endif // _TAO_PB_VARIANTS
+
+// Benchmark all methods for a combination of pixel types.  Return the number
+// of results or -1 in case of failure.
+static long _TAO_PB_NAME(_tao_preprocessing_benchmark)(
+    tao_preprocessing_benchmark* res,
+    long                         width,
+    long                         height,
+    long                         repeats,
+    const uint8_t*               raw,
+    double*                      buf,
+    double*                      times)
+{
+    // Packed 12-bit pixels are stored in `3*width/2` bytes per row, the
+    // stride of other pixel types is given in pixels.
+    long n = width*height;
+    long stride = (_TAO_PB_VARIANTS ? width : 3*width/2);
+    double bytes = (double)height*stride*sizeof(_TAO_PB_PIXEL) +
+        6.0*n*sizeof(_TAO_PB_FLOAT);
+    _TAO_PB_FLOAT* a = (_TAO_PB_FLOAT*)buf;
+    _TAO_PB_FLOAT* b = a + n;
+    _TAO_PB_FLOAT* q = b + n;
+    _TAO_PB_FLOAT* r = q + n;
+    _TAO_PB_FLOAT* dat = r + n;
+    _TAO_PB_FLOAT* wgt = dat + n;
+    _TAO_PB_FLOAT* c = wgt + n; // offsets for `dat = raw*a + c`
+    _TAO_PB_FLOAT* refdat = c + n;
+    _TAO_PB_FLOAT* refwgt = refdat + n;
+    for (long i = 0; i < n; ++i) {
+        a[i] = 1.1 + 0.01*(i%7);
+        b[i] = 10 + (i%13);
+        q[i] = 1;
+        r[i] = 2.5;
+        c[i] = -a[i]*b[i];
+    }
+    for (int k = 0; k < _TAO_PB_NKERNELS; ++k) {
+        _TAO_PB_NAME(_tao_bench_preproc_kernel)* kernel =
+            _TAO_PB_NAME(_tao_bench_preproc_kernels)[k];
+        int variant = (k > 0 ? tao_preprocessing_benchmark_variants[k-1] : 0);
+        const _TAO_PB_FLOAT* off = (variant%10 >= 3 ? c : b);
+        tao_preprocessing_benchmark* dst = &res[k];
+        // First call is not timed to warm-up caches and to check the result.
+        kernel(width, height, stride, wgt, dat,
+               (const _TAO_PB_PIXEL*)raw, a, off, q, r);
+        if (k == 0) {
+            memcpy(refdat, dat, n*sizeof(_TAO_PB_FLOAT));
+            memcpy(refwgt, wgt, n*sizeof(_TAO_PB_FLOAT));
+            dst->diff = 0;
+            dst->agree = true;
+        } else {
+#if _TAO_PB_VARIANTS
+            dst->agree = _TAO_PB_NAME(_tao_preprocessing_agree)(
+                dat, wgt, refdat, refwgt, n, &dst->diff);
+#endif
+        }
+        for (long rep = 0; rep < repeats; ++rep) {
+            tao_time t0, t1;
+            if (tao_get_monotonic_time(&t0) != TAO_OK) {
+                return -1;
+            }
+            kernel(width, height, stride, wgt, dat,
+                   (const _TAO_PB_PIXEL*)raw, a, off, q, r);
+            if (tao_get_monotonic_time(&t1) != TAO_OK) {
+                return -1;
+            }
+            times[rep] = tao_elapsed_seconds(&t1, &t0);
+        }
+        dst->pixel = _TAO_PB_NICK;
+        dst->eltype = (sizeof(_TAO_PB_FLOAT) == sizeof(float) ?
+                       "float" : "double");
+        dst->variant = variant;
+        dst->width = width;
+        dst->height = height;
+        _tao_preprocessing_benchmark_summarize(dst, times, repeats, bytes);
+    }
+    return _TAO_PB_NKERNELS;
+}
+
+#undef _TAO_PB_NKERNELS
+
+#endif // _TAO_PB_PIXEL && _TAO_PB_VARIANT
@@ -0,0 +1,1186 @@
+// tao-preprocessing-checks.h -
+//
+// Equivalence checks of the pre-processing kernels with the library.
+//
+//-----------------------------------------------------------------------------
+//
+// This file if part of TAO real-time software licensed under the MIT license
+// (https://git-cral.univ-lyon1.fr/tao/tao-rt).
+//
+// Copyright (C) 2022, Éric Thiébaut.
+
+#ifndef TAO_PREPROCESSING_CHECKS_H_
+#define TAO_PREPROCESSING_CHECKS_H_ 1
+
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <tao-bad-pixels.h>
+#include <tao-basics.h>
+#include <tao-calibrations.h>
+#include <tao-camera-servers.h>
+#include <tao-dark-estimators.h>
+#include <tao-encodings.h>
+#include <tao-errors.h>
+#include <tao-fixed-point.h>
+#include <tao-float16.h>
+#include <tao-frame-reducers.h>
+#include <tao-options.h>
+#include <tao-packed-pixels.h>
+#include <tao-pixels.h>
+#include <tao-shackhartmann-engine.h>
+#include <tao-utils.h>
+
+TAO_BEGIN_DECLS
+
+/**
+ * @defgroup PreprocessingChecks Pre-processing checks
+ *
+ * @ingroup Cameras
+ *
+ * @brief Equivalence of the pre-processing kernels with the library.
+ *
+ * @{
+ *
+ * The pre-processing kernels provided by the headers of TAO (sparse,
+ * half-precision, packed pixels, masking of bad pixels, fixed-point, etc.)
+ * and the consumers of pre-processed images (dark estimators and frame
+ * reducers) must yield the same results as the functions of the library
+ * (see @ref tao-pixels.h) up to the rounding errors or to their documented
+ * loss of precision (e.g., a relative error of at most 2^-11 for
+ * half-precision values or of at most 1/32 for fixed-point weights).  Each
+ * check of this header runs a kernel on synthetic raw images and compares
+ * its result with the one computed by the library, like the pre-processing
+ * benchmarks do for the variants encoded by `tao-test-preprocessing.h` (see
+ * @ref PreprocessingBenchmarks).
+ *
+ * The function tao_preprocessing_check_main() implements the
+ * `tao-check-preproc` program which runs all the checks, prints one line per
+ * check and exits with a failure status if any check fails:
+ *
+ * ~~~~~{.c}
+ * #include <tao-preprocessing-checks.h>
+ *
+ * int main(int argc, char* argv[])
+ * {
+ *     return tao_preprocessing_check_main(argc, argv);
+ * }
+ * ~~~~~
+ *
+ * This header defines static functions, it must be included by a single
+ * compilation unit.
+ */
+
+/**
+ * Result of an equivalence check.
+ */
+typedef struct tao_preprocessing_check {
+    const char* name;///< Name of the check.
+    double      diff;///< Largest difference with the reference.
+    double       tol;///< Largest allowed difference.
+    bool        pass;///< Whether the check passed.
+} tao_preprocessing_check;
+
+#ifndef TAO_DOXYGEN_
+// Relative tolerance for results that only differ by rounding errors.
+#define _TAO_PREPROCESSING_CHECK_TOLERANCE(eltype) \
+    ((eltype) == TAO_FLOAT ? 1e3*FLT_EPSILON : 1e3*DBL_EPSILON)
+
+// Fill a buffer with pseudo-random bytes.
+static void _tao_preprocessing_check_fill(
+    void*    buf,
+    size_t   size,
+    uint32_t seed)
+{
+    for (size_t i = 0; i < size; ++i) {
+        seed = seed*1664525 + 1013904223;
+        ((uint8_t*)buf)[i] = (uint8_t)(seed >> 24);
+    }
+}
+
+// Get the value of the `i`-th element of an array of `float` or `double`.
+static inline double _tao_preprocessing_check_get(
+    const void* arr,
+    tao_eltype  eltype,
+    long        i)
+{
+    return (eltype == TAO_FLOAT ? (double)((const float*)arr)[i] :
+            ((const double*)arr)[i]);
+}
+
+// Store the result of a check.
+static void _tao_preprocessing_check_result(
+    tao_preprocessing_check* res,
+    const char*              name,
+    double                   diff,
+    double                   tol)
+{
+    res->name = name;
+    res->diff = diff;
+    res->tol = tol;
+    res->pass = (diff <= tol);
+}
+
+// Allocate `n` coefficients `a`, `b`, `q`, and `r` of type `eltype` with
+// synthetic values and store their addresses in `coefs`.  The coefficients
+// are stored in a single block, the first one, to be freed by the caller.
+static void* _tao_preprocessing_check_coefs(
+    tao_eltype  eltype,
+    long        n,
+    const void* coefs[4])
+{
+    size_t elsize = tao_size_of_eltype(eltype);
+    char* buf = (char*)tao_malloc(4*n*elsize);
+    if (buf == NULL) {
+        return NULL;
+    }
+    for (long i = 0; i < n; ++i) {
+        double val[4] = {1.1 + 0.01*(i%7), 10 + (i%13), 1, 2.5};
+        for (int p = 0; p < 4; ++p) {
+            if (eltype == TAO_FLOAT) {
+                ((float*)(buf + p*n*elsize))[i] = val[p];
+            } else {
+                ((double*)(buf + p*n*elsize))[i] = val[p];
+            }
+        }
+    }
+    for (int p = 0; p < 4; ++p) {
+        coefs[p] = buf + p*n*elsize;
+    }
+    return buf;
+}
+
+#define _TAO_PC_CALL(op, sfx, args)                                     \
+    do {                                                                \
+        if (ctx->eltype == TAO_FLOAT) {                                 \
+            tao_pixels_##op##_##sfx##_to_flt args;                      \
+        } else {                                                        \
+            tao_pixels_##op##_##sfx##_to_dbl args;                      \
+        }                                                               \
+    } while (false)
+
+#define _TAO_PC_DISPATCH(sfx, T)                                        \
+    do {                                                                \
+        const T* raw = (const T*)ctx->raw;                              \
+        switch (ctx->preprocessing) {                                   \
+        case TAO_PREPROCESSING_FULL:                                    \
+            _TAO_PC_CALL(preprocess_full, sfx,                          \
+                         (ctx->dat, ctx->wgt, w, h, ctx->preproc[0],    \
+                          ctx->preproc[1], ctx->preproc[2],             \
+                          ctx->preproc[3], raw, ctx->stride));          \
+            break;                                                      \
+        case TAO_PREPROCESSING_AFFINE:                                  \
+            _TAO_PC_CALL(preprocess_affine, sfx,                        \
+                         (ctx->dat, w, h, ctx->preproc[0],              \
+                          ctx->preproc[1], raw, ctx->stride));          \
+            break;                                                      \
+        default:                                                        \
+            _TAO_PC_CALL(convert, sfx, (ctx->dat, w, h, raw,            \
+                                        ctx->stride));                  \
+        }                                                               \
+    } while (false)
+
+// Reference pixel processor: the functions of the library for 8, 16, or
+// 32-bit unsigned raw pixels and for Andor packed 12-bit raw pixels.
+static void _tao_preprocessing_check_reference(
+    const tao_pixels_processor_context* ctx)
+{
+    long w = ctx->width, h = ctx->height;
+    switch (ctx->bufferencoding) {
+    case TAO_ENCODING_MONO(8):
+        _TAO_PC_DISPATCH(u8, uint8_t);
+        break;
+    case TAO_ENCODING_MONO(16):
+        _TAO_PC_DISPATCH(u16, uint16_t);
+        break;
+    case TAO_ENCODING_MONO(32):
+        _TAO_PC_DISPATCH(u32, uint32_t);
+        break;
+    case TAO_ENCODING_ANDOR_MONO12PACKED:
+        _TAO_PC_DISPATCH(p12, uint8_t);
+        break;
+    }
+}
+
+#undef _TAO_PC_DISPATCH
+#undef _TAO_PC_CALL
+
+// Sparse pre-processing (see tao_shackhartmann_preprocess_sparse()) by
+// pixel processor `proc`: pixels inside the mask must be those computed by
+// `proc` for the whole image, the others must be left untouched.
+static tao_status _tao_preprocessing_check_sparse(
+    tao_preprocessing_check* res,
+    tao_encoding             enc,
+    tao_pixels_processor*    proc,
+    const char*              name)
+{
+    const long width = 60, height = 40, n = width*height;
+    const tao_eltype eltype = TAO_FLOAT;
+    tao_subimage subs[3];
+    memset(subs, 0, sizeof(subs));
+    subs[0].box = (tao_bounding_box){.xmin =  3, .xmax = 12,
+                                     .ymin =  1, .ymax =  9};
+    subs[1].box = (tao_bounding_box){.xmin =  9, .xmax = 20,
+                                     .ymin =  5, .ymax = 14};
+    subs[2].box = (tao_bounding_box){.xmin = 40, .xmax = 59,
+                                     .ymin = 30, .ymax = 39};
+    long bpp = TAO_ENCODING_BITS_PER_PACKET(enc)/8;
+    long ppp = TAO_ENCODING_BITS_PER_PACKET(enc)/
+        TAO_ENCODING_BITS_PER_PIXEL(enc);
+    long stride = ((width + ppp - 1)/ppp)*bpp + 8;
+    size_t elsize = tao_size_of_eltype(eltype);
+    tao_shackhartmann_mask* mask = NULL;
+    tao_status status = TAO_ERROR;
+    const void* coefs[4];
+    void* cbuf = _tao_preprocessing_check_coefs(eltype, n, coefs);
+    uint8_t* raw = (uint8_t*)tao_malloc(height*stride);
+    char* buf = (char*)tao_calloc(4*n, elsize);
+    if (cbuf == NULL || raw == NULL || buf == NULL) {
+        goto done;
+    }
+    _tao_preprocessing_check_fill(raw, height*stride, 0x2545F491);
+    if (tao_shackhartmann_mask_update(&mask, subs, 3, width, height,
+                                      enc) != TAO_OK) {
+        goto done;
+    }
+    tao_pixels_processor_context ctx = {
+        .preprocessing = TAO_PREPROCESSING_FULL,
+        .bufferencoding = enc,
+        .eltype = eltype,
+        .width = width,
+        .height = height,
+        .stride = stride,
+        .stride_min = stride,
+        .raw = raw,
+        .processor = proc,
+    };
+    memcpy(ctx.preproc, coefs, sizeof(ctx.preproc));
+    ctx.dat = buf + 2*n*elsize;
+    ctx.wgt = buf + 3*n*elsize;
+    proc(&ctx);
+    const char* ref[2] = {ctx.dat, ctx.wgt};
+    ctx.dat = buf;
+    ctx.wgt = buf + n*elsize;
+    if (tao_shackhartmann_preprocess_sparse(mask, &ctx) != TAO_OK) {
+        goto done;
+    }
+    // Pixels inside the boxes (extended to whole packets) must match, the
+    // others must be left zero.
+    double diff = 0, scale = 0;
+    for (int p = 0; p < 2; ++p) {
+        const char* out = buf + p*n*elsize;
+        for (long i = 0; i < n; ++i) {
+            long x = i%width, y = i/width;
+            bool inside = false;
+            for (int k = 0; k < 3 && !inside; ++k) {
+                const tao_bounding_box* box = &subs[k].box;
+                inside = ((box->xmin/ppp)*ppp <= x &&
+                          x < ((box->xmax + ppp)/ppp)*ppp &&
+                          box->ymin <= y && y <= box->ymax);
+            }
+            double val = _tao_preprocessing_check_get(out, eltype, i);
+            double e = fabs(inside ?
+                            val - _tao_preprocessing_check_get(
+                                ref[p], eltype, i) : val);
+            diff = (e > diff || isnan(e) ? e : diff);
+            scale = TAO_MAX(scale, fabs(_tao_preprocessing_check_get(
+                                            ref[p], eltype, i)));
+        }
+    }
+    _tao_preprocessing_check_result(
+        res, name, diff, _TAO_PREPROCESSING_CHECK_TOLERANCE(eltype)*scale);
+    status = TAO_OK;
+
+done:
+    tao_shackhartmann_mask_destroy(mask);
+    tao_free(cbuf);
+    tao_free(raw);
+    tao_free(buf);
+    return status;
+}
+
+static tao_status _tao_preprocessing_check_sparse_u16(
+    tao_preprocessing_check* res)
+{
+    return _tao_preprocessing_check_sparse(
+        res, TAO_ENCODING_MONO(16), _tao_preprocessing_check_reference,
+        "sparse u16");
+}
+
+// Packed pixels exercise the alignment of the runs on packet boundaries.
+static tao_status _tao_preprocessing_check_sparse_p10(
+    tao_preprocessing_check* res)
+{
+    return _tao_preprocessing_check_sparse(
+        res, TAO_ENCODING_GENICAM_MONO10P, tao_pixels_packed_processor,
+        "sparse p10");
+}
+
+// Unpack raw pixels of `bits` bits packed in little-endian bit order (as
+// for GenICam Mono10p and Mono14p encodings) bit by bit into 16-bit unsigned
+// integers.
+static void _tao_preprocessing_check_unpack(
+    uint16_t*      pix,
+    long           width,
+    long           height,
+    const uint8_t* raw,
+    long           stride,
+    int            bits)
+{
+    for (long y = 0; y < height; ++y) {
+        const uint8_t* row = raw + y*stride;
+        for (long x = 0; x < width; ++x) {
+            unsigned val = 0;
+            for (int j = 0; j < bits; ++j) {
+                long p = x*bits + j;
+                val |= ((row[p >> 3] >> (p & 7)) & 1u) << j;
+            }
+            pix[x + y*width] = val;
+        }
+    }
+}
+
+// Pre-processing of packed raw images (see tao_pixels_packed_processor())
+// compared with the library applied to the same pixels unpacked bit by bit
+// into 16-bit unsigned integers.  All pre-processing levels are checked,
+// the image width is not a multiple of the number of pixels per packet.
+static tao_status _tao_preprocessing_check_packed(
+    tao_preprocessing_check* res,
+    tao_encoding             enc,
+    tao_eltype               eltype,
+    const char*              name)
+{
+    const long width = 61, height = 23, n = width*height;
+    int bits = TAO_ENCODING_BITS_PER_PIXEL(enc);
+    long bpp = TAO_ENCODING_BITS_PER_PACKET(enc)/8;
+    long ppp = TAO_ENCODING_BITS_PER_PACKET(enc)/bits;
+    long stride = ((width + ppp - 1)/ppp)*bpp + 8;
+    size_t elsize = tao_size_of_eltype(eltype);
+    tao_status status = TAO_ERROR;
+    const void* coefs[4];
+    void* cbuf = _tao_preprocessing_check_coefs(eltype, n, coefs);
+    uint8_t* raw = (uint8_t*)tao_malloc(height*stride);
+    uint16_t* pix = (uint16_t*)tao_malloc(n*sizeof(uint16_t));
+    char* buf = (char*)tao_malloc(4*n*elsize);
+    if (cbuf == NULL || raw == NULL || pix == NULL || buf == NULL) {
+        goto done;
+    }
+    _tao_preprocessing_check_fill(raw, height*stride, 0x6C078965);
+    _tao_preprocessing_check_unpack(pix, width, height, raw, stride, bits);
+    const tao_preprocessing levels[] = {TAO_PREPROCESSING_NONE,
+                                        TAO_PREPROCESSING_AFFINE,
+                                        TAO_PREPROCESSING_FULL};
+    double diff = 0, scale = 0;
+    for (int l = 0; l < 3; ++l) {
+        tao_pixels_processor_context ctx = {
+            .preprocessing = levels[l],
+            .bufferencoding = enc,
+            .eltype = eltype,
+            .width = width,
+            .height = height,
+            .stride = stride,
+            .stride_min = stride,
+            .raw = raw,
+            .processor = tao_pixels_packed_processor,
+        };
+        memcpy(ctx.preproc, coefs, sizeof(ctx.preproc));
+        ctx.dat = buf;
+        ctx.wgt = buf + n*elsize;
+        tao_pixels_packed_processor(&ctx);
+        ctx.bufferencoding = TAO_ENCODING_MONO(16);
+        ctx.stride = width*sizeof(uint16_t);
+        ctx.stride_min = ctx.stride;
+        ctx.raw = pix;
+        ctx.dat = buf + 2*n*elsize;
+        ctx.wgt = buf + 3*n*elsize;
+        _tao_preprocessing_check_reference(&ctx);
+        long m = (levels[l] == TAO_PREPROCESSING_FULL ? 2*n : n);
+        for (long i = 0; i < m; ++i) {
+            double ref = _tao_preprocessing_check_get(buf + 2*n*elsize,
+                                                      eltype, i);
+            double e = fabs(_tao_preprocessing_check_get(buf, eltype, i)
+                            - ref);
+            diff = (e > diff || isnan(e) ? e : diff);
+            scale = TAO_MAX(scale, fabs(ref));
+        }
+    }
+    _tao_preprocessing_check_result(
+        res, name, diff, _TAO_PREPROCESSING_CHECK_TOLERANCE(eltype)*scale);
+    status = TAO_OK;
+
+done:
+    tao_free(cbuf);
+    tao_free(raw);
+    tao_free(pix);
+    tao_free(buf);
+    return status;
+}
+
+static tao_status _tao_preprocessing_check_packed_p10_flt(
+    tao_preprocessing_check* res)
+{
+    return _tao_preprocessing_check_packed(
+        res, TAO_ENCODING_GENICAM_MONO10P, TAO_FLOAT, "packed p10 flt");
+}
+
+static tao_status _tao_preprocessing_check_packed_p10_dbl(
+    tao_preprocessing_check* res)
+{
+    return _tao_preprocessing_check_packed(
+        res, TAO_ENCODING_GENICAM_MONO10P, TAO_DOUBLE, "packed p10 dbl");
+}
+
+static tao_status _tao_preprocessing_check_packed_p14_flt(
+    tao_preprocessing_check* res)
+{
+    return _tao_preprocessing_check_packed(
+        res, TAO_ENCODING_GENICAM_MONO14P, TAO_FLOAT, "packed p14 flt");
+}
+
+static tao_status _tao_preprocessing_check_packed_p14_dbl(
+    tao_preprocessing_check* res)
+{
+    return _tao_preprocessing_check_packed(
+        res, TAO_ENCODING_GENICAM_MONO14P, TAO_DOUBLE, "packed p14 dbl");
+}
+
+// Largest difference between `n` values of type `eltype` and reference
+// values divided by the largest magnitude of the latter.  NaNs propagate.
+static double _tao_preprocessing_check_reldiff(
+    const void*   arr,
+    tao_eltype    eltype,
+    const double* ref,
+    long          n)
+{
+    double diff = 0, scale = 0;
+    for (long i = 0; i < n; ++i) {
+        double e = fabs(_tao_preprocessing_check_get(arr, eltype, i) - ref[i]);
+        diff = (e > diff || isnan(e) ? e : diff);
+        scale = TAO_MAX(scale, fabs(ref[i]));
+    }
+    return (scale > 0 ? diff/scale : diff);
+}
+
+// Estimates of a dark estimator (see @ref DarkEstimators) after a few dark
+// and non-dark frames compared with the same running averages computed from
+// the raw pixels converted by the library (after unpacking them if they are
+// packed).  The frames are processed synchronously, without the background
+// thread, and the estimates are those published to the calibration by the
+// last update.  The difference is relative to the largest estimate.
+static tao_status _tao_preprocessing_check_dark(
+    tao_preprocessing_check* res,
+    tao_encoding             enc,
+    const char*              name)
+{
+    const long width = 45, height = 21, n = width*height, nframes = 8;
+    const double lambda = 0.25;
+    int bits = TAO_ENCODING_BITS_PER_PIXEL(enc);
+    long stride = _tao_dark_estimator_line_size(enc, width) + 6;
+    bool packed = (enc == TAO_ENCODING_GENICAM_MONO10P ||
+                   enc == TAO_ENCODING_GENICAM_MONO14P);
+    tao_subimage sub;
+    memset(&sub, 0, sizeof(sub));
+    sub.box = (tao_bounding_box){.xmin = 5, .xmax = 20,
+                                 .ymin = 3, .ymax = 10};
+    tao_status status = TAO_ERROR;
+    tao_calibration* cal = NULL;
+    tao_dark_estimator* est = NULL;
+    uint8_t* raw = (uint8_t*)tao_malloc(height*stride);
+    uint16_t* pix = (uint16_t*)tao_malloc(n*sizeof(uint16_t));
+    double* ref = (double*)tao_malloc(3*n*sizeof(double));
+    if (raw == NULL || pix == NULL || ref == NULL) {
+        goto done;
+    }
+    cal = tao_calibration_create("tao-check-preproc", width, height,
+                                 TAO_FLOAT, NULL, 0);
+    if (cal == NULL) {
+        goto done;
+    }
+    est = tao_dark_estimator_create(cal, lambda, nframes);
+    if (est == NULL ||
+        tao_dark_estimator_set_background(est, &sub, 1) != TAO_OK) {
+        goto done;
+    }
+    // Initial estimates for `a = q = r = 1` and `b = 0`.
+    double* mean = ref;
+    double* var = ref + n;
+    double* val = ref + 2*n;
+    for (long i = 0; i < n; ++i) {
+        mean[i] = 0;
+        var[i] = 1;
+    }
+    for (long f = 0; f < nframes; ++f) {
+        bool dark = (f % 3 == 0);
+        _tao_preprocessing_check_fill(raw, height*stride, 0x5851F42D + f);
+        if (packed) {
+            _tao_preprocessing_check_unpack(pix, width, height, raw, stride,
+                                            bits);
+            tao_pixels_convert_u16_to_dbl(val, width, height, pix,
+                                          width*sizeof(uint16_t));
+        } else {
+            // Clear the padding bits.
+            for (long i = 0; i < height*stride/2; ++i) {
+                ((uint16_t*)raw)[i] &= (1u << bits) - 1u;
+            }
+            tao_pixels_convert_u16_to_dbl(val, width, height,
+                                          (const uint16_t*)raw, stride);
+        }
+        for (long i = 0; i < n; ++i) {
+            if (dark || est->mask[i] != 0) {
+                double d = val[i] - mean[i];
+                mean[i] += lambda*d;
+                var[i] = (1 - lambda)*(var[i] + lambda*d*d);
+            }
+        }
+        memcpy(est->work, raw, height*stride);
+        est->work_stride = stride;
+        est->work_encoding = enc;
+        est->work_dark = dark;
+        _tao_dark_estimator_update(est, lambda);
+    }
+    const void* coefs[4];
+    if (tao_calibration_refresh(cal, coefs) != TAO_OK) {
+        goto done;
+    }
+    double diff = TAO_MAX(
+        _tao_preprocessing_check_reldiff(coefs[1], TAO_FLOAT, mean, n),
+        _tao_preprocessing_check_reldiff(coefs[3], TAO_FLOAT, var, n));
+    _tao_preprocessing_check_result(
+        res, name, diff, _TAO_PREPROCESSING_CHECK_TOLERANCE(TAO_FLOAT));
+    status = TAO_OK;
+
+done:
+    tao_dark_estimator_destroy(est);
+    tao_calibration_destroy(cal);
+    tao_free(raw);
+    tao_free(pix);
+    tao_free(ref);
+    return status;
+}
+
+// Mono12 pixels padded to 16 bits.
+static tao_status _tao_preprocessing_check_dark_mono12(
+    tao_preprocessing_check* res)
+{
+    return _tao_preprocessing_check_dark(
+        res, TAO_ENCODING_ANDOR_MONO12, "dark mono12");
+}
+
+static tao_status _tao_preprocessing_check_dark_p10(
+    tao_preprocessing_check* res)
+{
+    return _tao_preprocessing_check_dark(
+        res, TAO_ENCODING_GENICAM_MONO10P, "dark p10");
+}
+
+static tao_status _tao_preprocessing_check_dark_p14(
+    tao_preprocessing_check* res)
+{
+    return _tao_preprocessing_check_dark(
+        res, TAO_ENCODING_GENICAM_MONO14P, "dark p14");
+}
+
+// Full pre-processing with masking of bad pixels (see
+// tao_pixels_preprocess_full_masked_u16_to_flt()) compared with the full
+// pre-processing of the library followed by zeroing the weights of the bad
+// pixels and, if `interpolate` is true, replacing their values by the mean
+// of their valid neighbours.  The bad pixels include the corners of the
+// image, isolated ones, and a 3×3 block whose center has no valid
+// neighbours.
+static tao_status _tao_preprocessing_check_bad_pixels(
+    tao_preprocessing_check* res,
+    int                      bits,
+    tao_eltype               eltype,
+    bool                     interpolate,
+    const char*              name)
+{
+    const long width = 53, height = 29, n = width*height;
+    long stride = width*(bits/8) + 12;
+    size_t elsize = tao_size_of_eltype(eltype);
+    tao_status status = TAO_ERROR;
+    const void* coefs[4];
+    void* cbuf = _tao_preprocessing_check_coefs(eltype, n, coefs);
+    uint8_t* raw = (uint8_t*)tao_malloc(height*stride);
+    char* buf = (char*)tao_malloc(4*n*elsize);
+    double* ref = (double*)tao_malloc(2*n*sizeof(double));
+    long* list = (long*)tao_malloc(n*sizeof(long));
+    uint8_t* map = (uint8_t*)tao_calloc(n, 1);
+    if (cbuf == NULL || raw == NULL || buf == NULL || ref == NULL ||
+        list == NULL || map == NULL) {
+        goto done;
+    }
+    _tao_preprocessing_check_fill(raw, height*stride, 0x2F6B8A13);
+    map[0] = map[width - 1] = map[n - width] = map[n - 1] = 1;
+    for (long y = 10; y < 13; ++y) {
+        for (long x = 20; x < 23; ++x) {
+            map[x + y*width] = 1;
+        }
+    }
+    for (long i = 37; i < n; i += 97) {
+        map[i] = 1;
+    }
+    tao_bad_pixels bp = {
+        .width = width,
+        .height = height,
+        .list = list,
+        .map = map,
+        .interpolate = interpolate,
+    };
+    for (long i = 0; i < n; ++i) {
+        if (map[i] != 0) {
+            list[bp.nbad++] = i;
+        }
+    }
+    tao_pixels_processor_context ctx = {
+        .preprocessing = TAO_PREPROCESSING_FULL,
+        .bufferencoding = TAO_ENCODING_MONO(bits),
+        .eltype = eltype,
+        .width = width,
+        .height = height,
+        .stride = stride,
+        .stride_min = stride,
+        .raw = raw,
+        .processor = _tao_preprocessing_check_reference,
+    };
+    memcpy(ctx.preproc, coefs, sizeof(ctx.preproc));
+    ctx.dat = buf + 2*n*elsize;
+    ctx.wgt = buf + 3*n*elsize;
+    _tao_preprocessing_check_reference(&ctx);
+    for (long i = 0; i < 2*n; ++i) {
+        ref[i] = _tao_preprocessing_check_get(ctx.dat, eltype, i);
+    }
+    for (long k = 0; k < bp.nbad; ++k) {
+        long i = list[k], x = i%width, y = i/width;
+        ref[n + i] = 0;
+        if (interpolate) {
+            double sum = 0;
+            long cnt = 0;
+            for (long yy = y - 1; yy <= y + 1; ++yy) {
+                for (long xx = x - 1; xx <= x + 1; ++xx) {
+                    long j = xx + yy*width;
+                    if (0 <= xx && xx < width && 0 <= yy && yy < height &&
+                        map[j] == 0) {
+                        sum += _tao_preprocessing_check_get(
+                            ctx.dat, eltype, j);
+                        ++cnt;
+                    }
+                }
+            }
+            ref[i] = (cnt > 0 ? sum/cnt : 0);
+        }
+    }
+#define _TAO_PC_MASKED(S, P, O, T)                                      \
+    tao_pixels_preprocess_full_masked_##S##_to_##O(                     \
+        (T*)buf, (T*)(buf + n*elsize), width, height,                   \
+        (const T*)coefs[0], (const T*)coefs[1], (const T*)coefs[2],     \
+        (const T*)coefs[3], (const P*)raw, stride, &bp)
+#define _TAO_PC_MASKED_BITS(O, T)                                       \
+    do {                                                                \
+        if (bits == 8) {                                                \
+            _TAO_PC_MASKED(u8, uint8_t, O, T);                          \
+        } else if (bits == 16) {                                        \
+            _TAO_PC_MASKED(u16, uint16_t, O, T);                        \
+        } else {                                                        \
+            _TAO_PC_MASKED(u32, uint32_t, O, T);                        \
+        }                                                               \
+    } while (false)
+    if (eltype == TAO_FLOAT) {
+        _TAO_PC_MASKED_BITS(flt, float);
+    } else {
+        _TAO_PC_MASKED_BITS(dbl, double);
+    }
+#undef _TAO_PC_MASKED_BITS
+#undef _TAO_PC_MASKED
+    double diff = TAO_MAX(
+        _tao_preprocessing_check_reldiff(buf, eltype, ref, n),
+        _tao_preprocessing_check_reldiff(buf + n*elsize, eltype,
+                                         ref + n, n));
+    _tao_preprocessing_check_result(
+        res, name, diff, _TAO_PREPROCESSING_CHECK_TOLERANCE(eltype));
+    status = TAO_OK;
+
+done:
+    tao_free(cbuf);
+    tao_free(raw);
+    tao_free(buf);
+    tao_free(ref);
+    tao_free(list);
+    tao_free(map);
+    return status;
+}
+
+static tao_status _tao_preprocessing_check_bad_pixels_u8(
+    tao_preprocessing_check* res)
+{
+    return _tao_preprocessing_check_bad_pixels(
+        res, 8, TAO_DOUBLE, true, "bad pixels u8 dbl");
+}
+
+static tao_status _tao_preprocessing_check_bad_pixels_u16(
+    tao_preprocessing_check* res)
+{
+    return _tao_preprocessing_check_bad_pixels(
+        res, 16, TAO_FLOAT, true, "bad pixels u16 flt");
+}
+
+// Bad pixels are not interpolated, only their weights are zeroed.
+static tao_status _tao_preprocessing_check_bad_pixels_u32(
+    tao_preprocessing_check* res)
+{
+    return _tao_preprocessing_check_bad_pixels(
+        res, 32, TAO_FLOAT, false, "bad pixels u32 flt");
+}
+
+// Reduced images published by a frame reducer (see @ref FrameReducers)
+// compared with the co-added and binned values and variances of the images
+// pre-processed by the library, summed in double precision.  Two reduced
+// images are produced, the pixels of the last macro-row and macro-column are
+// partially ignored, and a pixel of zero weight must yield a macro-pixel of
+// zero weight.
+static tao_status _tao_preprocessing_check_reducer(
+    tao_preprocessing_check* res,
+    tao_eltype               eltype,
+    const char*              name)
+{
+    const long width = 50, height = 31, n = width*height, nframes = 3;
+    const long xbin = 3, ybin = 2, w = width/xbin, h = height/ybin;
+    long stride = width*sizeof(uint16_t) + 4;
+    size_t elsize = tao_size_of_eltype(eltype);
+    tao_status status = TAO_ERROR;
+    tao_frame_reducer* red = NULL;
+    const void* coefs[4];
+    void* cbuf = _tao_preprocessing_check_coefs(eltype, n, coefs);
+    uint8_t* raw = (uint8_t*)tao_malloc(height*stride);
+    char* buf = (char*)tao_malloc(2*n*elsize);
+    double* ref = (double*)tao_malloc(2*w*h*sizeof(double));
+    if (cbuf == NULL || raw == NULL || buf == NULL || ref == NULL) {
+        goto done;
+    }
+    red = tao_frame_reducer_create("tao-check-preproc", width, height,
+                                   eltype, nframes, xbin, ybin, 0);
+    if (red == NULL) {
+        goto done;
+    }
+    tao_pixels_processor_context ctx = {
+        .preprocessing = TAO_PREPROCESSING_FULL,
+        .bufferencoding = TAO_ENCODING_MONO(16),
+        .eltype = eltype,
+        .width = width,
+        .height = height,
+        .stride = stride,
+        .stride_min = stride,
+        .raw = raw,
+        .processor = _tao_preprocessing_check_reference,
+        .dat = buf,
+        .wgt = buf + n*elsize,
+    };
+    memcpy(ctx.preproc, coefs, sizeof(ctx.preproc));
+    double* acc = ref;
+    double* var = ref + w*h;
+    for (long f = 0; f < 2*nframes; ++f) {
+        _tao_preprocessing_check_fill(raw, height*stride, 0x41C64E6D + f);
+        _tao_preprocessing_check_reference(&ctx);
+        if (f == 4) {
+            // A pixel of zero weight (e.g., a bad pixel).
+            if (eltype == TAO_FLOAT) {
+                ((float*)ctx.wgt)[7 + 5*width] = 0;
+            } else {
+                ((double*)ctx.wgt)[7 + 5*width] = 0;
+            }
+        }
+        if (f % nframes == 0) {
+            memset(ref, 0, 2*w*h*sizeof(double));
+        }
+        for (long y = 0; y < h*ybin; ++y) {
+            for (long x = 0; x < w*xbin; ++x) {
+                long i = x + y*width, j = x/xbin + (y/ybin)*w;
+                double g = _tao_preprocessing_check_get(ctx.wgt, eltype, i);
+                acc[j] += _tao_preprocessing_check_get(ctx.dat, eltype, i);
+                var[j] += (g > 0 ? 1/g : INFINITY);
+            }
+        }
+        if (tao_frame_reducer_process(red, &ctx) != TAO_OK) {
+            goto done;
+        }
+    }
+    for (long j = 0; j < w*h; ++j) {
+        var[j] = 1/var[j];
+    }
+    if (red->pending || tao_shared_array_rdlock(red->shared) != TAO_OK) {
+        goto done;
+    }
+    const char* out = (const char*)tao_shared_array_get_data(red->shared);
+    double diff = TAO_MAX(
+        _tao_preprocessing_check_reldiff(out, eltype, acc, w*h),
+        _tao_preprocessing_check_reldiff(out + w*h*elsize, eltype,
+                                         var, w*h));
+    if (tao_shared_array_unlock(red->shared) != TAO_OK) {
+        goto done;
+    }
+    _tao_preprocessing_check_result(
+        res, name, diff, _TAO_PREPROCESSING_CHECK_TOLERANCE(eltype));
+    status = TAO_OK;
+
+done:
+    tao_frame_reducer_destroy(red);
+    tao_free(cbuf);
+    tao_free(raw);
+    tao_free(buf);
+    tao_free(ref);
+    return status;
+}
+
+static tao_status _tao_preprocessing_check_reducer_flt(
+    tao_preprocessing_check* res)
+{
+    return _tao_preprocessing_check_reducer(res, TAO_FLOAT, "reducer flt");
+}
+
+static tao_status _tao_preprocessing_check_reducer_dbl(
+    tao_preprocessing_check* res)
+{
+    return _tao_preprocessing_check_reducer(res, TAO_DOUBLE, "reducer dbl");
+}
+
+// Largest error of `n` half-precision values divided by `scale` with respect
+// to reference values.  The error is relative, with an absolute floor at the
+// smallest normalized half-precision value (the absolute precision of
+// subnormal values), so it is at most 2^-11 after rounding.
+static double _tao_preprocessing_check_f16_error(
+    const tao_float16* h,
+    float              scale,
+    const float*       ref,
+    long               n)
+{
+    double d = 0, floor = ldexp(1.0, -14)/scale;
+    for (long i = 0; i < n; ++i) {
+        double e = fabs(tao_float16_to_float(h[i])/scale - ref[i])/
+            (fabs(ref[i]) + floor);
+        d = (e > d || isnan(e) ? e : d);
+    }
+    return d;
+}
+
+// Full pre-processing to half-precision (see
+// tao_pixels_preprocess_full_u16_to_f16()) and conversion of the weights
+// computed by the library with the scale used by the publishers of camera
+// servers (see tao_float16_publisher_process()).
+static tao_status _tao_preprocessing_check_float16(
+    tao_preprocessing_check* res,
+    int                      bits,
+    const char*              name)
+{
+    const long width = 61, height = 37, n = width*height;
+    long stride = width*(bits/8) + 6;
+    const void* coefs[4];
+    void* cbuf = _tao_preprocessing_check_coefs(TAO_FLOAT, n, coefs);
+    uint8_t* raw = (uint8_t*)tao_malloc(height*stride);
+    float* ref = (float*)tao_malloc(2*n*sizeof(float));
+    tao_float16* out = (tao_float16*)tao_malloc(3*n*sizeof(tao_float16));
+    tao_status status = TAO_ERROR;
+    if (cbuf == NULL || raw == NULL || ref == NULL || out == NULL) {
+        goto done;
+    }
+    _tao_preprocessing_check_fill(raw, height*stride, 0x9E3779B9);
+    if (bits == 16) {
+        // Keep pre-processed values below the largest half-precision value.
+        for (long i = 0; i < height*stride/2; ++i) {
+            ((uint16_t*)raw)[i] &= 0x7fff;
+        }
+    }
+    const float* a = coefs[0];
+    const float* b = coefs[1];
+    const float* q = coefs[2];
+    const float* r = coefs[3];
+    if (bits == 8) {
+        tao_pixels_preprocess_full_u8_to_flt(
+            ref, ref + n, width, height, a, b, q, r, raw, stride);
+        tao_pixels_preprocess_full_u8_to_f16(
+            out, out + n, width, height, a, b, q, r, raw, stride);
+    } else {
+        tao_pixels_preprocess_full_u16_to_flt(
+            ref, ref + n, width, height, a, b, q, r,
+            (const uint16_t*)raw, stride);
+        tao_pixels_preprocess_full_u16_to_f16(
+            out, out + n, width, height, a, b, q, r,
+            (const uint16_t*)raw, stride);
+    }
+    tao_pixels_convert_flt_to_f16(out + 2*n, ref + n, n,
+                                  TAO_FLOAT16_WEIGHT_SCALE);
+    double diff = TAO_MAX(
+        _tao_preprocessing_check_f16_error(out, 1, ref, 2*n),
+        _tao_preprocessing_check_f16_error(
+            out + 2*n, TAO_FLOAT16_WEIGHT_SCALE, ref + n, n));
+    _tao_preprocessing_check_result(res, name, diff,
+                                    ldexp(1.0, -11)*(1 + 1e-3));
+    status = TAO_OK;
+
+done:
+    tao_free(cbuf);
+    tao_free(raw);
+    tao_free(ref);
+    tao_free(out);
+    return status;
+}
+
+static tao_status _tao_preprocessing_check_float16_u8(
+    tao_preprocessing_check* res)
+{
+    return _tao_preprocessing_check_float16(res, 8, "float16 u8");
+}
+
+static tao_status _tao_preprocessing_check_float16_u16(
+    tao_preprocessing_check* res)
+{
+    return _tao_preprocessing_check_float16(res, 16, "float16 u16");
+}
+
+// Fixed-point pre-processing (see tao_pixels_preprocess_full_u16_to_i16())
+// compared with the full pre-processing of the library.  If `weights` is
+// false, the difference is that of the values in units of their last bit
+// (`2^-frac`) and the tolerance accounts for the rounding of the result and
+// of the gains; the values computed by the affine and full functions must
+// be identical.  Otherwise, the difference is the relative error of the
+// weights with respect to `q/(max(v,0) + r)` for the fixed-point value `v`
+// (after the rounding of the table to integers), at most 1/32 for the bins
+// of the table.
+static tao_status _tao_preprocessing_check_fixed_point(
+    tao_preprocessing_check* res,
+    int                      bits,
+    int                      outbits,
+    bool                     weights,
+    const char*              name)
+{
+    const long width = 47, height = 19, n = width*height;
+    const int rawbits = (bits == 8 ? 8 : 12), wfrac = 15;
+    const int frac = (bits == 8 ? 6 : 2);
+    long stride = width*(bits/8) + 10;
+    tao_status status = TAO_ERROR;
+    tao_fixed_point_coefs* fp = NULL;
+    const void* coefs[4];
+    void* cbuf = _tao_preprocessing_check_coefs(TAO_FLOAT, n, coefs);
+    uint8_t* raw = (uint8_t*)tao_malloc(height*stride);
+    float* ref = (float*)tao_malloc(2*n*sizeof(float));
+    void* out = tao_malloc(3*n*sizeof(int32_t));
+    if (cbuf == NULL || raw == NULL || ref == NULL || out == NULL) {
+        goto done;
+    }
+    _tao_preprocessing_check_fill(raw, height*stride, 0x7F4A7C15);
+    if (bits == 16) {
+        for (long i = 0; i < height*stride/2; ++i) {
+            ((uint16_t*)raw)[i] &= (1u << rawbits) - 1u;
+        }
+    }
+    const float* a = coefs[0];
+    const float* b = coefs[1];
+    double q = ((const float*)coefs[2])[0];
+    double r = ((const float*)coefs[3])[0];
+    fp = tao_fixed_point_coefs_create(n, a, b, q, r, rawbits, frac, wfrac);
+    if (fp == NULL) {
+        goto done;
+    }
+#define _TAO_PC_FP(S, P, O, U)                                          \
+    do {                                                                \
+        U* dat = (U*)out;                                               \
+        tao_pixels_preprocess_full_##S##_to_flt(                        \
+            ref, ref + n, width, height, a, b, coefs[2], coefs[3],      \
+            (const P*)raw, stride);                                     \
+        tao_pixels_preprocess_full_##S##_to_##O(                        \
+            dat, dat + n, width, height, fp->a, fp->c, fp->shift,       \
+            fp->lut, fp->lutshift, (const P*)raw, stride);              \
+        tao_pixels_preprocess_affine_##S##_to_##O(                      \
+            dat + 2*n, width, height, fp->a, fp->c, fp->shift,          \
+            (const P*)raw, stride);                                     \
+    } while (false)
+    if (bits == 8 && outbits == 16) {
+        _TAO_PC_FP(u8, uint8_t, i16, int16_t);
+    } else if (bits == 8) {
+        _TAO_PC_FP(u8, uint8_t, i32, int32_t);
+    } else if (outbits == 16) {
+        _TAO_PC_FP(u16, uint16_t, i16, int16_t);
+    } else {
+        _TAO_PC_FP(u16, uint16_t, i32, int32_t);
+    }
+#undef _TAO_PC_FP
+#define _TAO_PC_FP_GET(i)                                               \
+    (double)(outbits == 16 ? ((const int16_t*)out)[i] :                 \
+             ((const int32_t*)out)[i])
+    double diff = 0, tol;
+    if (weights) {
+        double rnd = ldexp(0.5, -wfrac);
+        for (long i = 0; i < n; ++i) {
+            double v = ldexp(_TAO_PC_FP_GET(i), -frac);
+            double w = q/((v > 0 ? v : 0) + r);
+            double e = TAO_MAX(
+                fabs(ldexp(_TAO_PC_FP_GET(n + i), -wfrac) - w) - rnd, 0)/w;
+            diff = (e > diff || isnan(e) ? e : diff);
+        }
+        tol = (1.0/32)*(1 + 1e-3);
+    } else {
+        long rawmax = (1L << rawbits) - 1;
+        for (long i = 0; i < n; ++i) {
+            double e = fabs(_TAO_PC_FP_GET(i) - ldexp(ref[i], frac));
+            if (_TAO_PC_FP_GET(2*n + i) != _TAO_PC_FP_GET(i)) {
+                e = INFINITY;
+            }
+            diff = (e > diff || isnan(e) ? e : diff);
+        }
+        tol = 1 + ldexp((double)rawmax, -fp->shift - 1);
+    }
+#undef _TAO_PC_FP_GET
+    _tao_preprocessing_check_result(res, name, diff, tol);
+    status = TAO_OK;
+
+done:
+    tao_fixed_point_coefs_destroy(fp);
+    tao_free(cbuf);
+    tao_free(raw);
+    tao_free(ref);
+    tao_free(out);
+    return status;
+}
+
+static tao_status _tao_preprocessing_check_fixed_point_u8_dat(
+    tao_preprocessing_check* res)
+{
+    return _tao_preprocessing_check_fixed_point(
+        res, 8, 16, false, "fixed u8 i16 dat");
+}
+
+static tao_status _tao_preprocessing_check_fixed_point_u8_wgt(
+    tao_preprocessing_check* res)
+{
+    return _tao_preprocessing_check_fixed_point(
+        res, 8, 16, true, "fixed u8 i16 wgt");
+}
+
+static tao_status _tao_preprocessing_check_fixed_point_u16_dat(
+    tao_preprocessing_check* res)
+{
+    return _tao_preprocessing_check_fixed_point(
+        res, 16, 32, false, "fixed u16 i32 dat");
+}
+
+static tao_status _tao_preprocessing_check_fixed_point_u16_wgt(
+    tao_preprocessing_check* res)
+{
+    return _tao_preprocessing_check_fixed_point(
+        res, 16, 32, true, "fixed u16 i32 wgt");
+}
+
+// All the checks.
+static tao_status (*const _tao_preprocessing_checks[])(
+    tao_preprocessing_check*) = {
+    _tao_preprocessing_check_sparse_u16,
+    _tao_preprocessing_check_sparse_p10,
+    _tao_preprocessing_check_float16_u8,
+    _tao_preprocessing_check_float16_u16,
+    _tao_preprocessing_check_packed_p10_flt,
+    _tao_preprocessing_check_packed_p10_dbl,
+    _tao_preprocessing_check_packed_p14_flt,
+    _tao_preprocessing_check_packed_p14_dbl,
+    _tao_preprocessing_check_dark_mono12,
+    _tao_preprocessing_check_dark_p10,
+    _tao_preprocessing_check_dark_p14,
+    _tao_preprocessing_check_bad_pixels_u8,
+    _tao_preprocessing_check_bad_pixels_u16,
+    _tao_preprocessing_check_bad_pixels_u32,
+    _tao_preprocessing_check_reducer_flt,
+    _tao_preprocessing_check_reducer_dbl,
+    _tao_preprocessing_check_fixed_point_u8_dat,
+    _tao_preprocessing_check_fixed_point_u8_wgt,
+    _tao_preprocessing_check_fixed_point_u16_dat,
+    _tao_preprocessing_check_fixed_point_u16_wgt,
+};
+#endif // TAO_DOXYGEN_
+
+/**
+ * Number of equivalence checks run by tao_preprocessing_check_run().
+ */
+#define TAO_PREPROCESSING_CHECKS \
+    (long)(sizeof(_tao_preprocessing_checks)/ \
+           sizeof(_tao_preprocessing_checks[0]))
+
+/**
+ * Run all the equivalence checks.
+ *
+ * @param res     Array of at least @ref TAO_PREPROCESSING_CHECKS entries to
+ *                store the results.
+ *
+ * @return The number of failed checks; -1 in case of failure to run a check.
+ */
+static inline long tao_preprocessing_check_run(
+    tao_preprocessing_check* res)
+{
+    long nfails = 0;
+    for (long k = 0; k < TAO_PREPROCESSING_CHECKS; ++k) {
+        if (_tao_preprocessing_checks[k](&res[k]) != TAO_OK) {
+            return -1;
+        }
+        if (!res[k].pass) {
+            ++nfails;
+        }
+    }
+    return nfails;
+}
+
+/**
+ * Main function of the `tao-check-preproc` program.
+ *
+ * The program runs all the equivalence checks and prints, for each check,
+ * the largest difference with the reference and the largest allowed one.
+ *
+ * @param argc    Number of arguments.
+ *
+ * @param argv    List of arguments.
+ *
+ * @return The exit status of the program, a failure if any check fails.
+ */
+static inline int tao_preprocessing_check_main(
+    int   argc,
+    char* argv[])
+{
+    tao_help_info info = {
+        .program = argv[0],
+        .args = NULL,
+        .purpose = "Check the pre-processing kernels against the library.",
+        .output = stdout,
+    };
+    tao_option options[] = {
+        TAO_OPTION_HELP_AND_EXIT(0, 0),
+        TAO_OPTION_LAST_ENTRY,
+    };
+    info.options = options;
+    options[0].ptr = &info;
+    argc = tao_parse_options(NULL, argc, argv, 0, options);
+    if (argc != 1) {
+        if (argc > 1) {
+            fprintf(stderr, "%s: too many arguments\n", argv[0]);
+        }
+        return EXIT_FAILURE;
+    }
+    tao_preprocessing_check res[TAO_PREPROCESSING_CHECKS];
+    long nfails = tao_preprocessing_check_run(res);
+    if (nfails < 0) {
+        tao_report_error();
+        return EXIT_FAILURE;
+    }
+    printf("# %-20s %10s %10s %s\n", "check", "diff", "tolerance", "result");
+    for (long k = 0; k < TAO_PREPROCESSING_CHECKS; ++k) {
+        printf("  %-20s %10.3e %10.3e %s\n", res[k].name, res[k].diff,
+               res[k].tol, (res[k].pass ? "pass" : "FAIL"));
+    }
+    return (nfails == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+/**
+ * @}
+ */
+
+TAO_END_DECLS
+
+#endif // TAO_PREPROCESSING_CHECKS_H_
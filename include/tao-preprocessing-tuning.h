@@ -0,0 +1,554 @@
+// tao-preprocessing-tuning.h -
+//
+// Run-time selection of the fastest pre-processing method.
+//
+//-----------------------------------------------------------------------------
+//
+// This file if part of TAO real-time software licensed under the MIT license
+// (https://git-cral.univ-lyon1.fr/tao/tao-rt).
+//
+// Copyright (C) 2022, Éric Thiébaut.
+
+#ifndef TAO_PREPROCESSING_TUNING_H_
+#define TAO_PREPROCESSING_TUNING_H_ 1
+
+#include <float.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <tao-basics.h>
+#include <tao-camera-servers.h>
+#include <tao-encodings.h>
+#include <tao-errors.h>
+#include <tao-pixels.h>
+#include <tao-processor-chains.h>
+#include <tao-utils.h>
+
+TAO_BEGIN_DECLS
+
+/**
+ * @defgroup PreprocessingTuning Pre-processing tuning
+ *
+ * @ingroup Cameras
+ *
+ * @brief Run-time selection of the fastest pre-processing method.
+ *
+ * @{
+ *
+ * The fastest variant of the full pre-processing of raw images (see @ref
+ * PreprocessingTests) depends on the processor and on the size of the images.
+ * This header encodes all the variants, for raw pixels of type `uint8_t`,
+ * `uint16_t`, or `uint32_t` and for `float` or `double` results, that use the
+ * same pre-processing parameters as the camera servers, that is `dat = (raw -
+ * b)*a` (variants `i + 10*j` with `i = 1` or `2` and `j = 1, ..., 7`).
+ * Each variant is compiled for several instruction sets (AVX-512, AVX2, and
+ * the baseline of the target, that is SSE2 for x86-64) with the best one
+ * selected at run-time (see @ref TAO_SIMD_CLONES).
+ *
+ * Function tao_preprocessing_tune() benchmarks all the variants for the
+ * actual image size and encoding described by a pixel processing context and
+ * installs a pixel processor calling the fastest one in the context.  The
+ * benchmark uses private buffers, so it does not touch the images of the
+ * server.  Before being timed, the result of each variant is compared with
+ * that of the corresponding function of the library (e.g.,
+ * tao_pixels_preprocess_full_u16_to_flt()) on a synthetic image; variants
+ * whose pre-processed pixels or weights differ by more than the rounding
+ * errors are never selected.  The selection is done once for each
+ * combination of pixel types and image size.
+ *
+ * Camera servers call tao_camera_server_tune_preprocessing() to add a stage
+ * (see @ref ProcessorChains) applying tao_preprocessing_tune() to the pixel
+ * processing context of the server, so that the tuned pixel processor is
+ * installed again whenever the library resets the pixel processor, e.g.
+ * after the camera has been configured.
+ *
+ * This header defines static functions, it must be included by a single
+ * compilation unit.
+ */
+
+/**
+ * @def TAO_PREPROCESSING_TUNING_REPEATS
+ *
+ * Number of timed calls of each pre-processing variant.  The fastest call is
+ * retained.
+ */
+#ifndef TAO_PREPROCESSING_TUNING_REPEATS
+#  define TAO_PREPROCESSING_TUNING_REPEATS 5
+#endif
+
+/**
+ * Number of pre-processing variants.
+ */
+#define TAO_PREPROCESSING_VARIANTS 14
+
+/**
+ * Identifiers of the pre-processing variants.
+ */
+static const int tao_preprocessing_variants[TAO_PREPROCESSING_VARIANTS] = {
+    11, 12, 21, 22, 31, 32, 41,
+    42, 51, 52, 61, 62, 71, 72
+};
+
+/**
+ * Get the name of the instruction set selected for SIMD clones.
+ *
+ * @return The name of the instruction set that is used by functions marked
+ *         by @ref TAO_SIMD_CLONES on this machine.
+ */
+static inline const char* tao_preprocessing_target(
+    void)
+{
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return "AVX-512";
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return "AVX2";
+    }
+    return "SSE2";
+#else
+    return "default";
+#endif
+}
+
+#ifndef TAO_DOXYGEN_
+// Pixel processor replaced by the tuned one, called for images whose rows
+// are not aligned on pixel boundaries.
+static tao_pixels_processor* _tao_preprocessing_fallback = NULL;
+
+// Relative tolerance for the comparison of the results of a pre-processing
+// variant with those of the library function.
+#define _TAO_PREPROCESSING_TOLERANCE(T) \
+    (sizeof(T) == sizeof(float) ? 1e3*FLT_EPSILON : 1e3*DBL_EPSILON)
+
+// Fill a buffer with pseudo-random raw bytes.
+static void _tao_preprocessing_fill(
+    void*  raw,
+    size_t size)
+{
+    uint32_t seed = 0x2545F491;
+    for (size_t i = 0; i < size; ++i) {
+        seed = seed*1664525 + 1013904223;
+        ((uint8_t*)raw)[i] = (uint8_t)(seed >> 24);
+    }
+}
+
+#define _TAO_PT_JOIN2_(a, b) a##_##b
+#define _TAO_PT_JOIN2(a, b) _TAO_PT_JOIN2_(a, b)
+#define _TAO_PT_JOIN3_(a, b, c) a##_##b##_##c
+#define _TAO_PT_JOIN3(a, b, c) _TAO_PT_JOIN3_(a, b, c)
+#define _TAO_PT_NAME(name) _TAO_PT_JOIN2(name, _TAO_PT_SUFFIX)
+#define _TAO_PT_KERNEL(v) _TAO_PT_JOIN3(_tao_preproc, _TAO_PT_SUFFIX, v)
+#define _TAO_PT_LIBRARY(sfx) _TAO_PT_JOIN2(tao_pixels_preprocess_full, sfx)
+
+#define _TAO_PT_PIXEL  uint8_t
+#define _TAO_PT_FLOAT  float
+#define _TAO_PT_SUFFIX u8_to_flt
+#include <tao-preprocessing-tuning.h>
+#undef _TAO_PT_PIXEL
+#undef _TAO_PT_FLOAT
+#undef _TAO_PT_SUFFIX
+
+#define _TAO_PT_PIXEL  uint16_t
+#define _TAO_PT_FLOAT  float
+#define _TAO_PT_SUFFIX u16_to_flt
+#include <tao-preprocessing-tuning.h>
+#undef _TAO_PT_PIXEL
+#undef _TAO_PT_FLOAT
+#undef _TAO_PT_SUFFIX
+
+#define _TAO_PT_PIXEL  uint32_t
+#define _TAO_PT_FLOAT  float
+#define _TAO_PT_SUFFIX u32_to_flt
+#include <tao-preprocessing-tuning.h>
+#undef _TAO_PT_PIXEL
+#undef _TAO_PT_FLOAT
+#undef _TAO_PT_SUFFIX
+
+#define _TAO_PT_PIXEL  uint8_t
+#define _TAO_PT_FLOAT  double
+#define _TAO_PT_SUFFIX u8_to_dbl
+#include <tao-preprocessing-tuning.h>
+#undef _TAO_PT_PIXEL
+#undef _TAO_PT_FLOAT
+#undef _TAO_PT_SUFFIX
+
+#define _TAO_PT_PIXEL  uint16_t
+#define _TAO_PT_FLOAT  double
+#define _TAO_PT_SUFFIX u16_to_dbl
+#include <tao-preprocessing-tuning.h>
+#undef _TAO_PT_PIXEL
+#undef _TAO_PT_FLOAT
+#undef _TAO_PT_SUFFIX
+
+#define _TAO_PT_PIXEL  uint32_t
+#define _TAO_PT_FLOAT  double
+#define _TAO_PT_SUFFIX u32_to_dbl
+#include <tao-preprocessing-tuning.h>
+#undef _TAO_PT_PIXEL
+#undef _TAO_PT_FLOAT
+#undef _TAO_PT_SUFFIX
+#endif // TAO_DOXYGEN_
+
+/**
+ * Select the fastest pre-processing method.
+ *
+ * If the pixel processing context describes full pre-processing (@ref
+ * TAO_PREPROCESSING_FULL) of raw pixels encoded as 8, 16 or 32-bit unsigned
+ * integers into `float` or `double` values, this function benchmarks all the
+ * pre-processing variants for the image size of the context (the first time
+ * it is called for a given combination of pixel types and whenever the image
+ * size has changed since the last benchmark) and replaces the pixel
+ * processor of the context by one calling the fastest variant which agrees
+ * with the library.  The benchmark is done on private buffers, the buffers
+ * referenced by the context are not used.  Otherwise, or if no variant agrees
+ * with the library, the context is left unchanged.
+ *
+ * @param ctx      Pixel processing context.
+ *
+ * @param variant  Address to store the identifier of the selected variant or
+ *                 0 if the context has been left unchanged.  Can be `NULL`.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure.
+ */
+static inline tao_status tao_preprocessing_tune(
+    tao_pixels_processor_context* ctx,
+    int*                          variant)
+{
+    if (variant != NULL) {
+        *variant = 0;
+    }
+    if (ctx->preprocessing != TAO_PREPROCESSING_FULL) {
+        return TAO_OK;
+    }
+    tao_encoding enc = ctx->bufferencoding;
+    unsigned bits = TAO_ENCODING_BITS_PER_PIXEL(enc);
+    if (TAO_ENCODING_COLORANT(enc) != TAO_COLORANT_MONO ||
+        TAO_ENCODING_BITS_PER_PACKET(enc) != bits) {
+        return TAO_OK;
+    }
+    if (ctx->eltype == TAO_FLOAT) {
+        switch (bits) {
+        case 8:  return _tao_preprocessing_tune_u8_to_flt(ctx, variant);
+        case 16: return _tao_preprocessing_tune_u16_to_flt(ctx, variant);
+        case 32: return _tao_preprocessing_tune_u32_to_flt(ctx, variant);
+        }
+    } else if (ctx->eltype == TAO_DOUBLE) {
+        switch (bits) {
+        case 8:  return _tao_preprocessing_tune_u8_to_dbl(ctx, variant);
+        case 16: return _tao_preprocessing_tune_u16_to_dbl(ctx, variant);
+        case 32: return _tao_preprocessing_tune_u32_to_dbl(ctx, variant);
+        }
+    }
+    return TAO_OK;
+}
+
+#ifndef TAO_DOXYGEN_
+// Last reported variant and image size.
+static long _tao_preprocessing_reported[3] = {0, 0, 0};
+
+static tao_status _tao_preprocessing_tuning_stage(
+    tao_camera_server* srv)
+{
+    int variant;
+    if (tao_preprocessing_tune(&srv->proc, &variant) != TAO_OK) {
+        return TAO_ERROR;
+    }
+    if (variant > 0 && (variant != _tao_preprocessing_reported[0] ||
+                        srv->proc.width != _tao_preprocessing_reported[1] ||
+                        srv->proc.height != _tao_preprocessing_reported[2])) {
+        _tao_preprocessing_reported[0] = variant;
+        _tao_preprocessing_reported[1] = srv->proc.width;
+        _tao_preprocessing_reported[2] = srv->proc.height;
+        tao_inform(srv->logfile, TAO_MESG_INFO,
+                   "Pre-processing variant %d selected for %ld×%ld images "
+                   "(%s instructions)\n", variant, srv->proc.width,
+                   srv->proc.height, tao_preprocessing_target());
+    }
+    return TAO_OK;
+}
+#endif // TAO_DOXYGEN_
+
+/**
+ * Select the fastest pre-processing method for a camera server.
+ *
+ * This function adds (or removes) a stage of rank @ref
+ * TAO_PROCESSOR_RANK_KERNEL to the chain of pixel processors of the camera
+ * server.  When acquisition is started, this stage calls
+ * tao_preprocessing_tune() for the pixel processing context of the server,
+ * which benchmarks the variants again if the image size has changed, and
+ * then reports the selected variant and instruction set in the log of the
+ * server.  The camera must not be acquiring.
+ *
+ * @param srv     Camera server.
+ *
+ * @param enable  Whether to use the fastest pre-processing method.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure.
+ */
+static inline tao_status tao_camera_server_tune_preprocessing(
+    tao_camera_server* srv,
+    bool               enable)
+{
+    if (!enable) {
+        return tao_camera_server_remove_processor_stage(
+            srv, _tao_preprocessing_tuning_stage);
+    }
+    return tao_camera_server_add_processor_stage(
+        srv, _tao_preprocessing_tuning_stage, TAO_PROCESSOR_RANK_KERNEL,
+        true);
+}
+
+/**
+ * @}
+ */
+
+TAO_END_DECLS
+
+#endif // TAO_PREPROCESSING_TUNING_H_
+
+//-----------------------------------------------------------------------------
+// Code encoded for each combination of pixel types and for each variant.
+
+#if defined(_TAO_PT_PIXEL) && defined(_TAO_PT_VARIANT)
+
+#define PREPROC_SCOPE      static
+#define PREPROC_ATTRIBUTES TAO_SIMD_CLONES
+#define PREPROC_PIXEL      _TAO_PT_PIXEL
+#define PREPROC_FLOAT      _TAO_PT_FLOAT
+#define PREPROC_FUNC       _TAO_PT_KERNEL(_TAO_PT_VARIANT)
+#define PREPROC_VARIANT    _TAO_PT_VARIANT
+#include <tao-test-preprocessing.h>
+#undef PREPROC_SCOPE
+#undef PREPROC_ATTRIBUTES
+
+#elif defined(_TAO_PT_PIXEL)
+
+#define _TAO_PT_VARIANT 11
+#include <tao-preprocessing-tuning.h>
+#undef _TAO_PT_VARIANT
+#define _TAO_PT_VARIANT 12
+#include <tao-preprocessing-tuning.h>
+#undef _TAO_PT_VARIANT
+#define _TAO_PT_VARIANT 21
+#include <tao-preprocessing-tuning.h>
+#undef _TAO_PT_VARIANT
+#define _TAO_PT_VARIANT 22
+#include <tao-preprocessing-tuning.h>
+#undef _TAO_PT_VARIANT
+#define _TAO_PT_VARIANT 31
+#include <tao-preprocessing-tuning.h>
+#undef _TAO_PT_VARIANT
+#define _TAO_PT_VARIANT 32
+#include <tao-preprocessing-tuning.h>
+#undef _TAO_PT_VARIANT
+#define _TAO_PT_VARIANT 41
+#include <tao-preprocessing-tuning.h>
+#undef _TAO_PT_VARIANT
+#define _TAO_PT_VARIANT 42
+#include <tao-preprocessing-tuning.h>
+#undef _TAO_PT_VARIANT
+#define _TAO_PT_VARIANT 51
+#include <tao-preprocessing-tuning.h>
+#undef _TAO_PT_VARIANT
+#define _TAO_PT_VARIANT 52
+#include <tao-preprocessing-tuning.h>
+#undef _TAO_PT_VARIANT
+#define _TAO_PT_VARIANT 61
+#include <tao-preprocessing-tuning.h>
+#undef _TAO_PT_VARIANT
+#define _TAO_PT_VARIANT 62
+#include <tao-preprocessing-tuning.h>
+#undef _TAO_PT_VARIANT
+#define _TAO_PT_VARIANT 71
+#include <tao-preprocessing-tuning.h>
+#undef _TAO_PT_VARIANT
+#define _TAO_PT_VARIANT 72
+#include <tao-preprocessing-tuning.h>
+#undef _TAO_PT_VARIANT
+
+typedef void _TAO_PT_NAME(_tao_preprocessing_kernel)(
+    long width,
+    long height,
+    long stride,
+    _TAO_PT_FLOAT*       restrict wgt,
+    _TAO_PT_FLOAT*       restrict dat,
+    _TAO_PT_PIXEL const* restrict img,
+    _TAO_PT_FLOAT const* restrict a,
+    _TAO_PT_FLOAT const* restrict b,
+    _TAO_PT_FLOAT const* restrict q,
+    _TAO_PT_FLOAT const* restrict r);
+
+static _TAO_PT_NAME(_tao_preprocessing_kernel)* const
+_TAO_PT_NAME(_tao_preprocessing_kernels)[TAO_PREPROCESSING_VARIANTS] = {
+    _TAO_PT_KERNEL(11), _TAO_PT_KERNEL(12),
+    _TAO_PT_KERNEL(21), _TAO_PT_KERNEL(22),
+    _TAO_PT_KERNEL(31), _TAO_PT_KERNEL(32),
+    _TAO_PT_KERNEL(41), _TAO_PT_KERNEL(42),
+    _TAO_PT_KERNEL(51), _TAO_PT_KERNEL(52),
+    _TAO_PT_KERNEL(61), _TAO_PT_KERNEL(62),
+    _TAO_PT_KERNEL(71), _TAO_PT_KERNEL(72)
+};
+
+// Compare the pre-processed pixels and weights computed by a variant with
+// the reference ones computed by the library.  The maximum absolute difference
+// is stored in `diff`.  Return whether the differences are within the
+// tolerance relative to the largest magnitude of the reference values.
+static bool _TAO_PT_NAME(_tao_preprocessing_agree)(
+    const _TAO_PT_FLOAT* dat,
+    const _TAO_PT_FLOAT* wgt,
+    const _TAO_PT_FLOAT* refdat,
+    const _TAO_PT_FLOAT* refwgt,
+    long                 npixels,
+    double*              diff)
+{
+    double ddat = 0, dwgt = 0, mdat = 0, mwgt = 0;
+    for (long i = 0; i < npixels; ++i) {
+        // NaN's are propagated to the differences.
+        double e = fabs((double)dat[i] - (double)refdat[i]);
+        ddat = (e > ddat || isnan(e) ? e : ddat);
+        e = fabs((double)wgt[i] - (double)refwgt[i]);
+        dwgt = (e > dwgt || isnan(e) ? e : dwgt);
+        mdat = TAO_MAX(mdat, fabs((double)refdat[i]));
+        mwgt = TAO_MAX(mwgt, fabs((double)refwgt[i]));
+    }
+    double tol = _TAO_PREPROCESSING_TOLERANCE(_TAO_PT_FLOAT);
+    *diff = (isnan(ddat) || isnan(dwgt) ? NAN : TAO_MAX(ddat, dwgt));
+    return ddat <= tol*mdat && dwgt <= tol*mwgt;
+}
+
+// Index of selected variant, -1 if no variant agrees with the library or if
+// not yet tuned.
+static int _TAO_PT_NAME(_tao_preprocessing_selected) = -1;
+
+// Width and height of the images for which the variant has been selected.
+static long _TAO_PT_NAME(_tao_preprocessing_tuned)[2] = {0, 0};
+
+static void _TAO_PT_NAME(_tao_preprocessing_processor)(
+    const tao_pixels_processor_context* ctx)
+{
+    if (ctx->stride%sizeof(_TAO_PT_PIXEL) != 0) {
+        _tao_preprocessing_fallback(ctx);
+        return;
+    }
+    _TAO_PT_NAME(_tao_preprocessing_kernels)[
+        _TAO_PT_NAME(_tao_preprocessing_selected)](
+            ctx->width, ctx->height,
+            ctx->stride/(long)sizeof(_TAO_PT_PIXEL),
+            (_TAO_PT_FLOAT*)ctx->wgt,
+            (_TAO_PT_FLOAT*)ctx->dat,
+            (_TAO_PT_PIXEL const*)ctx->raw,
+            (_TAO_PT_FLOAT const*)ctx->preproc[0],
+            (_TAO_PT_FLOAT const*)ctx->preproc[1],
+            (_TAO_PT_FLOAT const*)ctx->preproc[2],
+            (_TAO_PT_FLOAT const*)ctx->preproc[3]);
+}
+
+static tao_status _TAO_PT_NAME(_tao_preprocessing_tune)(
+    tao_pixels_processor_context* ctx,
+    int*                          variant)
+{
+    long width = ctx->width, height = ctx->height, npixels = width*height;
+    if (width < 1 || height < 1) {
+        tao_store_error(__func__, TAO_BAD_SIZE);
+        return TAO_ERROR;
+    }
+    if (_TAO_PT_NAME(_tao_preprocessing_tuned)[0] != width ||
+        _TAO_PT_NAME(_tao_preprocessing_tuned)[1] != height) {
+        // Benchmark on private buffers with synthetic raw pixels and
+        // coefficients: raw pixels, then pre-processed pixels, weights, `a`,
+        // `b`, `q`, `r`, and reference pixels and weights.
+        _TAO_PT_PIXEL* raw = (_TAO_PT_PIXEL*)tao_malloc(
+            npixels*sizeof(_TAO_PT_PIXEL));
+        _TAO_PT_FLOAT* buf = (_TAO_PT_FLOAT*)tao_malloc(
+            8*npixels*sizeof(_TAO_PT_FLOAT));
+        if (raw == NULL || buf == NULL) {
+            tao_free(raw);
+            tao_free(buf);
+            return TAO_ERROR;
+        }
+        _tao_preprocessing_fill(raw, npixels*sizeof(_TAO_PT_PIXEL));
+        for (long i = 0; i < npixels; ++i) {
+            buf[2*npixels + i] = 1.1 + 0.01*(i%7);
+            buf[3*npixels + i] = 10 + (i%13);
+            buf[4*npixels + i] = 1;
+            buf[5*npixels + i] = 2.5;
+        }
+        tao_pixels_processor_context tmp = *ctx;
+        tmp.raw = raw;
+        tmp.stride = width*sizeof(_TAO_PT_PIXEL);
+        tmp.dat = buf;
+        tmp.wgt = buf + npixels;
+        for (int j = 0; j < 4; ++j) {
+            tmp.preproc[j] = buf + (j + 2)*npixels;
+        }
+        _TAO_PT_FLOAT* refdat = buf + 6*npixels;
+        _TAO_PT_FLOAT* refwgt = buf + 7*npixels;
+        _TAO_PT_LIBRARY(_TAO_PT_SUFFIX)(
+            refdat, refwgt, width, height, tmp.preproc[0], tmp.preproc[1],
+            tmp.preproc[2], tmp.preproc[3], raw, tmp.stride);
+        int best = -1;
+        double tbest = HUGE_VAL;
+        tao_status status = TAO_OK;
+        for (int k = 0; k < TAO_PREPROCESSING_VARIANTS; ++k) {
+            // First call is not timed to warm-up caches and to check the
+            // result.
+            double diff;
+            _TAO_PT_NAME(_tao_preprocessing_selected) = k;
+            _TAO_PT_NAME(_tao_preprocessing_processor)(&tmp);
+            if (!_TAO_PT_NAME(_tao_preprocessing_agree)(
+                    tmp.dat, tmp.wgt, refdat, refwgt, npixels, &diff)) {
+                continue;
+            }
+            for (int rep = 0; rep < TAO_PREPROCESSING_TUNING_REPEATS; ++rep) {
+                tao_time t0, t1;
+                if (tao_get_monotonic_time(&t0) != TAO_OK) {
+                    status = TAO_ERROR;
+                    break;
+                }
+                _TAO_PT_NAME(_tao_preprocessing_processor)(&tmp);
+                if (tao_get_monotonic_time(&t1) != TAO_OK) {
+                    status = TAO_ERROR;
+                    break;
+                }
+                double t = tao_elapsed_seconds(&t1, &t0);
+                if (t < tbest) {
+                    tbest = t;
+                    best = k;
+                }
+            }
+        }
+        tao_free(raw);
+        tao_free(buf);
+        _TAO_PT_NAME(_tao_preprocessing_selected) = -1;
+        _TAO_PT_NAME(_tao_preprocessing_tuned)[0] = 0;
+        _TAO_PT_NAME(_tao_preprocessing_tuned)[1] = 0;
+        if (status != TAO_OK) {
+            return TAO_ERROR;
+        }
+        _TAO_PT_NAME(_tao_preprocessing_selected) = best;
+        _TAO_PT_NAME(_tao_preprocessing_tuned)[0] = width;
+        _TAO_PT_NAME(_tao_preprocessing_tuned)[1] = height;
+    }
+    if (_TAO_PT_NAME(_tao_preprocessing_selected) < 0) {
+        // No variant agrees with the library, keep the library function.
+        if (ctx->processor == _TAO_PT_NAME(_tao_preprocessing_processor)) {
+            ctx->processor = _tao_preprocessing_fallback;
+        }
+        return TAO_OK;
+    }
+    if (ctx->processor != _TAO_PT_NAME(_tao_preprocessing_processor)) {
+        _tao_preprocessing_fallback = ctx->processor;
+    }
+    ctx->processor = _TAO_PT_NAME(_tao_preprocessing_processor);
+    if (variant != NULL) {
+        *variant = tao_preprocessing_variants[
+            _TAO_PT_NAME(_tao_preprocessing_selected)];
+    }
+    return TAO_OK;
+}
+
+#endif // _TAO_PT_PIXEL
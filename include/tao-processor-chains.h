@@ -0,0 +1,384 @@
+// tao-processor-chains.h -
+//
+// Chains of pixel processors of camera servers in TAO library.
+//
+//-----------------------------------------------------------------------------
+//
+// This file if part of TAO real-time software licensed under the MIT license
+// (https://git-cral.univ-lyon1.fr/tao/tao-rt).
+//
+// Copyright (C) 2022, Éric Thiébaut.
+
+#ifndef TAO_PROCESSOR_CHAINS_H_
+#define TAO_PROCESSOR_CHAINS_H_ 1
+
+#include <tao-basics.h>
+#include <tao-camera-servers.h>
+#include <tao-cameras-private.h>
+#include <tao-errors.h>
+#include <tao-utils.h>
+
+TAO_BEGIN_DECLS
+
+/**
+ * @defgroup ProcessorChains  Processor chains
+ *
+ * @ingroup Cameras
+ *
+ * @brief Stages wrapping the pixel processor of camera servers.
+ *
+ * @{
+ *
+ * Several extensions of the camera servers (tuned or parallel
+ * pre-processing, calibration, bad pixels, etc.) work by replacing the pixel
+ * processor of the server (member `proc.processor` of @ref
+ * tao_camera_server) by their own which, in general, calls the one it has
+ * replaced.  The library resets the pixel processor of the server when the
+ * worker starts and whenever the camera is configured, so these replacements
+ * cannot simply be done once.
+ *
+ * Instead, each extension registers a stage, that is a function installing
+ * its pixel processor over the one in place, and the stages are applied in
+ * turn, by increasing rank (see @ref tao_processor_rank) and then by order
+ * of registration, over the pixel processor chosen by the library.  The
+ * chain of stages is applied by the worker of the server with the camera
+ * locked, when acquisition is started and before waiting for each frame, if
+ * the pixel processor has been reset by the library or if the stages have
+ * changed.  For that, the `start` and `wait_buffer` methods of the camera
+ * device are replaced by the first call to
+ * tao_camera_server_add_processor_stage().
+ *
+ * Stages can only be added or removed while the camera is not acquiring, the
+ * new chain is then applied when acquisition is next started.  As a result,
+ * the pixel processor of a stage is never called after the stage has been
+ * removed and the resources it uses can be released.
+ *
+ * There is a single chain of stages per process.
+ *
+ * This header defines static functions, it must be included by a single
+ * compilation unit.
+ */
+
+/**
+ * @def TAO_PROCESSOR_CHAIN_MAX_STAGES
+ *
+ * Maximum number of stages in the chain of pixel processors.
+ */
+#define TAO_PROCESSOR_CHAIN_MAX_STAGES 16
+
+/**
+ * Ranks of the stages of the chain of pixel processors.
+ *
+ * Stages of lower rank are applied first, so their pixel processors are
+ * called by those of higher rank.
+ */
+typedef enum tao_processor_rank {
+    TAO_PROCESSOR_RANK_KERNEL      = 0,///< Replaces the processing kernel.
+    TAO_PROCESSOR_RANK_SPLIT       = 1,///< Splits images between threads.
+    TAO_PROCESSOR_RANK_COPY        = 2,///< Avoids copying raw images.
+    TAO_PROCESSOR_RANK_PIPELINE    = 3,///< Pipelines the processing.
+    TAO_PROCESSOR_RANK_MASK        = 4,///< Masks pixels.
+    TAO_PROCESSOR_RANK_CALIBRATION = 5,///< Changes pre-processing parameters.
+    TAO_PROCESSOR_RANK_OUTPUT      = 6,///< Uses raw or processed images.
+    TAO_PROCESSOR_RANK_PUBLICATION = 7,///< Brackets writing of output images.
+    TAO_PROCESSOR_RANK_TIMING      = 8,///< Measures processing times.
+} tao_processor_rank;
+
+/**
+ * Prototype of a function installing a stage of the chain of pixel
+ * processors.
+ *
+ * This function is called by the worker of the camera server, with the
+ * camera locked, to apply the chain of pixel processors.  The pixel
+ * processor in place in `srv->proc.processor` is the one beneath the stage,
+ * the function shall save it (if its pixel processor calls it) and replace it
+ * by its own.  In case of failure, the function shall leave the pixel
+ * processor unchanged, store the error and return @ref TAO_ERROR.
+ */
+typedef tao_status tao_processor_stage(
+    tao_camera_server* srv);
+
+#ifndef TAO_DOXYGEN_
+// Chain of pixel processors.  All members, but the stages, are only used by
+// the worker of the camera server.  The stages are only modified with the
+// camera locked and not acquiring.
+static struct {
+    tao_camera_server*         srv;// Camera server.
+    const tao_camera_ops*   driver;// Methods of the camera beneath the chain.
+    tao_camera_ops             ops;// Methods of the camera with the chain.
+    tao_pixels_processor*     base;// Pixel processor chosen by the library.
+    tao_pixels_processor*      top;// Pixel processor of the applied chain.
+    bool                   changed;// Stages changed since last applied.
+    long                    nstages;// Number of stages.
+    struct {
+        tao_processor_stage* stage;// Function installing the stage.
+        tao_processor_rank    rank;// Rank of the stage.
+        bool             reentrant;// Pixel processor of stage is reentrant.
+    } stages[TAO_PROCESSOR_CHAIN_MAX_STAGES];
+} _tao_processor_chain;
+
+// Apply the chain of pixel processors if needed.
+static void _tao_processor_chain_apply(
+    tao_camera_server* srv)
+{
+    tao_pixels_processor_context* ctx = &srv->proc;
+    if (ctx->processor == _tao_processor_chain.top &&
+        !_tao_processor_chain.changed) {
+        return;
+    }
+    if (ctx->processor != _tao_processor_chain.top) {
+        // Pixel processor has been reset by the library.
+        _tao_processor_chain.base = ctx->processor;
+    }
+    ctx->processor = _tao_processor_chain.base;
+    for (long k = 0; k < _tao_processor_chain.nstages; ++k) {
+        if (_tao_processor_chain.stages[k].stage(srv) != TAO_OK) {
+            tao_report_error();
+        }
+    }
+    _tao_processor_chain.top = ctx->processor;
+    _tao_processor_chain.changed = false;
+}
+
+static tao_status _tao_processor_chain_start(
+    tao_camera* cam)
+{
+    _tao_processor_chain_apply(_tao_processor_chain.srv);
+    return _tao_processor_chain.driver->start(cam);
+}
+
+static tao_status _tao_processor_chain_wait_buffer(
+    tao_camera*             cam,
+    tao_acquisition_buffer* buf,
+    double                  secs,
+    int                     drop)
+{
+    _tao_processor_chain_apply(_tao_processor_chain.srv);
+    return _tao_processor_chain.driver->wait_buffer(cam, buf, secs, drop);
+}
+
+// Lock the camera of the server and check that the chain can be modified.
+static tao_status _tao_processor_chain_lock(
+    tao_camera_server* srv,
+    const char*        func)
+{
+    if (_tao_processor_chain.srv != NULL && _tao_processor_chain.srv != srv) {
+        tao_store_error(func, TAO_ALREADY_IN_USE);
+        return TAO_ERROR;
+    }
+    if (tao_camera_lock(srv->device) != TAO_OK) {
+        return TAO_ERROR;
+    }
+    if (srv->device->runlevel == 2) {
+        tao_camera_unlock(srv->device);
+        tao_store_error(func, TAO_ACQUISITION_RUNNING);
+        return TAO_ERROR;
+    }
+    return TAO_OK;
+}
+#endif // TAO_DOXYGEN_
+
+/**
+ * Add a stage to the chain of pixel processors of a camera server.
+ *
+ * If the stage is already in the chain, its rank is updated.  The chain is
+ * applied when acquisition is next started.  This function shall not be
+ * called by the worker of the server.
+ *
+ * @param srv        Camera server.
+ *
+ * @param stage      Function installing the stage.
+ *
+ * @param rank       Rank of the stage.
+ *
+ * @param reentrant  Whether the pixel processor of the stage can be called
+ *                   by several threads at the same time provided the pixel
+ *                   processors beneath it are reentrant.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure, e.g. if
+ *         the camera is acquiring.
+ */
+static inline tao_status tao_camera_server_add_processor_stage(
+    tao_camera_server*  srv,
+    tao_processor_stage* stage,
+    tao_processor_rank  rank,
+    bool                reentrant)
+{
+    if (_tao_processor_chain_lock(srv, __func__) != TAO_OK) {
+        return TAO_ERROR;
+    }
+    long n = _tao_processor_chain.nstages, j = 0;
+    while (j < n && _tao_processor_chain.stages[j].stage != stage) {
+        ++j;
+    }
+    if (j < n) {
+        // Remove the stage to insert it again.
+        for (--n; j < n; ++j) {
+            _tao_processor_chain.stages[j] = _tao_processor_chain.stages[j+1];
+        }
+    } else if (n >= TAO_PROCESSOR_CHAIN_MAX_STAGES) {
+        tao_camera_unlock(srv->device);
+        tao_store_error(__func__, TAO_EXHAUSTED);
+        return TAO_ERROR;
+    }
+    tao_camera* cam = srv->device;
+    if (cam->ops != &_tao_processor_chain.ops) {
+        _tao_processor_chain.srv = srv;
+        _tao_processor_chain.driver = cam->ops;
+        _tao_processor_chain.ops = *cam->ops;
+        _tao_processor_chain.ops.start = _tao_processor_chain_start;
+        _tao_processor_chain.ops.wait_buffer =
+            _tao_processor_chain_wait_buffer;
+        cam->ops = &_tao_processor_chain.ops;
+    }
+    for (j = n; j > 0 && _tao_processor_chain.stages[j-1].rank > rank; --j) {
+        _tao_processor_chain.stages[j] = _tao_processor_chain.stages[j-1];
+    }
+    _tao_processor_chain.stages[j].stage = stage;
+    _tao_processor_chain.stages[j].rank = rank;
+    _tao_processor_chain.stages[j].reentrant = reentrant;
+    _tao_processor_chain.nstages = n + 1;
+    _tao_processor_chain.changed = true;
+    tao_camera_unlock(cam);
+    return TAO_OK;
+}
+
+/**
+ * Remove a stage from the chain of pixel processors of a camera server.
+ *
+ * Nothing is done if the stage is not in the chain.  The pixel processor of
+ * the stage is no longer called once this function has returned.  This
+ * function shall not be called by the worker of the server.
+ *
+ * @param srv     Camera server.
+ *
+ * @param stage   Function installing the stage.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure, e.g. if
+ *         the camera is acquiring.
+ */
+static inline tao_status tao_camera_server_remove_processor_stage(
+    tao_camera_server*   srv,
+    tao_processor_stage* stage)
+{
+    if (_tao_processor_chain_lock(srv, __func__) != TAO_OK) {
+        return TAO_ERROR;
+    }
+    long n = _tao_processor_chain.nstages, j = 0;
+    while (j < n && _tao_processor_chain.stages[j].stage != stage) {
+        ++j;
+    }
+    if (j < n) {
+        for (--n; j < n; ++j) {
+            _tao_processor_chain.stages[j] = _tao_processor_chain.stages[j+1];
+        }
+        _tao_processor_chain.nstages = n;
+        _tao_processor_chain.changed = true;
+    }
+    tao_camera_unlock(srv->device);
+    return TAO_OK;
+}
+
+/**
+ * Check whether a stage is in the chain of pixel processors.
+ *
+ * This function is intended to be called by the worker of the camera server
+ * (for instance by the methods of the camera driver), when the chain is
+ * applied.
+ *
+ * @param stage   Function installing the stage.
+ *
+ * @return Whether the stage is in the chain.
+ */
+static inline bool tao_processor_chain_has_stage(
+    tao_processor_stage* stage)
+{
+    for (long k = 0; k < _tao_processor_chain.nstages; ++k) {
+        if (_tao_processor_chain.stages[k].stage == stage) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Check whether the pixel processors beneath a given rank are reentrant.
+ *
+ * This function is intended to be called by the function installing a stage
+ * whose pixel processor calls the one beneath it from several threads.
+ *
+ * @param rank    Rank of the stage.
+ *
+ * @return Whether the pixel processors of the stages of lower rank can be
+ *         called by several threads at the same time.  The pixel processors
+ *         of the library are.
+ */
+static inline bool tao_processor_chain_is_reentrant(
+    tao_processor_rank rank)
+{
+    for (long k = 0; k < _tao_processor_chain.nstages; ++k) {
+        if (_tao_processor_chain.stages[k].rank < rank &&
+            !_tao_processor_chain.stages[k].reentrant) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Get the methods of the camera device beneath the chain of pixel
+ * processors.
+ *
+ * Extensions replacing methods of the camera device of a server shall use
+ * this function and tao_camera_server_set_camera_ops() so that the chain of
+ * pixel processors is applied before calling their methods.  The camera
+ * shall be locked by the caller and not acquiring.
+ *
+ * @param srv     Camera server.
+ *
+ * @return The methods called by the chain or, if there is no chain, those
+ *         of the camera device.
+ */
+static inline const tao_camera_ops* tao_camera_server_get_camera_ops(
+    tao_camera_server* srv)
+{
+    tao_camera* cam = srv->device;
+    return (cam->ops == &_tao_processor_chain.ops ?
+            _tao_processor_chain.driver : cam->ops);
+}
+
+/**
+ * Set the methods of the camera device beneath the chain of pixel
+ * processors.
+ *
+ * @param srv     Camera server.
+ *
+ * @param ops     Methods to be called by the chain or, if there is no chain,
+ *                by the library.  The camera shall be locked by the caller
+ *                and not acquiring.
+ *
+ * @see tao_camera_server_get_camera_ops().
+ */
+static inline void tao_camera_server_set_camera_ops(
+    tao_camera_server*    srv,
+    const tao_camera_ops* ops)
+{
+    tao_camera* cam = srv->device;
+    if (cam->ops == &_tao_processor_chain.ops) {
+        _tao_processor_chain.driver = ops;
+        _tao_processor_chain.ops = *ops;
+        _tao_processor_chain.ops.start = _tao_processor_chain_start;
+        _tao_processor_chain.ops.wait_buffer =
+            _tao_processor_chain_wait_buffer;
+    } else {
+        cam->ops = ops;
+    }
+}
+
+/**
+ * @}
+ */
+
+TAO_END_DECLS
+
+#endif // TAO_PROCESSOR_CHAINS_H_
@@ -14,6 +14,9 @@
 
 #include <tao-remote-objects-private.h>
 #include <tao-remote-sensors.h>
+#include <tao-errors.h>
+
+#include <stdatomic.h>
 
 TAO_BEGIN_DECLS
 
@@ -66,6 +69,138 @@ typedef struct tao_remote_sensor_dataframe {
     tao_shackhartmann_data data[1];
 } tao_remote_sensor_dataframe;
 
+/**
+ * @brief Get the address of a data-frame in the cyclic list of buffers.
+ *
+ * @param wfs      Pointer to remote wavefront sensor in caller's address
+ *                 space.
+ *
+ * @param serial   Serial number (≥ 1) of the data-frame.
+ *
+ * @return The address of the buffer where the data-frame is (or will be)
+ *         stored.
+ */
+static inline const tao_remote_sensor_dataframe* tao_remote_sensor_get_dataframe(
+    const tao_remote_sensor* wfs,
+    tao_serial               serial)
+{
+    return (const tao_remote_sensor_dataframe*)(
+        (const char*)wfs + wfs->base.offset +
+        ((serial - 1)%wfs->base.nbufs)*wfs->base.stride);
+}
+
+/**
+ * @brief Get a direct access to a wavefront sensor data-frame.
+ *
+ * This function yields the address of the measurements of a data-frame in
+ * the cyclic list of buffers of a remote wavefront sensor.  This is a
+ * zero-copy alternative to tao_remote_sensor_fetch_data(): the measurements
+ * can be used in place, but they may be overwritten by the server at any
+ * time, so, after having used them, the caller must call
+ * tao_remote_sensor_validate_data() to check that the data-frame has not
+ * been overwritten in the mean time.  If the validation fails, any results
+ * computed from the measurements must be discarded and the data-frame must be
+ * considered as lost.
+ *
+ * Typical usage:
+ *
+ * ~~~~~{.c}
+ * tao_serial serial = tao_remote_sensor_wait_output(wfs, 0, 3.2);
+ * if (serial > 0) {
+ *     long nsubs;
+ *     tao_dataframe_info info;
+ *     const tao_shackhartmann_data* data = tao_remote_sensor_peek_data(
+ *         wfs, serial, &nsubs, &info);
+ *     if (data != NULL) {
+ *         // Compute commands from data[0], ..., data[nsubs-1].
+ *         ...;
+ *         if (tao_remote_sensor_validate_data(wfs, serial)) {
+ *             // Commands are valid.
+ *             ...;
+ *         }
+ *     }
+ * }
+ * ~~~~~
+ *
+ * The caller must not have locked the wavefront sensor.
+ *
+ * @param wfs      Pointer to remote wavefront sensor in caller's address
+ *                 space.
+ *
+ * @param serial   Serial number of the data-frame, typically obtained by
+ *                 calling tao_remote_sensor_wait_output().
+ *
+ * @param nsubs    Address to store the number of measurements, not used if
+ *                 `NULL`.
+ *
+ * @param info     Address to store the data-frame information, not used if
+ *                 `NULL`.  If the data-frame is not available,
+ *                 `info->serial` is set to 0 if the data-frame is too new and
+ *                 to -1 if it has been overwritten.
+ *
+ * @return The address of the measurements; `NULL` if the data-frame is not
+ *         available or in case of error (in which case the caller's last
+ *         error is updated).
+ */
+static inline const tao_shackhartmann_data* tao_remote_sensor_peek_data(
+    const tao_remote_sensor* wfs,
+    tao_serial               serial,
+    long*                    nsubs,
+    tao_dataframe_info*      info)
+{
+    if (serial < 1) {
+        tao_store_error(__func__, TAO_BAD_SERIAL);
+        return NULL;
+    }
+    const tao_remote_sensor_dataframe* frame =
+        tao_remote_sensor_get_dataframe(wfs, serial);
+    tao_serial current = atomic_load_explicit(
+        &frame->base.serial, memory_order_acquire);
+    if (current != serial) {
+        if (info != NULL) {
+            info->serial = (current < serial ? 0 : -1);
+            info->mark = 0;
+            info->time.sec = 0;
+            info->time.nsec = 0;
+        }
+        return NULL;
+    }
+    if (nsubs != NULL) {
+        *nsubs = frame->nsubs;
+    }
+    if (info != NULL) {
+        info->serial = serial;
+        info->mark = frame->base.mark;
+        info->time = frame->base.time;
+    }
+    return frame->data;
+}
+
+/**
+ * @brief Check whether a wavefront sensor data-frame is still valid.
+ *
+ * This function checks that the data-frame accessed by
+ * tao_remote_sensor_peek_data() has not been overwritten by the server.  It
+ * must be called after all reads of the data-frame.
+ *
+ * @param wfs      Pointer to remote wavefront sensor in caller's address
+ *                 space.
+ *
+ * @param serial   Serial number of the data-frame.
+ *
+ * @return Whether the data-frame has not been overwritten.
+ */
+static inline bool tao_remote_sensor_validate_data(
+    const tao_remote_sensor* wfs,
+    tao_serial               serial)
+{
+    const tao_remote_sensor_dataframe* frame =
+        tao_remote_sensor_get_dataframe(wfs, serial);
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(
+        &frame->base.serial, memory_order_relaxed) == serial;
+}
+
 TAO_END_DECLS
 
 #endif // TAO_REMOTE_SENSORS_PRIVATE__H_
@@ -0,0 +1,2697 @@
+// tao-shackhartmann-engine.h -
+//
+// Processing of pre-processed images by Shack-Hartmann wavefront sensors in
+// TAO.
+//
+//-----------------------------------------------------------------------------
+//
+// This file if part of TAO real-time software licensed under the MIT license
+// (https://git-cral.univ-lyon1.fr/tao/tao-rt).
+//
+// Copyright (C) 2022, Éric Thiébaut.
+
+#ifndef TAO_SHACK_HARTMANN_ENGINE_H_
+#define TAO_SHACK_HARTMANN_ENGINE_H_ 1
+
+#include <math.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <tao-basics.h>
+#include <tao-camera-servers.h>
+#include <tao-cameras-private.h>
+#include <tao-config.h>
+#include <tao-errors.h>
+#include <tao-macros.h>
+#include <tao-options.h>
+#include <tao-processor-chains.h>
+#include <tao-remote-objects.h>
+#include <tao-shackhartmann.h>
+#include <tao-shared-arrays.h>
+#include <tao-threads.h>
+#include <tao-utils.h>
+#include <tao-worker-teams.h>
+
+TAO_BEGIN_DECLS
+
+/**
+ * @defgroup ShackHartmannEngine  Shack-Hartmann wavefront sensor engine
+ *
+ * @ingroup WavefrontSensors
+ *
+ * @brief Measurement of the sub-images of a Shack-Hartmann wavefront sensor.
+ *
+ * @{
+ *
+ * These functions compute the elementary data of a Shack-Hartmann wavefront
+ * sensor data-frame (see @ref tao_shackhartmann_data) from a pre-processed
+ * image delivered by a camera server.  They are used by the wavefront sensor
+ * server which attaches to the camera named in the configuration of the
+ * remote wavefront sensor, waits for each new image and publishes the
+ * resulting data-frames.  They are provided as inlined functions so that the
+ * compiler can optimize them for the pixel type and the target machine.
+ *
+ * Pixel coordinates are 0-based image coordinates, the bounding box and the
+ * reference position of each sub-image are expressed in these coordinates and
+ * the measured position is relative to the reference position.  If weights
+ * are provided, pixels with zero weight (e.g. bad pixels) are ignored.
+ *
+ * For the center of gravity (@ref TAO_CENTER_OF_GRAVITY), the weights are
+ * the inverse of the variance of the pixel values and are used to compute the
+ * precision matrix of the measured position (i.e. the inverse of its
+ * covariance), the intensity factor `alpha` is the sum of the pixel values in
+ * the bounding box and the quality factor `eta` is the signal-to-noise ratio
+ * of `alpha`.  If there are no weights, all pixels are assumed to have unit
+ * variance.  All these quantities are computed in a single pass over the
+ * pixels.  If the intensity is not strictly positive, the measured position
+ * and its precision are set to zero.  If the covariance of the measured
+ * position is singular, its precision is set to zero.
+ *
+ * The functions processing all the sub-images of an image are compiled for
+ * several instruction sets with the best one selected at run-time (see @ref
+ * TAO_SIMD_CLONES).
+ *
+ * The pre-processed image is a `width` by `height` array of pixel values
+ * possibly followed by an array of weights of the same size (this is how
+ * camera servers store images when pre-processing is @ref
+ * TAO_PREPROCESSING_FULL).
+ *
+ * For each floating-point type, with suffix `flt` for `float` or `dbl` for
+ * `double`, the following functions are provided:
+ *
+ * ~~~~~{.c}
+ * // Measure a single sub-image.
+ * void tao_shackhartmann_measure_cog_flt(
+ *     tao_shackhartmann_data* restrict out,
+ *     const tao_subimage*     restrict sub,
+ *     const float*            restrict dat,
+ *     const float*            restrict wgt,
+ *     long                             width);
+ *
+ * // Measure all sub-images of an image.
+ * void tao_shackhartmann_process_flt(
+ *     tao_shackhartmann_data* restrict data,
+ *     const tao_subimage*     restrict subs,
+ *     long                             nsubs,
+ *     const float*            restrict dat,
+ *     const float*            restrict wgt,
+ *     long                             width);
+ * ~~~~~
+ *
+ * where `wgt` can be `NULL` if there are no weights.
+ *
+ * For the linearized matched filter (@ref TAO_LINEARIZED_MATCHED_FILTER), the
+ * following function is provided (see @ref tao_shackhartmann_lmf):
+ *
+ * ~~~~~{.c}
+ * // Measure all sub-images of an image and post the image to update the
+ * // templates.
+ * void tao_shackhartmann_process_lmf_flt(
+ *     tao_shackhartmann_lmf*           lmf,
+ *     tao_shackhartmann_data* restrict data,
+ *     const float*            restrict dat,
+ *     long                             width);
+ * ~~~~~
+ *
+ * The cross-correlation is not one of the algorithms of the configuration of
+ * the wavefront sensor (see @ref tao_algorithm), which the library checks.
+ * It is selected by the wavefront sensor server with the option given by
+ * @ref TAO_SHACKHARTMANN_XCORR_OPTION and replaces the algorithm of the
+ * configuration (which shall be @ref TAO_CENTER_OF_GRAVITY).  The following
+ * function is provided (see @ref tao_shackhartmann_xcorr):
+ *
+ * ~~~~~{.c}
+ * // Measure all sub-images of an image.
+ * void tao_shackhartmann_process_xcorr_flt(
+ *     tao_shackhartmann_xcorr*         xc,
+ *     tao_shackhartmann_data* restrict data,
+ *     const float*            restrict dat,
+ *     long                             width);
+ * ~~~~~
+ *
+ * In streaming mode, pre-processing of the raw image and centroiding are
+ * fused: the raw image is pre-processed by bands of rows and each sub-image
+ * is measured as soon as the rows covering its bounding box have been
+ * pre-processed, while these rows are still in the cache (see
+ * tao_shackhartmann_process_streamed()).  Sub-images are processed in the
+ * order of increasing `ymax` given by tao_shackhartmann_stream_order().
+ *
+ * In sparse mode, only the pixels inside the bounding boxes of the
+ * sub-images are pre-processed according to a run-length encoded mask (see
+ * @ref tao_shackhartmann_mask and tao_shackhartmann_preprocess_sparse()).
+ * Sparse pre-processing is applied by a camera server to which the bounding
+ * boxes of the sub-images have been given by
+ * tao_camera_server_attach_sparse_mask().
+ *
+ * In addition to the data-frames of the remote wavefront sensor, the
+ * measured positions and intensities can be published as contiguous vectors
+ * (a structure of arrays) in a shared array so that a controller can read
+ * them with a single copy or in place (see tao_shackhartmann_slopes_create(),
+ * tao_shackhartmann_slopes_publish() and tao_shackhartmann_slopes_fetch()).
+ *
+ * When there are too many sub-images to be measured by a single core within
+ * the frame time, the center of gravity can be computed by a team of
+ * persistent worker threads (see @ref tao_shackhartmann_team).
+ *
+ * The bounding boxes of the sub-images can follow the spots as they drift
+ * (see @ref tao_shackhartmann_tracker).
+ */
+
+/**
+ * Tracker of the sub-image windows.
+ *
+ * With tracking, the bounding box of each sub-image is moved by whole pixels
+ * to follow its spot.  The reference position is not moved, so the measured
+ * position remains relative to the nominal reference position and the
+ * published data-frames, which store the bounding box actually used for each
+ * sub-image, are consistent.
+ *
+ * After each frame, the offset of the box of a sub-image is set to `(1 -
+ * restoring_force)*pos` rounded to the nearest integer, where `pos` is the
+ * measured position, but only if it differs from the current offset by more
+ * than one pixel (to avoid jitter).  The offsets are bounded by `±
+ * max_excursion` along each axis and boxes are kept inside the image.  Hence
+ * a restoring force of 1 or a maximum excursion less than 1 disables
+ * tracking.  Sub-images with non-positive intensity are not moved.  Tracking
+ * is designed for the center of gravity; the linearized matched filter and the
+ * cross-correlation assume fixed boxes.
+ *
+ * Typical usage:
+ *
+ * ~~~~~{.c}
+ * tao_shackhartmann_tracker* trk = tao_shackhartmann_tracker_create(
+ *     subs, nsubs, width, height);
+ * tao_shackhartmann_tracker_tune(trk, cfg.restoring_force,
+ *                                cfg.max_excursion);
+ * while (...) {
+ *     // For each new image.
+ *     tao_shackhartmann_process_image(data, trk->subs, nsubs, arr);
+ *     tao_shackhartmann_tracker_update(trk, data);
+ * }
+ * tao_shackhartmann_tracker_destroy(trk);
+ * ~~~~~
+ */
+typedef struct tao_shackhartmann_tracker {
+    long                  nsubs;///< Number of sub-images.
+    long                  width;///< Image width.
+    long                 height;///< Image height.
+    double      restoring_force;///< Restoring force in `[0,1]`.
+    long          max_excursion;///< Maximum offset of boxes (in pixels).
+    const tao_subimage* nominal;///< Nominal sub-image definitions.
+    tao_subimage*          subs;///< Sub-images with tracked boxes.
+} tao_shackhartmann_tracker;
+
+/**
+ * @def TAO_SHACKHARTMANN_TILE_PIXELS
+ *
+ * Approximate number of pixels in a tile of sub-images measured by a worker
+ * of a team.  The default value is such that the pixels and the weights of a
+ * tile of single precision pre-processed pixels fit in a 32 kB L1 data cache.
+ */
+#define TAO_SHACKHARTMANN_TILE_PIXELS 4096
+
+/**
+ * Team of worker threads to measure sub-images.
+ *
+ * The sub-images are sorted by increasing `ymax` of their bounding boxes and
+ * grouped in tiles of consecutive sub-images (i.e. in row bands) of about
+ * @ref TAO_SHACKHARTMANN_TILE_PIXELS pixels.  For each image, the calling
+ * thread and the workers of the team claim tiles with an atomic counter until
+ * there are none left, so the load is balanced dynamically.  The measurements
+ * are directly written in the output array provided by the caller, typically
+ * the next data-frame.
+ *
+ * The workers are persistent (see @ref tao_worker_team): they are not created
+ * for each image and jobs are not queued.  The number of workers and the cores
+ * they are pinned to can be changed at run-time by
+ * tao_shackhartmann_team_set_workers().  Pinning threads requires that
+ * `_GNU_SOURCE` be defined before including any header.
+ *
+ * All functions of a team except the workers shall be called by the same
+ * thread.
+ *
+ * Typical usage:
+ *
+ * ~~~~~{.c}
+ * tao_shackhartmann_team* team = tao_shackhartmann_team_create(subs, nsubs);
+ * int cpus[] = {2, 3, 4};
+ * tao_shackhartmann_team_set_workers(team, 3, cpus);
+ * while (...) {
+ *     // For each new image.
+ *     tao_shackhartmann_team_process(team, data, arr);
+ * }
+ * tao_shackhartmann_team_destroy(team);
+ * ~~~~~
+ */
+typedef struct tao_shackhartmann_team tao_shackhartmann_team;
+
+/**
+ * Run of consecutive pixels in a row.
+ */
+typedef struct tao_shackhartmann_run {
+    long y;///< Row index.
+    long x;///< Index of first pixel in the row.
+    long n;///< Number of pixels.
+} tao_shackhartmann_run;
+
+/**
+ * Run-length encoded mask of the pixels to pre-process.
+ *
+ * The mask is the union of the bounding boxes of the sub-images encoded as
+ * a list of runs of consecutive pixels sorted by increasing row and column
+ * indices.  For packed raw encodings, runs are enlarged to start and end on
+ * packet boundaries.  A copy of the bounding boxes is kept so that
+ * tao_shackhartmann_mask_update() can rebuild the mask when the
+ * configuration of the sub-images changes.
+ */
+typedef struct tao_shackhartmann_mask {
+    long                  width;///< Image width.
+    long                 height;///< Image height.
+    tao_encoding       encoding;///< Encoding of raw pixels.
+    long                  nsubs;///< Number of sub-images.
+    long                  nruns;///< Number of runs.
+    tao_bounding_box*     boxes;///< Bounding boxes of the sub-images.
+    tao_shackhartmann_run* runs;///< List of runs.
+} tao_shackhartmann_mask;
+
+/**
+ * @def TAO_SHACKHARTMANN_STREAM_MIN_ROWS
+ *
+ * Minimum number of rows pre-processed at a time in streaming mode.  This is
+ * to amortize the cost of calling the pixel processor for each band of rows.
+ */
+#define TAO_SHACKHARTMANN_STREAM_MIN_ROWS 4
+
+/**
+ * Linearized matched filter engine.
+ *
+ * The linearized matched filter models each sub-image as `α*T(x - δ)` where
+ * `T` is a template of the spot (centered at the reference position), `α` is
+ * the intensity factor and `δ = (δx,δy)` is the displacement to measure.  To
+ * first order, this model is linear in `(α, α*δx, α*δy)` and the weighted
+ * least-squares solution is given by 3 dot products of the sub-image pixels
+ * with coefficients precomputed from the template, its derivatives and the
+ * pixel weights.  Measuring a sub-image is thus a short batch of fused
+ * multiply-adds over contiguous aligned coefficients instead of a fit.
+ *
+ * The templates are updated with the forgetting factor `λ` of the
+ * configuration as `T ← λ*T + (1 - λ)*(d/α + δx*∂T/∂x + δy*∂T/∂y)` where `d`
+ * are the pixel values of the last posted sub-image (hence `λ = 1` means no
+ * updates).  Updates are done by a background thread (see
+ * tao_shackhartmann_lmf_start()) which computes the new coefficients in a
+ * spare set and then atomically makes it the active set.  The real-time
+ * thread never waits for the background thread: posting a frame is skipped if
+ * the background thread is busy.
+ *
+ * Typical usage:
+ *
+ * ~~~~~{.c}
+ * tao_shackhartmann_lmf* lmf = tao_shackhartmann_lmf_create(subs, nsubs);
+ * for (long i = 0; i < nsubs; ++i) {
+ *     tao_shackhartmann_lmf_set_template(lmf, i, tmpl[i], wgt[i]);
+ * }
+ * tao_shackhartmann_lmf_tune(lmf, cfg.forgetting_factor);
+ * tao_shackhartmann_lmf_start(lmf);
+ * while (...) {
+ *     // For each new image.
+ *     tao_shackhartmann_process_lmf_flt(lmf, data, dat, width);
+ * }
+ * tao_shackhartmann_lmf_destroy(lmf);
+ * ~~~~~
+ */
+typedef struct tao_shackhartmann_lmf tao_shackhartmann_lmf;
+
+/**
+ * Set of coefficients of the linearized matched filter.
+ */
+typedef struct tao_shackhartmann_lmf_coefs {
+    float*  coefs;///< Packed coefficients, 3 rows per sub-image.
+    double* covar;///< Covariance terms `(C00,C11,C12,C22)` per sub-image.
+} tao_shackhartmann_lmf_coefs;
+
+struct tao_shackhartmann_lmf {
+    long                  nsubs;///< Number of sub-images.
+    long                   npix;///< Total number of pixels in sub-images.
+    long                 ncoefs;///< Total number of coefficients per set.
+    tao_subimage*          subs;///< Sub-image definitions.
+    long*                pixoff;///< Offset of sub-images in pixel arrays.
+    long*               coefoff;///< Offset of sub-images in coefficients.
+    double*                tmpl;///< Templates (owned by the updater).
+    double*                 wgt;///< Model weights (owned by the updater).
+    tao_shackhartmann_lmf_coefs set[2];///< Active and spare sets.
+    tao_atomic int       active;///< Index of active set.
+    tao_atomic int      reading;///< Index of set used by real-time thread or
+                                ///  -1.
+    tao_atomic double    lambda;///< Forgetting factor.
+    tao_mutex             mutex;///< Lock for posted frames.
+    tao_cond               cond;///< Condition to notify posted frames.
+    tao_thread           thread;///< Background updater thread.
+    bool                running;///< Background thread is running.
+    bool                   quit;///< Background thread must quit.
+    bool                pending;///< A frame has been posted.
+    float*              posted;///< Pixels of posted frame.
+    float*                 work;///< Pixels of frame being processed.
+    double*         posted_meas;///< Measured `(α,α*δx,α*δy)` of posted frame.
+    double*           work_meas;///< Same as `posted_meas` for `work`.
+    double*                meas;///< Measurements of the real-time thread.
+    void*                  base;///< Base address of allocated memory.
+};
+
+
+/**
+ * @def TAO_SHACKHARTMANN_XCORR_MAX_SHIFT
+ *
+ * Maximum displacement (in pixels) searched by the cross-correlation.
+ */
+#define TAO_SHACKHARTMANN_XCORR_MAX_SHIFT 8
+
+/**
+ * @def TAO_SHACKHARTMANN_XCORR_OPTION(addr)
+ *
+ * Entry of the table of options of a wavefront sensor server (see @ref
+ * tao_option) to select the cross-correlation.  The option `-xcorr` stores
+ * the maximum displacement in the `long` integer at address `addr`, 0 (the
+ * default) to use the algorithm of the configuration.  If the value is not
+ * 0, the server shall create a cross-correlation engine with this maximum
+ * displacement (see tao_shackhartmann_xcorr_create()) for the sub-images of
+ * each new configuration and measure them with it.
+ */
+#define TAO_SHACKHARTMANN_XCORR_OPTION(addr)                             \
+    TAO_OPTION_NONNEGATIVE_LONG(                                        \
+        0, "xcorr", "PIXELS",                                           \
+        "Maximum shift for cross-correlation (0 to disable)", addr)
+
+/**
+ * Cross-correlation engine.
+ *
+ * The cross-correlation method is intended for extended scenes (e.g. solar
+ * granulation) for which the center of gravity is meaningless.  Each
+ * sub-image is correlated with a reference image of the same size as its
+ * bounding box: the central part of the reference (without a margin of
+ * `maxshift` pixels on every side) is compared with the sub-image for all
+ * integer displacements in `[-maxshift,maxshift]` along each axis and the
+ * position of the correlation peak is refined by a parabolic interpolation
+ * along each axis.  The correlation is computed in the direct domain because
+ * the search range is small and all sub-images are processed in a single
+ * batch.  For each measured sub-image, `alpha` is the sum of the pixel values
+ * in the bounding box and `eta` is the normalized correlation coefficient at
+ * the peak; the precisions of the measured position are not estimated and
+ * are set to zero.
+ *
+ * The reference images are stored in a shared array of `float` values with
+ * dimensions `(wmax,hmax,nsubs)` where `wmax` and `hmax` are the maximum
+ * width and height of the bounding boxes.  The reference of the `i`-th
+ * sub-image starts at the first pixel of the `i`-th plane.  The shared
+ * memory identifier of this array is written in the configuration parameter
+ * `"$owner-references"` where `$owner` is the name of the wavefront sensor
+ * server.  To refresh the references, a client locks the shared array for
+ * writing, writes the new references, increments its serial number and
+ * unlocks it.  The server checks the serial number for each frame and copies
+ * the new references when it can lock the shared array for reading without
+ * blocking.
+ */
+typedef struct tao_shackhartmann_xcorr {
+    long                  nsubs;///< Number of sub-images.
+    long               maxshift;///< Maximum displacement.
+    tao_subimage*          subs;///< Sub-image definitions.
+    tao_shared_array*    shared;///< Reference images in shared memory.
+    tao_serial           serial;///< Serial number of copied references.
+    float*                 refs;///< Zero-mean central parts of references.
+    long*                refoff;///< Offsets of references in `refs`.
+    double*             refnorm;///< Euclidean norms of the references.
+    void*                  base;///< Base address of allocated memory.
+} tao_shackhartmann_xcorr;
+
+static inline tao_status tao_shackhartmann_xcorr_refresh(
+    tao_shackhartmann_xcorr* xc);
+
+#ifndef TAO_DOXYGEN_
+#define _TAO_SH_JOIN_(a, b) a##_##b
+#define _TAO_SH_JOIN(a, b)  _TAO_SH_JOIN_(a, b)
+#define _TAO_SH_NAME(name)  _TAO_SH_JOIN(name, _TAO_SH_SUFFIX)
+
+// Number of partial sums for reductions in pixel loops.  Splitting the sums
+// this way let the compiler vectorize the loops without re-associating
+// floating-point operations.
+#define _TAO_SH_LANES 8
+
+// Number of coefficients to which each row of coefficients of the linearized
+// matched filter is padded to preserve alignment.
+#define _TAO_SH_COEF_ALIGN (TAO_ALIGNMENT/sizeof(float))
+
+#define _TAO_SH_FLOAT  float
+#define _TAO_SH_SUFFIX flt
+#include <tao-shackhartmann-engine.h>
+
+#define _TAO_SH_FLOAT  double
+#define _TAO_SH_SUFFIX dbl
+#include <tao-shackhartmann-engine.h>
+#endif // TAO_DOXYGEN_
+
+// Invert a 3×3 symmetric positive definite matrix stored as `(a00, a01, a02,
+// a11, a12, a22)`.  Return false if the matrix is singular.
+static inline bool _tao_shackhartmann_invert_sym3(
+    double* restrict c,
+    const double* restrict a)
+{
+    double c00 = a[3]*a[5] - a[4]*a[4];
+    double c01 = a[2]*a[4] - a[1]*a[5];
+    double c02 = a[1]*a[4] - a[2]*a[3];
+    double det = a[0]*c00 + a[1]*c01 + a[2]*c02;
+    if (!(det > 0)) {
+        return false;
+    }
+    double q = 1/det;
+    c[0] = c00*q;
+    c[1] = c01*q;
+    c[2] = c02*q;
+    c[3] = (a[0]*a[5] - a[2]*a[2])*q;
+    c[4] = (a[1]*a[2] - a[0]*a[4])*q;
+    c[5] = (a[0]*a[3] - a[1]*a[1])*q;
+    return true;
+}
+
+// Compute the coefficients of the `i`-th sub-image in a set given its
+// template.
+static inline void _tao_shackhartmann_lmf_compute(
+    tao_shackhartmann_lmf* lmf,
+    tao_shackhartmann_lmf_coefs* set,
+    long i)
+{
+    long n = lmf->subs[i].box.xmax - lmf->subs[i].box.xmin + 1;
+    long m = lmf->subs[i].box.ymax - lmf->subs[i].box.ymin + 1;
+    long npix = n*m;
+    const double* t = lmf->tmpl + lmf->pixoff[i];
+    const double* w = lmf->wgt + lmf->pixoff[i];
+    float* c0 = set->coefs + lmf->coefoff[i];
+    float* c1 = c0 + TAO_ROUND_UP(npix, _TAO_SH_COEF_ALIGN);
+    float* c2 = c1 + TAO_ROUND_UP(npix, _TAO_SH_COEF_ALIGN);
+    double* cov = set->covar + 4*i;
+
+    // Derivatives of the template (centered differences) and normal matrix.
+#define T(x, y) t[(x) + n*(y)]
+#define TX(x, y) (n < 2 ? 0.0 : (x) == 0 ? T(1, y) - T(0, y) :         \
+                  (x) == n - 1 ? T(x, y) - T((x) - 1, y) :              \
+                  (T((x) + 1, y) - T((x) - 1, y))/2)
+#define TY(x, y) (m < 2 ? 0.0 : (y) == 0 ? T(x, 1) - T(x, 0) :         \
+                  (y) == m - 1 ? T(x, y) - T(x, (y) - 1) :              \
+                  (T(x, (y) + 1) - T(x, (y) - 1))/2)
+    double a[6] = {0, 0, 0, 0, 0, 0}, c[6];
+    for (long y = 0; y < m; ++y) {
+        for (long x = 0; x < n; ++x) {
+            double wk = w[x + n*y], tk = T(x, y), tx = TX(x, y), ty = TY(x, y);
+            a[0] += wk*tk*tk;
+            a[1] += wk*tk*tx;
+            a[2] += wk*tk*ty;
+            a[3] += wk*tx*tx;
+            a[4] += wk*tx*ty;
+            a[5] += wk*ty*ty;
+        }
+    }
+    if (!_tao_shackhartmann_invert_sym3(c, a)) {
+        memset(c0, 0, 3*TAO_ROUND_UP(npix, _TAO_SH_COEF_ALIGN)*sizeof(float));
+        memset(cov, 0, 4*sizeof(double));
+        return;
+    }
+    for (long y = 0; y < m; ++y) {
+        for (long x = 0; x < n; ++x) {
+            long k = x + n*y;
+            double wk = w[k], tk = T(x, y), tx = TX(x, y), ty = TY(x, y);
+            c0[k] = wk*(c[0]*tk + c[1]*tx + c[2]*ty);
+            c1[k] = wk*(c[1]*tk + c[3]*tx + c[4]*ty);
+            c2[k] = wk*(c[2]*tk + c[4]*tx + c[5]*ty);
+        }
+    }
+#undef T
+#undef TX
+#undef TY
+    cov[0] = c[0];
+    cov[1] = c[3];
+    cov[2] = c[4];
+    cov[3] = c[5];
+}
+
+// Wait until the real-time thread no longer reads the spare set and return
+// its index.
+static inline int _tao_shackhartmann_lmf_acquire_spare(
+    tao_shackhartmann_lmf* lmf)
+{
+    int spare = 1 - atomic_load(&lmf->active);
+    while (atomic_load(&lmf->reading) == spare) {
+        tao_sleep(1e-5);
+    }
+    return spare;
+}
+
+// Update the templates given the last posted frame and recompute the
+// coefficients.
+static inline void _tao_shackhartmann_lmf_update(
+    tao_shackhartmann_lmf* lmf,
+    double lambda)
+{
+    int spare = _tao_shackhartmann_lmf_acquire_spare(lmf);
+    tao_shackhartmann_lmf_coefs* set = &lmf->set[spare];
+    for (long i = 0; i < lmf->nsubs; ++i) {
+        const double* meas = lmf->work_meas + 3*i;
+        double alpha = meas[0];
+        if (alpha > 0) {
+            long n = lmf->subs[i].box.xmax - lmf->subs[i].box.xmin + 1;
+            long m = lmf->subs[i].box.ymax - lmf->subs[i].box.ymin + 1;
+            double* t = lmf->tmpl + lmf->pixoff[i];
+            const float* d = lmf->work + lmf->pixoff[i];
+            double q = 1/alpha, dx = meas[1]*q, dy = meas[2]*q;
+            double mu = 1 - lambda, sum = 0;
+            // The spot measured in `d` has moved by `δ`, shifting it back to
+            // first order amounts to `d(x + δ) ≈ d + δx*∂T/∂x + δy*∂T/∂y`
+            // (derivatives of the template are used as they are less noisy).
+            // The shifted sub-image is temporarily stored in the spare
+            // coefficients which are recomputed next.
+            for (long y = 0; y < m; ++y) {
+                for (long x = 0; x < n; ++x) {
+                    long k = x + n*y;
+                    double tx = (n < 2 ? 0.0 :
+                                 x == 0 ? t[k+1] - t[k] :
+                                 x == n - 1 ? t[k] - t[k-1] :
+                                 (t[k+1] - t[k-1])/2);
+                    double ty = (m < 2 ? 0.0 :
+                                 y == 0 ? t[k+n] - t[k] :
+                                 y == m - 1 ? t[k] - t[k-n] :
+                                 (t[k+n] - t[k-n])/2);
+                    double val = d[k]*q + dx*tx + dy*ty;
+                    set->coefs[lmf->coefoff[i] + k] = val;
+                }
+            }
+            for (long k = 0; k < n*m; ++k) {
+                t[k] = lambda*t[k] + mu*set->coefs[lmf->coefoff[i] + k];
+                sum += t[k];
+            }
+            if (sum > 0) {
+                for (long k = 0; k < n*m; ++k) {
+                    t[k] /= sum;
+                }
+            }
+        }
+        _tao_shackhartmann_lmf_compute(lmf, set, i);
+    }
+    atomic_store(&lmf->active, spare);
+}
+
+// Function run by the background thread.
+static inline void* _tao_shackhartmann_lmf_updater(
+    void* arg)
+{
+    tao_shackhartmann_lmf* lmf = (tao_shackhartmann_lmf*)arg;
+    while (true) {
+        tao_mutex_lock(&lmf->mutex);
+        while (!lmf->pending && !lmf->quit) {
+            tao_condition_wait(&lmf->cond, &lmf->mutex);
+        }
+        if (lmf->quit) {
+            tao_mutex_unlock(&lmf->mutex);
+            break;
+        }
+        float* pix = lmf->posted;
+        double* meas = lmf->posted_meas;
+        lmf->posted = lmf->work;
+        lmf->posted_meas = lmf->work_meas;
+        lmf->work = pix;
+        lmf->work_meas = meas;
+        lmf->pending = false;
+        tao_mutex_unlock(&lmf->mutex);
+        double lambda = atomic_load(&lmf->lambda);
+        if (lambda < 1) {
+            _tao_shackhartmann_lmf_update(lmf, lambda);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Create a linearized matched filter engine.
+ *
+ * The templates are initially uniform with unit weights.  The caller shall
+ * call tao_shackhartmann_lmf_set_template() to set the template of each
+ * sub-image before starting the background thread.
+ *
+ * @param subs    Sub-image definitions.
+ *
+ * @param nsubs   Number of sub-images.
+ *
+ * @return The address of a new engine; `NULL` in case of failure.
+ */
+static inline tao_shackhartmann_lmf* tao_shackhartmann_lmf_create(
+    const tao_subimage* subs,
+    long nsubs)
+{
+    if (nsubs < 1) {
+        tao_store_error(__func__, TAO_BAD_NUMBER);
+        return NULL;
+    }
+    long npix = 0, ncoefs = 0;
+    for (long i = 0; i < nsubs; ++i) {
+        long n = subs[i].box.xmax - subs[i].box.xmin + 1;
+        long m = subs[i].box.ymax - subs[i].box.ymin + 1;
+        if (n < 1 || m < 1) {
+            tao_store_error(__func__, TAO_BAD_BOUNDING_BOX);
+            return NULL;
+        }
+        npix += n*m;
+        ncoefs += 3*TAO_ROUND_UP(n*m, _TAO_SH_COEF_ALIGN);
+    }
+    // Allocate everything in a single block with the coefficients first.
+    size_t coefs_size = TAO_ROUND_UP(ncoefs*sizeof(float), TAO_ALIGNMENT);
+    size_t size = TAO_ALIGNMENT - 1
+        + 2*coefs_size
+        + 2*4*nsubs*sizeof(double)
+        + 2*npix*sizeof(double)
+        + 2*npix*sizeof(float)
+        + 3*3*nsubs*sizeof(double)
+        + nsubs*sizeof(tao_subimage)
+        + 2*nsubs*sizeof(long);
+    tao_shackhartmann_lmf* lmf = (tao_shackhartmann_lmf*)tao_calloc(
+        1, sizeof(tao_shackhartmann_lmf));
+    if (lmf == NULL) {
+        return NULL;
+    }
+    void* base = tao_calloc(1, size);
+    if (base == NULL) {
+        tao_free(lmf);
+        return NULL;
+    }
+    char* ptr = (char*)TAO_ROUND_UP((uintptr_t)base, TAO_ALIGNMENT);
+#define _TAO_SH_TAKE(T, n) ((T*)(ptr += (n)*sizeof(T), ptr - (n)*sizeof(T)))
+    lmf->base = base;
+    lmf->set[0].coefs = (float*)ptr; ptr += coefs_size;
+    lmf->set[1].coefs = (float*)ptr; ptr += coefs_size;
+    lmf->set[0].covar = _TAO_SH_TAKE(double, 4*nsubs);
+    lmf->set[1].covar = _TAO_SH_TAKE(double, 4*nsubs);
+    lmf->tmpl         = _TAO_SH_TAKE(double, npix);
+    lmf->wgt          = _TAO_SH_TAKE(double, npix);
+    lmf->posted_meas  = _TAO_SH_TAKE(double, 3*nsubs);
+    lmf->work_meas    = _TAO_SH_TAKE(double, 3*nsubs);
+    lmf->meas         = _TAO_SH_TAKE(double, 3*nsubs);
+    lmf->posted       = _TAO_SH_TAKE(float, npix);
+    lmf->work         = _TAO_SH_TAKE(float, npix);
+    lmf->subs         = _TAO_SH_TAKE(tao_subimage, nsubs);
+    lmf->pixoff       = _TAO_SH_TAKE(long, nsubs);
+    lmf->coefoff      = _TAO_SH_TAKE(long, nsubs);
+#undef _TAO_SH_TAKE
+    lmf->nsubs = nsubs;
+    lmf->npix = npix;
+    lmf->ncoefs = ncoefs;
+    npix = 0;
+    ncoefs = 0;
+    for (long i = 0; i < nsubs; ++i) {
+        long n = subs[i].box.xmax - subs[i].box.xmin + 1;
+        long m = subs[i].box.ymax - subs[i].box.ymin + 1;
+        lmf->subs[i] = subs[i];
+        lmf->pixoff[i] = npix;
+        lmf->coefoff[i] = ncoefs;
+        for (long k = 0; k < n*m; ++k) {
+            lmf->tmpl[npix + k] = 1.0/(n*m);
+            lmf->wgt[npix + k] = 1.0;
+        }
+        npix += n*m;
+        ncoefs += 3*TAO_ROUND_UP(n*m, _TAO_SH_COEF_ALIGN);
+    }
+    for (long i = 0; i < nsubs; ++i) {
+        _tao_shackhartmann_lmf_compute(lmf, &lmf->set[0], i);
+    }
+    atomic_init(&lmf->active, 0);
+    atomic_init(&lmf->reading, -1);
+    atomic_init(&lmf->lambda, 1.0);
+    if (tao_mutex_initialize(&lmf->mutex, TAO_PROCESS_PRIVATE) != TAO_OK) {
+        tao_free(base);
+        tao_free(lmf);
+        return NULL;
+    }
+    if (tao_condition_initialize(&lmf->cond, TAO_PROCESS_PRIVATE) != TAO_OK) {
+        tao_mutex_destroy(&lmf->mutex, false);
+        tao_free(base);
+        tao_free(lmf);
+        return NULL;
+    }
+    return lmf;
+}
+
+/**
+ * Destroy a linearized matched filter engine.
+ *
+ * The background thread, if any, is stopped and joined.
+ *
+ * @param lmf     Linearized matched filter engine (can be `NULL`).
+ */
+static inline void tao_shackhartmann_lmf_destroy(
+    tao_shackhartmann_lmf* lmf)
+{
+    if (lmf != NULL) {
+        if (lmf->running) {
+            tao_mutex_lock(&lmf->mutex);
+            lmf->quit = true;
+            tao_condition_signal(&lmf->cond);
+            tao_mutex_unlock(&lmf->mutex);
+            tao_thread_join(lmf->thread, NULL);
+        }
+        tao_condition_destroy(&lmf->cond);
+        tao_mutex_destroy(&lmf->mutex, false);
+        tao_free(lmf->base);
+        tao_free(lmf);
+    }
+}
+
+/**
+ * Set the template of a sub-image in a linearized matched filter engine.
+ *
+ * This function shall not be called once the background thread has been
+ * started.
+ *
+ * @param lmf     Linearized matched filter engine.
+ *
+ * @param i       Index of sub-image.
+ *
+ * @param tmpl    Template image centered at the reference position, must
+ *                have the same size as the bounding box of the sub-image.
+ *
+ * @param wgt     Weights of the pixels (e.g. the inverse of the expected
+ *                variance of the pixels for the template), same size as
+ *                `tmpl`, can be `NULL` to assume unit weights.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure.
+ */
+static inline tao_status tao_shackhartmann_lmf_set_template(
+    tao_shackhartmann_lmf* lmf,
+    long                   i,
+    const double*          tmpl,
+    const double*          wgt)
+{
+    if (i < 0 || i >= lmf->nsubs) {
+        tao_store_error(__func__, TAO_OUT_OF_RANGE);
+        return TAO_ERROR;
+    }
+    if (lmf->running) {
+        tao_store_error(__func__, TAO_ALREADY_IN_USE);
+        return TAO_ERROR;
+    }
+    long n = lmf->subs[i].box.xmax - lmf->subs[i].box.xmin + 1;
+    long m = lmf->subs[i].box.ymax - lmf->subs[i].box.ymin + 1;
+    for (long k = 0; k < n*m; ++k) {
+        lmf->tmpl[lmf->pixoff[i] + k] = tmpl[k];
+        lmf->wgt[lmf->pixoff[i] + k] = (wgt == NULL ? 1.0 : wgt[k]);
+    }
+    _tao_shackhartmann_lmf_compute(
+        lmf, &lmf->set[atomic_load(&lmf->active)], i);
+    return TAO_OK;
+}
+
+/**
+ * Tune the forgetting factor of a linearized matched filter engine.
+ *
+ * This function can be called at any time (e.g. after
+ * tao_remote_sensor_tune_config()), it never blocks.
+ *
+ * @param lmf     Linearized matched filter engine.
+ *
+ * @param lambda  Forgetting factor in the range `[0,1]`.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure.
+ */
+static inline tao_status tao_shackhartmann_lmf_tune(
+    tao_shackhartmann_lmf* lmf,
+    double                 lambda)
+{
+    if (!(lambda >= 0 && lambda <= 1)) {
+        tao_store_error(__func__, TAO_BAD_FORGETTING_FACTOR);
+        return TAO_ERROR;
+    }
+    atomic_store(&lmf->lambda, lambda);
+    return TAO_OK;
+}
+
+/**
+ * Start the background thread updating the templates of a linearized matched
+ * filter engine.
+ *
+ * @param lmf     Linearized matched filter engine.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure.
+ */
+static inline tao_status tao_shackhartmann_lmf_start(
+    tao_shackhartmann_lmf* lmf)
+{
+    if (lmf->running) {
+        return TAO_OK;
+    }
+    // Both sets must be valid before the first flip.
+    tao_shackhartmann_lmf_coefs* src = &lmf->set[atomic_load(&lmf->active)];
+    tao_shackhartmann_lmf_coefs* dst = &lmf->set[1 - atomic_load(&lmf->active)];
+    memcpy(dst->coefs, src->coefs, lmf->ncoefs*sizeof(float));
+    memcpy(dst->covar, src->covar, 4*lmf->nsubs*sizeof(double));
+    lmf->quit = false;
+    lmf->pending = false;
+    if (tao_thread_create(&lmf->thread, NULL,
+                          _tao_shackhartmann_lmf_updater, lmf) != TAO_OK) {
+        return TAO_ERROR;
+    }
+    lmf->running = true;
+    return TAO_OK;
+}
+
+/**
+ * Copy the reference images of a cross-correlation engine if they have
+ * changed.
+ *
+ * This function never blocks: if the shared array storing the references is
+ * locked for writing by a client, nothing is done and the references will be
+ * copied by a subsequent call.
+ *
+ * @param xc      Cross-correlation engine.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure.
+ */
+static inline tao_status tao_shackhartmann_xcorr_refresh(
+    tao_shackhartmann_xcorr* xc)
+{
+    if (tao_shared_array_get_serial(xc->shared) == xc->serial) {
+        return TAO_OK;
+    }
+    tao_status status = tao_shared_array_try_rdlock(xc->shared);
+    if (status != TAO_OK) {
+        return status == TAO_TIMEOUT ? TAO_OK : TAO_ERROR;
+    }
+    long wmax = tao_shared_array_get_dim(xc->shared, 1);
+    long hmax = tao_shared_array_get_dim(xc->shared, 2);
+    const float* src = (const float*)tao_shared_array_get_data(xc->shared);
+    long R = xc->maxshift;
+    for (long i = 0; i < xc->nsubs; ++i) {
+        long p = xc->subs[i].box.xmax - xc->subs[i].box.xmin + 1 - 2*R;
+        long q = xc->subs[i].box.ymax - xc->subs[i].box.ymin + 1 - 2*R;
+        const float* ref = src + i*wmax*hmax;
+        float* dst = xc->refs + xc->refoff[i];
+        double sum = 0, sum2 = 0;
+        for (long v = 0; v < q; ++v) {
+            for (long u = 0; u < p; ++u) {
+                sum += ref[(u + R) + wmax*(v + R)];
+            }
+        }
+        double mean = sum/(p*q);
+        for (long v = 0; v < q; ++v) {
+            for (long u = 0; u < p; ++u) {
+                double val = ref[(u + R) + wmax*(v + R)] - mean;
+                dst[u + p*v] = val;
+                sum2 += val*val;
+            }
+        }
+        xc->refnorm[i] = sqrt(sum2);
+    }
+    xc->serial = tao_shared_array_get_serial(xc->shared);
+    return tao_shared_array_unlock(xc->shared);
+}
+
+/**
+ * Create a cross-correlation engine.
+ *
+ * This function creates the shared array storing the reference images (see
+ * @ref tao_shackhartmann_xcorr) and publishes its shared memory identifier.
+ * The reference images are initially zero.
+ *
+ * @param owner     The name of the wavefront sensor server.
+ *
+ * @param subs      Sub-image definitions.
+ *
+ * @param nsubs     Number of sub-images.
+ *
+ * @param maxshift  Maximum displacement (in pixels) along each axis, at most
+ *                  @ref TAO_SHACKHARTMANN_XCORR_MAX_SHIFT.  The bounding
+ *                  boxes must be larger than `2*maxshift` along each axis.
+ *
+ * @param flags     Permissions for clients (see tao_shared_array_create()).
+ *
+ * @return The address of a new engine; `NULL` in case of failure.
+ */
+static inline tao_shackhartmann_xcorr* tao_shackhartmann_xcorr_create(
+    const char*         owner,
+    const tao_subimage* subs,
+    long                nsubs,
+    long                maxshift,
+    unsigned            flags)
+{
+    if (nsubs < 1) {
+        tao_store_error(__func__, TAO_BAD_NUMBER);
+        return NULL;
+    }
+    if (maxshift < 1 || maxshift > TAO_SHACKHARTMANN_XCORR_MAX_SHIFT) {
+        tao_store_error(__func__, TAO_OUT_OF_RANGE);
+        return NULL;
+    }
+    if (owner == NULL || owner[0] == '\0' ||
+        strlen(owner) >= TAO_OWNER_SIZE) {
+        tao_store_error(__func__, TAO_BAD_NAME);
+        return NULL;
+    }
+    long wmax = 0, hmax = 0, nrefs = 0;
+    for (long i = 0; i < nsubs; ++i) {
+        long n = subs[i].box.xmax - subs[i].box.xmin + 1;
+        long m = subs[i].box.ymax - subs[i].box.ymin + 1;
+        if (n <= 2*maxshift || m <= 2*maxshift) {
+            tao_store_error(__func__, TAO_BAD_BOUNDING_BOX);
+            return NULL;
+        }
+        wmax = TAO_MAX(wmax, n);
+        hmax = TAO_MAX(hmax, m);
+        nrefs += (n - 2*maxshift)*(m - 2*maxshift);
+    }
+    tao_shackhartmann_xcorr* xc = (tao_shackhartmann_xcorr*)tao_calloc(
+        1, sizeof(tao_shackhartmann_xcorr));
+    if (xc == NULL) {
+        return NULL;
+    }
+    xc->base = tao_calloc(1, TAO_ALIGNMENT - 1 + nrefs*sizeof(float)
+                          + nsubs*(sizeof(double) + sizeof(long)
+                                   + sizeof(tao_subimage)));
+    if (xc->base == NULL) {
+        tao_free(xc);
+        return NULL;
+    }
+    char* ptr = (char*)TAO_ROUND_UP((uintptr_t)xc->base, TAO_ALIGNMENT);
+    xc->refs = (float*)ptr;
+    ptr += nrefs*sizeof(float);
+    xc->refnorm = (double*)ptr;
+    ptr += nsubs*sizeof(double);
+    xc->refoff = (long*)ptr;
+    ptr += nsubs*sizeof(long);
+    xc->subs = (tao_subimage*)ptr;
+    xc->nsubs = nsubs;
+    xc->maxshift = maxshift;
+    nrefs = 0;
+    for (long i = 0; i < nsubs; ++i) {
+        long n = subs[i].box.xmax - subs[i].box.xmin + 1;
+        long m = subs[i].box.ymax - subs[i].box.ymin + 1;
+        xc->subs[i] = subs[i];
+        xc->refoff[i] = nrefs;
+        nrefs += (n - 2*maxshift)*(m - 2*maxshift);
+    }
+    xc->shared = tao_shared_array_create_3d(
+        TAO_FLOAT, wmax, hmax, nsubs, flags);
+    if (xc->shared == NULL) {
+        goto error;
+    }
+    xc->serial = tao_shared_array_get_serial(xc->shared);
+    char name[TAO_OWNER_SIZE + 16];
+    sprintf(name, "%s-references", owner);
+    if (tao_config_write_long(
+            name, tao_shared_array_get_shmid(xc->shared)) != TAO_OK) {
+        goto error;
+    }
+    return xc;
+
+error:
+    if (xc->shared != NULL) {
+        tao_shared_array_detach(xc->shared);
+    }
+    tao_free(xc->base);
+    tao_free(xc);
+    return NULL;
+}
+
+/**
+ * Destroy a cross-correlation engine.
+ *
+ * @param xc      Cross-correlation engine (can be `NULL`).
+ */
+static inline void tao_shackhartmann_xcorr_destroy(
+    tao_shackhartmann_xcorr* xc)
+{
+    if (xc != NULL) {
+        if (xc->shared != NULL) {
+            tao_shared_array_detach(xc->shared);
+        }
+        tao_free(xc->base);
+        tao_free(xc);
+    }
+}
+
+/**
+ * Measure all sub-images of a pre-processed shared image.
+ *
+ * This function measures all sub-images in a pre-processed image stored in a
+ * shared array as delivered by a camera server.  The shared array must have
+ * `float` or `double` elements.  If the shared array is 3-dimensional with a
+ * 3rd dimension equal to 2, the second plane is assumed to store the pixel
+ * weights.  The caller is responsible of locking the shared array for reading
+ * if needed.
+ *
+ * @param data    Output elementary data (at least `nsubs` elements).
+ *
+ * @param subs    Sub-image definitions (at least `nsubs` elements).
+ *
+ * @param nsubs   Number of sub-images.
+ *
+ * @param arr     Shared array with the pre-processed image.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure.
+ */
+static inline tao_status tao_shackhartmann_process_image(
+    tao_shackhartmann_data* restrict data,
+    const tao_subimage*     restrict subs,
+    long                             nsubs,
+    const tao_shared_array*          arr)
+{
+    int ndims = tao_shared_array_get_ndims(arr);
+    long width = tao_shared_array_get_dim(arr, 1);
+    long height = tao_shared_array_get_dim(arr, 2);
+    long npixels = width*height;
+    bool weighted = false;
+    if (ndims == 3 && tao_shared_array_get_dim(arr, 3) == 2) {
+        weighted = true;
+    } else if (ndims != 2) {
+        tao_store_error(__func__, TAO_BAD_RANK);
+        return TAO_ERROR;
+    }
+    for (long i = 0; i < nsubs; ++i) {
+        const tao_bounding_box* box = &subs[i].box;
+        if (box->xmin < 0 || box->xmax < box->xmin || box->xmax >= width ||
+            box->ymin < 0 || box->ymax < box->ymin || box->ymax >= height) {
+            tao_store_error(__func__, TAO_BAD_BOUNDING_BOX);
+            return TAO_ERROR;
+        }
+    }
+    switch (tao_shared_array_get_eltype(arr)) {
+    case TAO_FLOAT: {
+        const float* dat = (const float*)tao_shared_array_get_data(arr);
+        const float* wgt = weighted ? dat + npixels : NULL;
+        tao_shackhartmann_process_flt(data, subs, nsubs, dat, wgt, width);
+        return TAO_OK;
+    }
+    case TAO_DOUBLE: {
+        const double* dat = (const double*)tao_shared_array_get_data(arr);
+        const double* wgt = weighted ? dat + npixels : NULL;
+        tao_shackhartmann_process_dbl(data, subs, nsubs, dat, wgt, width);
+        return TAO_OK;
+    }
+    default:
+        tao_store_error(__func__, TAO_BAD_TYPE);
+        return TAO_ERROR;
+    }
+}
+
+/**
+ * Compute the order of processing of sub-images in streaming mode.
+ *
+ * This function sorts the indices of the sub-images by increasing `ymax` of
+ * their bounding boxes (the sort is stable).  It is meant to be called once
+ * when the configuration of the sub-images changes.
+ *
+ * @param order   Output array of `nsubs` indices.
+ *
+ * @param subs    Sub-image definitions.
+ *
+ * @param nsubs   Number of sub-images.
+ */
+static inline void tao_shackhartmann_stream_order(
+    long*               restrict order,
+    const tao_subimage* restrict subs,
+    long                         nsubs)
+{
+    for (long i = 0; i < nsubs; ++i) {
+        long j = i;
+        while (j > 0 && subs[order[j-1]].box.ymax > subs[i].box.ymax) {
+            order[j] = order[j-1];
+            --j;
+        }
+        order[j] = i;
+    }
+}
+
+/**
+ * Pre-process a raw image and measure its sub-images in a single pass.
+ *
+ * This function pre-processes the raw image described by `ctx` by bands of
+ * rows (by calling `ctx->processor` for each band) and measures each
+ * sub-image with the center of gravity method as soon as the rows covering
+ * its bounding box are available.  On return, the whole image has been
+ * pre-processed in `ctx->dat` (and `ctx->wgt` for @ref
+ * TAO_PREPROCESSING_FULL) as if `ctx->processor` had been called once.
+ *
+ * The pixel processor must only depend on the width, height, strides and
+ * addresses stored in the context so that a band of rows can be processed by
+ * a copy of the context with updated height and addresses.  This is the case
+ * of the processors of the camera servers.
+ *
+ * @param data    Output array of `nsubs` data.
+ *
+ * @param subs    Sub-image definitions.
+ *
+ * @param order   Order of processing of the sub-images as computed by
+ *                tao_shackhartmann_stream_order().
+ *
+ * @param nsubs   Number of sub-images.
+ *
+ * @param ctx     Pixel processing context.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure.
+ */
+static inline tao_status tao_shackhartmann_process_streamed(
+    tao_shackhartmann_data*             restrict data,
+    const tao_subimage*                 restrict subs,
+    const long*                         restrict order,
+    long                                         nsubs,
+    const tao_pixels_processor_context*          ctx)
+{
+    for (long k = 0; k < nsubs; ++k) {
+        const tao_bounding_box* box = &subs[order[k]].box;
+        if (box->xmin < 0 || box->xmax < box->xmin ||
+            box->xmax >= ctx->width || box->ymin < 0 ||
+            box->ymax < box->ymin || box->ymax >= ctx->height ||
+            (k > 0 && box->ymax < subs[order[k-1]].box.ymax)) {
+            tao_store_error(__func__, TAO_BAD_BOUNDING_BOX);
+            return TAO_ERROR;
+        }
+    }
+    switch (ctx->eltype) {
+    case TAO_FLOAT:
+        tao_shackhartmann_process_streamed_flt(data, subs, order, nsubs, ctx);
+        return TAO_OK;
+    case TAO_DOUBLE:
+        tao_shackhartmann_process_streamed_dbl(data, subs, order, nsubs, ctx);
+        return TAO_OK;
+    default:
+        tao_store_error(__func__, TAO_BAD_TYPE);
+        return TAO_ERROR;
+    }
+}
+
+/**
+ * Create a run-length encoded mask of the pixels to pre-process.
+ *
+ * @param subs      Sub-image definitions.
+ *
+ * @param nsubs     Number of sub-images.
+ *
+ * @param width     Image width.
+ *
+ * @param height    Image height.
+ *
+ * @param encoding  Encoding of raw pixels.
+ *
+ * @return The address of a new mask; `NULL` in case of failure.
+ */
+static inline tao_shackhartmann_mask* tao_shackhartmann_mask_create(
+    const tao_subimage* subs,
+    long                nsubs,
+    long                width,
+    long                height,
+    tao_encoding        encoding)
+{
+    long pxl = TAO_ENCODING_BITS_PER_PIXEL(encoding);
+    long pkt = TAO_ENCODING_BITS_PER_PACKET(encoding);
+    if (pxl < 1 || pkt < pxl || pkt%pxl != 0 || pkt%8 != 0) {
+        tao_store_error(__func__, TAO_BAD_ENCODING);
+        return NULL;
+    }
+    long ppp = pkt/pxl; // number of pixels per packet
+    if (nsubs < 0) {
+        tao_store_error(__func__, TAO_BAD_NUMBER);
+        return NULL;
+    }
+    long maxruns = 0;
+    for (long i = 0; i < nsubs; ++i) {
+        const tao_bounding_box* box = &subs[i].box;
+        if (box->xmin < 0 || box->xmax < box->xmin || box->xmax >= width ||
+            box->ymin < 0 || box->ymax < box->ymin || box->ymax >= height) {
+            tao_store_error(__func__, TAO_BAD_BOUNDING_BOX);
+            return NULL;
+        }
+        maxruns += box->ymax - box->ymin + 1;
+    }
+    size_t size = sizeof(tao_shackhartmann_mask)
+        + nsubs*sizeof(tao_bounding_box)
+        + maxruns*sizeof(tao_shackhartmann_run);
+    tao_shackhartmann_mask* mask = (tao_shackhartmann_mask*)tao_malloc(size);
+    if (mask == NULL) {
+        return NULL;
+    }
+    long* xlim = (long*)tao_malloc(2*TAO_MAX(nsubs, 1)*sizeof(long));
+    if (xlim == NULL) {
+        tao_free(mask);
+        return NULL;
+    }
+    mask->width = width;
+    mask->height = height;
+    mask->encoding = encoding;
+    mask->nsubs = nsubs;
+    mask->boxes = (tao_bounding_box*)(mask + 1);
+    mask->runs = (tao_shackhartmann_run*)(mask->boxes + nsubs);
+    for (long i = 0; i < nsubs; ++i) {
+        mask->boxes[i] = subs[i].box;
+    }
+
+    // For each row, collect the column ranges of the bounding boxes aligned
+    // on packet boundaries, sort them by increasing first column and merge
+    // those which overlap or touch.
+    long nruns = 0;
+    for (long y = 0; y < height; ++y) {
+        long m = 0;
+        for (long i = 0; i < nsubs; ++i) {
+            const tao_bounding_box* box = &subs[i].box;
+            if (box->ymin <= y && y <= box->ymax) {
+                long x0 = (box->xmin/ppp)*ppp;
+                long x1 = TAO_MIN(((box->xmax + ppp)/ppp)*ppp, width);
+                long j = m++;
+                while (j > 0 && xlim[2*(j-1)] > x0) {
+                    xlim[2*j] = xlim[2*(j-1)];
+                    xlim[2*j+1] = xlim[2*(j-1)+1];
+                    --j;
+                }
+                xlim[2*j] = x0;
+                xlim[2*j+1] = x1;
+            }
+        }
+        for (long j = 0; j < m; ) {
+            long x0 = xlim[2*j], x1 = xlim[2*j+1];
+            for (++j; j < m && xlim[2*j] <= x1; ++j) {
+                x1 = TAO_MAX(x1, xlim[2*j+1]);
+            }
+            mask->runs[nruns].y = y;
+            mask->runs[nruns].x = x0;
+            mask->runs[nruns].n = x1 - x0;
+            ++nruns;
+        }
+    }
+    mask->nruns = nruns;
+    tao_free(xlim);
+    return mask;
+}
+
+/**
+ * Destroy a run-length encoded mask.
+ *
+ * @param mask    Mask to destroy (can be `NULL`).
+ */
+static inline void tao_shackhartmann_mask_destroy(
+    tao_shackhartmann_mask* mask)
+{
+    tao_free(mask);
+}
+
+/**
+ * Update a run-length encoded mask.
+ *
+ * This function rebuilds the mask if it does not exist yet or if it does not
+ * match the sub-images, the image size or the raw encoding.  It is cheap
+ * enough to be called for every image.
+ *
+ * @param maskptr   Address of the mask (which may be `NULL` on entry).
+ *
+ * @param subs      Sub-image definitions.
+ *
+ * @param nsubs     Number of sub-images.
+ *
+ * @param width     Image width.
+ *
+ * @param height    Image height.
+ *
+ * @param encoding  Encoding of raw pixels.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure (the mask
+ *         is left unchanged).
+ */
+static inline tao_status tao_shackhartmann_mask_update(
+    tao_shackhartmann_mask** maskptr,
+    const tao_subimage*      subs,
+    long                     nsubs,
+    long                     width,
+    long                     height,
+    tao_encoding             encoding)
+{
+    tao_shackhartmann_mask* mask = *maskptr;
+    if (mask != NULL && mask->width == width && mask->height == height &&
+        mask->encoding == encoding && mask->nsubs == nsubs) {
+        long i = 0;
+        while (i < nsubs &&
+               memcmp(&mask->boxes[i], &subs[i].box,
+                      sizeof(tao_bounding_box)) == 0) {
+            ++i;
+        }
+        if (i == nsubs) {
+            return TAO_OK;
+        }
+    }
+    tao_shackhartmann_mask* newmask = tao_shackhartmann_mask_create(
+        subs, nsubs, width, height, encoding);
+    if (newmask == NULL) {
+        return TAO_ERROR;
+    }
+    tao_shackhartmann_mask_destroy(mask);
+    *maskptr = newmask;
+    return TAO_OK;
+}
+
+/**
+ * Pre-process the pixels of a raw image inside a mask.
+ *
+ * This function pre-processes the raw image described by `ctx` as
+ * `ctx->processor` would do but only for the pixels inside the mask (the
+ * processor is called for each run of the mask).  Output pixels and weights
+ * outside the mask are left unchanged, only the pixels inside the mask are
+ * valid unless the caller has zeroed the others (as done by
+ * tao_camera_server_attach_sparse_mask()).
+ *
+ * The pixel processor must only depend on the width, height, strides and
+ * addresses stored in the context.  This is the case of the processors of
+ * the camera servers.
+ *
+ * @param mask    Run-length encoded mask of the pixels to pre-process.
+ *
+ * @param ctx     Pixel processing context.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure.
+ */
+static inline tao_status tao_shackhartmann_preprocess_sparse(
+    const tao_shackhartmann_mask*       mask,
+    const tao_pixels_processor_context* ctx)
+{
+    if (mask->width != ctx->width || mask->height != ctx->height) {
+        tao_store_error(__func__, TAO_BAD_SIZE);
+        return TAO_ERROR;
+    }
+    if (mask->encoding != ctx->bufferencoding) {
+        tao_store_error(__func__, TAO_BAD_ENCODING);
+        return TAO_ERROR;
+    }
+    size_t elsize = tao_size_of_eltype(ctx->eltype);
+    if (elsize == 0) {
+        tao_store_error(__func__, TAO_BAD_TYPE);
+        return TAO_ERROR;
+    }
+    long pxl = TAO_ENCODING_BITS_PER_PIXEL(mask->encoding);
+    long pkt = TAO_ENCODING_BITS_PER_PACKET(mask->encoding);
+    long ppp = pkt/pxl; // number of pixels per packet
+    long bpp = pkt/8;   // number of bytes per packet
+    tao_pixels_processor_context run = *ctx;
+    run.height = 1;
+    for (long k = 0; k < mask->nruns; ++k) {
+        const tao_shackhartmann_run* r = &mask->runs[k];
+        size_t offset = (r->y*ctx->width + r->x)*elsize;
+        run.width = r->n;
+        run.stride_min = ((r->n + ppp - 1)/ppp)*bpp;
+        run.raw = (const char*)ctx->raw + r->y*ctx->stride + (r->x/ppp)*bpp;
+        run.dat = (char*)ctx->dat + offset;
+        if (ctx->wgt != NULL) {
+            run.wgt = (char*)ctx->wgt + offset;
+        }
+        for (int j = 0; j < 4; ++j) {
+            if (ctx->preproc[j] != NULL) {
+                run.preproc[j] = (const char*)ctx->preproc[j] + offset;
+            }
+        }
+        ctx->processor(&run);
+    }
+    return TAO_OK;
+}
+
+/**
+ * @def TAO_SHACKHARTMANN_SPARSE_SLOTS
+ *
+ * Number of output buffers remembered by the sparse pre-processing of a
+ * camera server as having their pixels outside the mask zeroed.
+ */
+#define TAO_SHACKHARTMANN_SPARSE_SLOTS 16
+
+#ifndef TAO_DOXYGEN_
+// Bounding boxes of the sub-images, mask, output buffers whose pixels
+// outside the mask have been zeroed and pixel processor used by the sparse
+// pre-processing of a camera server.  The bounding boxes are only changed
+// while the camera is not acquiring, the other members are only used by the
+// worker.
+static struct {
+    tao_subimage*          subs;// Sub-image definitions.
+    long                  nsubs;// Number of sub-images.
+    tao_shackhartmann_mask* mask;// Mask built for the current images.
+    long               ncleared;// Number of zeroed output buffers.
+    long                 oldest;// Index of the oldest zeroed output buffer.
+    void*   cleared[TAO_SHACKHARTMANN_SPARSE_SLOTS];// Zeroed output buffers.
+    tao_pixels_processor* processor;// Pixel processor beneath the stage.
+} _tao_shackhartmann_sparse;
+
+// Zero the pixels and weights of an output buffer if not yet done for the
+// current mask.  The whole buffer is zeroed before the pixels inside the mask
+// are pre-processed.
+static void _tao_shackhartmann_sparse_clear(
+    const tao_pixels_processor_context* ctx)
+{
+    for (long k = 0; k < _tao_shackhartmann_sparse.ncleared; ++k) {
+        if (_tao_shackhartmann_sparse.cleared[k] == ctx->dat) {
+            return;
+        }
+    }
+    size_t size = ctx->width*ctx->height*tao_size_of_eltype(ctx->eltype);
+    memset(ctx->dat, 0, size);
+    if (ctx->wgt != NULL) {
+        memset(ctx->wgt, 0, size);
+    }
+    if (_tao_shackhartmann_sparse.ncleared < TAO_SHACKHARTMANN_SPARSE_SLOTS) {
+        long k = _tao_shackhartmann_sparse.ncleared++;
+        _tao_shackhartmann_sparse.cleared[k] = ctx->dat;
+    } else {
+        long k = _tao_shackhartmann_sparse.oldest;
+        _tao_shackhartmann_sparse.cleared[k] = ctx->dat;
+        _tao_shackhartmann_sparse.oldest =
+            (k + 1)%TAO_SHACKHARTMANN_SPARSE_SLOTS;
+    }
+}
+
+static void _tao_shackhartmann_sparse_processor(
+    const tao_pixels_processor_context* ctx)
+{
+    tao_shackhartmann_mask* mask = _tao_shackhartmann_sparse.mask;
+    if (tao_shackhartmann_mask_update(
+            &_tao_shackhartmann_sparse.mask, _tao_shackhartmann_sparse.subs,
+            _tao_shackhartmann_sparse.nsubs, ctx->width, ctx->height,
+            ctx->bufferencoding) != TAO_OK) {
+        // Bounding boxes not in the image, pre-process all pixels.
+        tao_report_error();
+        _tao_shackhartmann_sparse.processor(ctx);
+        return;
+    }
+    if (_tao_shackhartmann_sparse.mask != mask) {
+        _tao_shackhartmann_sparse.ncleared = 0;
+        _tao_shackhartmann_sparse.oldest = 0;
+    }
+    _tao_shackhartmann_sparse_clear(ctx);
+    tao_pixels_processor_context run = *ctx;
+    run.processor = _tao_shackhartmann_sparse.processor;
+    if (tao_shackhartmann_preprocess_sparse(
+            _tao_shackhartmann_sparse.mask, &run) != TAO_OK) {
+        tao_report_error();
+    }
+}
+
+static tao_status _tao_shackhartmann_sparse_stage(
+    tao_camera_server* srv)
+{
+    // Splitting the image between threads is not compatible with a mask
+    // expressed in image coordinates.
+    for (long k = 0; k < _tao_processor_chain.nstages; ++k) {
+        if (_tao_processor_chain.stages[k].rank == TAO_PROCESSOR_RANK_SPLIT &&
+            _tao_processor_chain.stages[k].stage !=
+            _tao_shackhartmann_sparse_stage) {
+            tao_store_error(__func__, TAO_UNSUPPORTED);
+            return TAO_ERROR;
+        }
+    }
+    // Output images may have been re-created with the same addresses.
+    _tao_shackhartmann_sparse.ncleared = 0;
+    _tao_shackhartmann_sparse.oldest = 0;
+    _tao_shackhartmann_sparse.processor = srv->proc.processor;
+    srv->proc.processor = _tao_shackhartmann_sparse_processor;
+    return TAO_OK;
+}
+#endif // TAO_DOXYGEN_
+
+/**
+ * Pre-process only the sub-images in the images of a camera server.
+ *
+ * This function adds a stage of rank @ref TAO_PROCESSOR_RANK_SPLIT to the
+ * chain of pixel processors of the camera server (see @ref ProcessorChains).
+ * The pixel processor of this stage only pre-processes the pixels inside the
+ * bounding boxes of the sub-images (see
+ * tao_shackhartmann_preprocess_sparse()).  The first time an output buffer
+ * is used with a given mask, all its pixels and weights are zeroed so that
+ * the pixels outside the mask are never those of older images.  The stage is
+ * installed again whenever the library resets the pixel processor of the
+ * server, e.g. after the camera has been configured.  It cannot be combined
+ * with another stage of the same rank, such as parallel pre-processing (the
+ * whole images are then pre-processed and an error is reported).  The mask
+ * is built for the size and encoding of the images when they are processed,
+ * if the bounding boxes do not fit in the images, the whole images are
+ * pre-processed.  There is a single sparse pre-processing per process.  The
+ * camera must not be acquiring.
+ *
+ * @param srv     Camera server.
+ *
+ * @param subs    Sub-image definitions, `NULL` to pre-process the whole
+ *                images.
+ *
+ * @param nsubs   Number of sub-images.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure.
+ */
+static inline tao_status tao_camera_server_attach_sparse_mask(
+    tao_camera_server*  srv,
+    const tao_subimage* subs,
+    long                nsubs)
+{
+    tao_subimage* copy = NULL;
+    if (subs != NULL) {
+        if (nsubs < 1) {
+            tao_store_error(__func__, TAO_BAD_NUMBER);
+            return TAO_ERROR;
+        }
+        copy = (tao_subimage*)tao_malloc(nsubs*sizeof(tao_subimage));
+        if (copy == NULL) {
+            return TAO_ERROR;
+        }
+        memcpy(copy, subs, nsubs*sizeof(tao_subimage));
+    } else {
+        if (tao_camera_server_remove_processor_stage(
+                srv, _tao_shackhartmann_sparse_stage) != TAO_OK) {
+            return TAO_ERROR;
+        }
+    }
+    // The sub-images shall not be changed while the worker may be using
+    // them.
+    tao_camera* cam = srv->device;
+    if (tao_camera_lock(cam) != TAO_OK) {
+        tao_free(copy);
+        return TAO_ERROR;
+    }
+    tao_status status = TAO_OK;
+    if (cam->runlevel == 2) {
+        tao_store_error(__func__, TAO_ACQUISITION_RUNNING);
+        status = TAO_ERROR;
+    } else {
+        tao_free(_tao_shackhartmann_sparse.subs);
+        tao_shackhartmann_mask_destroy(_tao_shackhartmann_sparse.mask);
+        _tao_shackhartmann_sparse.subs = copy;
+        _tao_shackhartmann_sparse.nsubs = (copy != NULL ? nsubs : 0);
+        _tao_shackhartmann_sparse.mask = NULL;
+        copy = NULL;
+    }
+    if (tao_camera_unlock(cam) != TAO_OK) {
+        status = TAO_ERROR;
+    }
+    tao_free(copy);
+    if (status != TAO_OK) {
+        return TAO_ERROR;
+    }
+    if (subs == NULL) {
+        return TAO_OK;
+    }
+    return tao_camera_server_add_processor_stage(
+        srv, _tao_shackhartmann_sparse_stage, TAO_PROCESSOR_RANK_SPLIT,
+        false);
+}
+
+/**
+ * Create a shared array to publish slopes as a structure of arrays.
+ *
+ * The shared array is a `ld` by 3 array of `float` or `double` values with
+ * `ld ≥ nsubs` chosen so that each column starts at an aligned address.  The
+ * columns store, for each sub-image, the measured abscissa `pos.x`, the
+ * measured ordinate `pos.y` and the intensity `alpha`.  The elements beyond
+ * `nsubs` in each column are zero.  The shared memory identifier of the array
+ * is written in the configuration parameter `"$owner-slopes"` where `$owner`
+ * is the name of the wavefront sensor server.  The serial number and the
+ * first time-stamp of the shared array are those of the last published
+ * data-frame.
+ *
+ * @param owner   The name of the wavefront sensor server.
+ *
+ * @param nsubs   Number of sub-images.
+ *
+ * @param eltype  Element type, @ref TAO_FLOAT or @ref TAO_DOUBLE.
+ *
+ * @param flags   Permissions for clients (see tao_shared_array_create()).
+ *
+ * @return The address of the new shared array; `NULL` in case of failure.
+ */
+static inline tao_shared_array* tao_shackhartmann_slopes_create(
+    const char* owner,
+    long        nsubs,
+    tao_eltype  eltype,
+    unsigned    flags)
+{
+    if (eltype != TAO_FLOAT && eltype != TAO_DOUBLE) {
+        tao_store_error(__func__, TAO_BAD_TYPE);
+        return NULL;
+    }
+    if (nsubs < 1) {
+        tao_store_error(__func__, TAO_BAD_NUMBER);
+        return NULL;
+    }
+    if (owner == NULL || owner[0] == '\0' ||
+        strlen(owner) >= TAO_OWNER_SIZE) {
+        tao_store_error(__func__, TAO_BAD_NAME);
+        return NULL;
+    }
+    long ld = TAO_ROUND_UP(nsubs, TAO_ALIGNMENT/tao_size_of_eltype(eltype));
+    tao_shared_array* arr = tao_shared_array_create_2d(eltype, ld, 3, flags);
+    if (arr == NULL) {
+        return NULL;
+    }
+    memset(tao_shared_array_get_data(arr), 0,
+           3*ld*tao_size_of_eltype(eltype));
+    char name[TAO_OWNER_SIZE + 16];
+    sprintf(name, "%s-slopes", owner);
+    if (tao_config_write_long(
+            name, tao_shared_array_get_shmid(arr)) != TAO_OK) {
+        tao_shared_array_detach(arr);
+        return NULL;
+    }
+    return arr;
+}
+
+/**
+ * Publish slopes as a structure of arrays.
+ *
+ * This function locks the shared array created by
+ * tao_shackhartmann_slopes_create() for writing, stores the measured
+ * positions and intensities, updates the serial number and the time-stamp of
+ * the shared array and unlocks it.
+ *
+ * This function never blocks so that the real-time loop of the sensor is not
+ * stalled by clients: if the shared array is locked by a client, the
+ * data-frame is skipped and the counter of skipped data-frames is
+ * incremented.  Clients notice skipped data-frames as gaps in the serial
+ * numbers.
+ *
+ * @param arr      Shared array.
+ *
+ * @param data     Measurements.
+ *
+ * @param nsubs    Number of sub-images.
+ *
+ * @param serial   Serial number of the data-frame.
+ *
+ * @param time     Time-stamp of the data-frame (can be `NULL`).
+ *
+ * @param skipped  Address of the counter of skipped data-frames (can be
+ *                 `NULL`).
+ *
+ * @return @ref TAO_OK on success; @ref TAO_TIMEOUT if the data-frame has been
+ *         skipped; @ref TAO_ERROR in case of failure.
+ */
+static inline tao_status tao_shackhartmann_slopes_publish(
+    tao_shared_array*                      arr,
+    const tao_shackhartmann_data* restrict data,
+    long                                   nsubs,
+    tao_serial                             serial,
+    const tao_time*               restrict time,
+    tao_serial*                   restrict skipped)
+{
+    long ld = tao_shared_array_get_dim(arr, 1);
+    if (nsubs < 0 || nsubs > ld) {
+        tao_store_error(__func__, TAO_BAD_NUMBER);
+        return TAO_ERROR;
+    }
+    tao_status status = tao_shared_array_try_wrlock(arr);
+    if (status != TAO_OK) {
+        if (status == TAO_TIMEOUT && skipped != NULL) {
+            ++*skipped;
+        }
+        return status;
+    }
+    void* dst = tao_shared_array_get_data(arr);
+    if (tao_shared_array_get_eltype(arr) == TAO_FLOAT) {
+        tao_shackhartmann_store_slopes_flt((float*)dst, ld, data, nsubs);
+    } else {
+        tao_shackhartmann_store_slopes_dbl((double*)dst, ld, data, nsubs);
+    }
+    tao_shared_array_set_serial(arr, serial);
+    if (time != NULL) {
+        tao_shared_array_set_timestamp(arr, 0, time);
+    }
+    return tao_shared_array_unlock(arr);
+}
+
+/**
+ * Fetch slopes published as a structure of arrays.
+ *
+ * This function copies, with a single `memcpy`, the contents of the shared
+ * array created by tao_shackhartmann_slopes_create() if its serial number is
+ * `serial`.  To read the slopes in place, lock the shared array for reading,
+ * check its serial number, use the address given by
+ * tao_shared_array_get_data() and unlock the shared array.  The lock shall
+ * be held as briefly as possible: data-frames measured while it is held are
+ * not published (see tao_shackhartmann_slopes_publish()).
+ *
+ * The shared array shall not be locked by the caller.
+ *
+ * @param arr     Shared array.
+ *
+ * @param serial  Serial number of the data-frame to fetch, typically
+ *                obtained by calling tao_remote_sensor_wait_output().
+ *
+ * @param dst     Output buffer of `3*ld` values of the same type as the
+ *                elements of the shared array with `ld` the first dimension
+ *                of the shared array.
+ *
+ * @param info    Pointer to retrieve the data-frame information, not used if
+ *                `NULL`.  The `mark` member is set to zero.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_TIMEOUT if the published slopes do
+ *         not correspond to `serial`; @ref TAO_ERROR in case of failure.  If
+ *         @ref TAO_TIMEOUT is returned, the output buffer is zero-filled and,
+ *         if `info` is not `NULL`, `info->serial` is set to 0 if the
+ *         requested slopes are too new and to -1 if they are too old.
+ */
+static inline tao_status tao_shackhartmann_slopes_fetch(
+    tao_shared_array*            arr,
+    tao_serial                   serial,
+    void*               restrict dst,
+    tao_dataframe_info* restrict info)
+{
+    size_t size = tao_shared_array_get_length(arr)*
+        tao_size_of_eltype(tao_shared_array_get_eltype(arr));
+    if (tao_shared_array_rdlock(arr) != TAO_OK) {
+        return TAO_ERROR;
+    }
+    tao_serial last = tao_shared_array_get_serial(arr);
+    tao_status status = TAO_OK;
+    if (last == serial) {
+        memcpy(dst, tao_shared_array_get_data(arr), size);
+        if (info != NULL) {
+            info->serial = serial;
+            info->mark = 0;
+            tao_shared_array_get_timestamp(arr, 0, &info->time);
+        }
+    } else {
+        memset(dst, 0, size);
+        if (info != NULL) {
+            info->serial = (last < serial ? 0 : -1);
+            info->mark = 0;
+            info->time.sec = 0;
+            info->time.nsec = 0;
+        }
+        status = TAO_TIMEOUT;
+    }
+    if (tao_shared_array_unlock(arr) != TAO_OK) {
+        status = TAO_ERROR;
+    }
+    return status;
+}
+
+struct tao_shackhartmann_team {
+    long                  nsubs;///< Number of sub-images.
+    long                 ntiles;///< Number of tiles.
+    tao_subimage*          subs;///< Sub-image definitions.
+    long*                 order;///< Sub-image indices sorted by tiles.
+    long*                 tiles;///< Tile `t` is `order[tiles[t]:tiles[t+1]-1]`.
+    tao_worker_team*    workers;///< Team of worker threads.
+
+    // Current job.
+    tao_shackhartmann_data* data;///< Output measurements.
+    const void*             dat;///< Pre-processed pixels.
+    const void*             wgt;///< Pixel weights or `NULL`.
+    long                  width;///< Image width.
+    tao_eltype           eltype;///< Pixel type.
+};
+
+// Measure a tile of the current job.
+static inline void _tao_shackhartmann_team_job(
+    void* arg,
+    long  t)
+{
+    tao_shackhartmann_team* team = (tao_shackhartmann_team*)arg;
+    long first = team->tiles[t], last = team->tiles[t+1];
+    if (team->eltype == TAO_FLOAT) {
+        tao_shackhartmann_process_tile_flt(
+            team->data, team->subs, team->order + first, last - first,
+            (const float*)team->dat, (const float*)team->wgt, team->width);
+    } else {
+        tao_shackhartmann_process_tile_dbl(
+            team->data, team->subs, team->order + first, last - first,
+            (const double*)team->dat, (const double*)team->wgt, team->width);
+    }
+}
+
+/**
+ * Create a team to measure sub-images.
+ *
+ * The team has initially no workers, so all sub-images are measured by the
+ * calling thread of tao_shackhartmann_team_process() until
+ * tao_shackhartmann_team_set_workers() is called.
+ *
+ * @param subs    Sub-image definitions.
+ *
+ * @param nsubs   Number of sub-images.
+ *
+ * @return The address of a new team; `NULL` in case of failure.
+ */
+static inline tao_shackhartmann_team* tao_shackhartmann_team_create(
+    const tao_subimage* subs,
+    long                nsubs)
+{
+    if (nsubs < 1) {
+        tao_store_error(__func__, TAO_BAD_NUMBER);
+        return NULL;
+    }
+    for (long i = 0; i < nsubs; ++i) {
+        const tao_bounding_box* box = &subs[i].box;
+        if (box->xmin < 0 || box->xmax < box->xmin ||
+            box->ymin < 0 || box->ymax < box->ymin) {
+            tao_store_error(__func__, TAO_BAD_BOUNDING_BOX);
+            return NULL;
+        }
+    }
+    size_t size = TAO_ROUND_UP(sizeof(tao_shackhartmann_team), sizeof(double))
+        + nsubs*sizeof(tao_subimage) + (2*nsubs + 1)*sizeof(long);
+    tao_shackhartmann_team* team = (tao_shackhartmann_team*)tao_calloc(1, size);
+    if (team == NULL) {
+        return NULL;
+    }
+    team->nsubs = nsubs;
+    team->subs = (tao_subimage*)((char*)team + TAO_ROUND_UP(
+        sizeof(tao_shackhartmann_team), sizeof(double)));
+    team->order = (long*)(team->subs + nsubs);
+    team->tiles = team->order + nsubs;
+    memcpy(team->subs, subs, nsubs*sizeof(tao_subimage));
+    tao_shackhartmann_stream_order(team->order, subs, nsubs);
+    long ntiles = 0, npix = 0;
+    for (long k = 0; k < nsubs; ++k) {
+        const tao_bounding_box* box = &subs[team->order[k]].box;
+        if (k == 0 || npix >= TAO_SHACKHARTMANN_TILE_PIXELS) {
+            team->tiles[ntiles++] = k;
+            npix = 0;
+        }
+        npix += (box->xmax - box->xmin + 1)*(box->ymax - box->ymin + 1);
+    }
+    team->tiles[ntiles] = nsubs;
+    team->ntiles = ntiles;
+    team->workers = tao_worker_team_create();
+    if (team->workers == NULL) {
+        tao_free(team);
+        return NULL;
+    }
+    return team;
+}
+
+/**
+ * Destroy a team.
+ *
+ * This function stops and joins all the workers of the team.
+ *
+ * @param team    Team to destroy (can be `NULL`).
+ */
+static inline void tao_shackhartmann_team_destroy(
+    tao_shackhartmann_team* team)
+{
+    if (team != NULL) {
+        tao_worker_team_destroy(team->workers);
+        tao_free(team);
+    }
+}
+
+/**
+ * Set the workers of a team.
+ *
+ * This function stops the current workers of the team (if any) and starts
+ * new ones.  It shall not be called while tao_shackhartmann_team_process()
+ * is running.
+ *
+ * @param team      Team.
+ *
+ * @param nworkers  Number of worker threads (in addition to the calling
+ *                  thread of tao_shackhartmann_team_process()), at most
+ *                  @ref TAO_WORKER_TEAM_MAX_WORKERS.
+ *
+ * @param cpus      If not `NULL`, an array of `nworkers` indices of the cores
+ *                  to pin the workers to (a negative index means not to pin
+ *                  the corresponding worker).
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure (in
+ *         which case the team has no workers).
+ */
+static inline tao_status tao_shackhartmann_team_set_workers(
+    tao_shackhartmann_team* team,
+    long                    nworkers,
+    const int*              cpus)
+{
+    return tao_worker_team_set_workers(team->workers, nworkers, cpus);
+}
+
+/**
+ * Get the number of workers of a team.
+ *
+ * @param team    Team.
+ *
+ * @return The number of worker threads.
+ */
+static inline long tao_shackhartmann_team_get_workers(
+    const tao_shackhartmann_team* team)
+{
+    return tao_worker_team_get_workers(team->workers);
+}
+
+/**
+ * Measure all sub-images of a pre-processed shared image with a team.
+ *
+ * This function behaves as tao_shackhartmann_process_image() except that the
+ * sub-images are measured by the calling thread and the workers of the team.
+ * It returns when all sub-images have been measured.
+ *
+ * @param team    Team.
+ *
+ * @param data    Output array of data, at least as many as the number of
+ *                sub-images of the team.
+ *
+ * @param arr     Shared array with the pre-processed image.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure.
+ */
+static inline tao_status tao_shackhartmann_team_process(
+    tao_shackhartmann_team*          team,
+    tao_shackhartmann_data* restrict data,
+    const tao_shared_array*          arr)
+{
+    int ndims = tao_shared_array_get_ndims(arr);
+    long width = tao_shared_array_get_dim(arr, 1);
+    long height = tao_shared_array_get_dim(arr, 2);
+    tao_eltype eltype = tao_shared_array_get_eltype(arr);
+    bool weighted = false;
+    if (ndims == 3 && tao_shared_array_get_dim(arr, 3) == 2) {
+        weighted = true;
+    } else if (ndims != 2) {
+        tao_store_error(__func__, TAO_BAD_RANK);
+        return TAO_ERROR;
+    }
+    if (eltype != TAO_FLOAT && eltype != TAO_DOUBLE) {
+        tao_store_error(__func__, TAO_BAD_TYPE);
+        return TAO_ERROR;
+    }
+    for (long i = 0; i < team->nsubs; ++i) {
+        const tao_bounding_box* box = &team->subs[i].box;
+        if (box->xmax >= width || box->ymax >= height) {
+            tao_store_error(__func__, TAO_BAD_BOUNDING_BOX);
+            return TAO_ERROR;
+        }
+    }
+    team->data = data;
+    team->dat = tao_shared_array_get_data(arr);
+    team->wgt = weighted ? (const char*)team->dat +
+        width*height*tao_size_of_eltype(eltype) : NULL;
+    team->width = width;
+    team->eltype = eltype;
+    tao_worker_team_run(team->workers, _tao_shackhartmann_team_job,
+                        team, team->ntiles);
+    return TAO_OK;
+}
+
+/**
+ * Update the sub-image definitions of a team.
+ *
+ * This function copies the bounding boxes and reference positions of the
+ * sub-images (e.g., after their boxes have been moved by a @ref
+ * tao_shackhartmann_tracker).  The grouping of sub-images in tiles is not
+ * changed.  It shall not be called while tao_shackhartmann_team_process() is
+ * running.
+ *
+ * @param team    Team.
+ *
+ * @param subs    Sub-image definitions, as many as the team has.
+ */
+static inline void tao_shackhartmann_team_update_subs(
+    tao_shackhartmann_team* team,
+    const tao_subimage*     subs)
+{
+    memcpy(team->subs, subs, team->nsubs*sizeof(tao_subimage));
+}
+
+/**
+ * Create a tracker of the sub-image windows.
+ *
+ * The tracker is created with tracking disabled (unit restoring force and no
+ * excursion), call tao_shackhartmann_tracker_tune() to enable it.
+ *
+ * @param subs    Nominal sub-image definitions.
+ *
+ * @param nsubs   Number of sub-images.
+ *
+ * @param width   Image width.
+ *
+ * @param height  Image height.
+ *
+ * @return The address of a new tracker; `NULL` in case of failure.
+ */
+static inline tao_shackhartmann_tracker* tao_shackhartmann_tracker_create(
+    const tao_subimage* subs,
+    long                nsubs,
+    long                width,
+    long                height)
+{
+    if (nsubs < 1) {
+        tao_store_error(__func__, TAO_BAD_NUMBER);
+        return NULL;
+    }
+    for (long i = 0; i < nsubs; ++i) {
+        const tao_bounding_box* box = &subs[i].box;
+        if (box->xmin < 0 || box->xmax < box->xmin || box->xmax >= width ||
+            box->ymin < 0 || box->ymax < box->ymin || box->ymax >= height) {
+            tao_store_error(__func__, TAO_BAD_BOUNDING_BOX);
+            return NULL;
+        }
+    }
+    size_t size = TAO_ROUND_UP(sizeof(tao_shackhartmann_tracker),
+                               sizeof(double))
+        + 2*nsubs*sizeof(tao_subimage);
+    tao_shackhartmann_tracker* trk =
+        (tao_shackhartmann_tracker*)tao_malloc(size);
+    if (trk == NULL) {
+        return NULL;
+    }
+    tao_subimage* nominal = (tao_subimage*)((char*)trk + TAO_ROUND_UP(
+        sizeof(tao_shackhartmann_tracker), sizeof(double)));
+    memcpy(nominal, subs, nsubs*sizeof(tao_subimage));
+    trk->nsubs = nsubs;
+    trk->width = width;
+    trk->height = height;
+    trk->restoring_force = 1;
+    trk->max_excursion = 0;
+    trk->nominal = nominal;
+    trk->subs = nominal + nsubs;
+    memcpy(trk->subs, subs, nsubs*sizeof(tao_subimage));
+    return trk;
+}
+
+/**
+ * Destroy a tracker of the sub-image windows.
+ *
+ * @param trk     Tracker (can be `NULL`).
+ */
+static inline void tao_shackhartmann_tracker_destroy(
+    tao_shackhartmann_tracker* trk)
+{
+    tao_free(trk);
+}
+
+/**
+ * Set the parameters of a tracker of the sub-image windows.
+ *
+ * The bounding boxes are left where they are, they will be updated according
+ * to the new parameters by the next call to tao_shackhartmann_tracker_update().
+ *
+ * @param trk              Tracker.
+ *
+ * @param restoring_force  Restoring force in `[0,1]`.
+ *
+ * @param max_excursion    Maximum offset (in pixels) of the boxes along each
+ *                         axis, rounded down to an integer.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure.
+ */
+static inline tao_status tao_shackhartmann_tracker_tune(
+    tao_shackhartmann_tracker* trk,
+    double                     restoring_force,
+    double                     max_excursion)
+{
+    if (!(restoring_force >= 0 && restoring_force <= 1)) {
+        tao_store_error(__func__, TAO_BAD_RESTORING_FORCE);
+        return TAO_ERROR;
+    }
+    if (!(max_excursion >= 0 && max_excursion <= trk->width + trk->height)) {
+        tao_store_error(__func__, TAO_BAD_MAX_EXCURSION);
+        return TAO_ERROR;
+    }
+    trk->restoring_force = restoring_force;
+    trk->max_excursion = (long)floor(max_excursion);
+    return TAO_OK;
+}
+
+/**
+ * Reset the sub-image windows of a tracker to their nominal positions.
+ *
+ * @param trk     Tracker.
+ */
+static inline void tao_shackhartmann_tracker_reset(
+    tao_shackhartmann_tracker* trk)
+{
+    memcpy(trk->subs, trk->nominal, trk->nsubs*sizeof(tao_subimage));
+}
+
+// Compute the new offset along an axis of a tracked box given its current
+// offset, the target offset and the bounds of the offset.
+static inline long _tao_shackhartmann_track(
+    long   cur,
+    double target,
+    long   lo,
+    long   hi)
+{
+    if (fabs(target - cur) > 1) {
+        cur = lround(target);
+    }
+    return cur < lo ? lo : (cur > hi ? hi : cur);
+}
+
+/**
+ * Move the sub-image windows of a tracker to follow the spots.
+ *
+ * @param trk     Tracker.
+ *
+ * @param data    Measurements of the last frame made with the sub-image
+ *                definitions in `trk->subs`.
+ *
+ * @return The number of moved boxes.
+ */
+static inline long tao_shackhartmann_tracker_update(
+    tao_shackhartmann_tracker*             trk,
+    const tao_shackhartmann_data* restrict data)
+{
+    double gain = 1 - trk->restoring_force;
+    long exc = trk->max_excursion;
+    long nmoves = 0;
+    for (long i = 0; i < trk->nsubs; ++i) {
+        const tao_bounding_box* nom = &trk->nominal[i].box;
+        tao_bounding_box* box = &trk->subs[i].box;
+        long dx = box->xmin - nom->xmin, dy = box->ymin - nom->ymin;
+        long nx, ny;
+        if (data[i].alpha > 0) {
+            nx = _tao_shackhartmann_track(
+                dx, gain*data[i].pos.x, TAO_MAX(-exc, -nom->xmin),
+                TAO_MIN(exc, trk->width - 1 - nom->xmax));
+            ny = _tao_shackhartmann_track(
+                dy, gain*data[i].pos.y, TAO_MAX(-exc, -nom->ymin),
+                TAO_MIN(exc, trk->height - 1 - nom->ymax));
+        } else {
+            nx = TAO_MIN(TAO_MAX(dx, -exc), exc);
+            ny = TAO_MIN(TAO_MAX(dy, -exc), exc);
+        }
+        if (nx != dx || ny != dy) {
+            box->xmin = nom->xmin + nx;
+            box->xmax = nom->xmax + nx;
+            box->ymin = nom->ymin + ny;
+            box->ymax = nom->ymax + ny;
+            ++nmoves;
+        }
+    }
+    return nmoves;
+}
+
+/**
+ * @}
+ */
+
+TAO_END_DECLS
+
+#endif // TAO_SHACK_HARTMANN_ENGINE_H_
+
+//-----------------------------------------------------------------------------
+// Code encoded for each floating-point type.
+
+#ifdef _TAO_SH_FLOAT
+
+// Compute the sums of the pixel values `d` in a row of `n` pixels, of `d*u`
+// with `u` the offset of the pixel in the row, and assume unit variance.
+static TAO_ALWAYS_INLINE void _TAO_SH_NAME(tao_shackhartmann_row_sums)(
+    _TAO_SH_FLOAT*       restrict sums,
+    const _TAO_SH_FLOAT* restrict d,
+    long                          n)
+{
+    _TAO_SH_FLOAT s[_TAO_SH_LANES] = {0}, su[_TAO_SH_LANES] = {0};
+    long u = 0;
+    for (; u + _TAO_SH_LANES <= n; u += _TAO_SH_LANES) {
+        for (long k = 0; k < _TAO_SH_LANES; ++k) {
+            _TAO_SH_FLOAT val = d[u+k];
+            s[k] += val;
+            su[k] += val*(_TAO_SH_FLOAT)(u+k);
+        }
+    }
+    for (long k = 1; k < _TAO_SH_LANES; ++k) {
+        s[0] += s[k];
+        su[0] += su[k];
+    }
+    for (; u < n; ++u) {
+        _TAO_SH_FLOAT val = d[u];
+        s[0] += val;
+        su[0] += val*(_TAO_SH_FLOAT)u;
+    }
+    _TAO_SH_FLOAT fn = n;
+    sums[0] = s[0];
+    sums[1] = su[0];
+    sums[2] = fn;
+    sums[3] = fn*(fn - 1)/2;
+    sums[4] = fn*(fn - 1)*(2*fn - 1)/6;
+}
+
+// Compute the sums of the pixel values `d` in a row of `n` pixels, of `d*u`
+// with `u` the offset of the pixel in the row, of the variances `v = 1/w`, of
+// `v*u` and of `v*u^2`.  Pixels with zero weight are ignored.
+static TAO_ALWAYS_INLINE void _TAO_SH_NAME(tao_shackhartmann_weighted_row_sums)(
+    _TAO_SH_FLOAT*       restrict sums,
+    const _TAO_SH_FLOAT* restrict d,
+    const _TAO_SH_FLOAT* restrict w,
+    long                          n)
+{
+    const _TAO_SH_FLOAT zero = 0, one = 1;
+    _TAO_SH_FLOAT s[_TAO_SH_LANES] = {0}, su[_TAO_SH_LANES] = {0};
+    _TAO_SH_FLOAT v[_TAO_SH_LANES] = {0}, vu[_TAO_SH_LANES] = {0};
+    _TAO_SH_FLOAT vuu[_TAO_SH_LANES] = {0};
+    long u = 0;
+    for (; u + _TAO_SH_LANES <= n; u += _TAO_SH_LANES) {
+        for (long k = 0; k < _TAO_SH_LANES; ++k) {
+            _TAO_SH_FLOAT x = u + k;
+            _TAO_SH_FLOAT wk = w[u+k];
+            _TAO_SH_FLOAT dk = wk > zero ? d[u+k] : zero;
+            _TAO_SH_FLOAT vk = wk > zero ? one/wk : zero;
+            s[k] += dk;
+            su[k] += dk*x;
+            v[k] += vk;
+            vu[k] += vk*x;
+            vuu[k] += vk*x*x;
+        }
+    }
+    for (long k = 1; k < _TAO_SH_LANES; ++k) {
+        s[0] += s[k];
+        su[0] += su[k];
+        v[0] += v[k];
+        vu[0] += vu[k];
+        vuu[0] += vuu[k];
+    }
+    for (; u < n; ++u) {
+        _TAO_SH_FLOAT x = u;
+        _TAO_SH_FLOAT wk = w[u];
+        if (wk > zero) {
+            _TAO_SH_FLOAT vk = one/wk;
+            s[0] += d[u];
+            su[0] += d[u]*x;
+            v[0] += vk;
+            vu[0] += vk*x;
+            vuu[0] += vk*x*x;
+        }
+    }
+    sums[0] = s[0];
+    sums[1] = su[0];
+    sums[2] = v[0];
+    sums[3] = vu[0];
+    sums[4] = vuu[0];
+}
+
+static TAO_ALWAYS_INLINE void _TAO_SH_NAME(tao_shackhartmann_measure_cog)(
+    tao_shackhartmann_data* restrict out,
+    const tao_subimage*     restrict sub,
+    const _TAO_SH_FLOAT*    restrict dat,
+    const _TAO_SH_FLOAT*    restrict wgt,
+    long                             width)
+{
+    // Coordinates are relative to the first pixel of the bounding box to
+    // limit rounding errors.
+    long xmin = sub->box.xmin, xmax = sub->box.xmax;
+    long ymin = sub->box.ymin, ymax = sub->box.ymax;
+    long n = xmax - xmin + 1;
+    double s = 0, sx = 0, sy = 0;
+    double v = 0, vx = 0, vy = 0, vxx = 0, vxy = 0, vyy = 0;
+    for (long y = ymin; y <= ymax; ++y) {
+        _TAO_SH_FLOAT r[5];
+        if (wgt == NULL) {
+            _TAO_SH_NAME(tao_shackhartmann_row_sums)(
+                r, dat + y*width + xmin, n);
+        } else {
+            _TAO_SH_NAME(tao_shackhartmann_weighted_row_sums)(
+                r, dat + y*width + xmin, wgt + y*width + xmin, n);
+        }
+        double t = y - ymin;
+        s   += r[0];
+        sx  += r[1];
+        sy  += r[0]*t;
+        v   += r[2];
+        vx  += r[3];
+        vy  += r[2]*t;
+        vxx += r[4];
+        vxy += r[3]*t;
+        vyy += r[2]*t*t;
+    }
+    out->box = sub->box;
+    out->ref = sub->ref;
+    out->alpha = s;
+    out->eta = v > 0 ? s/sqrt(v) : 0;
+    if (s > 0) {
+        double xc = sx/s, yc = sy/s;
+        double q = 1/(s*s);
+        double cxx = (vxx - 2*xc*vx + xc*xc*v)*q;
+        double cxy = (vxy - xc*vy - yc*vx + xc*yc*v)*q;
+        double cyy = (vyy - 2*yc*vy + yc*yc*v)*q;
+        double det = cxx*cyy - cxy*cxy;
+        out->pos.x = (xmin + xc) - sub->ref.x;
+        out->pos.y = (ymin + yc) - sub->ref.y;
+        if (det > 0) {
+            out->pos.wxx =  cyy/det;
+            out->pos.wxy = -cxy/det;
+            out->pos.wyy =  cxx/det;
+        } else {
+            out->pos.wxx = 0;
+            out->pos.wxy = 0;
+            out->pos.wyy = 0;
+        }
+    } else {
+        out->pos.x = 0;
+        out->pos.y = 0;
+        out->pos.wxx = 0;
+        out->pos.wxy = 0;
+        out->pos.wyy = 0;
+    }
+}
+
+static inline TAO_SIMD_CLONES void _TAO_SH_NAME(tao_shackhartmann_process)(
+    tao_shackhartmann_data* restrict data,
+    const tao_subimage*     restrict subs,
+    long                             nsubs,
+    const _TAO_SH_FLOAT*    restrict dat,
+    const _TAO_SH_FLOAT*    restrict wgt,
+    long                             width)
+{
+    for (long i = 0; i < nsubs; ++i) {
+        _TAO_SH_NAME(tao_shackhartmann_measure_cog)(
+            &data[i], &subs[i], dat, wgt, width);
+    }
+}
+
+static TAO_ALWAYS_INLINE void _TAO_SH_NAME(tao_shackhartmann_measure_lmf)(
+    tao_shackhartmann_data* restrict out,
+    const tao_subimage*     restrict sub,
+    const float*            restrict c0,
+    const double*           restrict cov,
+    const _TAO_SH_FLOAT*    restrict dat,
+    long                             width,
+    double*                 restrict meas)
+{
+    long xmin = sub->box.xmin, xmax = sub->box.xmax;
+    long ymin = sub->box.ymin, ymax = sub->box.ymax;
+    long n = xmax - xmin + 1;
+    long npad = TAO_ROUND_UP(n*(ymax - ymin + 1), _TAO_SH_COEF_ALIGN);
+    const float* c1 = c0 + npad;
+    const float* c2 = c1 + npad;
+    double a0 = 0, a1 = 0, a2 = 0;
+    for (long y = ymin; y <= ymax; ++y) {
+        const _TAO_SH_FLOAT* d = dat + y*width + xmin;
+        long off = (y - ymin)*n;
+        _TAO_SH_FLOAT s0[_TAO_SH_LANES] = {0};
+        _TAO_SH_FLOAT s1[_TAO_SH_LANES] = {0};
+        _TAO_SH_FLOAT s2[_TAO_SH_LANES] = {0};
+        long u = 0;
+        for (; u + _TAO_SH_LANES <= n; u += _TAO_SH_LANES) {
+            for (long k = 0; k < _TAO_SH_LANES; ++k) {
+                _TAO_SH_FLOAT val = d[u+k];
+                s0[k] += c0[off+u+k]*val;
+                s1[k] += c1[off+u+k]*val;
+                s2[k] += c2[off+u+k]*val;
+            }
+        }
+        for (long k = 1; k < _TAO_SH_LANES; ++k) {
+            s0[0] += s0[k];
+            s1[0] += s1[k];
+            s2[0] += s2[k];
+        }
+        for (; u < n; ++u) {
+            _TAO_SH_FLOAT val = d[u];
+            s0[0] += c0[off+u]*val;
+            s1[0] += c1[off+u]*val;
+            s2[0] += c2[off+u]*val;
+        }
+        a0 += s0[0];
+        a1 += s1[0];
+        a2 += s2[0];
+    }
+    out->box = sub->box;
+    out->ref = sub->ref;
+    out->alpha = a0;
+    out->eta = cov[0] > 0 ? a0/sqrt(cov[0]) : 0;
+    // The model is `α*(T - δx*∂T/∂x - δy*∂T/∂y)`, hence the signs.
+    meas[0] = a0;
+    meas[1] = -a1;
+    meas[2] = -a2;
+    double det = cov[1]*cov[3] - cov[2]*cov[2];
+    if (a0 > 0 && det > 0) {
+        double q = a0*a0/det;
+        out->pos.x = -a1/a0;
+        out->pos.y = -a2/a0;
+        out->pos.wxx =  cov[3]*q;
+        out->pos.wxy = -cov[2]*q;
+        out->pos.wyy =  cov[1]*q;
+    } else {
+        out->pos.x = 0;
+        out->pos.y = 0;
+        out->pos.wxx = 0;
+        out->pos.wxy = 0;
+        out->pos.wyy = 0;
+    }
+}
+
+static inline void _TAO_SH_NAME(tao_shackhartmann_lmf_post)(
+    tao_shackhartmann_lmf*               lmf,
+    const double*               restrict meas,
+    const _TAO_SH_FLOAT*        restrict dat,
+    long                                 width)
+{
+    if (atomic_load(&lmf->lambda) >= 1 ||
+        tao_mutex_try_lock(&lmf->mutex) != TAO_OK) {
+        return;
+    }
+    if (!lmf->pending) {
+        for (long i = 0; i < lmf->nsubs; ++i) {
+            const tao_bounding_box* box = &lmf->subs[i].box;
+            long n = box->xmax - box->xmin + 1;
+            float* dst = lmf->posted + lmf->pixoff[i];
+            for (long y = box->ymin; y <= box->ymax; ++y) {
+                const _TAO_SH_FLOAT* src = dat + y*width + box->xmin;
+                for (long x = 0; x < n; ++x) {
+                    dst[x] = src[x];
+                }
+                dst += n;
+            }
+        }
+        memcpy(lmf->posted_meas, meas, 3*lmf->nsubs*sizeof(double));
+        lmf->pending = true;
+        tao_condition_signal(&lmf->cond);
+    }
+    tao_mutex_unlock(&lmf->mutex);
+}
+
+static inline TAO_SIMD_CLONES void _TAO_SH_NAME(_tao_shackhartmann_lmf_run)(
+    tao_shackhartmann_data*     restrict data,
+    const tao_subimage*         restrict subs,
+    long                                 nsubs,
+    const tao_shackhartmann_lmf_coefs*   set,
+    const long*                 restrict coefoff,
+    const _TAO_SH_FLOAT*        restrict dat,
+    long                                 width,
+    double*                     restrict meas)
+{
+    for (long i = 0; i < nsubs; ++i) {
+        _TAO_SH_NAME(tao_shackhartmann_measure_lmf)(
+            &data[i], &subs[i], set->coefs + coefoff[i], set->covar + 4*i,
+            dat, width, meas + 3*i);
+    }
+}
+
+static inline void _TAO_SH_NAME(tao_shackhartmann_process_lmf)(
+    tao_shackhartmann_lmf*               lmf,
+    tao_shackhartmann_data*     restrict data,
+    const _TAO_SH_FLOAT*        restrict dat,
+    long                                 width)
+{
+    // Register the set being read, making sure that the background thread
+    // has not made it the spare set in-between.
+    int k;
+    do {
+        k = atomic_load(&lmf->active);
+        atomic_store(&lmf->reading, k);
+    } while (k != atomic_load(&lmf->active));
+    _TAO_SH_NAME(_tao_shackhartmann_lmf_run)(
+        data, lmf->subs, lmf->nsubs, &lmf->set[k], lmf->coefoff,
+        dat, width, lmf->meas);
+    atomic_store(&lmf->reading, -1);
+    _TAO_SH_NAME(tao_shackhartmann_lmf_post)(lmf, lmf->meas, dat, width);
+}
+
+static TAO_ALWAYS_INLINE void _TAO_SH_NAME(tao_shackhartmann_measure_xcorr)(
+    tao_shackhartmann_data* restrict out,
+    const tao_subimage*     restrict sub,
+    const float*            restrict ref,
+    double                           refnorm,
+    long                             R,
+    const _TAO_SH_FLOAT*    restrict dat,
+    long                             width)
+{
+    long xmin = sub->box.xmin, xmax = sub->box.xmax;
+    long ymin = sub->box.ymin, ymax = sub->box.ymax;
+    long n = xmax - xmin + 1, m = ymax - ymin + 1;
+    long p = n - 2*R, q = m - 2*R, l = 2*R + 1;
+    double c[(2*TAO_SHACKHARTMANN_XCORR_MAX_SHIFT + 1)*
+             (2*TAO_SHACKHARTMANN_XCORR_MAX_SHIFT + 1)];
+
+    // Correlation for all displacements.  As the reference has zero mean,
+    // there is no needs to subtract the mean of the sub-image.
+    long best = 0;
+    for (long sy = 0; sy < l; ++sy) {
+        for (long sx = 0; sx < l; ++sx) {
+            const _TAO_SH_FLOAT* d = dat + (ymin + sy)*width + (xmin + sx);
+            double sum = 0;
+            for (long v = 0; v < q; ++v) {
+                const float* r = ref + v*p;
+                _TAO_SH_FLOAT acc[_TAO_SH_LANES] = {0};
+                long u = 0;
+                for (; u + _TAO_SH_LANES <= p; u += _TAO_SH_LANES) {
+                    for (long k = 0; k < _TAO_SH_LANES; ++k) {
+                        acc[k] += r[u+k]*d[u+k];
+                    }
+                }
+                for (long k = 1; k < _TAO_SH_LANES; ++k) {
+                    acc[0] += acc[k];
+                }
+                for (; u < p; ++u) {
+                    acc[0] += r[u]*d[u];
+                }
+                sum += acc[0];
+                d += width;
+            }
+            c[sx + l*sy] = sum;
+            if (sum > c[best]) {
+                best = sx + l*sy;
+            }
+        }
+    }
+
+    // Parabolic interpolation of the peak along each axis.
+    long bx = best%l, by = best/l;
+    double dx = 0, dy = 0;
+    if (bx > 0 && bx < l - 1) {
+        double cm = c[best-1], c0 = c[best], cp = c[best+1];
+        double den = cm - 2*c0 + cp;
+        if (den < 0) {
+            dx = (cm - cp)/(2*den);
+        }
+    }
+    if (by > 0 && by < l - 1) {
+        double cm = c[best-l], c0 = c[best], cp = c[best+l];
+        double den = cm - 2*c0 + cp;
+        if (den < 0) {
+            dy = (cm - cp)/(2*den);
+        }
+    }
+
+    // Intensity and normalized correlation at the peak.
+    double s = 0, sw = 0, sw2 = 0;
+    for (long y = ymin; y <= ymax; ++y) {
+        const _TAO_SH_FLOAT* d = dat + y*width;
+        bool inside = (y >= ymin + by && y < ymin + by + q);
+        for (long x = xmin; x <= xmax; ++x) {
+            double val = d[x];
+            s += val;
+            if (inside && x >= xmin + bx && x < xmin + bx + p) {
+                sw += val;
+                sw2 += val*val;
+            }
+        }
+    }
+    double var = sw2 - sw*sw/(p*q);
+    out->box = sub->box;
+    out->ref = sub->ref;
+    out->pos.x = (bx - R) + dx;
+    out->pos.y = (by - R) + dy;
+    out->pos.wxx = 0;
+    out->pos.wxy = 0;
+    out->pos.wyy = 0;
+    out->alpha = s;
+    out->eta = (var > 0 && refnorm > 0) ? c[best]/(refnorm*sqrt(var)) : 0;
+}
+
+static inline TAO_SIMD_CLONES void _TAO_SH_NAME(_tao_shackhartmann_xcorr_run)(
+    tao_shackhartmann_data*  restrict data,
+    const tao_shackhartmann_xcorr*    xc,
+    const _TAO_SH_FLOAT*     restrict dat,
+    long                              width)
+{
+    for (long i = 0; i < xc->nsubs; ++i) {
+        _TAO_SH_NAME(tao_shackhartmann_measure_xcorr)(
+            &data[i], &xc->subs[i], xc->refs + xc->refoff[i], xc->refnorm[i],
+            xc->maxshift, dat, width);
+    }
+}
+
+static inline void _TAO_SH_NAME(tao_shackhartmann_process_xcorr)(
+    tao_shackhartmann_xcorr*          xc,
+    tao_shackhartmann_data*  restrict data,
+    const _TAO_SH_FLOAT*     restrict dat,
+    long                              width)
+{
+    if (tao_shackhartmann_xcorr_refresh(xc) != TAO_OK) {
+        // Keep on with the current references.
+        tao_clear_error(NULL);
+    }
+    _TAO_SH_NAME(_tao_shackhartmann_xcorr_run)(data, xc, dat, width);
+}
+
+static inline TAO_SIMD_CLONES void _TAO_SH_NAME(tao_shackhartmann_process_tile)(
+    tao_shackhartmann_data* restrict data,
+    const tao_subimage*     restrict subs,
+    const long*             restrict order,
+    long                             n,
+    const _TAO_SH_FLOAT*    restrict dat,
+    const _TAO_SH_FLOAT*    restrict wgt,
+    long                             width)
+{
+    for (long k = 0; k < n; ++k) {
+        long i = order[k];
+        _TAO_SH_NAME(tao_shackhartmann_measure_cog)(
+            &data[i], &subs[i], dat, wgt, width);
+    }
+}
+
+static inline void _TAO_SH_NAME(tao_shackhartmann_store_slopes)(
+    _TAO_SH_FLOAT*                restrict dst,
+    long                                   ld,
+    const tao_shackhartmann_data* restrict data,
+    long                                   nsubs)
+{
+    for (long i = 0; i < nsubs; ++i) {
+        dst[i]        = data[i].pos.x;
+        dst[i + ld]   = data[i].pos.y;
+        dst[i + 2*ld] = data[i].alpha;
+    }
+}
+
+// Pre-process rows `y0` to `y1 - 1` of the image described by `ctx`.
+static TAO_ALWAYS_INLINE void _TAO_SH_NAME(_tao_shackhartmann_stream_band)(
+    const tao_pixels_processor_context* ctx,
+    long                                y0,
+    long                                y1)
+{
+    tao_pixels_processor_context band = *ctx;
+    long offset = y0*ctx->width;
+    band.height = y1 - y0;
+    band.raw = (const char*)ctx->raw + y0*ctx->stride;
+    band.dat = (_TAO_SH_FLOAT*)ctx->dat + offset;
+    if (ctx->wgt != NULL) {
+        band.wgt = (_TAO_SH_FLOAT*)ctx->wgt + offset;
+    }
+    for (int j = 0; j < 4; ++j) {
+        if (ctx->preproc[j] != NULL) {
+            band.preproc[j] = (const _TAO_SH_FLOAT*)ctx->preproc[j] + offset;
+        }
+    }
+    ctx->processor(&band);
+}
+
+static inline TAO_SIMD_CLONES void _TAO_SH_NAME(
+    tao_shackhartmann_process_streamed)(
+    tao_shackhartmann_data*             restrict data,
+    const tao_subimage*                 restrict subs,
+    const long*                         restrict order,
+    long                                         nsubs,
+    const tao_pixels_processor_context*          ctx)
+{
+    const _TAO_SH_FLOAT* dat = (const _TAO_SH_FLOAT*)ctx->dat;
+    const _TAO_SH_FLOAT* wgt = (const _TAO_SH_FLOAT*)ctx->wgt;
+    long width = ctx->width, height = ctx->height;
+    long done = 0; // number of pre-processed rows
+    for (long k = 0; k < nsubs; ++k) {
+        long i = order[k];
+        if (subs[i].box.ymax >= done) {
+            long next = TAO_MAX(subs[i].box.ymax + 1,
+                                done + TAO_SHACKHARTMANN_STREAM_MIN_ROWS);
+            next = TAO_MIN(next, height);
+            _TAO_SH_NAME(_tao_shackhartmann_stream_band)(ctx, done, next);
+            done = next;
+        }
+        _TAO_SH_NAME(tao_shackhartmann_measure_cog)(
+            &data[i], &subs[i], dat, wgt, width);
+    }
+    if (done < height) {
+        _TAO_SH_NAME(_tao_shackhartmann_stream_band)(ctx, done, height);
+    }
+}
+
+#undef _TAO_SH_FLOAT
+#undef _TAO_SH_SUFFIX
+
+#endif // _TAO_SH_FLOAT
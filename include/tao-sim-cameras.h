@@ -0,0 +1,811 @@
+// tao-sim-cameras.h -
+//
+// Simulated cameras generating synthetic images or replaying recorded images
+// in TAO library.
+//
+//-----------------------------------------------------------------------------
+//
+// This file if part of TAO real-time software licensed under the MIT license
+// (https://git-cral.univ-lyon1.fr/tao/tao-rt).
+//
+// Copyright (C) 2022, Éric Thiébaut.
+
+#ifndef TAO_SIM_CAMERAS_H_
+#define TAO_SIM_CAMERAS_H_ 1
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <tao-arrays.h>
+#include <tao-basics.h>
+#include <tao-camera-servers.h>
+#include <tao-cameras-private.h>
+#include <tao-encodings.h>
+#include <tao-errors.h>
+#include <tao-generic.h>
+#include <tao-macros.h>
+#include <tao-options.h>
+#include <tao-utils.h>
+
+TAO_BEGIN_DECLS
+
+/**
+ * @defgroup SimCameras  Simulated cameras
+ *
+ * @ingroup Cameras
+ *
+ * @brief Camera devices generating synthetic images or replaying recorded
+ * images.
+ *
+ * @{
+ *
+ * A simulated camera is a camera device (see @ref tao_camera_create) which
+ * delivers frames at a given rate without any hardware, so that the whole
+ * chain of a camera server (see @ref tao_camera_server_run_loop) can be
+ * load-tested on any machine.  It has two modes:
+ *
+ * - A synthetic camera, created by tao_sim_camera_create(), delivers images
+ *   of a given size and encoding (unsigned integers of 8, 16, or 32 bits,
+ *   packed 12-bit pixels, or single precision floating-point) with a
+ *   background, a moving spot, and some noise.  These images are computed
+ *   once, in as many frames as the number of acquisition buffers, when
+ *   acquisition is started, so that delivering a frame costs nothing.
+ *
+ * - A replay camera, created by tao_sim_camera_create_replay(), delivers the
+ *   frames of a 3-dimensional array in a loop with their original
+ *   time-stamps (if provided) or at a given rate.  The frames are delivered
+ *   without copy, the region of interest being selected by the offset and
+ *   the stride of the acquisition buffers.
+ *
+ * Frames are produced on schedule whether they are consumed or not.  When
+ * the consumer is too slow, the pending frames exceeding the number of
+ * acquisition buffers are lost and counted as overruns, and the frames
+ * skipped because of the `drop` argument of
+ * tao_camera_wait_acquisition_buffer() are counted as dropped frames.
+ *
+ * If `tao-fits.h` is included before this header, function
+ * tao_sim_camera_load_replay() loads the images to replay from a FITS file.
+ * Function tao_sim_camera_server_main() implements the `tao_sim_camera_server`
+ * program:
+ *
+ * ~~~~~{.c}
+ * #include <tao-fits.h>
+ * #include <tao-sim-cameras.h>
+ *
+ * int main(int argc, char* argv[])
+ * {
+ *     return tao_sim_camera_server_main(argc, argv);
+ * }
+ * ~~~~~
+ *
+ * This header defines static functions, it must be included by a single
+ * compilation unit.
+ */
+
+/**
+ * Simulated camera.
+ */
+typedef struct tao_sim_camera {
+    tao_camera         base;///< Generic camera.  Must be first.
+    tao_array*         cube;///< Images to replay, `NULL` for a synthetic
+                            ///  camera.
+    tao_array*       stamps;///< Time-stamps of the images to replay (in
+                            ///  seconds), or `NULL`.
+    long            nframes;///< Number of images to replay.
+    double           period;///< Duration of a replay loop (in seconds), 0
+                            ///  to replay at the frame rate.
+    void*           buffers;///< Synthetic frames.
+    long              nbufs;///< Number of synthetic frames.
+    size_t          bufsize;///< Number of bytes per synthetic frame.
+    long             stride;///< Number of bytes per row of frames.
+    long             offset;///< Offset of the region of interest in replayed
+                            ///  frames (in bytes).
+    tao_time          start;///< Time when acquisition was started.
+    tao_serial         next;///< Index of next frame to deliver.
+} tao_sim_camera;
+
+#ifndef TAO_DOXYGEN_
+// Settings to initialize a simulated camera.
+typedef struct _tao_sim_camera_settings {
+    long             width;
+    long            height;
+    tao_encoding  encoding;
+    double       framerate;
+    tao_array*        cube;
+    tao_array*      stamps;
+} _tao_sim_camera_settings;
+
+// Get the encoding of the pixels of an array.
+static inline tao_encoding _tao_sim_camera_array_encoding(
+    tao_eltype eltype)
+{
+    switch (eltype) {
+    case TAO_INT8:   return TAO_ENCODING_SIGNED(8);
+    case TAO_UINT8:  return TAO_ENCODING_UNSIGNED(8);
+    case TAO_INT16:  return TAO_ENCODING_SIGNED(16);
+    case TAO_UINT16: return TAO_ENCODING_UNSIGNED(16);
+    case TAO_INT32:  return TAO_ENCODING_SIGNED(32);
+    case TAO_UINT32: return TAO_ENCODING_UNSIGNED(32);
+    case TAO_FLOAT:  return TAO_ENCODING_FLOAT(32);
+    case TAO_DOUBLE: return TAO_ENCODING_FLOAT(64);
+    default:         return TAO_ENCODING_UNKNOWN;
+    }
+}
+
+// Get the maximum level of synthetic pixels, 0 if the encoding is not
+// supported.
+static inline double _tao_sim_camera_max_level(
+    tao_encoding enc)
+{
+    if (enc == TAO_ENCODING_UNSIGNED(8)) {
+        return 255.0;
+    } else if (enc == TAO_ENCODING_ANDOR_MONO12PACKED) {
+        return 4095.0;
+    } else if (enc == TAO_ENCODING_UNSIGNED(16) ||
+               enc == TAO_ENCODING_UNSIGNED(32) ||
+               enc == TAO_ENCODING_FLOAT(32)) {
+        return 65535.0;
+    } else {
+        return 0.0;
+    }
+}
+
+// Get the number of bytes for a row of synthetic pixels.
+static inline long _tao_sim_camera_row_size(
+    tao_encoding enc,
+    long         width)
+{
+    if (enc == TAO_ENCODING_ANDOR_MONO12PACKED) {
+        return 3*(width/2);
+    } else {
+        return width*(TAO_ENCODING_BITS_PER_PIXEL(enc)/8);
+    }
+}
+
+// Time of a frame relative to the start of acquisition (in seconds).
+static inline double _tao_sim_camera_frame_time(
+    const tao_sim_camera* cam,
+    tao_serial            k)
+{
+    if (cam->period > 0) {
+        const double* t = (const double*)tao_get_array_data(cam->stamps);
+        tao_serial n = cam->nframes;
+        return (k/n)*cam->period + (t[k%n] - t[0]);
+    } else {
+        return k/cam->base.config.framerate;
+    }
+}
+
+// Fill a row of synthetic pixels.
+static void _tao_sim_camera_fill_row(
+    uint8_t*      dst,
+    const double* val,
+    long          width,
+    tao_encoding  enc)
+{
+    if (enc == TAO_ENCODING_UNSIGNED(8)) {
+        for (long x = 0; x < width; ++x) {
+            dst[x] = (uint8_t)val[x];
+        }
+    } else if (enc == TAO_ENCODING_UNSIGNED(16)) {
+        for (long x = 0; x < width; ++x) {
+            ((uint16_t*)dst)[x] = (uint16_t)val[x];
+        }
+    } else if (enc == TAO_ENCODING_UNSIGNED(32)) {
+        for (long x = 0; x < width; ++x) {
+            ((uint32_t*)dst)[x] = (uint32_t)val[x];
+        }
+    } else if (enc == TAO_ENCODING_FLOAT(32)) {
+        for (long x = 0; x < width; ++x) {
+            ((float*)dst)[x] = (float)val[x];
+        }
+    } else if (enc == TAO_ENCODING_ANDOR_MONO12PACKED) {
+        // Layout of tao_pixels_convert_p12_to_u16(): the 8 most significant
+        // bits of each pixel of a pair in bytes 0 and 2, their 4 least
+        // significant bits in the low and high nibbles of byte 1.
+        for (long x = 0; x + 1 < width; x += 2) {
+            unsigned p0 = (unsigned)val[x], p1 = (unsigned)val[x+1];
+            dst[0] = (uint8_t)(p0 >> 4);
+            dst[1] = (uint8_t)((p0 & 0xf) | ((p1 & 0xf) << 4));
+            dst[2] = (uint8_t)(p1 >> 4);
+            dst += 3;
+        }
+    }
+}
+
+// Compute the synthetic frames for the current configuration.
+static tao_status _tao_sim_camera_synthesize(
+    tao_sim_camera* cam)
+{
+    const tao_camera_config* cfg = &cam->base.config;
+    long width = cfg->roi.width, height = cfg->roi.height;
+    long nbufs = cfg->buffers;
+    long stride = _tao_sim_camera_row_size(cfg->bufferencoding, width);
+    size_t bufsize = stride*height;
+    if (cam->buffers == NULL || cam->nbufs*cam->bufsize < nbufs*bufsize) {
+        tao_free(cam->buffers);
+        cam->nbufs = 0;
+        cam->buffers = tao_malloc(nbufs*bufsize);
+        if (cam->buffers == NULL) {
+            return TAO_ERROR;
+        }
+    }
+    double* val = (double*)tao_malloc(width*sizeof(double));
+    if (val == NULL) {
+        return TAO_ERROR;
+    }
+    cam->nbufs = nbufs;
+    cam->bufsize = bufsize;
+    cam->stride = stride;
+    double top = _tao_sim_camera_max_level(cfg->bufferencoding);
+    double bkg = 0.1*top, amp = 0.5*top, rms = 0.02*top;
+    double sw = cfg->sensorwidth, sh = cfg->sensorheight;
+    double rad = 0.25*TAO_MIN(sw, sh), sig = 3.0;
+    uint32_t seed = 0x2545F491;
+    for (long k = 0; k < nbufs; ++k) {
+        // The spot moves on a circle centered on the sensor, coordinates
+        // are in physical pixels so that they do not depend on the ROI.
+        double phi = (2*M_PI*k)/nbufs;
+        double xc = 0.5*sw + rad*cos(phi), yc = 0.5*sh + rad*sin(phi);
+        uint8_t* buf = (uint8_t*)cam->buffers + k*bufsize;
+        for (long y = 0; y < height; ++y) {
+            double yp = cfg->roi.yoff + (y + 0.5)*cfg->roi.ybin - yc;
+            for (long x = 0; x < width; ++x) {
+                double xp = cfg->roi.xoff + (x + 0.5)*cfg->roi.xbin - xc;
+                seed ^= seed << 13;
+                seed ^= seed >> 17;
+                seed ^= seed << 5;
+                double v = bkg + amp*exp(-(xp*xp + yp*yp)/(2*sig*sig)) +
+                    rms*(seed*(2.0/4294967295.0) - 1.0);
+                val[x] = TAO_MIN(TAO_MAX(round(v), 0.0), top);
+            }
+            _tao_sim_camera_fill_row(buf + y*stride, val, width,
+                                     cfg->bufferencoding);
+        }
+    }
+    tao_free(val);
+    return TAO_OK;
+}
+
+static tao_status _tao_sim_camera_initialize(
+    tao_camera* base,
+    void*       ctx)
+{
+    tao_sim_camera* cam = (tao_sim_camera*)base;
+    const _tao_sim_camera_settings* set = (_tao_sim_camera_settings*)ctx;
+    tao_camera_config* cfg = &base->config;
+    tao_forced_store(&cfg->sensorwidth, set->width);
+    tao_forced_store(&cfg->sensorheight, set->height);
+    tao_camera_roi_define(&cfg->roi, 1, 1, 0, 0, set->width, set->height);
+    cfg->framerate = set->framerate;
+    cfg->exposuretime = 0.9/set->framerate;
+    cfg->buffers = 4;
+    cfg->sensorencoding = set->encoding;
+    cfg->bufferencoding = set->encoding;
+    if (set->cube != NULL) {
+        cam->cube = tao_reference_array(set->cube);
+        cam->nframes = tao_get_array_dim(set->cube, 3);
+        if (set->stamps != NULL && cam->nframes > 1) {
+            cam->stamps = tao_reference_array(set->stamps);
+            const double* t = (const double*)tao_get_array_data(cam->stamps);
+            cam->period = (t[cam->nframes-1] - t[0])*cam->nframes/
+                (cam->nframes - 1);
+        }
+    }
+    return TAO_OK;
+}
+
+static tao_status _tao_sim_camera_finalize(
+    tao_camera* base)
+{
+    tao_sim_camera* cam = (tao_sim_camera*)base;
+    if (cam->cube != NULL) {
+        tao_unreference_array(cam->cube);
+    }
+    if (cam->stamps != NULL) {
+        tao_unreference_array(cam->stamps);
+    }
+    tao_free(cam->buffers);
+    return TAO_OK;
+}
+
+static tao_status _tao_sim_camera_reset(
+    tao_camera* base)
+{
+    (void)base;
+    return TAO_OK;
+}
+
+static tao_status _tao_sim_camera_update_config(
+    tao_camera* base)
+{
+    (void)base;
+    return TAO_OK;
+}
+
+static tao_status _tao_sim_camera_check_config(
+    tao_camera*              base,
+    const tao_camera_config* cfg)
+{
+    tao_sim_camera* cam = (tao_sim_camera*)base;
+    if (tao_camera_roi_check(&cfg->roi, cfg->sensorwidth,
+                             cfg->sensorheight) != TAO_OK) {
+        return TAO_ERROR;
+    }
+    if (!(cfg->framerate > 0 && isfinite(cfg->framerate))) {
+        tao_store_error(__func__, TAO_BAD_FRAMERATE);
+        return TAO_ERROR;
+    }
+    if (!(cfg->exposuretime >= 0 && cfg->exposuretime*cfg->framerate <= 1)) {
+        tao_store_error(__func__, TAO_BAD_EXPOSURETIME);
+        return TAO_ERROR;
+    }
+    if (cfg->buffers < 2) {
+        tao_store_error(__func__, TAO_BAD_BUFFERS);
+        return TAO_ERROR;
+    }
+    if (cfg->bufferencoding != cfg->sensorencoding) {
+        tao_store_error(__func__, TAO_BAD_ENCODING);
+        return TAO_ERROR;
+    }
+    if (cam->cube != NULL) {
+        if (cfg->sensorencoding != base->config.sensorencoding) {
+            tao_store_error(__func__, TAO_BAD_ENCODING);
+            return TAO_ERROR;
+        }
+        if (cfg->roi.xbin != 1 || cfg->roi.ybin != 1) {
+            tao_store_error(__func__, TAO_BAD_ROI);
+            return TAO_ERROR;
+        }
+    } else {
+        if (_tao_sim_camera_max_level(cfg->sensorencoding) <= 0) {
+            tao_store_error(__func__, TAO_BAD_ENCODING);
+            return TAO_ERROR;
+        }
+        if (cfg->sensorencoding == TAO_ENCODING_ANDOR_MONO12PACKED &&
+            (cfg->roi.width & 1) != 0) {
+            tao_store_error(__func__, TAO_BAD_ROI);
+            return TAO_ERROR;
+        }
+    }
+    return TAO_OK;
+}
+
+static tao_status _tao_sim_camera_set_config(
+    tao_camera*              base,
+    const tao_camera_config* cfg)
+{
+    tao_camera_config* dst = &base->config;
+    tao_camera_roi_copy(&dst->roi, &cfg->roi);
+    dst->framerate = cfg->framerate;
+    dst->exposuretime = cfg->exposuretime;
+    dst->buffers = cfg->buffers;
+    dst->pixeltype = cfg->pixeltype;
+    dst->sensorencoding = cfg->sensorencoding;
+    dst->bufferencoding = cfg->bufferencoding;
+    dst->preprocessing = cfg->preprocessing;
+    return TAO_OK;
+}
+
+static tao_status _tao_sim_camera_start(
+    tao_camera* base)
+{
+    tao_sim_camera* cam = (tao_sim_camera*)base;
+    const tao_camera_config* cfg = &base->config;
+    if (cam->cube != NULL) {
+        long elsize = tao_size_of_eltype(tao_get_array_eltype(cam->cube));
+        cam->stride = cfg->sensorwidth*elsize;
+        cam->offset = cfg->roi.yoff*cam->stride + cfg->roi.xoff*elsize;
+        cam->bufsize = cfg->sensorheight*cam->stride;
+    } else if (_tao_sim_camera_synthesize(cam) != TAO_OK) {
+        return TAO_ERROR;
+    }
+    cam->next = 0;
+    return tao_get_monotonic_time(&cam->start);
+}
+
+static tao_status _tao_sim_camera_stop(
+    tao_camera* base)
+{
+    (void)base;
+    return TAO_OK;
+}
+
+// Wait for a given number of seconds with the camera unlocked so that other
+// threads can use the camera meanwhile.  The caller owns the lock on the
+// camera.
+static inline tao_status _tao_sim_camera_sleep(
+    tao_camera* base,
+    double      secs)
+{
+    tao_time lim;
+    tao_timeout timeout = tao_get_absolute_timeout(&lim, secs);
+    if (timeout == TAO_TIMEOUT_ERROR) {
+        return TAO_ERROR;
+    }
+    if (timeout != TAO_TIMEOUT_FUTURE) {
+        return TAO_OK;
+    }
+    while (true) {
+        tao_status status = tao_camera_abstimed_wait(base, &lim);
+        if (status != TAO_OK) {
+            return status == TAO_TIMEOUT ? TAO_OK : TAO_ERROR;
+        }
+    }
+}
+
+static tao_status _tao_sim_camera_wait_buffer(
+    tao_camera*             base,
+    tao_acquisition_buffer* buf,
+    double                  secs,
+    int                     drop)
+{
+    tao_sim_camera* cam = (tao_sim_camera*)base;
+    tao_camera_config* cfg = &base->config;
+    tao_time now;
+    double t, elapsed;
+    while (true) {
+        if (tao_get_monotonic_time(&now) != TAO_OK) {
+            return TAO_ERROR;
+        }
+        elapsed = tao_elapsed_seconds(&now, &cam->start);
+        t = _tao_sim_camera_frame_time(cam, cam->next);
+        if (t > elapsed + secs) {
+            if (_tao_sim_camera_sleep(base, secs) != TAO_OK) {
+                return TAO_ERROR;
+            }
+            ++cfg->timeouts;
+            return TAO_TIMEOUT;
+        }
+        if (t > elapsed) {
+            if (_tao_sim_camera_sleep(base, t - elapsed) != TAO_OK) {
+                return TAO_ERROR;
+            }
+            elapsed = t;
+            tao_get_monotonic_time(&now);
+        }
+        // Count the pending frames, the oldest ones are overwritten if they
+        // exceed the number of acquisition buffers.
+        tao_serial pending = 1;
+        while (_tao_sim_camera_frame_time(cam, cam->next + pending) <=
+               elapsed) {
+            ++pending;
+        }
+        if (pending > cfg->buffers) {
+            cfg->overruns += pending - cfg->buffers;
+            cam->next += pending - cfg->buffers;
+            pending = cfg->buffers;
+        }
+        cfg->frames = cam->next + pending;
+        if (drop < 1) {
+            break;
+        }
+        cfg->droppedframes += pending - 1;
+        cam->next += pending - 1;
+        if (drop == 1) {
+            break;
+        }
+        // Drop all pending frames and wait for a fresh one.
+        ++cfg->droppedframes;
+        ++cam->next;
+    }
+    tao_serial k = cam->next++;
+    if (cam->cube != NULL) {
+        buf->data = (uint8_t*)tao_get_array_data(cam->cube) +
+            (k%cam->nframes)*cam->bufsize;
+        buf->offset = cam->offset;
+    } else {
+        buf->data = (uint8_t*)cam->buffers + (k%cam->nbufs)*cam->bufsize;
+        buf->offset = 0;
+    }
+    buf->size = cam->bufsize;
+    buf->width = cfg->roi.width;
+    buf->height = cfg->roi.height;
+    buf->stride = cam->stride;
+    buf->encoding = cfg->bufferencoding;
+    buf->serial = k + 1;
+    tao_time dt;
+    tao_time_add(&buf->frame_end, &cam->start,
+                 tao_seconds_to_time(&dt, _tao_sim_camera_frame_time(cam, k)));
+    tao_time_subtract(&buf->frame_start, &buf->frame_end,
+                      tao_seconds_to_time(&dt, cfg->exposuretime));
+    buf->buffer_ready = now;
+    return TAO_OK;
+}
+
+static const tao_camera_ops _tao_sim_camera_ops = {
+    .name = "SimulatedCamera",
+    .initialize = _tao_sim_camera_initialize,
+    .finalize = _tao_sim_camera_finalize,
+    .reset = _tao_sim_camera_reset,
+    .update_config = _tao_sim_camera_update_config,
+    .check_config = _tao_sim_camera_check_config,
+    .set_config = _tao_sim_camera_set_config,
+    .start = _tao_sim_camera_start,
+    .stop = _tao_sim_camera_stop,
+    .wait_buffer = _tao_sim_camera_wait_buffer,
+};
+#endif // TAO_DOXYGEN_
+
+/**
+ * Create a synthetic camera.
+ *
+ * @param width      Number of pixels per row of the sensor.
+ *
+ * @param height     Number of rows of the sensor.
+ *
+ * @param encoding   Pixel encoding of the images: `TAO_ENCODING_UNSIGNED(n)`
+ *                   with `n` equal to 8, 16, or 32, @ref
+ *                   TAO_ENCODING_ANDOR_MONO12PACKED, or
+ *                   `TAO_ENCODING_FLOAT(32)`.
+ *
+ * @param framerate  Initial number of frames per second.
+ *
+ * @return The address of a new camera device; `NULL` in case of failure.
+ */
+static inline tao_camera* tao_sim_camera_create(
+    long         width,
+    long         height,
+    tao_encoding encoding,
+    double       framerate)
+{
+    if (width < 1 || height < 1 ||
+        (encoding == TAO_ENCODING_ANDOR_MONO12PACKED && (width & 1) != 0)) {
+        tao_store_error(__func__, TAO_BAD_SIZE);
+        return NULL;
+    }
+    if (_tao_sim_camera_max_level(encoding) <= 0) {
+        tao_store_error(__func__, TAO_BAD_ENCODING);
+        return NULL;
+    }
+    if (!(framerate > 0 && isfinite(framerate))) {
+        tao_store_error(__func__, TAO_BAD_FRAMERATE);
+        return NULL;
+    }
+    _tao_sim_camera_settings set = {
+        .width = width,
+        .height = height,
+        .encoding = encoding,
+        .framerate = framerate,
+    };
+    return tao_camera_create(&_tao_sim_camera_ops, &set,
+                             sizeof(tao_sim_camera));
+}
+
+/**
+ * Create a replay camera.
+ *
+ * The camera delivers the images of a 3-dimensional array in a loop.  If
+ * time-stamps are provided, the images are delivered with the same time
+ * intervals as when they were recorded, a loop lasting the duration of the
+ * sequence plus the mean interval between images.  Otherwise, images are
+ * delivered at the frame rate of the camera.
+ *
+ * @param cube       Images to replay, a `width×height×nframes` array whose
+ *                   elements are integers or floating-point values.  The
+ *                   array is referenced by the camera.
+ *
+ * @param stamps     Time-stamps of the images (in seconds), an array of
+ *                   `nframes` increasing double precision values, or `NULL`.
+ *                   The array is referenced by the camera.
+ *
+ * @param framerate  Initial number of frames per second.
+ *
+ * @return The address of a new camera device; `NULL` in case of failure.
+ */
+static inline tao_camera* tao_sim_camera_create_replay(
+    tao_array* cube,
+    tao_array* stamps,
+    double     framerate)
+{
+    if (cube == NULL) {
+        tao_store_error(__func__, TAO_BAD_ADDRESS);
+        return NULL;
+    }
+    tao_encoding encoding = _tao_sim_camera_array_encoding(
+        tao_get_array_eltype(cube));
+    if (encoding == TAO_ENCODING_UNKNOWN) {
+        tao_store_error(__func__, TAO_BAD_TYPE);
+        return NULL;
+    }
+    long nframes = tao_get_array_dim(cube, 3);
+    if (tao_get_array_ndims(cube) != 3 || nframes < 1) {
+        tao_store_error(__func__, TAO_BAD_RANK);
+        return NULL;
+    }
+    if (stamps != NULL) {
+        if (tao_get_array_eltype(stamps) != TAO_DOUBLE ||
+            tao_get_array_length(stamps) != nframes) {
+            tao_store_error(__func__, TAO_BAD_SIZE);
+            return NULL;
+        }
+        const double* t = (const double*)tao_get_array_data(stamps);
+        for (long k = 1; k < nframes; ++k) {
+            if (!(t[k] > t[k-1])) {
+                tao_store_error(__func__, TAO_BAD_VALUE);
+                return NULL;
+            }
+        }
+    }
+    if (!(framerate > 0 && isfinite(framerate))) {
+        tao_store_error(__func__, TAO_BAD_FRAMERATE);
+        return NULL;
+    }
+    _tao_sim_camera_settings set = {
+        .width = tao_get_array_dim(cube, 1),
+        .height = tao_get_array_dim(cube, 2),
+        .encoding = encoding,
+        .framerate = framerate,
+        .cube = cube,
+        .stamps = stamps,
+    };
+    return tao_camera_create(&_tao_sim_camera_ops, &set,
+                             sizeof(tao_sim_camera));
+}
+
+#if defined(TAO_FITS_H_) || defined(TAO_DOXYGEN_)
+/**
+ * Create a replay camera for the images of a FITS file.
+ *
+ * The images are read in the first FITS IMAGE of the file and their
+ * time-stamps, if any, in the FITS IMAGE extension named `TIMESTAMPS`.  This
+ * function is only available if `tao-fits.h` has been included before
+ * `tao-sim-cameras.h`.
+ *
+ * @param filename   Name of the FITS file.
+ *
+ * @param framerate  Initial number of frames per second, used if there are
+ *                   no time-stamps.
+ *
+ * @return The address of a new camera device; `NULL` in case of failure.
+ *
+ * @see tao_sim_camera_create_replay().
+ */
+static inline tao_camera* tao_sim_camera_load_replay(
+    const char* filename,
+    double      framerate)
+{
+    tao_array* cube = tao_load_array_from_fits_file(filename, NULL);
+    if (cube == NULL) {
+        return NULL;
+    }
+    char extname[] = "TIMESTAMPS";
+    tao_array* stamps = tao_load_array_from_fits_file(filename, extname);
+    if (stamps == NULL) {
+        tao_clear_error(NULL);
+    } else if (tao_get_array_eltype(stamps) == TAO_FLOAT) {
+        long n = tao_get_array_length(stamps);
+        tao_array* tmp = tao_create_1d_array(TAO_DOUBLE, n);
+        if (tmp != NULL) {
+            const float* src = (const float*)tao_get_array_data(stamps);
+            double* dst = (double*)tao_get_array_data(tmp);
+            for (long k = 0; k < n; ++k) {
+                dst[k] = src[k];
+            }
+        }
+        tao_unreference_array(stamps);
+        if (tmp == NULL) {
+            tao_unreference_array(cube);
+            return NULL;
+        }
+        stamps = tmp;
+    }
+    tao_camera* cam = tao_sim_camera_create_replay(cube, stamps, framerate);
+    tao_unreference_array(cube);
+    if (stamps != NULL) {
+        tao_unreference_array(stamps);
+    }
+    return cam;
+}
+#endif // TAO_FITS_H_ || TAO_DOXYGEN_
+
+/**
+ * Main function of the `tao_sim_camera_server` program.
+ *
+ * The program runs a camera server named after its single argument for a
+ * simulated camera.  Options `-width`, `-height`, `-encoding` (one of `u8`,
+ * `u16`, `u32`, `p12`, or `float`), and `-framerate` specify a synthetic
+ * camera, option `-replay` specifies a FITS file with images to replay (if
+ * `tao-fits.h` has been included), and option `-nbufs` specifies the number
+ * of output images of the server.
+ *
+ * @param argc    Number of arguments.
+ *
+ * @param argv    List of arguments.
+ *
+ * @return The exit status of the program.
+ */
+static inline int tao_sim_camera_server_main(
+    int   argc,
+    char* argv[])
+{
+    long width = 640, height = 480, nbufs = 20;
+    double framerate = 100.0;
+    const char* encoding = "u16";
+    const char* replay = "";
+    tao_help_info info = {
+        .program = argv[0],
+        .args = "NAME",
+        .purpose = "Run a camera server for a simulated camera.",
+        .output = stdout,
+    };
+    tao_option options[] = {
+        TAO_OPTION_POSITIVE_LONG(0, "width", "NUMBER",
+                                 "Number of pixels per row", &width),
+        TAO_OPTION_POSITIVE_LONG(0, "height", "NUMBER",
+                                 "Number of rows", &height),
+        TAO_OPTION_STRING(0, "encoding", "NAME",
+                          "Pixel encoding (u8, u16, u32, p12, or float)",
+                          &encoding),
+        TAO_OPTION_POSITIVE_DOUBLE(0, "framerate", "VALUE",
+                                   "Frames per second", &framerate),
+        TAO_OPTION_STRING(0, "replay", "FILE",
+                          "FITS file with images to replay", &replay),
+        TAO_OPTION_POSITIVE_LONG(0, "nbufs", "NUMBER",
+                                 "Number of output images", &nbufs),
+        TAO_OPTION_HELP_AND_EXIT(0, 0),
+        TAO_OPTION_LAST_ENTRY,
+    };
+    info.options = options;
+    options[6].ptr = &info;
+    argc = tao_parse_options(NULL, argc, argv, 0, options);
+    if (argc != 2) {
+        if (argc >= 0) {
+            fprintf(stderr, "%s: %s server name\n", argv[0],
+                    (argc < 2 ? "missing" : "too many arguments after"));
+        }
+        return EXIT_FAILURE;
+    }
+    tao_camera* cam;
+    if (replay[0] != '\0') {
+#ifdef TAO_FITS_H_
+        cam = tao_sim_camera_load_replay(replay, framerate);
+#else
+        tao_store_error(__func__, TAO_NO_FITS_SUPPORT);
+        cam = NULL;
+#endif
+    } else {
+        tao_encoding enc =
+            strcmp(encoding, "u8")    == 0 ? TAO_ENCODING_UNSIGNED(8) :
+            strcmp(encoding, "u16")   == 0 ? TAO_ENCODING_UNSIGNED(16) :
+            strcmp(encoding, "u32")   == 0 ? TAO_ENCODING_UNSIGNED(32) :
+            strcmp(encoding, "p12")   == 0 ? TAO_ENCODING_ANDOR_MONO12PACKED :
+            strcmp(encoding, "float") == 0 ? TAO_ENCODING_FLOAT(32) :
+            TAO_ENCODING_UNKNOWN;
+        if (enc == TAO_ENCODING_UNKNOWN) {
+            fprintf(stderr, "%s: invalid encoding \"%s\"\n",
+                    argv[0], encoding);
+            return EXIT_FAILURE;
+        }
+        cam = tao_sim_camera_create(width, height, enc, framerate);
+    }
+    if (cam == NULL) {
+        tao_report_error();
+        return EXIT_FAILURE;
+    }
+    int code = EXIT_SUCCESS;
+    tao_camera_server* srv = tao_camera_server_create(argv[1], cam, nbufs, 0);
+    if (srv == NULL || tao_camera_server_run_loop(srv) != TAO_OK) {
+        code = EXIT_FAILURE;
+    }
+    if (srv != NULL && tao_camera_server_destroy(srv) != TAO_OK) {
+        code = EXIT_FAILURE;
+    }
+    if (tao_camera_destroy(cam) != TAO_OK) {
+        code = EXIT_FAILURE;
+    }
+    if (code != EXIT_SUCCESS) {
+        tao_report_error();
+    }
+    return code;
+}
+
+/**
+ * @}
+ */
+
+TAO_END_DECLS
+
+#endif // TAO_SIM_CAMERAS_H_
@@ -47,6 +47,9 @@
  * - `PREPROC_SCOPE` can be defined to specify the scope of the encoded
  *   function, `extern` is assumed by default.
  *
+ * - `PREPROC_ATTRIBUTES` can be defined to specify attributes of the encoded
+ *   function (e.g. @ref TAO_SIMD_CLONES), nothing is assumed by default.
+ *
  * - `PREPROC_FUNC` is the name of the preprocessing function to encode.
  *
  * - `PREPROC_FLOAT` is the floating-point pixel type of resulting data and
@@ -117,7 +120,8 @@
  * The header file `tao-test-preprocessing.h` may be included several times to
  * encode different versions of the pre-processing function with different
  * pixel types, different methods, etc.  The above macros (except
- * `PREPROC_SCOPE`) are automatically undefined by `tao-test-preprocessing.h`.
+ * `PREPROC_SCOPE` and `PREPROC_ATTRIBUTES`) are automatically undefined by
+ * `tao-test-preprocessing.h`.
  *
  * The encoded preprocessing function has the following prototype:
  *
@@ -347,6 +351,9 @@ static inline uint16_t unpack_high_p12(uint16_t b1, uint16_t b2)
 #ifndef PREPROC_SCOPE
 #  define PREPROC_SCOPE extern
 #endif
+#ifndef PREPROC_ATTRIBUTES
+#  define PREPROC_ATTRIBUTES
+#endif
 
 #ifndef PREPROC_FLOAT
 #  error PREPROC_FLOAT must be defined
@@ -386,7 +393,7 @@ static inline uint16_t unpack_high_p12(uint16_t b1, uint16_t b2)
 
 #if _PREPROC_SPLIT == 1
 // Version 1.  Apply all operations to each pixel in turn.
-PREPROC_SCOPE void PREPROC_FUNC(
+PREPROC_SCOPE PREPROC_ATTRIBUTES void PREPROC_FUNC(
     long width,
     long height,
     long stride,
@@ -408,7 +415,7 @@ PREPROC_SCOPE void PREPROC_FUNC(
 #elif _PREPROC_SPLIT == 2
 // Version 2.  Convert and apply correction to a row of pixels, then
 //             compute weights for this row of pixels.
-PREPROC_SCOPE void PREPROC_FUNC(
+PREPROC_SCOPE PREPROC_ATTRIBUTES void PREPROC_FUNC(
     long width,
     long height,
     long stride,
@@ -432,7 +439,7 @@ PREPROC_SCOPE void PREPROC_FUNC(
 #elif _PREPROC_SPLIT == 3
 // Version 3.  Convert a row of pixels, then apply correction and
 //             compute weights for this row of pixels.
-PREPROC_SCOPE void PREPROC_FUNC(
+PREPROC_SCOPE PREPROC_ATTRIBUTES void PREPROC_FUNC(
     long width,
     long height,
     long stride,
@@ -459,7 +466,7 @@ PREPROC_SCOPE void PREPROC_FUNC(
 // Version 4.  Convert a row of pixels, then apply correction for this
 //             row of pixels, finally compute weights for this row of
 //             pixels.
-PREPROC_SCOPE void PREPROC_FUNC(
+PREPROC_SCOPE PREPROC_ATTRIBUTES void PREPROC_FUNC(
     long width,
     long height,
     long stride,
@@ -486,7 +493,7 @@ PREPROC_SCOPE void PREPROC_FUNC(
 #elif _PREPROC_SPLIT == 5
 // Version 5.  Convert and apply correction to the full image, then
 //             compute the weights for the image.
-PREPROC_SCOPE void PREPROC_FUNC(
+PREPROC_SCOPE PREPROC_ATTRIBUTES void PREPROC_FUNC(
     long width,
     long height,
     long stride,
@@ -512,7 +519,7 @@ PREPROC_SCOPE void PREPROC_FUNC(
 #elif _PREPROC_SPLIT == 6
 // Version 6.  Convert the full image to floating-point, then apply
 //             the correction and compute the weights for the image.
-PREPROC_SCOPE void PREPROC_FUNC(
+PREPROC_SCOPE PREPROC_ATTRIBUTES void PREPROC_FUNC(
     long width,
     long height,
     long stride,
@@ -541,7 +548,7 @@ PREPROC_SCOPE void PREPROC_FUNC(
 // Version 7.  Convert the full image to floating-point, then apply
 //             the correction to the image and finally compute the
 //             weights for the image.
-PREPROC_SCOPE void PREPROC_FUNC(
+PREPROC_SCOPE PREPROC_ATTRIBUTES void PREPROC_FUNC(
     long width,
     long height,
     long stride,
@@ -0,0 +1,343 @@
+// tao-worker-teams.h -
+//
+// Teams of persistent worker threads in TAO library.
+//
+//-----------------------------------------------------------------------------
+//
+// This file if part of TAO real-time software licensed under the MIT license
+// (https://git-cral.univ-lyon1.fr/tao/tao-rt).
+//
+// Copyright (C) 2022, Éric Thiébaut.
+
+#ifndef TAO_WORKER_TEAMS_H_
+#define TAO_WORKER_TEAMS_H_ 1
+
+#include <sched.h>
+#include <stdatomic.h>
+
+#include <tao-basics.h>
+#include <tao-errors.h>
+#include <tao-threads.h>
+#include <tao-utils.h>
+
+TAO_BEGIN_DECLS
+
+/**
+ * @defgroup WorkerTeams  Teams of worker threads
+ *
+ * @ingroup Utilities
+ *
+ * @brief Teams of persistent worker threads for real-time processing.
+ *
+ * @{
+ *
+ * A team of worker threads executes, with the calling thread, a job split
+ * in a number of independent tasks.  The tasks are claimed by the threads with
+ * an atomic counter until there are none left, so the load is balanced
+ * dynamically.  Unlike a thread pool (see @ref tao_threadpool_push_job),
+ * there is no queue of jobs: the workers are persistent and are notified of a
+ * new job by incrementing a generation counter.  An idle worker polls this
+ * counter for a while (see @ref TAO_WORKER_TEAM_SPINS) and then blocks on a
+ * condition variable until notified.  The calling thread waits for the end of
+ * the job in the same way.  This keeps the overhead of a job to a few
+ * microseconds when jobs are frequent (e.g. one per image) without burning
+ * the processors when jobs are rare.
+ *
+ * The number of workers and the cores they are pinned to can be changed at
+ * run-time by tao_worker_team_set_workers().  Pinning threads requires that
+ * `_GNU_SOURCE` be defined before including any header.
+ *
+ * All functions of a team, except the workers, shall be called by the same
+ * thread.
+ */
+
+/**
+ * @def TAO_WORKER_TEAM_MAX_WORKERS
+ *
+ * Maximum number of worker threads in a team.
+ */
+#define TAO_WORKER_TEAM_MAX_WORKERS 64
+
+/**
+ * @def TAO_WORKER_TEAM_SPINS
+ *
+ * Number of polling iterations of an idle worker of a team before it blocks
+ * on a condition variable, and of the calling thread waiting for the workers
+ * before it yields the processor.
+ */
+#define TAO_WORKER_TEAM_SPINS 20000
+
+/**
+ * Prototype of the function executing a task of a job.
+ *
+ * @param arg     Argument of the job.
+ *
+ * @param task    Index of the task in the range `0` to `ntasks-1`.
+ */
+typedef void tao_worker_team_job(
+    void* arg,
+    long task);
+
+/**
+ * Team of persistent worker threads.
+ */
+typedef struct tao_worker_team {
+    tao_mutex             mutex;///< Lock to notify workers.
+    tao_cond               cond;///< Condition to notify workers.
+    long               nworkers;///< Number of worker threads.
+    tao_thread workers[TAO_WORKER_TEAM_MAX_WORKERS];///< Worker threads.
+    tao_atomic tao_serial   gen;///< Generation of the current job.
+    tao_serial          started;///< Generation when workers were started.
+    tao_atomic long        next;///< Index of next task to execute.
+    tao_atomic long        busy;///< Number of workers still on current job.
+    tao_atomic bool        quit;///< Workers must quit.
+    tao_worker_team_job*    job;///< Function executing a task.
+    void*                   arg;///< Argument of the job.
+    long                 ntasks;///< Number of tasks of the job.
+} tao_worker_team;
+
+#ifndef TAO_DOXYGEN_
+#if defined(__x86_64__) || defined(__i386__)
+#  define _TAO_WT_PAUSE() __builtin_ia32_pause()
+#else
+#  define _TAO_WT_PAUSE() do {} while (false)
+#endif
+#endif // TAO_DOXYGEN_
+
+// Execute tasks of the current job until there are none left.
+static inline void _tao_worker_team_work(
+    tao_worker_team* team)
+{
+    long task;
+    while ((task = atomic_fetch_add(&team->next, 1)) < team->ntasks) {
+        team->job(team->arg, task);
+    }
+}
+
+static inline void* _tao_worker_team_worker(
+    void* arg)
+{
+    tao_worker_team* team = (tao_worker_team*)arg;
+    tao_serial seen = team->started;
+    while (true) {
+        tao_serial gen = atomic_load(&team->gen);
+        for (long k = 0; gen == seen && k < TAO_WORKER_TEAM_SPINS; ++k) {
+            _TAO_WT_PAUSE();
+            gen = atomic_load(&team->gen);
+        }
+        if (gen == seen) {
+            tao_mutex_lock(&team->mutex);
+            while ((gen = atomic_load(&team->gen)) == seen) {
+                tao_condition_wait(&team->cond, &team->mutex);
+            }
+            tao_mutex_unlock(&team->mutex);
+        }
+        seen = gen;
+        if (atomic_load(&team->quit)) {
+            break;
+        }
+        _tao_worker_team_work(team);
+        atomic_fetch_sub(&team->busy, 1);
+    }
+    return NULL;
+}
+
+// Start a new generation and wake up idle workers.
+static inline void _tao_worker_team_notify(
+    tao_worker_team* team)
+{
+    tao_mutex_lock(&team->mutex);
+    atomic_fetch_add(&team->gen, 1);
+    tao_condition_broadcast(&team->cond);
+    tao_mutex_unlock(&team->mutex);
+}
+
+// Stop and join all workers.
+static inline void _tao_worker_team_stop(
+    tao_worker_team* team)
+{
+    if (team->nworkers > 0) {
+        atomic_store(&team->quit, true);
+        _tao_worker_team_notify(team);
+        for (long k = 0; k < team->nworkers; ++k) {
+            tao_thread_join(team->workers[k], NULL);
+        }
+        team->nworkers = 0;
+        atomic_store(&team->quit, false);
+    }
+}
+
+/**
+ * Create a team of worker threads.
+ *
+ * The team has initially no workers, so all tasks are executed by the
+ * calling thread of tao_worker_team_run() until tao_worker_team_set_workers()
+ * is called.
+ *
+ * @return The address of a new team; `NULL` in case of failure.
+ */
+static inline tao_worker_team* tao_worker_team_create(
+    void)
+{
+    tao_worker_team* team = (tao_worker_team*)tao_calloc(
+        1, sizeof(tao_worker_team));
+    if (team == NULL) {
+        return NULL;
+    }
+    atomic_init(&team->gen, 0);
+    atomic_init(&team->next, 0);
+    atomic_init(&team->busy, 0);
+    atomic_init(&team->quit, false);
+    if (tao_mutex_initialize(&team->mutex, TAO_PROCESS_PRIVATE) != TAO_OK) {
+        tao_free(team);
+        return NULL;
+    }
+    if (tao_condition_initialize(&team->cond, TAO_PROCESS_PRIVATE) != TAO_OK) {
+        tao_mutex_destroy(&team->mutex, false);
+        tao_free(team);
+        return NULL;
+    }
+    return team;
+}
+
+/**
+ * Destroy a team of worker threads.
+ *
+ * This function stops and joins all the workers of the team.
+ *
+ * @param team    Team to destroy (can be `NULL`).
+ */
+static inline void tao_worker_team_destroy(
+    tao_worker_team* team)
+{
+    if (team != NULL) {
+        _tao_worker_team_stop(team);
+        tao_condition_destroy(&team->cond);
+        tao_mutex_destroy(&team->mutex, false);
+        tao_free(team);
+    }
+}
+
+/**
+ * Set the workers of a team.
+ *
+ * This function stops the current workers of the team (if any) and starts
+ * new ones.  It shall not be called while tao_worker_team_run() is running.
+ *
+ * @param team      Team.
+ *
+ * @param nworkers  Number of worker threads (in addition to the calling
+ *                  thread of tao_worker_team_run()), at most @ref
+ *                  TAO_WORKER_TEAM_MAX_WORKERS.
+ *
+ * @param cpus      If not `NULL`, an array of `nworkers` indices of the cores
+ *                  to pin the workers to (a negative index means not to pin
+ *                  the corresponding worker).
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure (in
+ *         which case the team has no workers).
+ */
+static inline tao_status tao_worker_team_set_workers(
+    tao_worker_team* team,
+    long             nworkers,
+    const int*       cpus)
+{
+    _tao_worker_team_stop(team);
+    if (nworkers < 0 || nworkers > TAO_WORKER_TEAM_MAX_WORKERS) {
+        tao_store_error(__func__, TAO_BAD_NUMBER);
+        return TAO_ERROR;
+    }
+#ifndef CPU_SET
+    for (long k = 0; cpus != NULL && k < nworkers; ++k) {
+        if (cpus[k] >= 0) {
+            tao_store_error(__func__, TAO_UNSUPPORTED);
+            return TAO_ERROR;
+        }
+    }
+#endif
+    team->started = atomic_load(&team->gen);
+    for (long k = 0; k < nworkers; ++k) {
+        if (tao_thread_create(&team->workers[k], NULL,
+                              _tao_worker_team_worker, team) != TAO_OK) {
+            goto error;
+        }
+        team->nworkers = k + 1;
+#ifdef CPU_SET
+        if (cpus != NULL && cpus[k] >= 0) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpus[k], &set);
+            int code = pthread_setaffinity_np(
+                team->workers[k], sizeof(set), &set);
+            if (code != 0) {
+                tao_store_error(__func__, code);
+                goto error;
+            }
+        }
+#endif
+    }
+    return TAO_OK;
+
+error:
+    _tao_worker_team_stop(team);
+    return TAO_ERROR;
+}
+
+/**
+ * Get the number of workers of a team.
+ *
+ * @param team    Team.
+ *
+ * @return The number of worker threads.
+ */
+static inline long tao_worker_team_get_workers(
+    const tao_worker_team* team)
+{
+    return team->nworkers;
+}
+
+/**
+ * Run a job with a team of worker threads.
+ *
+ * This function executes all the tasks of a job with the calling thread and
+ * the workers of the team and returns when all tasks have been executed.
+ *
+ * @param team    Team.
+ *
+ * @param job     Function executing a task.
+ *
+ * @param arg     Argument of the job.
+ *
+ * @param ntasks  Number of tasks.
+ */
+static inline void tao_worker_team_run(
+    tao_worker_team*     team,
+    tao_worker_team_job* job,
+    void*                arg,
+    long                 ntasks)
+{
+    team->job = job;
+    team->arg = arg;
+    team->ntasks = ntasks;
+    atomic_store(&team->next, 0);
+    if (team->nworkers > 0) {
+        atomic_store(&team->busy, team->nworkers);
+        _tao_worker_team_notify(team);
+    }
+    _tao_worker_team_work(team);
+    for (long k = 0; atomic_load(&team->busy) > 0; ++k) {
+        if (k < TAO_WORKER_TEAM_SPINS) {
+            _TAO_WT_PAUSE();
+        } else {
+            sched_yield();
+        }
+    }
+}
+
+/**
+ * @}
+ */
+
+TAO_END_DECLS
+
+#endif // TAO_WORKER_TEAMS_H_
@@ -0,0 +1,203 @@
+// tao-zero-copy.h -
+//
+// Zero-copy publication of raw images by camera servers in TAO library.
+//
+//-----------------------------------------------------------------------------
+//
+// This file if part of TAO real-time software licensed under the MIT license
+// (https://git-cral.univ-lyon1.fr/tao/tao-rt).
+//
+// Copyright (C) 2022, Éric Thiébaut.
+
+#ifndef TAO_ZERO_COPY_H_
+#define TAO_ZERO_COPY_H_ 1
+
+#include <tao-basics.h>
+#include <tao-camera-servers.h>
+#include <tao-encodings.h>
+#include <tao-errors.h>
+#include <tao-processor-chains.h>
+#include <tao-shared-arrays.h>
+
+TAO_BEGIN_DECLS
+
+/**
+ * @defgroup ZeroCopy  Zero-copy publication
+ *
+ * @ingroup Cameras
+ *
+ * @brief Acquisition of raw images directly into the published shared
+ * arrays.
+ *
+ * @{
+ *
+ * When images are not pre-processed (@ref TAO_PREPROCESSING_NONE) and the
+ * encoding of the acquisition buffers is that of the pixel type of the
+ * output images (e.g., `TAO_ENCODING_MONO(16)` for @ref TAO_UINT16), the
+ * pixel processor of a camera server merely copies the acquisition buffer
+ * into the next output image.  This copy can be avoided if the camera driver
+ * writes the frame directly in the output image: in its `wait_buffer`
+ * method, the driver calls tao_camera_server_get_output_buffer() and, if
+ * this yields a non-`NULL` address, stores the frame there and returns an
+ * acquisition buffer with that address, a zero offset and the stride given
+ * by tao_camera_server_get_output_buffer().  The pixel processor of the
+ * stage added by tao_camera_server_enable_zero_copy() to the chain of pixel
+ * processors of the server (see @ref ProcessorChains) then detects that the
+ * raw pixels are already in place and does not call the pixel processors
+ * beneath it, so that the server just has to set the serial number and the
+ * time-stamps of the image and publish it.
+ *
+ * The output image is the shared array locked for writing by the server
+ * for the next image (member `locked` of @ref tao_camera_server), so it
+ * cannot be read by clients while the driver writes into it.  The address
+ * is only valid until the worker of the camera server processes the
+ * acquisition buffer, the driver must thus not keep such acquisition
+ * buffers pending across calls to its `wait_buffer` method.  Otherwise (no
+ * output image is locked, or the settings are not eligible), the driver
+ * shall use its own buffers and the image is copied as usual.
+ *
+ * This header defines static functions, it must be included by a single
+ * compilation unit.
+ */
+
+/**
+ * Check whether raw images can be published without copy.
+ *
+ * @param ctx     Pixel processing context.
+ *
+ * @return Whether images are not pre-processed and the encoding of the raw
+ *         pixels is that of the pixel type of the output images.
+ */
+static inline bool tao_pixels_processor_is_copy(
+    const tao_pixels_processor_context* ctx)
+{
+    if (ctx->preprocessing != TAO_PREPROCESSING_NONE) {
+        return false;
+    }
+    tao_encoding enc = ctx->bufferencoding;
+    switch (ctx->eltype) {
+    case TAO_UINT8:  return enc == TAO_ENCODING_UNSIGNED(8);
+    case TAO_UINT16: return enc == TAO_ENCODING_UNSIGNED(16);
+    case TAO_UINT32: return enc == TAO_ENCODING_UNSIGNED(32);
+    case TAO_INT8:   return enc == TAO_ENCODING_SIGNED(8);
+    case TAO_INT16:  return enc == TAO_ENCODING_SIGNED(16);
+    case TAO_INT32:  return enc == TAO_ENCODING_SIGNED(32);
+    case TAO_FLOAT:  return enc == TAO_ENCODING_FLOAT(32);
+    case TAO_DOUBLE: return enc == TAO_ENCODING_FLOAT(64);
+    default:         return false;
+    }
+}
+
+#ifndef TAO_DOXYGEN_
+// Pixel processor used by the camera server.
+static tao_pixels_processor* _tao_zero_copy_processor = NULL;
+
+static void _tao_zero_copy_checking_processor(
+    const tao_pixels_processor_context* ctx)
+{
+    long rowsize = ctx->width*tao_size_of_eltype(ctx->eltype);
+    if (ctx->raw != ctx->dat || ctx->stride != rowsize ||
+        !tao_pixels_processor_is_copy(ctx)) {
+        _tao_zero_copy_processor(ctx);
+    }
+}
+
+static tao_status _tao_zero_copy_stage(
+    tao_camera_server* srv)
+{
+    _tao_zero_copy_processor = srv->proc.processor;
+    srv->proc.processor = _tao_zero_copy_checking_processor;
+    return TAO_OK;
+}
+
+// Check whether the zero-copy stage is in the chain and whether frames are
+// acquired by the worker (not by the acquisition thread of a pipeline).
+static inline bool _tao_zero_copy_usable(
+    void)
+{
+    bool found = false;
+    for (long k = 0; k < _tao_processor_chain.nstages; ++k) {
+        if (_tao_processor_chain.stages[k].rank ==
+            TAO_PROCESSOR_RANK_PIPELINE) {
+            return false;
+        }
+        if (_tao_processor_chain.stages[k].stage == _tao_zero_copy_stage) {
+            found = true;
+        }
+    }
+    return found;
+}
+#endif // TAO_DOXYGEN_
+
+/**
+ * Get the address where to acquire the next raw image of a camera server.
+ *
+ * This function is intended to be called by the `wait_buffer` method of
+ * camera drivers (that is, by the worker thread of the camera server) to
+ * store the next frame directly in the next output image.
+ *
+ * @param srv     Camera server.
+ *
+ * @param stride  Address to store the number of bytes per row of the output
+ *                image.
+ *
+ * @return The address of the pixels of the output image locked by the
+ *         server for the next image, `NULL` if there is no such image, if
+ *         zero-copy has not been enabled, if a pipeline is attached to the
+ *         server, or if images cannot be published without copy.
+ */
+static inline void* tao_camera_server_get_output_buffer(
+    tao_camera_server* srv,
+    long*              stride)
+{
+    const tao_pixels_processor_context* ctx = &srv->proc;
+    tao_shared_array* arr = srv->locked;
+    if (arr == NULL ||
+        !_tao_zero_copy_usable() ||
+        !tao_pixels_processor_is_copy(ctx) ||
+        tao_shared_array_get_eltype(arr) != ctx->eltype ||
+        tao_shared_array_get_dim(arr, 1) != ctx->width ||
+        tao_shared_array_get_dim(arr, 2) != ctx->height) {
+        return NULL;
+    }
+    *stride = ctx->width*tao_size_of_eltype(ctx->eltype);
+    return tao_shared_array_get_data(arr);
+}
+
+/**
+ * Enable or disable zero-copy publication of raw images by a camera server.
+ *
+ * This function adds a stage of rank @ref TAO_PROCESSOR_RANK_COPY to the
+ * chain of pixel processors of the camera server (see @ref ProcessorChains),
+ * or removes it.  The pixel processor of this stage does nothing if the raw
+ * pixels have been acquired in place by the driver (see
+ * tao_camera_server_get_output_buffer()) and calls the pixel processor
+ * beneath it otherwise.  It is installed again whenever the library resets
+ * the pixel processor of the server, e.g. after the camera has been
+ * configured.  The camera must not be acquiring.
+ *
+ * @param srv     Camera server.
+ *
+ * @param enable  Whether to enable zero-copy publication.
+ *
+ * @return @ref TAO_OK on success; @ref TAO_ERROR in case of failure.
+ */
+static inline tao_status tao_camera_server_enable_zero_copy(
+    tao_camera_server* srv,
+    bool               enable)
+{
+    if (!enable) {
+        return tao_camera_server_remove_processor_stage(
+            srv, _tao_zero_copy_stage);
+    }
+    return tao_camera_server_add_processor_stage(
+        srv, _tao_zero_copy_stage, TAO_PROCESSOR_RANK_COPY, true);
+}
+
+/**
+ * @}
+ */
+
+TAO_END_DECLS
+
+#endif // TAO_ZERO_COPY_H_